@@ -0,0 +1,191 @@
+/*
+ *  modio - Modbus input output access tool
+ *
+ *  Copyright (C) 2022, Dimitris Economou (dimitris.s.economou@gmail.com)
+ *
+ *  This file is part of modio.
+ *
+ *  modio is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  modio is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with modio. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include "alarm.h"
+
+/*
+ * Open the alarm event stream of path, appended to and line buffered.
+ * "-" is stdout and NULL stderr. Returns NULL on error.
+ */
+FILE *
+alarm_open(const char *path)
+{
+    FILE *fp;
+
+    if (path == NULL) {
+        return stderr;
+    }
+    if (strcmp(path, "-") == 0) {
+        fp = stdout;
+    } else if ((fp = fopen(path, "a")) == NULL) {
+        printf("ERROR:(%s) open %s\n", strerror(errno), path);
+        return NULL;
+    }
+    setvbuf(fp, NULL, _IOLBF, 0);
+    return fp;
+}
+
+/*
+ * close the alarm event stream, stdout and stderr are left open
+ */
+void
+alarm_close(FILE *fp)
+{
+    if (fp != NULL && fp != stdout && fp != stderr) {
+        fclose(fp);
+    }
+}
+
+/*
+ * name of alarm condition kind
+ */
+const char *
+alarm_name(int kind)
+{
+    switch (kind) {
+        case AL_HIGH:
+            return "HIGH";
+        case AL_LOW:
+            return "LOW";
+        case AL_FLAG:
+            return "FLAG";
+        default:
+            return "NONE";
+    }
+}
+
+/*
+ * Alarm condition of value v for rule a, act is the raised condition
+ * whose hysteresis applies. Flags take precedence over the limits.
+ */
+static int
+alarm_cond(const alrule_t *a, int act, double v)
+{
+    if (a->mask && v >= 0 && v < 4294967296.0 && ((uint32_t )v & a->mask)) {
+        return AL_FLAG;
+    }
+    if (!isnan(a->high) && v > a->high - (act == AL_HIGH ? a->hyst : 0)) {
+        return AL_HIGH;
+    }
+    if (!isnan(a->low) && v < a->low + (act == AL_LOW ? a->hyst : 0)) {
+        return AL_LOW;
+    }
+    return AL_NONE;
+}
+
+/*
+ * write the transition of rule a of unit u to condition kind, or the
+ * clearing of condition act if kind is AL_NONE, with value v
+ */
+static void
+alarm_event(FILE *fp, dvlist_t *dv, unit_t *u, const alrule_t *a, int act, int kind, double v)
+{
+    struct timespec ts;
+    struct tm tm;
+    char tstr[32];
+    char num[8];
+    const char *name;
+    const char *engu;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    localtime_r(&ts.tv_sec, &tm);
+    strftime(tstr, sizeof(tstr), "%Y-%m-%d %H:%M:%S", &tm);
+    if (a->vi < dv->nor) {
+        snprintf(num, sizeof(num), "%05d", dv->regs[a->vi].num);
+        name = dv->regs[a->vi].info->name;
+        engu = dv->regs[a->vi].info->engu;
+    } else {
+        snprintf(num, sizeof(num), "-");
+        name = dv->drv[a->vi - dv->nor].name;
+        engu = dv->drv[a->vi - dv->nor].engu;
+    }
+    fprintf(fp, "%s.%03ld %d %s \"%s\" %s %s ",
+            tstr,
+            ts.tv_nsec / 1000000,
+            u->id,
+            num,
+            name,
+            kind ? "ALARM" : "CLEAR",
+            alarm_name(kind ? kind : act)
+    );
+    if ((kind ? kind : act) == AL_FLAG) {
+        fprintf(fp, "0x%x\n", (v >= 0 && v < 4294967296.0) ? (uint32_t )v : 0);
+    } else {
+        fprintf(fp, "%.2f%s\n", v, engu);
+    }
+}
+
+/*
+ * Evaluate the alarm rules of device dv over the last values of unit
+ * u at monotonic time now in ns, and write the alarms raised and
+ * cleared to fp. An alarm whose condition changes, from HIGH to LOW
+ * or to FLAG, is cleared before the new one is raised, so every ALARM
+ * line has its CLEAR. A value that isn't known leaves its alarm as it is.
+ * The states of the rules are reset when the number of rules changed
+ * with a reload.
+ */
+void
+alarm_eval(FILE *fp, dvlist_t *dv, unit_t *u, int64_t now)
+{
+    if (u->nals != dv->noa) {
+        free(u->als);
+        u->als = (alstate_t *)calloc(dv->noa ? dv->noa : 1, sizeof(alstate_t));
+        if (u->als == NULL) {
+            fprintf(stderr, "malloc failed: insufficient memory!\n");
+            exit(EXIT_FAILURE);
+        }
+        u->nals = dv->noa;
+    }
+    if (u->val == NULL || u->nval != dv->nor + dv->nod) {
+        return;
+    }
+    for (int i = 0; i < dv->noa; i++) {
+        const alrule_t *a = &dv->alarm[i];
+        alstate_t *st = &u->als[i];
+        double v = u->val[a->vi];
+        int c;
+
+        if (isnan(v)) {
+            continue;
+        }
+        c = alarm_cond(a, st->act, v);
+        if (c != st->cand) {
+            st->cand = c;
+            st->since = now;
+        }
+        if (c == st->act || now - st->since < (int64_t )(c ? a->on : a->off) * 1000000) {
+            continue;
+        }
+
+        /* an alarm that turns into another one is cleared first */
+        if (c != AL_NONE && st->act != AL_NONE) {
+            alarm_event(fp, dv, u, a, st->act, AL_NONE, v);
+        }
+        alarm_event(fp, dv, u, a, st->act, c, v);
+        st->act = c;
+    }
+}
@@ -0,0 +1,60 @@
+/*
+ *  modio - Modbus input output access tool
+ *
+ *  Copyright (C) 2022, Dimitris Economou (dimitris.s.economou@gmail.com)
+ *
+ *  This file is part of modio.
+ *
+ *  modio is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  modio is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with modio. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Alarms of polled registers.
+ *
+ * The alarm rules of the registers and derived registers of the device
+ * files are evaluated in poll mode over the values of every unit, once
+ * its registers and derived registers of the poll cycle are decoded.
+ * A condition, a value above the high or below the low limit or a bit
+ * flag of the mask, raises the alarm once it lasted the on delay of the
+ * rule and clears it once it was gone for the off delay. A raised limit
+ * alarm clears only when the value is back within the limit by the
+ * hysteresis of the rule. A raised alarm that turns into another
+ * condition is cleared before the new one is raised. Every transition
+ * is written at once as one line to the alarm event stream:
+ *
+ *   <date> <time> <uid> <reg> "<name>" ALARM|CLEAR HIGH|LOW|FLAG <value>
+ *
+ * <reg> is '-' for derived registers.
+ */
+
+#ifndef MXIO_ALARM_H
+#define MXIO_ALARM_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "modio.h"
+
+/* open the alarm event stream */
+FILE *alarm_open(const char *path);
+
+/* close the alarm event stream */
+void alarm_close(FILE *fp);
+
+/* evaluate the alarm rules of a unit over its last values */
+void alarm_eval(FILE *fp, dvlist_t *dv, unit_t *u, int64_t now);
+
+/* name of an alarm condition */
+const char *alarm_name(int kind);
+
+#endif
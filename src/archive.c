@@ -0,0 +1,570 @@
+/*
+ *  modio - Modbus input output access tool
+ *
+ *  Copyright (C) 2022, Dimitris Economou (dimitris.s.economou@gmail.com)
+ *
+ *  This file is part of modio.
+ *
+ *  modio is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  modio is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with modio. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "archive.h"
+#include "dev.h"
+
+/*
+ * write n bytes of buf at offset off of fd
+ */
+static int
+arch_pwrite(int fd, const void *buf, size_t n, uint64_t off)
+{
+    const uint8_t *p = (const uint8_t *)buf;
+
+    while (n > 0) {
+        ssize_t w = pwrite(fd, p, n, (off_t )off);
+        if (w == -1 && errno == EINTR) {
+            continue;
+        }
+        if (w <= 0) {
+            return -1;
+        }
+        p += w;
+        n -= w;
+        off += w;
+    }
+    return 0;
+}
+
+/*
+ * read n bytes at offset off of fd into buf
+ */
+static int
+arch_pread(int fd, void *buf, size_t n, uint64_t off)
+{
+    uint8_t *p = (uint8_t *)buf;
+
+    while (n > 0) {
+        ssize_t r = pread(fd, p, n, (off_t )off);
+        if (r == -1 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            return -1;
+        }
+        p += r;
+        n -= r;
+        off += r;
+    }
+    return 0;
+}
+
+/*
+ * store v as varint at p, 7 bits a byte with the low bits first,
+ * returns the number of bytes
+ */
+static int
+var_put(uint8_t *p, uint64_t v)
+{
+    int n = 0;
+
+    while (v >= 0x80) {
+        p[n++] = (uint8_t )(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (uint8_t )v;
+    return n;
+}
+
+/*
+ * load the varint at p before end into v, returns the number of
+ * bytes or 0 if it is truncated
+ */
+static int
+var_get(const uint8_t *p, const uint8_t *end, uint64_t *v)
+{
+    int n = 0;
+
+    *v = 0;
+    while (p + n < end && n < 10) {
+        *v |= (uint64_t )(p[n] & 0x7f) << (7 * n);
+        if ((p[n++] & 0x80) == 0) {
+            return n;
+        }
+    }
+    return 0;
+}
+
+/* signed integers as unsigned with small magnitudes small */
+static inline uint64_t
+zz_enc(int64_t v)
+{
+    return ((uint64_t )v << 1) ^ (uint64_t )(v >> 63);
+}
+
+static inline int64_t
+zz_dec(uint64_t v)
+{
+    return (int64_t )(v >> 1) ^ -(int64_t )(v & 1);
+}
+
+/*
+ * word encoding of a series, bits, bit fields and strings change in
+ * a few bits at a time, numbers by small amounts
+ */
+static int
+arch_enc(const arch_ser_t *s)
+{
+    if (s->type == COIL || s->type == INPUT_B) {
+        return ARCH_XOR;
+    }
+    return (s->prfmt == DEC || s->prfmt == HLO) ? ARCH_DELTA : ARCH_XOR;
+}
+
+/*
+ * check an archive header
+ */
+static int
+arch_valid(const arch_hdr_t *hdr, uint64_t size)
+{
+    return (hdr->magic == ARCH_MAGIC &&
+            hdr->version == ARCH_VERSION &&
+            hdr->hsize == sizeof(arch_hdr_t) &&
+            hdr->ssize == sizeof(arch_ser_t) &&
+            hdr->bsize == sizeof(arch_blk_t) &&
+            hdr->hsize + (uint64_t )hdr->nser * hdr->ssize <= size);
+}
+
+/*
+ * add the block at offset off to the index
+ */
+static void
+arch_idx_add(arch_t *ar, uint64_t off, const arch_blk_t *blk)
+{
+    if (ar->nidx == ar->cidx) {
+        ar->cidx = ar->cidx ? 2 * ar->cidx : 256;
+        ar->idx = (arch_idx_t *)realloc(ar->idx, ar->cidx * sizeof(arch_idx_t));
+        if (ar->idx == NULL) {
+            fprintf(stderr, "malloc failed: insufficient memory!\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    ar->idx[ar->nidx].off = off;
+    ar->idx[ar->nidx].blk = *blk;
+    ar->nidx++;
+}
+
+/*
+ * Load the block index of an archive of size bytes and set the end
+ * of its blocks. The index of a closed archive is read at once, the
+ * blocks of an archive that was not closed are found by walking their
+ * headers up to the first incomplete one.
+ */
+static void
+arch_index(arch_t *ar, uint64_t size)
+{
+    uint64_t data = ar->hdr.hsize + (uint64_t )ar->hdr.nser * ar->hdr.ssize;
+    arch_tail_t tl;
+    arch_blk_t blk;
+    uint64_t off;
+
+    if (size >= data + sizeof(tl) &&
+        arch_pread(ar->fd, &tl, sizeof(tl), size - sizeof(tl)) == 0 &&
+        tl.magic == ARCH_IDX_MAGIC &&
+        tl.off >= data &&
+        tl.off + (uint64_t )tl.nblk * sizeof(arch_idx_t) + sizeof(tl) == size) {
+        ar->cidx = tl.nblk ? tl.nblk : 1;
+        ar->idx = (arch_idx_t *)malloc(ar->cidx * sizeof(arch_idx_t));
+        if (ar->idx == NULL) {
+            fprintf(stderr, "malloc failed: insufficient memory!\n");
+            exit(EXIT_FAILURE);
+        }
+        if (arch_pread(ar->fd, ar->idx, tl.nblk * sizeof(arch_idx_t), tl.off) == 0) {
+            ar->nidx = tl.nblk;
+            ar->off = tl.off;
+            return;
+        }
+        free(ar->idx);
+        ar->idx = NULL;
+        ar->cidx = 0;
+    }
+    for (off = data; off + sizeof(blk) <= size; off += sizeof(blk) + blk.size) {
+        if (arch_pread(ar->fd, &blk, sizeof(blk), off) == -1 ||
+            blk.magic != ARCH_BLK_MAGIC ||
+            blk.ser >= ar->hdr.nser ||
+            off + sizeof(blk) + blk.size > size) {
+            break;
+        }
+        arch_idx_add(ar, off, &blk);
+    }
+    ar->off = off;
+    modio_debugx(1, "archive: recovered %u blocks without index\n", ar->nidx);
+}
+
+/*
+ * Open an archive for recording the nser series of ser. An existing
+ * archive of the same series is continued after its last complete
+ * block, an empty file becomes a new archive. Anything else, another
+ * file or an archive of other series, is left as it is and fails.
+ */
+arch_t *
+arch_open(const char *path, const arch_ser_t *ser, int nser)
+{
+    arch_t *ar;
+    struct stat st;
+    struct timespec ts;
+    uint64_t data = sizeof(arch_hdr_t) + (uint64_t )nser * sizeof(arch_ser_t);
+
+    ar = (arch_t *)calloc(1, sizeof(arch_t));
+    if (ar != NULL) {
+        ar->ser = (arch_ser_t *)malloc((nser ? nser : 1) * sizeof(arch_ser_t));
+        ar->buf = (arch_buf_t *)calloc(nser ? nser : 1, sizeof(arch_buf_t));
+    }
+    if (ar == NULL || ar->ser == NULL || ar->buf == NULL) {
+        fprintf(stderr, "malloc failed: insufficient memory!\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(ar->ser, ser, nser * sizeof(arch_ser_t));
+
+    ar->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (ar->fd == -1 || fstat(ar->fd, &st) == -1) {
+        printf("ERROR:(%s) open %s\n", strerror(errno), path);
+        arch_close(ar);
+        return NULL;
+    }
+
+    /* continue an existing archive of the same series */
+    if (st.st_size > 0) {
+        arch_hdr_t hdr;
+        arch_ser_t *old;
+        uint32_t i;
+
+        if ((size_t )st.st_size < sizeof(arch_hdr_t) ||
+            arch_pread(ar->fd, &hdr, sizeof(arch_hdr_t), 0) == -1 ||
+            !arch_valid(&hdr, st.st_size)) {
+            printf("ERROR: %s is not a modio archive\n", path);
+            arch_close(ar);
+            return NULL;
+        }
+        old = (arch_ser_t *)malloc((hdr.nser ? hdr.nser : 1) * sizeof(arch_ser_t));
+        if (old == NULL) {
+            fprintf(stderr, "malloc failed: insufficient memory!\n");
+            exit(EXIT_FAILURE);
+        }
+        if (arch_pread(ar->fd, old, hdr.nser * sizeof(arch_ser_t), sizeof(arch_hdr_t)) == -1) {
+            printf("ERROR:(%s) reading %s\n", strerror(errno), path);
+            free(old);
+            arch_close(ar);
+            return NULL;
+        }
+        for (i = 0; i < hdr.nser && i < (uint32_t )nser; i++) {
+            if (memcmp(&old[i], &ser[i], sizeof(arch_ser_t)) != 0) {
+                break;
+            }
+        }
+        if (i < hdr.nser || i < (uint32_t )nser) {
+            printf("ERROR: archive %s holds other registers than the polled ones, ", path);
+            if (i < hdr.nser && i < (uint32_t )nser) {
+                old[i].name[ARCH_NAME_LEN - 1] = '\0';
+                printf("series %u is unit %u register %d (%s), not unit %u register %d (%s)\n",
+                       i, old[i].uid, old[i].num, old[i].name, ser[i].uid, ser[i].num, ser[i].name);
+            } else {
+                printf("%u series, not %d\n", hdr.nser, nser);
+            }
+            free(old);
+            arch_close(ar);
+            return NULL;
+        }
+        free(old);
+        ar->hdr = hdr;
+        arch_index(ar, st.st_size);
+        if (ftruncate(ar->fd, (off_t )ar->off) == -1) {
+            printf("ERROR:(%s) truncating %s\n", strerror(errno), path);
+            arch_close(ar);
+            return NULL;
+        }
+        modio_debugx(1, "archive %s: continued after %u blocks\n", path, ar->nidx);
+        ar->wr = 1;
+        return ar;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    memset(&ar->hdr, 0, sizeof(arch_hdr_t));
+    ar->hdr.magic = ARCH_MAGIC;
+    ar->hdr.version = ARCH_VERSION;
+    ar->hdr.hsize = sizeof(arch_hdr_t);
+    ar->hdr.ssize = sizeof(arch_ser_t);
+    ar->hdr.bsize = sizeof(arch_blk_t);
+    ar->hdr.nser = nser;
+    ar->hdr.start_ns = (int64_t )ts.tv_sec * 1000000000 + ts.tv_nsec;
+    if (arch_pwrite(ar->fd, &ar->hdr, sizeof(arch_hdr_t), 0) == -1 ||
+        arch_pwrite(ar->fd, ser, nser * sizeof(arch_ser_t), sizeof(arch_hdr_t)) == -1) {
+        printf("ERROR:(%s) writing %s\n", strerror(errno), path);
+        arch_close(ar);
+        return NULL;
+    }
+    ar->off = data;
+    ar->wr = 1;
+    return ar;
+}
+
+/*
+ * open an archive for reading and load its block index
+ */
+arch_t *
+arch_load(const char *path)
+{
+    arch_t *ar;
+    struct stat st;
+
+    ar = (arch_t *)calloc(1, sizeof(arch_t));
+    if (ar == NULL) {
+        fprintf(stderr, "malloc failed: insufficient memory!\n");
+        exit(EXIT_FAILURE);
+    }
+    ar->fd = open(path, O_RDONLY);
+    if (ar->fd == -1 || fstat(ar->fd, &st) == -1) {
+        printf("ERROR:(%s) open %s\n", strerror(errno), path);
+        arch_close(ar);
+        return NULL;
+    }
+    if ((size_t )st.st_size < sizeof(arch_hdr_t) ||
+        arch_pread(ar->fd, &ar->hdr, sizeof(arch_hdr_t), 0) == -1 ||
+        !arch_valid(&ar->hdr, st.st_size)) {
+        printf("ERROR: %s is not a modio archive\n", path);
+        arch_close(ar);
+        return NULL;
+    }
+    ar->ser = (arch_ser_t *)malloc((ar->hdr.nser ? ar->hdr.nser : 1) * sizeof(arch_ser_t));
+    if (ar->ser == NULL) {
+        fprintf(stderr, "malloc failed: insufficient memory!\n");
+        exit(EXIT_FAILURE);
+    }
+    if (arch_pread(ar->fd, ar->ser, ar->hdr.nser * sizeof(arch_ser_t), sizeof(arch_hdr_t)) == -1) {
+        printf("ERROR:(%s) reading %s\n", strerror(errno), path);
+        arch_close(ar);
+        return NULL;
+    }
+    for (uint32_t i = 0; i < ar->hdr.nser; i++) {
+        ar->ser[i].name[ARCH_NAME_LEN - 1] = '\0';
+        ar->ser[i].engu[ARCH_ENGU_LEN - 1] = '\0';
+    }
+    arch_index(ar, st.st_size);
+    return ar;
+}
+
+/*
+ * write the pending samples of series i as a block
+ */
+static int
+arch_flush(arch_t *ar, int i)
+{
+    arch_buf_t *b = &ar->buf[i];
+    arch_blk_t blk;
+
+    if (b->n == 0) {
+        return 0;
+    }
+    memset(&blk, 0, sizeof(blk));
+    blk.magic = ARCH_BLK_MAGIC;
+    blk.ser = i;
+    blk.n = b->n;
+    blk.size = b->len;
+    blk.enc = arch_enc(&ar->ser[i]);
+    blk.t0 = b->t0 * 1000;
+    blk.t1 = b->tp * 1000;
+    b->n = 0;
+    b->len = 0;
+
+    /* the header goes last, so a block cut short is not taken for a complete one */
+    if (arch_pwrite(ar->fd, b->data, blk.size, ar->off + sizeof(blk)) == -1 ||
+        arch_pwrite(ar->fd, &blk, sizeof(blk), ar->off) == -1) {
+        printf("ERROR:(%s) writing archive block\n", strerror(errno));
+        return -1;
+    }
+    arch_idx_add(ar, ar->off, &blk);
+    ar->off += sizeof(blk) + blk.size;
+    return 0;
+}
+
+/*
+ * Close an archive. The recorder writes the pending samples of every
+ * series and the block index first.
+ */
+void
+arch_close(arch_t *ar)
+{
+    arch_tail_t tl;
+
+    if (ar == NULL) {
+        return;
+    }
+    if (ar->wr && ar->fd != -1 && ar->buf != NULL) {
+        for (uint32_t i = 0; i < ar->hdr.nser; i++) {
+            arch_flush(ar, i);
+        }
+        tl.off = ar->off;
+        tl.nblk = ar->nidx;
+        tl.magic = ARCH_IDX_MAGIC;
+        if (arch_pwrite(ar->fd, ar->idx, ar->nidx * sizeof(arch_idx_t), ar->off) == -1 ||
+            arch_pwrite(ar->fd, &tl, sizeof(tl), ar->off + ar->nidx * sizeof(arch_idx_t)) == -1) {
+            printf("ERROR:(%s) writing archive index\n", strerror(errno));
+        }
+        fsync(ar->fd);
+    }
+    if (ar->fd != -1) {
+        close(ar->fd);
+    }
+    if (ar->buf != NULL) {
+        for (uint32_t i = 0; i < ar->hdr.nser; i++) {
+            free(ar->buf[i].data);
+        }
+    }
+    free(ar->buf);
+    free(ar->idx);
+    free(ar->ser);
+    free(ar);
+}
+
+/*
+ * Archive a register sample of series ser. It is encoded into the
+ * pending block of the series, which is written once it is full or
+ * spans ARCH_BLK_SPAN s. Failed reads are kept with their errno.
+ */
+void
+arch_put(arch_t *ar, int ser, const rsmpl_t *s)
+{
+    arch_buf_t *b;
+    int64_t t = (int64_t )s->real.tv_sec * 1000000 + s->real.tv_nsec / 1000;
+    int64_t d;
+    uint8_t *p;
+
+    if (ser < 0 || (uint32_t )ser >= ar->hdr.nser) {
+        return;
+    }
+    b = &ar->buf[ser];
+    if (b->data == NULL) {
+        b->data = (uint8_t *)malloc(ARCH_BLK_BYTES + ARCH_SMPL_MAX);
+        if (b->data == NULL) {
+            fprintf(stderr, "malloc failed: insufficient memory!\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (b->n == 0) {
+        b->t0 = b->tp = t;
+        b->dp = 0;
+        memset(b->prev, 0, sizeof(b->prev));
+    }
+    p = b->data + b->len;
+    d = t - b->tp;
+    p += var_put(p, zz_enc(d - b->dp));
+    b->tp = t;
+    b->dp = d;
+    if (s->err == 0) {
+        int nw = (s->nw > ARCH_RAW_WORDS) ? ARCH_RAW_WORDS : s->nw;
+        int xor = (arch_enc(&ar->ser[ser]) == ARCH_XOR);
+
+        p += var_put(p, (uint64_t )nw << 1);
+        for (int j = 0; j < nw; j++) {
+            if (xor) {
+                p += var_put(p, s->raw[j] ^ b->prev[j]);
+            } else {
+                p += var_put(p, zz_enc((int16_t )(s->raw[j] - b->prev[j])));
+            }
+            b->prev[j] = s->raw[j];
+        }
+    } else {
+        p += var_put(p, ((uint64_t )(uint32_t )s->err << 1) | 1);
+    }
+    b->len = p - b->data;
+    b->n++;
+    if (b->n >= ARCH_BLK_SMPL || b->len >= ARCH_BLK_BYTES ||
+        b->tp - b->t0 >= (int64_t )ARCH_BLK_SPAN * 1000000) {
+        arch_flush(ar, ser);
+    }
+}
+
+/*
+ * Decode block i of the index into s, which holds ARCH_BLK_SMPL
+ * samples. Returns the number of samples or -1 if the block can't
+ * be read or is corrupt.
+ */
+int
+arch_block(arch_t *ar, uint32_t i, arch_smpl_t *s)
+{
+    const arch_blk_t *blk = &ar->idx[i].blk;
+    uint8_t *data;
+    const uint8_t *p;
+    const uint8_t *end;
+    uint16_t prev[ARCH_RAW_WORDS];
+    int64_t t = blk->t0 / 1000;
+    int64_t d = 0;
+    uint64_t v;
+    int n;
+
+    if (blk->n > ARCH_BLK_SMPL || blk->size > ARCH_BLK_BYTES + ARCH_SMPL_MAX) {
+        return -1;
+    }
+    data = (uint8_t *)malloc(blk->size ? blk->size : 1);
+    if (data == NULL) {
+        fprintf(stderr, "malloc failed: insufficient memory!\n");
+        exit(EXIT_FAILURE);
+    }
+    if (arch_pread(ar->fd, data, blk->size, ar->idx[i].off + sizeof(arch_blk_t)) == -1) {
+        free(data);
+        return -1;
+    }
+    memset(prev, 0, sizeof(prev));
+    p = data;
+    end = data + blk->size;
+    for (n = 0; n < (int )blk->n; n++) {
+        int k;
+
+        if ((k = var_get(p, end, &v)) == 0) {
+            break;
+        }
+        p += k;
+        d += zz_dec(v);
+        t += d;
+        s[n].real_ns = t * 1000;
+        if ((k = var_get(p, end, &v)) == 0) {
+            break;
+        }
+        p += k;
+        s[n].err = (v & 1) ? (int32_t )(v >> 1) : 0;
+        s[n].nw = (v & 1) ? 0 : (uint16_t )(v >> 1);
+        if (s[n].nw > ARCH_RAW_WORDS) {
+            break;
+        }
+        for (int j = 0; j < s[n].nw; j++) {
+            if ((k = var_get(p, end, &v)) == 0) {
+                break;
+            }
+            p += k;
+            prev[j] = (blk->enc == ARCH_XOR) ? prev[j] ^ (uint16_t )v : prev[j] + (uint16_t )zz_dec(v);
+            s[n].raw[j] = prev[j];
+        }
+        if (k == 0) {
+            break;
+        }
+    }
+    free(data);
+    return (n == (int )blk->n) ? n : -1;
+}
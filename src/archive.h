@@ -0,0 +1,181 @@
+/*
+ *  modio - Modbus input output access tool
+ *
+ *  Copyright (C) 2022, Dimitris Economou (dimitris.s.economou@gmail.com)
+ *
+ *  This file is part of modio.
+ *
+ *  modio is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  modio is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with modio. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Compressed archive of polled register samples.
+ *
+ * The samples of every polled register, a series, are collected in
+ * memory and appended to the file as blocks of the series. Timestamps
+ * are stored in us as varints of the zigzag delta of their delta, the
+ * register words as varints of the zigzag delta (numeric registers)
+ * or of the xor (bits, flags and strings) to the words of the sample
+ * before, so a steadily polled unchanged register takes 2 bytes plus
+ * one per word a sample. Every block starts over, so it is decoded
+ * on its own.
+ *
+ * The header holds the identity of the series, taken from the device
+ * registers, so the file is read without the device files. The index
+ * of the blocks is appended when the archive is closed. An archive
+ * without it, after a crash, is recovered by walking the block
+ * headers. Readers load the index and decode only the blocks of the
+ * series and time range they look for.
+ *
+ * file layout:
+ *
+ *   arch_hdr_t                     header, hsize bytes
+ *   arch_ser_t[nser]               series identity, ssize bytes each
+ *   { arch_blk_t, payload }...     blocks
+ *   arch_idx_t[nblk]               block index
+ *   arch_tail_t                    index position
+ */
+
+#ifndef MXIO_ARCHIVE_H
+#define MXIO_ARCHIVE_H
+
+#include <stdint.h>
+#include "modio.h"
+
+#define ARCH_MAGIC 0x4d4f4441   /* 'MODA' */
+#define ARCH_BLK_MAGIC 0x4d4f4442       /* 'MODB' */
+#define ARCH_IDX_MAGIC 0x4d4f4449       /* 'MODI' */
+#define ARCH_VERSION 1
+#define ARCH_NAME_LEN 36        /* register name length, including '\0' */
+#define ARCH_ENGU_LEN 12        /* engineering unit length, including '\0' */
+#define ARCH_RAW_WORDS 32       /* raw register words per sample */
+#define ARCH_BLK_SMPL 4096      /* samples per block */
+#define ARCH_BLK_BYTES 8192     /* encoded bytes per block */
+#define ARCH_BLK_SPAN 600       /* time span of a block in s */
+#define ARCH_SMPL_MAX (2 * 10 + ARCH_RAW_WORDS * 3)     /* encoded bytes of a sample */
+
+/* word encoding of a block */
+enum arch_enc {
+    ARCH_DELTA = 0,             /* zigzag delta to the word before */
+    ARCH_XOR = 1                /* xor to the word before */
+};
+
+/* archive file header */
+struct arch_hdr {
+    uint32_t magic;             /* ARCH_MAGIC */
+    uint32_t version;           /* ARCH_VERSION */
+    uint32_t hsize;             /* header size */
+    uint32_t ssize;             /* series identity size */
+    uint32_t bsize;             /* block header size */
+    uint32_t nser;              /* number of series */
+    int64_t start_ns;           /* wall clock time the file was created */
+};
+typedef struct arch_hdr arch_hdr_t;
+
+/* series identity, a polled register of a unit */
+struct arch_ser {
+    uint16_t uid;               /* modbus slave id */
+    uint16_t dnum;              /* device number in device list */
+    uint16_t rnum;              /* register index in device register list */
+    uint16_t type;              /* register type */
+    uint16_t len;               /* register length */
+    uint16_t prfmt;             /* register print format */
+    int32_t num;                /* register number */
+    int32_t addr;               /* register address */
+    uint32_t rsvd;              /* reserved */
+    double scale;               /* register scale */
+    char name[ARCH_NAME_LEN];   /* register name */
+    char engu[ARCH_ENGU_LEN];   /* register engineering unit */
+};
+typedef struct arch_ser arch_ser_t;
+
+/* block header, followed by size bytes of encoded samples */
+struct arch_blk {
+    uint32_t magic;             /* ARCH_BLK_MAGIC */
+    uint32_t ser;               /* series index */
+    uint32_t n;                 /* number of samples */
+    uint32_t size;              /* payload size */
+    uint32_t enc;               /* word encoding */
+    uint32_t rsvd;              /* reserved */
+    int64_t t0;                 /* wall clock time of the first sample in ns */
+    int64_t t1;                 /* wall clock time of the last sample in ns */
+};
+typedef struct arch_blk arch_blk_t;
+
+/* block index entry */
+struct arch_idx {
+    uint64_t off;               /* file offset of the block header */
+    arch_blk_t blk;             /* block header */
+};
+typedef struct arch_idx arch_idx_t;
+
+/* index position, the last bytes of a closed archive */
+struct arch_tail {
+    uint64_t off;               /* file offset of the index */
+    uint32_t nblk;              /* number of index entries */
+    uint32_t magic;             /* ARCH_IDX_MAGIC */
+};
+typedef struct arch_tail arch_tail_t;
+
+/* decoded sample */
+struct arch_smpl {
+    int64_t real_ns;            /* wall clock time of the read */
+    int32_t err;                /* errno of a failed read, 0 on success */
+    uint16_t nw;                /* register words in raw */
+    uint16_t raw[ARCH_RAW_WORDS];   /* raw register words, one per bit for bit registers */
+};
+typedef struct arch_smpl arch_smpl_t;
+
+/* samples of a series not yet written */
+struct arch_buf {
+    int n;                      /* number of samples */
+    size_t len;                 /* encoded bytes */
+    int64_t t0;                 /* time of the first sample in us */
+    int64_t tp;                 /* time of the sample before in us */
+    int64_t dp;                 /* time delta to the sample before in us */
+    uint16_t prev[ARCH_RAW_WORDS];  /* words of the sample before */
+    uint8_t *data;              /* encoded samples */
+};
+typedef struct arch_buf arch_buf_t;
+
+/* open archive */
+struct arch {
+    int fd;                     /* archive file */
+    int wr;                     /* recorder flag */
+    uint64_t off;               /* end of the blocks */
+    arch_hdr_t hdr;             /* file header */
+    arch_ser_t *ser;            /* series identity */
+    arch_buf_t *buf;            /* pending samples of every series of the recorder */
+    uint32_t nidx;              /* number of index entries */
+    uint32_t cidx;              /* capacity of idx */
+    arch_idx_t *idx;            /* block index */
+};
+typedef struct arch arch_t;
+
+/* open an archive for recording nser series, continuing it if it has the same series, failing on other files */
+arch_t *arch_open(const char *path, const arch_ser_t *ser, int nser);
+
+/* open an archive for reading */
+arch_t *arch_load(const char *path);
+
+/* write the pending blocks and the index of a recorder and close an archive */
+void arch_close(arch_t *ar);
+
+/* archive a register sample of series ser */
+void arch_put(arch_t *ar, int ser, const rsmpl_t *s);
+
+/* decode block i of the index into s, returns the number of samples */
+int arch_block(arch_t *ar, uint32_t i, arch_smpl_t *s);
+
+#endif
@@ -0,0 +1,187 @@
+/*
+ *  modio - Modbus input output access tool
+ *
+ *  Copyright (C) 2022, Dimitris Economou (dimitris.s.economou@gmail.com)
+ *
+ *  This file is part of modio.
+ *
+ *  modio is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  modio is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with modio. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+/*
+ * Allocate sz bytes of an arena, aligned to align, a power of 2. An
+ * allocation that doesn't fit in the current chunk opens a new one,
+ * one larger than the chunk size gets a chunk of its own behind the
+ * current one. Returns NULL if out of memory.
+ */
+static void *
+arena_push(arena_t *a, size_t sz, size_t align)
+{
+    achunk_t *c = a->head;
+    size_t off;
+
+    if (c != NULL) {
+        off = (c->used + align - 1) & ~(align - 1);
+        if (off + sz <= c->size) {
+            c->used = off + sz;
+            a->used += sz;
+            return c->mem + off;
+        }
+    }
+    if (sz > a->chunk / 4 && c != NULL) {
+        achunk_t *big = (achunk_t *)malloc(sizeof(achunk_t) + sz);
+
+        if (big == NULL) {
+            return NULL;
+        }
+        big->size = sz;
+        big->used = sz;
+        big->next = c->next;
+        c->next = big;
+        a->used += sz;
+        return big->mem;
+    }
+    c = (achunk_t *)malloc(sizeof(achunk_t) + (sz > a->chunk ? sz : a->chunk));
+    if (c == NULL) {
+        return NULL;
+    }
+    c->size = sz > a->chunk ? sz : a->chunk;
+    c->used = sz;
+    c->next = a->head;
+    a->head = c;
+    a->used += sz;
+    return c->mem;
+}
+
+/*
+ * FNV-1a hash of string s
+ */
+static uint32_t
+arena_hash(const char *s)
+{
+    uint32_t h = 2166136261u;
+
+    while (*s) {
+        h ^= (unsigned char )*s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/*
+ * double the size of the interned strings hash table
+ */
+static int
+arena_grow(arena_t *a)
+{
+    uint32_t sz = a->sstr ? 2 * a->sstr : 64;
+    char **tab = (char **)calloc(sz, sizeof(char *));
+
+    if (tab == NULL) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < a->sstr; i++) {
+        if (a->str[i] != NULL) {
+            uint32_t j = arena_hash(a->str[i]) & (sz - 1);
+
+            while (tab[j] != NULL) {
+                j = (j + 1) & (sz - 1);
+            }
+            tab[j] = a->str[i];
+        }
+    }
+    free(a->str);
+    a->str = tab;
+    a->sstr = sz;
+    return 0;
+}
+
+/*
+ * create an arena of chunks of size chunk, 0 for ARENA_CHUNK
+ */
+arena_t *
+arena_new(size_t chunk)
+{
+    arena_t *a = (arena_t *)calloc(1, sizeof(arena_t));
+
+    if (a == NULL) {
+        return NULL;
+    }
+    a->chunk = chunk ? chunk : ARENA_CHUNK;
+    return a;
+}
+
+/*
+ * Allocate sz bytes of an arena, aligned to ARENA_ALIGN. Returns NULL
+ * if out of memory.
+ */
+void *
+arena_alloc(arena_t *a, size_t sz)
+{
+    return arena_push(a, sz ? sz : 1, ARENA_ALIGN);
+}
+
+/*
+ * Intern string s in an arena: return the copy of s in the arena,
+ * making one if there is none yet. Returns NULL if out of memory.
+ */
+char *
+arena_intern(arena_t *a, const char *s)
+{
+    uint32_t i;
+    size_t len;
+    char *p;
+
+    if (2 * (a->nstr + 1) > a->sstr && arena_grow(a) == -1) {
+        return NULL;
+    }
+    for (i = arena_hash(s) & (a->sstr - 1); a->str[i] != NULL; i = (i + 1) & (a->sstr - 1)) {
+        if (strcmp(a->str[i], s) == 0) {
+            a->hits++;
+            return a->str[i];
+        }
+    }
+    len = strlen(s) + 1;
+    p = (char *)arena_push(a, len, 1);
+    if (p == NULL) {
+        return NULL;
+    }
+    memcpy(p, s, len);
+    a->str[i] = p;
+    a->nstr++;
+    return p;
+}
+
+/*
+ * free an arena and all its allocations
+ */
+void
+arena_free(arena_t *a)
+{
+    achunk_t *c;
+
+    if (a == NULL) {
+        return;
+    }
+    while ((c = a->head) != NULL) {
+        a->head = c->next;
+        free(c);
+    }
+    free(a->str);
+    free(a);
+}
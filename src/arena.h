@@ -0,0 +1,76 @@
+/*
+ *  modio - Modbus input output access tool
+ *
+ *  Copyright (C) 2022, Dimitris Economou (dimitris.s.economou@gmail.com)
+ *
+ *  This file is part of modio.
+ *
+ *  modio is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  modio is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with modio. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Arena allocation of device file data.
+ *
+ * The data of a device file, its register array and strings, are
+ * allocated from one arena: chunks of memory that are filled in
+ * order and freed all at once. Strings are interned, a string that
+ * is already in the arena isn't copied again, so the access,
+ * engineering unit and description strings that repeat across the
+ * registers of a device are stored once. Interned strings are shared
+ * and must not be modified.
+ */
+
+#ifndef MXIO_ARENA_H
+#define MXIO_ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ARENA_CHUNK 16384       /* default chunk size */
+#define ARENA_ALIGN 16          /* alignment of arena_alloc */
+
+/* chunk of an arena */
+struct achunk {
+    struct achunk *next;        /* previous chunk */
+    size_t size;                /* usable size */
+    size_t used;                /* used size */
+    _Alignas(ARENA_ALIGN) unsigned char mem[];  /* chunk memory */
+};
+typedef struct achunk achunk_t;
+
+/* arena */
+struct arena {
+    achunk_t *head;             /* current chunk */
+    size_t chunk;               /* size of new chunks */
+    size_t used;                /* allocated bytes */
+    char **str;                 /* interned strings hash table */
+    uint32_t sstr;              /* size of the hash table, a power of 2 */
+    uint32_t nstr;              /* number of interned strings */
+    uint32_t hits;              /* interned strings found in the table */
+};
+typedef struct arena arena_t;
+
+/* create an arena of chunks of size chunk */
+arena_t *arena_new(size_t chunk);
+
+/* allocate sz bytes of an arena, aligned to ARENA_ALIGN */
+void *arena_alloc(arena_t *a, size_t sz);
+
+/* intern string s in an arena */
+char *arena_intern(arena_t *a, const char *s);
+
+/* free an arena and all its allocations */
+void arena_free(arena_t *a);
+
+#endif
@@ -0,0 +1,422 @@
+/*
+ *  modio - Modbus input output access tool
+ *
+ *  Copyright (C) 2022, Dimitris Economou (dimitris.s.economou@gmail.com)
+ *
+ *  This file is part of modio.
+ *
+ *  modio is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  modio is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with modio. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "broker.h"
+#include "mbio.h"
+#include "plan.h"
+#include "dev.h"
+
+/* request message of a client */
+#define MSG_HDR(c) ((bk_msg_t *)(c)->in)
+#define MSG_PDU(c) ((c)->in + sizeof(bk_msg_t))
+
+/* address and count of a request PDU */
+#define PDU_ADDR(q) (((q)[1] << 8) | (q)[2])
+#define PDU_NB(q) (((q)[3] << 8) | (q)[4])
+
+/* broker client */
+struct bcli {
+    int fd;                     /* client connection, -1 for a free slot */
+    int inlen;                  /* bytes of the request message received */
+    int ready;                  /* a whole request waits to be served */
+    int merged;                 /* member of the merged read being served */
+    uint8_t in[sizeof(bk_msg_t) + CAP_PDU_MAX];     /* request message */
+};
+typedef struct bcli bcli_t;
+
+/*
+ * Listen on the broker socket path of port. A socket nobody listens
+ * on is left over by a broker that died and is replaced. The socket
+ * of a serial line is open to the group of its device, the users that
+ * may open the line may use its broker. Returns -1 on error.
+ */
+static int
+bk_listen(const char *path, const char *port)
+{
+    struct sockaddr_un sa;
+    struct stat st;
+    int fd;
+
+    if (strlen(path) >= sizeof(sa.sun_path)) {
+        printf("ERROR: broker socket path %s is too long\n", path);
+        return -1;
+    }
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    strcpy(sa.sun_path, path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd != -1 && connect(fd, (struct sockaddr *)&sa, sizeof(sa)) == 0) {
+        printf("ERROR: a broker of %s runs on %s\n", port, path);
+        close(fd);
+        return -1;
+    }
+    if (fd != -1) {
+        close(fd);
+    }
+    unlink(path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1 || bind(fd, (struct sockaddr *)&sa, sizeof(sa)) == -1 ||
+        listen(fd, BRK_MAX_CLIENTS) == -1) {
+        printf("ERROR:(%s) bind %s\n", strerror(errno), path);
+        if (fd != -1) {
+            close(fd);
+        }
+        return -1;
+    }
+    if (stat(port, &st) == 0 && S_ISCHR(st.st_mode) && chown(path, -1, st.st_gid) == 0) {
+        chmod(path, 0660);
+    } else {
+        chmod(path, 0600);
+    }
+    return fd;
+}
+
+/*
+ * close the connection of client c
+ */
+static void
+bk_drop(bcli_t *c)
+{
+    close(c->fd);
+    c->fd = -1;
+    c->inlen = 0;
+    c->ready = 0;
+    c->merged = 0;
+}
+
+/*
+ * Receive what has arrived of the request of client c. Returns -1 if
+ * the client has closed the connection or sent an invalid message.
+ */
+static int
+bk_recv(bcli_t *c)
+{
+    size_t need;
+    ssize_t n;
+
+    while (!c->ready) {
+        need = sizeof(bk_msg_t);
+        if (c->inlen >= (int )sizeof(bk_msg_t)) {
+            need += MSG_HDR(c)->len;
+        }
+        n = recv(c->fd, c->in + c->inlen, need - c->inlen, MSG_DONTWAIT);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        c->inlen += n;
+        if (c->inlen == (int )sizeof(bk_msg_t) && (MSG_HDR(c)->len < 1 || MSG_HDR(c)->len > CAP_PDU_MAX)) {
+            return -1;
+        }
+        if (c->inlen > (int )sizeof(bk_msg_t) && c->inlen == (int )sizeof(bk_msg_t) + MSG_HDR(c)->len) {
+            c->ready = 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Send the response PDU rsp of len bytes to client c, or errno err if
+ * len is -1, and wait for its next request.
+ */
+static void
+bk_reply(bcli_t *c, const uint8_t *rsp, int len, int err)
+{
+    uint8_t out[sizeof(bk_msg_t) + CAP_PDU_MAX];
+    bk_msg_t m = { 0, MSG_HDR(c)->unit, 0, err };
+    size_t sz = sizeof(bk_msg_t);
+
+    if (len > 0) {
+        m.len = len;
+        m.err = 0;
+        memcpy(out + sz, rsp, len);
+        sz += len;
+    }
+    memcpy(out, &m, sizeof(m));
+    c->inlen = 0;
+    c->ready = 0;
+    if (send(c->fd, out, sz, MSG_NOSIGNAL | MSG_DONTWAIT) != (ssize_t )sz) {
+        bk_drop(c);
+    }
+}
+
+/*
+ * run the request of client c on its own
+ */
+static void
+bk_serve(modbus_t *mb, bcli_t *c)
+{
+    uint8_t rsp[CAP_PDU_MAX];
+    int len;
+
+    len = mbio_pdu(mb, MSG_HDR(c)->unit, MSG_PDU(c), MSG_HDR(c)->len, rsp);
+    bk_reply(c, rsp, len, errno);
+}
+
+/*
+ * check if the request of client c is a read that can be merged
+ */
+static int
+bk_is_read(bcli_t *c)
+{
+    const uint8_t *q = MSG_PDU(c);
+
+    return MSG_HDR(c)->len == 5 && q[0] >= 0x01 && q[0] <= 0x04 && PDU_NB(q) > 0;
+}
+
+/*
+ * Build the response to read request q out of the response rsp of the
+ * merged read from address first. Returns the response length.
+ */
+static int
+bk_slice(const uint8_t *rsp, int first, const uint8_t *q, uint8_t *out)
+{
+    int off = PDU_ADDR(q) - first;
+    int nb = PDU_NB(q);
+
+    out[0] = q[0];
+    if (q[0] <= 0x02) {
+        out[1] = (nb + 7) / 8;
+        memset(out + 2, 0, out[1]);
+        for (int i = 0; i < nb; i++) {
+            if ((rsp[2 + (off + i) / 8] >> ((off + i) % 8)) & 1) {
+                out[2 + i / 8] |= 1 << (i % 8);
+            }
+        }
+    } else {
+        out[1] = 2 * nb;
+        memcpy(out + 2, rsp + 2 + 2 * off, 2 * nb);
+    }
+    return 2 + out[1];
+}
+
+/*
+ * Run the read of client c merged with the waiting reads of the same
+ * slave id and function code whose ranges overlap or adjoin its range,
+ * as long as the merged range stays within the protocol limit, and
+ * split the response among them. After an exception every read is run
+ * on its own.
+ */
+static void
+bk_read(modbus_t *mb, bcli_t *cl, bcli_t *c)
+{
+    const uint8_t *q = MSG_PDU(c);
+    int unit = MSG_HDR(c)->unit;
+    int fc = q[0];
+    int max = (fc <= 0x02) ? PLAN_MAX_BITS : PLAN_MAX_REGS;
+    int first = PDU_ADDR(q);
+    int end = first + PDU_NB(q);
+    int n = 1;
+    uint8_t req[5];
+    uint8_t rsp[CAP_PDU_MAX];
+    uint8_t out[CAP_PDU_MAX];
+    int len;
+    int err;
+
+    c->merged = 1;
+    for (int grew = 1; grew; ) {
+        grew = 0;
+        for (int i = 0; i < BRK_MAX_CLIENTS; i++) {
+            bcli_t *o = &cl[i];
+            int a;
+            int e;
+
+            if (o->fd == -1 || !o->ready || o->merged || !bk_is_read(o) ||
+                MSG_HDR(o)->unit != unit || MSG_PDU(o)[0] != fc) {
+                continue;
+            }
+            a = PDU_ADDR(MSG_PDU(o));
+            e = a + PDU_NB(MSG_PDU(o));
+            if (a > end || e < first || (e > end ? e : end) - (a < first ? a : first) > max) {
+                continue;
+            }
+            first = (a < first) ? a : first;
+            end = (e > end) ? e : end;
+            o->merged = 1;
+            n++;
+            grew = 1;
+        }
+    }
+    if (n == 1) {
+        c->merged = 0;
+        bk_serve(mb, c);
+        return;
+    }
+
+    req[0] = fc;
+    req[1] = first >> 8;
+    req[2] = first & 0xff;
+    req[3] = (end - first) >> 8;
+    req[4] = (end - first) & 0xff;
+    len = mbio_pdu(mb, unit, req, 5, rsp);
+    err = errno;
+    modio_debugx(1, "broker: %d reads of unit %d merged into FC%d 0x%04x+%d\n", n, unit, fc, first, end - first);
+
+    for (int i = 0; i < BRK_MAX_CLIENTS; i++) {
+        bcli_t *o = &cl[i];
+
+        if (o->fd == -1 || !o->merged) {
+            continue;
+        }
+        o->merged = 0;
+        if (len == -1) {
+            bk_reply(o, NULL, -1, err);
+        } else if (rsp[0] != fc) {
+            bk_serve(mb, o);
+        } else {
+            bk_reply(o, out, bk_slice(rsp, first, MSG_PDU(o), out), 0);
+        }
+    }
+}
+
+/*
+ * Serve the waiting requests of a round, starting with client start.
+ * Requests that arrive meanwhile wait for the next round.
+ */
+static void
+bk_round(modbus_t *mb, bcli_t *cl, int start)
+{
+    for (int k = 0; k < BRK_MAX_CLIENTS; k++) {
+        bcli_t *c = &cl[(start + k) % BRK_MAX_CLIENTS];
+
+        if (c->fd == -1 || !c->ready) {
+            continue;
+        }
+        if (bk_is_read(c)) {
+            bk_read(mb, cl, c);
+        } else {
+            bk_serve(mb, c);
+        }
+    }
+}
+
+/*
+ * Serve the clients of port on modbus context mb until stop is set.
+ * The broker of root listens on the system wide socket of the port,
+ * the one of another user on the socket of the user. Returns -1 if
+ * the socket can't be set up.
+ */
+int
+broker_run(modbus_t *mb, const char *port, volatile sig_atomic_t *stop)
+{
+    struct pollfd pfd[BRK_MAX_CLIENTS + 1];
+    int idx[BRK_MAX_CLIENTS + 1];
+    bcli_t *cl;
+    char *path;
+    int lfd;
+    int start = 0;
+
+    if (geteuid() == 0) {
+        mkdir("/run/modio", 0755);
+    }
+    path = strdup(mbio_broker_path(port, geteuid() == 0));
+    cl = (bcli_t *)calloc(BRK_MAX_CLIENTS, sizeof(bcli_t));
+    if (path == NULL || cl == NULL) {
+        fprintf(stderr, "malloc failed: insufficient memory!\n");
+        exit(EXIT_FAILURE);
+    }
+    if ((lfd = bk_listen(path, port)) == -1) {
+        free(path);
+        free(cl);
+        return -1;
+    }
+    for (int i = 0; i < BRK_MAX_CLIENTS; i++) {
+        cl[i].fd = -1;
+    }
+
+    /* no other process may open the serial line while the broker owns it */
+    if (strstr(port, "/dev/tty") != NULL) {
+        ioctl(modbus_get_socket(mb), TIOCEXCL);
+    }
+    printf("broker: %s on %s\n", port, path);
+    fflush(stdout);
+
+    while (!*stop) {
+        int np = 0;
+
+        pfd[np].fd = lfd;
+        pfd[np].events = POLLIN;
+        idx[np++] = -1;
+        for (int i = 0; i < BRK_MAX_CLIENTS; i++) {
+            if (cl[i].fd != -1) {
+                pfd[np].fd = cl[i].fd;
+                pfd[np].events = POLLIN;
+                idx[np++] = i;
+            }
+        }
+        if (poll(pfd, np, 1000) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            printf("ERROR:(%s) poll %s\n", strerror(errno), path);
+            break;
+        }
+        for (int k = 1; k < np; k++) {
+            if (pfd[k].revents && bk_recv(&cl[idx[k]]) == -1) {
+                bk_drop(&cl[idx[k]]);
+            }
+        }
+        if (pfd[0].revents & POLLIN) {
+            int fd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            int i;
+
+            for (i = 0; fd != -1 && i < BRK_MAX_CLIENTS && cl[i].fd != -1; i++);
+            if (fd != -1 && i == BRK_MAX_CLIENTS) {
+                modio_debugx(1, "broker: more than %d clients\n", BRK_MAX_CLIENTS);
+                close(fd);
+            } else if (fd != -1) {
+                cl[i].fd = fd;
+            }
+        }
+        bk_round(mb, cl, start);
+        start = (start + 1) % BRK_MAX_CLIENTS;
+    }
+
+    for (int i = 0; i < BRK_MAX_CLIENTS; i++) {
+        if (cl[i].fd != -1) {
+            bk_drop(&cl[i]);
+        }
+    }
+    close(lfd);
+    unlink(path);
+    free(path);
+    free(cl);
+    return 0;
+}
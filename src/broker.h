@@ -0,0 +1,48 @@
+/*
+ *  modio - Modbus input output access tool
+ *
+ *  Copyright (C) 2022, Dimitris Economou (dimitris.s.economou@gmail.com)
+ *
+ *  This file is part of modio.
+ *
+ *  modio is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  modio is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with modio. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Broker of a modbus port.
+ *
+ * modio --broker owns a port, a serial line above all, keeps its modbus
+ * context open and runs the transfers of the modio processes of the
+ * port that connect to its UNIX socket (see mbio.h). A client has one
+ * request in flight at a time. The waiting requests are served in
+ * rounds, every round starting with the next client, so a busy client
+ * can't starve the others. Reads of a round with the same slave id and
+ * function code whose ranges overlap or adjoin are merged into one
+ * request of up to 125 registers or 2000 bits and the response is split
+ * among their clients. A merged read that gets an exception is run
+ * again for every client, as the unit may not take the merged range.
+ */
+
+#ifndef MXIO_BROKER_H
+#define MXIO_BROKER_H
+
+#include <signal.h>
+#include <modbus.h>
+
+#define BRK_MAX_CLIENTS 64      /* max number of connected clients */
+
+/* serve the clients of port on modbus context mb until stop is set */
+int broker_run(modbus_t *mb, const char *port, volatile sig_atomic_t *stop);
+
+#endif
@@ -0,0 +1,475 @@
+/*
+ *  modio - Modbus input output access tool
+ *
+ *  Copyright (C) 2022, Dimitris Economou (dimitris.s.economou@gmail.com)
+ *
+ *  This file is part of modio.
+ *
+ *  modio is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  modio is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with modio. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <math.h>
+#include "derive.h"
+
+/* compiler state of a derived register expression */
+struct dcomp {
+    const char *src;            /* expression source */
+    const char *p;              /* parse position */
+    dvlist_t *dv;               /* device of the expression */
+    int nd;                     /* derived registers it may refer to */
+    dins_t code[DRV_CODE_MAX];  /* compiled instructions */
+    int n;                      /* number of instructions */
+    int sp;                     /* stack depth at the end of the code */
+    int depth;                  /* max stack depth of the code */
+    char msg[128];              /* error message, empty if none */
+};
+typedef struct dcomp dcomp_t;
+
+/* binary operators by precedence, lowest first */
+static const struct {
+    const char *tok;
+    int op;
+} drv_ops[][4] = {
+    { { "||", DOP_LOR } },
+    { { "&&", DOP_LAND } },
+    { { "|", DOP_OR } },
+    { { "^", DOP_XOR } },
+    { { "&", DOP_AND } },
+    { { "==", DOP_EQ }, { "!=", DOP_NE } },
+    { { "<", DOP_LT }, { "<=", DOP_LE }, { ">", DOP_GT }, { ">=", DOP_GE } },
+    { { "<<", DOP_SHL }, { ">>", DOP_SHR } },
+    { { "+", DOP_ADD }, { "-", DOP_SUB } },
+    { { "*", DOP_MUL }, { "/", DOP_DIV }, { "%", DOP_MOD } }
+};
+
+#define DRV_LEVELS (int )(sizeof(drv_ops) / sizeof(drv_ops[0]))
+
+static void drv_expr(dcomp_t *c, int lvl);
+
+/*
+ * integer part of v for the bit operators, 0 if out of range
+ */
+static int64_t
+drv_int(double v)
+{
+    if (!(v > -9.2e18 && v < 9.2e18)) {
+        return 0;
+    }
+    return (int64_t )v;
+}
+
+/*
+ * set the error message of the compiler, the first one is kept
+ */
+static void
+drv_error(dcomp_t *c, const char *msg)
+{
+    if (c->msg[0] == '\0') {
+        snprintf(c->msg, sizeof(c->msg), "%s at column %d", msg, (int )(c->p - c->src) + 1);
+    }
+}
+
+/*
+ * skip the white space at the parse position
+ */
+static void
+drv_space(dcomp_t *c)
+{
+    while (isspace((unsigned char )*c->p)) {
+        c->p++;
+    }
+}
+
+/*
+ * Append an instruction to the code. An operation on constants is
+ * folded into a constant.
+ */
+static void
+drv_emit(dcomp_t *c, int op, int arg, double k)
+{
+    int in;
+
+    if (c->msg[0] != '\0') {
+        return;
+    }
+    if (c->n == DRV_CODE_MAX) {
+        drv_error(c, "expression too long");
+        return;
+    }
+    c->code[c->n].op = op;
+    c->code[c->n].arg = arg;
+    c->code[c->n].k = k;
+    c->n++;
+
+    /* operands an operation takes off the stack */
+    in = (op == DOP_K || op == DOP_VAL) ? 0 : (op <= DOP_NOT) ? 1 : 2;
+    c->sp += 1 - in;
+    if (c->sp > c->depth) {
+        c->depth = c->sp;
+    }
+    if (in > 0 && c->n > in) {
+        for (int i = c->n - 1 - in; i < c->n - 1; i++) {
+            if (c->code[i].op != DOP_K) {
+                return;
+            }
+        }
+        k = drv_eval(&c->code[c->n - 1 - in], in + 1, NULL);
+        c->n -= in;
+        c->code[c->n - 1].op = DOP_K;
+        c->code[c->n - 1].arg = 0;
+        c->code[c->n - 1].k = k;
+    }
+}
+
+/*
+ * value index of register or earlier derived register name of len
+ * characters, -1 if there is none
+ */
+static int
+drv_lookup(dcomp_t *c, const char *name, size_t len)
+{
+    for (int i = 0; i < c->dv->nor; i++) {
+        const char *s = c->dv->regs[i].info->name;
+        if (strlen(s) == len && strncmp(s, name, len) == 0) {
+            return i;
+        }
+    }
+    for (int i = 0; i < c->nd; i++) {
+        const char *s = c->dv->drv[i].name;
+        if (strlen(s) == len && strncmp(s, name, len) == 0) {
+            return c->dv->nor + i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * primary: a parenthesized expression, a constant or a register name
+ */
+static void
+drv_primary(dcomp_t *c)
+{
+    const char *name;
+    size_t len;
+    char *e;
+    double k;
+    int i;
+
+    drv_space(c);
+    if (*c->p == '(') {
+        c->p++;
+        drv_expr(c, 0);
+        drv_space(c);
+        if (*c->p != ')') {
+            drv_error(c, "missing ')'");
+            return;
+        }
+        c->p++;
+        return;
+    }
+    if (isdigit((unsigned char )*c->p) || *c->p == '.') {
+        k = strtod(c->p, &e);
+        if (e == c->p) {
+            drv_error(c, "invalid number");
+            return;
+        }
+        c->p = e;
+        drv_emit(c, DOP_K, 0, k);
+        return;
+    }
+    if (*c->p == '\'') {
+        name = ++c->p;
+        while (*c->p != '\0' && *c->p != '\'') {
+            c->p++;
+        }
+        if (*c->p != '\'') {
+            drv_error(c, "missing '");
+            return;
+        }
+        len = c->p++ - name;
+    } else if (isalpha((unsigned char )*c->p) || *c->p == '_') {
+        name = c->p;
+        while (isalnum((unsigned char )*c->p) || *c->p == '_') {
+            c->p++;
+        }
+        len = c->p - name;
+    } else {
+        drv_error(c, "syntax error");
+        return;
+    }
+    if ((i = drv_lookup(c, name, len)) == -1) {
+        c->p = name;
+        drv_error(c, "unknown register");
+        return;
+    }
+    drv_emit(c, DOP_VAL, i, 0);
+}
+
+/*
+ * unary: - ~ ! applied to a unary, or a primary
+ */
+static void
+drv_unary(dcomp_t *c)
+{
+    int op;
+
+    drv_space(c);
+    switch (*c->p) {
+        case '-':
+            op = DOP_NEG;
+            break;
+        case '~':
+            op = DOP_INV;
+            break;
+        case '!':
+            op = DOP_NOT;
+            break;
+        case '+':
+            c->p++;
+            drv_unary(c);
+            return;
+        default:
+            drv_primary(c);
+            return;
+    }
+    c->p++;
+    drv_unary(c);
+    drv_emit(c, op, 0, 0);
+}
+
+/*
+ * binary operator of precedence level lvl at the parse position,
+ * the longest operator there decides, -1 if there is none
+ */
+static int
+drv_binop(dcomp_t *c, int lvl, size_t *len)
+{
+    size_t best = 0;
+    int op = -1;
+
+    for (int l = 0; l < DRV_LEVELS; l++) {
+        for (int i = 0; i < 4 && drv_ops[l][i].tok != NULL; i++) {
+            size_t n = strlen(drv_ops[l][i].tok);
+            if (n > best && strncmp(c->p, drv_ops[l][i].tok, n) == 0) {
+                best = n;
+                op = (l == lvl) ? drv_ops[l][i].op : -1;
+            }
+        }
+    }
+    *len = best;
+    return op;
+}
+
+/*
+ * expression of the binary operators of precedence level lvl and
+ * higher, left associative
+ */
+static void
+drv_expr(dcomp_t *c, int lvl)
+{
+    size_t len;
+    int op;
+
+    if (lvl == DRV_LEVELS) {
+        drv_unary(c);
+        return;
+    }
+    drv_expr(c, lvl + 1);
+    for (;;) {
+        drv_space(c);
+        if (c->msg[0] != '\0' || (op = drv_binop(c, lvl, &len)) == -1) {
+            return;
+        }
+        c->p += len;
+        drv_expr(c, lvl + 1);
+        drv_emit(c, op, 0, 0);
+    }
+}
+
+/*
+ * Compile expression src of derived register nd of device dv into its
+ * code, allocated from the arena of the device. The expression may
+ * refer to the registers and to the derived registers before nd.
+ * Errors are written to err, of size esz. Returns -1 on error.
+ */
+int
+drv_compile(dvlist_t *dv, int nd, const char *src, char *err, size_t esz)
+{
+    dcomp_t *c = (dcomp_t *)calloc(1, sizeof(dcomp_t));
+    dvar_t *d = &dv->drv[nd];
+
+    if (c == NULL) {
+        snprintf(err, esz, "insufficient memory");
+        return -1;
+    }
+    c->src = c->p = src;
+    c->dv = dv;
+    c->nd = nd;
+    drv_expr(c, 0);
+    drv_space(c);
+    if (*c->p != '\0') {
+        drv_error(c, "syntax error");
+    }
+    if (c->msg[0] == '\0' && c->depth > DRV_STACK) {
+        drv_error(c, "expression too deep");
+    }
+    if (c->msg[0] != '\0') {
+        snprintf(err, esz, "%s", c->msg);
+        free(c);
+        return -1;
+    }
+    d->code = (dins_t *)arena_alloc(dv->mem, c->n * sizeof(dins_t));
+    if (d->code == NULL) {
+        snprintf(err, esz, "insufficient memory");
+        free(c);
+        return -1;
+    }
+    memcpy(d->code, c->code, c->n * sizeof(dins_t));
+    d->ncode = c->n;
+    free(c);
+    return 0;
+}
+
+/*
+ * Evaluate the n instructions of code over the register values val,
+ * indexed by register and then by derived register. Returns NAN if a
+ * register it reads is NAN.
+ */
+double
+drv_eval(const dins_t *code, int n, const double *val)
+{
+    double st[DRV_STACK];
+    int sp = 0;
+    double a;
+    double b;
+
+    for (int i = 0; i < n; i++) {
+        switch (code[i].op) {
+            case DOP_K:
+                st[sp++] = code[i].k;
+                continue;
+            case DOP_VAL:
+                if (isnan(val[code[i].arg])) {
+                    return NAN;
+                }
+                st[sp++] = val[code[i].arg];
+                continue;
+            case DOP_NEG:
+                st[sp - 1] = -st[sp - 1];
+                continue;
+            case DOP_INV:
+                st[sp - 1] = (double )~drv_int(st[sp - 1]);
+                continue;
+            case DOP_NOT:
+                st[sp - 1] = (st[sp - 1] == 0);
+                continue;
+        }
+        b = st[--sp];
+        a = st[sp - 1];
+        switch (code[i].op) {
+            case DOP_MUL:
+                a *= b;
+                break;
+            case DOP_DIV:
+                a /= b;
+                break;
+            case DOP_MOD:
+                a = fmod(a, b);
+                break;
+            case DOP_ADD:
+                a += b;
+                break;
+            case DOP_SUB:
+                a -= b;
+                break;
+            case DOP_SHL:
+                a = (double )(int64_t )((uint64_t )drv_int(a) << (drv_int(b) & 63));
+                break;
+            case DOP_SHR:
+                a = (double )(drv_int(a) >> (drv_int(b) & 63));
+                break;
+            case DOP_LT:
+                a = (a < b);
+                break;
+            case DOP_LE:
+                a = (a <= b);
+                break;
+            case DOP_GT:
+                a = (a > b);
+                break;
+            case DOP_GE:
+                a = (a >= b);
+                break;
+            case DOP_EQ:
+                a = (a == b);
+                break;
+            case DOP_NE:
+                a = (a != b);
+                break;
+            case DOP_AND:
+                a = (double )(drv_int(a) & drv_int(b));
+                break;
+            case DOP_XOR:
+                a = (double )(drv_int(a) ^ drv_int(b));
+                break;
+            case DOP_OR:
+                a = (double )(drv_int(a) | drv_int(b));
+                break;
+            case DOP_LAND:
+                a = (a != 0 && b != 0);
+                break;
+            case DOP_LOR:
+                a = (a != 0 || b != 0);
+                break;
+        }
+        st[sp - 1] = a;
+    }
+    return (sp > 0) ? st[0] : NAN;
+}
+
+/*
+ * Evaluate the derived registers of device dv in order, from the
+ * register values at the start of val into the values after them
+ */
+void
+drv_update(dvlist_t *dv, double *val)
+{
+    for (int i = 0; i < dv->nod; i++) {
+        val[dv->nor + i] = drv_eval(dv->drv[i].code, dv->drv[i].ncode, val);
+    }
+}
+
+/*
+ * Print value v of derived register d into buf of size sz, in hex or
+ * as a dec with its engineering unit. Returns -1 if v is NAN.
+ */
+int
+drv_print(char *buf, size_t sz, const dvar_t *d, double v)
+{
+    if (isnan(v)) {
+        snprintf(buf, sz, "-");
+        return -1;
+    }
+    if (d->prfmt == HEX) {
+        snprintf(buf, sz, "0x%llx", (unsigned long long )drv_int(v));
+    } else {
+        snprintf(buf, sz, "%.2f%s", v, d->engu);
+    }
+    return 1;
+}
@@ -0,0 +1,92 @@
+/*
+ *  modio - Modbus input output access tool
+ *
+ *  Copyright (C) 2022, Dimitris Economou (dimitris.s.economou@gmail.com)
+ *
+ *  This file is part of modio.
+ *
+ *  modio is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  modio is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with modio. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Derived registers.
+ *
+ * The derived section of a device file defines values computed from
+ * the values of its registers, such as a 32bit counter from two words,
+ * a power from a voltage and a current or a state flag from a bit
+ * mask. Their expressions are compiled once, when the device file is
+ * read, into the instructions of a small stack machine that refer to
+ * the registers by their index, and evaluated on every read of the
+ * device after its registers are decoded.
+ *
+ * Expressions take registers and earlier derived registers by name,
+ * as a 'quoted name' or a bare name of letters, digits and '_', and
+ * decimal, hex or float constants, with the operators of C:
+ *
+ *   ( )  unary - ~ !  * / %  + -  << >>  < <= > >=  == !=  &  ^  |  &&  ||
+ *
+ * The bit operators work on the integer part of their operands. A
+ * derived register of a register that failed or has no numeric value
+ * is NAN.
+ */
+
+#ifndef MXIO_DERIVE_H
+#define MXIO_DERIVE_H
+
+#include <stddef.h>
+#include "modio.h"
+
+#define DRV_CODE_MAX 256        /* max instructions of an expression */
+#define DRV_STACK 32            /* max stack depth of an expression */
+
+/* operations of the derived register stack machine */
+enum dop {
+    DOP_K = 0,                  /* push constant */
+    DOP_VAL,                    /* push value of a register */
+    DOP_NEG,                    /* unary - */
+    DOP_INV,                    /* ~ */
+    DOP_NOT,                    /* ! */
+    DOP_MUL,
+    DOP_DIV,
+    DOP_MOD,
+    DOP_ADD,
+    DOP_SUB,
+    DOP_SHL,
+    DOP_SHR,
+    DOP_LT,
+    DOP_LE,
+    DOP_GT,
+    DOP_GE,
+    DOP_EQ,
+    DOP_NE,
+    DOP_AND,
+    DOP_XOR,
+    DOP_OR,
+    DOP_LAND,
+    DOP_LOR
+};
+
+/* compile the expression of derived register nd of a device */
+int drv_compile(dvlist_t *dv, int nd, const char *src, char *err, size_t esz);
+
+/* evaluate a compiled expression over the values of a device */
+double drv_eval(const dins_t *code, int n, const double *val);
+
+/* evaluate the derived registers of a device into val */
+void drv_update(dvlist_t *dv, double *val);
+
+/* print the value of a derived register */
+int drv_print(char *buf, size_t sz, const dvar_t *d, double v);
+
+#endif
@@ -0,0 +1,757 @@
+/*
+ *  modio - Modbus input output access tool
+ *
+ *  Copyright (C) 2022, Dimitris Economou (dimitris.s.economou@gmail.com)
+ *
+ *  This file is part of modio.
+ *
+ *  modio is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  modio is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with modio. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <libconfig.h>
+#include "dev.h"
+#include "value.h"
+#include "derive.h"
+
+/* modio debug level */
+int modio_dbg_lvl = 0;
+
+/*
+ * read number name of setting s, an integer or a float, into v
+ */
+static int
+cfg_num(const config_setting_t *s, const char *name, double *v)
+{
+    int i;
+
+    if (config_setting_lookup_float(s, name, v)) {
+        return 1;
+    }
+    if (config_setting_lookup_int(s, name, &i)) {
+        *v = i;
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * number of the settings of list that have an alarm group
+ */
+static int
+count_alarms(const config_setting_t *list)
+{
+    int n = 0;
+
+    for (int i = 0; list != NULL && i < config_setting_length(list); i++) {
+        if (config_setting_get_member(config_setting_get_elem(list, i), "alarm") != NULL) {
+            n++;
+        }
+    }
+    return n;
+}
+
+/*
+ * Read the alarm group of register or derived register setting s, of
+ * value index vi, into the next alarm rule of dvl. A group without
+ * limits or flags takes its limits from the "lo-hi" value range range,
+ * if not NULL. Settings without an alarm group are skipped. Errors are
+ * written to err, of size esz. Returns -1 on error.
+ */
+static int
+read_alarm(const config_setting_t *s, dvlist_t *dvl, int vi, const char *range, char *err, size_t esz)
+{
+    config_setting_t *g = config_setting_get_member(s, "alarm");
+    alrule_t *a;
+    int mask = 0;
+    char *e;
+
+    if (g == NULL) {
+        return 0;
+    }
+    a = &dvl->alarm[dvl->noa];
+    a->vi = vi;
+    a->high = NAN;
+    a->low = NAN;
+    a->hyst = 0;
+    a->on = 0;
+    a->off = 0;
+    cfg_num(g, "high", &a->high);
+    cfg_num(g, "low", &a->low);
+    cfg_num(g, "hyst", &a->hyst);
+    config_setting_lookup_int(g, "mask", &mask);
+    config_setting_lookup_int(g, "on", &a->on);
+    config_setting_lookup_int(g, "off", &a->off);
+    a->mask = (uint32_t )mask;
+
+    /* the limits of the value range */
+    if (isnan(a->high) && isnan(a->low) && a->mask == 0 && range != NULL) {
+        a->low = strtod(range, &e);
+        if (e != range) {
+            while (*e == ' ') {
+                e++;
+            }
+            if (*e == '-') {
+                range = e + 1;
+                a->high = strtod(range, &e);
+            }
+        }
+        if (e == range) {
+            a->low = NAN;
+            a->high = NAN;
+        }
+    }
+    if (isnan(a->high) && isnan(a->low) && a->mask == 0) {
+        snprintf(err, esz, "alarm without limits, mask or value range");
+        return -1;
+    }
+    if (a->hyst < 0 || a->on < 0 || a->off < 0) {
+        snprintf(err, esz, "alarm with a negative hyst, on or off");
+        return -1;
+    }
+    dvl->noa++;
+    return 0;
+}
+
+/* 
+ * Initialize device register list 
+ */
+int
+init_drlist(dvlist_t **lst)
+{
+    DIR* FD;
+    struct dirent* in_file;
+    dreg_t *drarr = NULL;
+    char user_dir[PATH_MAX];
+    int cnt = 0;
+
+    /* Scanning the devices' directory */
+    if (NULL == (FD = opendir(REGISTER_PATH))) {
+        fprintf(stderr, "Error: Failed to open devices' directory (%s)\n", REGISTER_PATH);
+    } else {
+        while ((in_file = readdir(FD))) {
+            /* On linux/Unix we don't want current and parent directories */
+            if (!strcmp (in_file->d_name, ".")) {
+                continue;
+            }
+            if (!strcmp (in_file->d_name, "..")) {
+                continue;
+            }
+            cnt++;
+        }
+        closedir(FD);
+    }
+
+    /* construct user path for config files */
+    snprintf(user_dir, sizeof(user_dir), "%s/.%s/", getenv("HOME") ? getenv("HOME") : "", PROGR_DIR_NAME);
+
+    modio_debugx(2, "user dir: %s\n", user_dir);
+
+    /* Scanning the devices' directory */
+    if (NULL == (FD = opendir(user_dir))) {
+        fprintf(stderr, "Error: Failed to open devices' directory (%s)\n", user_dir);
+    } else {
+        while ((in_file = readdir(FD))) {
+            /* On linux/Unix we don't want current and parent directories */
+            if (!strcmp (in_file->d_name, ".")) {
+                continue;
+            }
+            if (!strcmp (in_file->d_name, "..")) {
+                continue;
+            }
+            cnt++;
+        }
+        closedir(FD);
+    }
+
+    modio_debugx(2, "number of config files: %d\n", cnt);
+
+    /* allocate memory for device list */
+    *lst = (dvlist_t *)malloc(cnt * sizeof(dvlist_t));
+
+    /* allocate memory for device register array of size cnt */
+    drarr = (dreg_t *)malloc(sizeof(dreg_t));
+    (*lst)->regs = drarr;
+
+    return cnt;
+}
+
+/*
+ * append the paths of the files in directory dir, ending in '/', to the
+ * path list. Returns -1 with errno set if dir can't be opened, ENOMEM
+ * if the list can't grow, with the paths appended until then.
+ */
+int
+list_dev_files(const char *dir, char ***paths, int *n)
+{
+    DIR* FD;
+    struct dirent* in_file;
+    char **p;
+    char *path;
+
+    if (NULL == (FD = opendir(dir))) {
+        return -1;
+    }
+    while ((in_file = readdir(FD))) {
+
+        /* On linux/Unix we don't want current and parent directories */
+        if (!strcmp (in_file->d_name, ".")) {
+            continue;
+        }
+        if (!strcmp (in_file->d_name, "..")) {
+            continue;
+        }
+        p = (char **)realloc(*paths, (*n + 1) * sizeof(char *));
+        if (p == NULL) {
+            closedir(FD);
+            errno = ENOMEM;
+            return -1;
+        }
+        *paths = p;
+        path = (char *)malloc((strlen(dir) + strlen(in_file->d_name) + 1) * sizeof(char));
+        if (path == NULL) {
+            closedir(FD);
+            errno = ENOMEM;
+            return -1;
+        }
+        strcpy(path, dir);
+        strcat(path, in_file->d_name);
+        (*paths)[(*n)++] = path;
+    }
+    closedir(FD);
+    return 0;
+}
+
+/*
+ * device file worker, reads the next unread file of the pool until
+ * all files are read
+ */
+void *
+read_dev_worker(void *arg)
+{
+    dfpool_t *pool = (dfpool_t *)arg;
+    int i;
+
+    while ((i = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED)) < pool->n) {
+        dftask_t *t = &pool->task[i];
+        t->rval = read_dev_file(t->path, &t->dv, t->err, sizeof(t->err));
+    }
+    return NULL;
+}
+
+/*
+ * Read device and register info of the device files in REGISTER_PATH
+ * and $HOME/.modio into lst, of size lsz. Files with errors are
+ * reported and left out. Returns the number of devices.
+ */
+int
+read_dreg(dvlist_t *lst, int lsz)
+{
+    char user_dir[PATH_MAX];
+    char **paths = NULL;
+    int n = 0;
+
+    /* construct user path for config files */
+    snprintf(user_dir, sizeof(user_dir), "%s/.%s/", getenv("HOME") ? getenv("HOME") : "", PROGR_DIR_NAME);
+    modio_debugx(2, "user dir: %s\n", user_dir);
+
+    for (int i = 0; i < 2; i++) {
+        const char *dir = i ? user_dir : REGISTER_PATH;
+
+        if (list_dev_files(dir, &paths, &n) == -1) {
+            if (errno == ENOMEM) {
+                fprintf(stderr, "malloc failed: insufficient memory!\n");
+                exit(EXIT_FAILURE);
+            }
+            fprintf(stderr, "Error: Failed to open devices' directory (%s)\n", dir);
+        }
+    }
+    n = read_dev_files(paths, n, lst, lsz, NULL, 0);
+    if (n == -1) {
+        fprintf(stderr, "malloc failed: insufficient memory!\n");
+        exit(EXIT_FAILURE);
+    }
+    return n;
+}
+
+/*
+ * Read the n device files of paths into lst, of size lsz, and free the
+ * path list. Files are read by a pool of up to one worker per core and
+ * merged in path order, so device numbers don't depend on which worker
+ * finishes first. Files with errors are left out, their errors and the
+ * warnings of the others printed or, if err isn't NULL, the first error,
+ * or else the first warning, written to err of size esz. Returns the
+ * number of devices, -1 with errno ENOMEM if the pool can't be
+ * allocated.
+ */
+int
+read_dev_files(char **paths, int n, dvlist_t *lst, int lsz, char *err, size_t esz)
+{
+    dfpool_t pool = { NULL, n, 0 };
+    pthread_t wk[DEV_MAX_WORKERS];
+    long nw;
+    int cnt = 0;
+    int failed = 0;
+
+    pool.task = (dftask_t *)calloc(pool.n ? pool.n : 1, sizeof(dftask_t));
+    if (pool.task == NULL) {
+        for (int i = 0; i < n; i++) {
+            free(paths[i]);
+        }
+        free(paths);
+        if (err != NULL && esz > 0) {
+            snprintf(err, esz, "insufficient memory");
+        }
+        errno = ENOMEM;
+        return -1;
+    }
+    for (int i = 0; i < pool.n; i++) {
+        pool.task[i].path = paths[i];
+    }
+
+    /* start the workers, the calling thread is one of them */
+    nw = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nw > pool.n) {
+        nw = pool.n;
+    }
+    if (nw > DEV_MAX_WORKERS) {
+        nw = DEV_MAX_WORKERS;
+    }
+    modio_debugx(2, "device file workers: %ld\n", nw < 1 ? 1 : nw);
+    for (int i = 1; i < nw; i++) {
+        if (pthread_create(&wk[i], NULL, read_dev_worker, &pool) != 0) {
+            nw = i;
+            break;
+        }
+    }
+    read_dev_worker(&pool);
+    for (int i = 1; i < nw; i++) {
+        pthread_join(wk[i], NULL);
+    }
+
+    /* merge in file order, an error takes the place of a warning in err */
+    if (err != NULL && esz > 0) {
+        *err = '\0';
+    }
+    for (int i = 0; i < pool.n; i++) {
+        dftask_t *t = &pool.task[i];
+
+        if (t->err[0] != '\0') {
+            if (err == NULL) {
+                fprintf(stderr, "%s\n", t->err);
+            } else if (esz > 0 && (*err == '\0' || (t->rval == -1 && !failed))) {
+                snprintf(err, esz, "%s", t->err);
+                failed = (t->rval == -1);
+            }
+        }
+        if (t->rval == -1 || cnt >= lsz) {
+            free_dev(&t->dv);
+        } else {
+            lst[cnt++] = t->dv;
+        }
+        free(t->path);
+    }
+    free(pool.task);
+    free(paths);
+    return cnt;
+}
+
+/*
+ * order register indexes by register type, address and longest first,
+ * the order of the registers in a read plan
+ */
+int
+dreg_order_cmp(const void *a, const void *b, void *regs)
+{
+    const dreg_t *ra = &((const dreg_t *)regs)[*(const int *)a];
+    const dreg_t *rb = &((const dreg_t *)regs)[*(const int *)b];
+
+    if (ra->type != rb->type) {
+        return ra->type - rb->type;
+    }
+    if ((ra->addr & 0xffff) != (rb->addr & 0xffff)) {
+        return (ra->addr & 0xffff) - (rb->addr & 0xffff);
+    }
+    return rb->len - ra->len;
+}
+
+/*
+ * free the device and register info of a device
+ */
+void
+free_dev(dvlist_t *dv)
+{
+    arena_free(dv->mem);
+    memset(dv, 0, sizeof(dvlist_t));
+}
+
+/*
+ * Give the registers of a device without a ttl of their own the
+ * response cache ttl ms, so that a block read takes the shortest ttl
+ * of its registers
+ */
+void
+dev_ttl(dvlist_t *dv, int ms)
+{
+    for (int i = 0; i < dv->nor; i++) {
+        if (dv->regs[i].ttl < 0) {
+            dv->regs[i].ttl = ms;
+        }
+    }
+}
+
+/*
+ * write a warning of a device file to err, of size esz, if it has none
+ */
+static void
+dev_warn(char *err, size_t esz, const char *fmt, ...)
+{
+    va_list va;
+
+    if (esz == 0 || *err != '\0') {
+        return;
+    }
+    va_start(va, fmt);
+    vsnprintf(err, esz, fmt, va);
+    va_end(va);
+}
+
+/*
+ * Read the device and register info of device file path into dvl.
+ * All of it is allocated from the arena of the device, with its
+ * strings interned, and freed by free_dev(). Errors are written to
+ * err, of size esz, instead of being printed so files can be read in
+ * parallel, and so is the first warning of a file that is read, err
+ * is empty without one. Returns -1 on error.
+ */
+int
+read_dev_file(const char *path, dvlist_t *dvl, char *err, size_t esz)
+{
+    /* configuration vars */
+    config_t cfg;
+    const char *str;
+    config_setting_t *regs;
+    config_setting_t *drv;
+    int cnt;
+    char msg[256];
+
+    modio_debugx(3, "file name: %s\n", path);
+    if (esz > 0) {
+        *err = '\0';
+    }
+    memset(dvl, 0, sizeof(dvlist_t));
+    dvl->mem = arena_new(ARENA_CHUNK);
+    if (dvl->mem == NULL || (dvl->file = arena_intern(dvl->mem, path)) == NULL) {
+        snprintf(err, esz, "%s - insufficient memory", path);
+        return -1;
+    }
+
+    config_init(&cfg);
+
+    /* Read the file. If there is an error, report it. */
+    if (!config_read_file(&cfg, path)) {
+        snprintf(err, esz, "%s:%d - %s", path, config_error_line(&cfg), config_error_text(&cfg));
+        config_destroy(&cfg);
+        return -1;
+    }
+
+    /* Get the device manufacturer */
+    if (config_lookup_string(&cfg, "device.manfc", &str)) {
+        //printf("Device mfr: %s\n", str);
+        dvl->manfc = arena_intern(dvl->mem, str);
+    } else {
+        dev_warn(err, esz, "%s - No 'device manfc' in configuration file.", path);
+        dvl->manfc = arena_intern(dvl->mem, "");
+    }
+
+    /* Get the device type */
+    if (config_lookup_string(&cfg, "device.type", &str)) {
+        //printf("Device type: %s\n", str);
+        dvl->type = arena_intern(dvl->mem, str);
+    } else {
+        dev_warn(err, esz, "%s - No 'device type' in configuration file.", path);
+        dvl->type = arena_intern(dvl->mem, "");
+    }
+
+    /* Get the device model */
+    if (config_lookup_string(&cfg, "device.model", &str)) {
+        //printf("Device model: %s\n", str);
+        dvl->model = arena_intern(dvl->mem, str);
+    } else {
+        dev_warn(err, esz, "%s - No 'device model' in configuration file.", path);
+        dvl->model = arena_intern(dvl->mem, "");
+    }
+
+    /* Get the optional device identification patterns */
+    if (config_lookup_string(&cfg, "device.vendor", &str)) {
+        dvl->vendor = arena_intern(dvl->mem, str);
+    }
+    if (config_lookup_string(&cfg, "device.product", &str)) {
+        dvl->product = arena_intern(dvl->mem, str);
+    }
+    if (config_lookup_string(&cfg, "device.revision", &str)) {
+        dvl->revision = arena_intern(dvl->mem, str);
+    }
+
+    /* Get the optional RTU turnaround */
+    config_lookup_int(&cfg, "device.turnaround", &dvl->turnaround);
+
+    /* Get the zero based addressing configuration */
+    if (config_lookup_int(&cfg, "device.zba", &dvl->zba) == 0) {
+        snprintf(err, esz, "%s - No 'device zba' in configuration file.", path);
+        config_destroy(&cfg);
+        return -1;
+    }
+
+    modio_debugx(3, "manfc: %s type: %s model: %s zba: %d\n", dvl->manfc,
+                                                              dvl->type,
+                                                              dvl->model,
+                                                              dvl->zba
+    );
+    /* Output a list of all books in the inventory. */
+    regs = config_lookup(&cfg, "regs");
+    drv = config_lookup(&cfg, "derived");
+
+    /* alarm rules of the registers and derived registers */
+    if ((cnt = count_alarms(regs) + count_alarms(drv)) != 0) {
+        dvl->alarm = (alrule_t *)arena_alloc(dvl->mem, cnt * sizeof(alrule_t));
+        if (dvl->alarm == NULL) {
+            snprintf(err, esz, "%s - insufficient memory", path);
+            config_destroy(&cfg);
+            return -1;
+        }
+    }
+    if (regs != NULL) {
+        cnt = config_setting_length(regs);
+        if (cnt != 0) {
+            dvl->regs = (dreg_t *)arena_alloc(dvl->mem, cnt * sizeof(dreg_t));
+            dvl->info = (dinfo_t *)arena_alloc(dvl->mem, cnt * sizeof(dinfo_t));
+            dvl->order = (int *)arena_alloc(dvl->mem, cnt * sizeof(int));
+            if (dvl->regs == NULL || dvl->info == NULL || dvl->order == NULL) {
+                snprintf(err, esz, "%s - insufficient memory", path);
+                config_destroy(&cfg);
+                return -1;
+            }
+            dreg_t *r = dvl->regs;
+            dvl->nor = cnt;
+            for (int i = 0; i < cnt; ++i) {
+                config_setting_t *reg = config_setting_get_elem(regs, i);
+                const char *name;
+                const char *desc;
+                const char *range;
+                const char *engu;
+                const char *access;
+                if (!(config_setting_lookup_int(reg, "num", &r->num) &&
+                config_setting_lookup_int(reg, "addr", &r->addr) &&
+                config_setting_lookup_int(reg, "len", &r->len) &&
+                config_setting_lookup_int(reg, "type", &r->type) &&
+                config_setting_lookup_string(reg, "name", &name) &&
+                config_setting_lookup_string(reg, "descr", &desc) &&
+                config_setting_lookup_string(reg, "range", &range) &&
+                config_setting_lookup_float(reg, "scale", &r->scale) &&
+                config_setting_lookup_int(reg, "print", &r->prfmt) &&
+                config_setting_lookup_string(reg, "engu", &engu) &&
+                config_setting_lookup_string(reg, "access", &access))) {
+                    dvl->nor--;
+                    continue;
+                }
+                r->period = 0;
+                r->prio = 0;
+                r->ttl = -1;
+                r->window = 0;
+                config_setting_lookup_int(reg, "period", &r->period);
+                config_setting_lookup_int(reg, "priority", &r->prio);
+                config_setting_lookup_int(reg, "ttl", &r->ttl);
+                config_setting_lookup_int(reg, "window", &r->window);
+                r->info = &dvl->info[r - dvl->regs];
+                r->prval = prval_get(r->type, r->prfmt, 1);
+                r->info->name = arena_intern(dvl->mem, name);
+                r->info->desc = arena_intern(dvl->mem, desc);
+                r->info->range = arena_intern(dvl->mem, range);
+                r->info->engu = arena_intern(dvl->mem, engu);
+                r->info->acc = arena_intern(dvl->mem, access);
+                if (r->info->name == NULL || r->info->desc == NULL || r->info->range == NULL ||
+                    r->info->engu == NULL || r->info->acc == NULL) {
+                    snprintf(err, esz, "%s - insufficient memory", path);
+                    config_destroy(&cfg);
+                    return -1;
+                }
+                if (read_alarm(reg, dvl, r - dvl->regs, range, msg, sizeof(msg)) == -1) {
+                    snprintf(err, esz, "%s - register '%s': %s", path, name, msg);
+                    config_destroy(&cfg);
+                    return -1;
+                }
+
+                modio_debugx(3, "reg: %-5d name: %s ", r->num, r->info->name);
+                if (r->addr == 0) {
+                    int rnum = r->num;
+                    switch (r->type) {
+                        case COIL:
+                            r->addr = 0x0 + rnum - dvl->zba;
+                            break;
+                        case INPUT_B:
+                            rnum -= 10000;
+                            r->addr = 0x10000 + rnum - dvl->zba;
+                            break;
+                        case INPUT_R:
+                            rnum -= 30000;
+                            r->addr = 0x30000 + rnum - dvl->zba;
+                            break;
+                        case HOLDING:
+                            rnum -= 40000;
+                            r->addr = 0x40000 + rnum - dvl->zba;
+                            break;
+                        default:
+                            dev_warn(err, esz, "%s - register '%s': invalid register type %d",
+                                     path, name, r->type);
+                    }
+                    modio_debugx(3, "addr: 0x%x\n", r->addr);
+                }
+                r++;
+            }
+
+            /* sort the register indexes as block reads are planned */
+            for (int i = 0; i < dvl->nor; i++) {
+                dvl->order[i] = i;
+            }
+            qsort_r(dvl->order, dvl->nor, sizeof(int), dreg_order_cmp, dvl->regs);
+        }
+        modio_debugx(3, "nor: %d\n", dvl->nor);
+        modio_debugx(3, "arena: %zu bytes, %u strings, %u repeated\n\n", dvl->mem->used,
+                     dvl->mem->nstr,
+                     dvl->mem->hits
+        );
+    }
+
+    /* Compile the optional derived registers, in order as they may refer to each other */
+    if (drv != NULL && (cnt = config_setting_length(drv)) != 0) {
+        dvl->drv = (dvar_t *)arena_alloc(dvl->mem, cnt * sizeof(dvar_t));
+        if (dvl->drv == NULL) {
+            snprintf(err, esz, "%s - insufficient memory", path);
+            config_destroy(&cfg);
+            return -1;
+        }
+        for (int i = 0; i < cnt; i++) {
+            config_setting_t *dr = config_setting_get_elem(drv, i);
+            dvar_t *d = &dvl->drv[dvl->nod];
+            const char *name;
+            const char *expr;
+            const char *desc = "";
+            const char *engu = "";
+
+            if (!(config_setting_lookup_string(dr, "name", &name) &&
+                config_setting_lookup_string(dr, "expr", &expr))) {
+                continue;
+            }
+            config_setting_lookup_string(dr, "descr", &desc);
+            config_setting_lookup_string(dr, "engu", &engu);
+            d->prfmt = DEC;
+            d->window = 0;
+            config_setting_lookup_int(dr, "print", &d->prfmt);
+            config_setting_lookup_int(dr, "window", &d->window);
+            d->name = arena_intern(dvl->mem, name);
+            d->desc = arena_intern(dvl->mem, desc);
+            d->engu = arena_intern(dvl->mem, engu);
+            d->expr = arena_intern(dvl->mem, expr);
+            if (d->name == NULL || d->desc == NULL || d->engu == NULL || d->expr == NULL) {
+                snprintf(err, esz, "%s - insufficient memory", path);
+                config_destroy(&cfg);
+                return -1;
+            }
+            if (drv_compile(dvl, dvl->nod, expr, msg, sizeof(msg)) == -1) {
+                snprintf(err, esz, "%s - derived '%s': %s", path, name, msg);
+                config_destroy(&cfg);
+                return -1;
+            }
+            if (read_alarm(dr, dvl, dvl->nor + dvl->nod, NULL, msg, sizeof(msg)) == -1) {
+                snprintf(err, esz, "%s - derived '%s': %s", path, name, msg);
+                config_destroy(&cfg);
+                return -1;
+            }
+            modio_debugx(3, "derived: %s = %s, %d instructions\n", d->name, d->expr, d->ncode);
+            dvl->nod++;
+        }
+    }
+    config_destroy(&cfg);
+return 0;
+}
+
+/*
+ * Type and wire address of register number num, with the type offsets
+ * of -g. Returns the address with its type offset, or -1 if num isn't
+ * a valid register number.
+ */
+int
+reg_xaddr(int num, int zba, int *type)
+{
+    int raddr;
+
+    if (num < 10000) {
+        *type = COIL;
+        raddr = num - zba;
+    } else if (num < 20000) {
+        *type = INPUT_B;
+        raddr = num - zba - 10000;
+    } else if (num < 30000) {
+        return -1;
+    } else if (num < 40000) {
+        *type = INPUT_R;
+        raddr = num - zba - 30000;
+    } else if (num < 50000) {
+        *type = HOLDING;
+        raddr = num - zba - 40000;
+    } else {
+        return -1;
+    }
+    if (raddr < 0) {
+        return -1;
+    }
+    switch (*type) {
+        case COIL:
+            return 0x00000 + raddr;
+        case INPUT_B:
+            return 0x10000 + raddr;
+        case INPUT_R:
+            return 0x30000 + raddr;
+        default:
+            return 0x40000 + raddr;
+    }
+}
+
+/*
+ * debug function
+ */
+void
+modio_debugx(int level, const char *fmt, ...) {
+    int rval;
+    va_list va;
+
+    if (modio_dbg_lvl < level) {
+        return;
+    }
+    va_start(va, fmt);
+    rval = vprintf(fmt, va);
+    va_end(va);
+}
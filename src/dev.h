@@ -0,0 +1,74 @@
+/*
+ *  modio - Modbus input output access tool
+ *
+ *  Copyright (C) 2022, Dimitris Economou (dimitris.s.economou@gmail.com)
+ *
+ *  This file is part of modio.
+ *
+ *  modio is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  modio is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with modio. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Device files.
+ *
+ * A device file describes the registers of a device model: their
+ * numbers, addresses, lengths, print formats, scales and descriptive
+ * info. The device files of REGISTER_PATH and $HOME/.modio, or of any
+ * other directory, are read in parallel into a device list, one arena
+ * per device.
+ */
+
+#ifndef MXIO_DEV_H
+#define MXIO_DEV_H
+
+#include <stddef.h>
+#include "modio.h"
+
+/* modio debug level */
+extern int modio_dbg_lvl;
+
+/* debug function */
+void modio_debugx(int level, const char *fmt, ...);
+
+/* initialize supported devices' register list */
+int init_drlist(dvlist_t **lst);
+
+/* read supported devices and registers' info */
+int read_dreg(dvlist_t *lst, int lsz);
+
+/* list the files of a device directory */
+int list_dev_files(const char *dir, char ***paths, int *n);
+
+/* read the device files of a path list into a device list */
+int read_dev_files(char **paths, int n, dvlist_t *lst, int lsz, char *err, size_t esz);
+
+/* device file worker of read_dev_files */
+void *read_dev_worker(void *arg);
+
+/* read the device and registers' info of a device file */
+int read_dev_file(const char *path, dvlist_t *dvl, char *err, size_t esz);
+
+/* order register indexes by register type and address */
+int dreg_order_cmp(const void *a, const void *b, void *regs);
+
+/* free the device and registers' info of a device */
+void free_dev(dvlist_t *dv);
+
+/* give the registers of a device without their own ttl the cache ttl ms */
+void dev_ttl(dvlist_t *dv, int ms);
+
+/* type and wire address of a register number */
+int reg_xaddr(int num, int zba, int *type);
+
+#endif
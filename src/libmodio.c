@@ -0,0 +1,602 @@
+/*
+ *  modio - Modbus input output access tool
+ *
+ *  Copyright (C) 2022, Dimitris Economou (dimitris.s.economou@gmail.com)
+ *
+ *  This file is part of modio.
+ *
+ *  modio is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  modio is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with modio. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <math.h>
+#include <limits.h>
+#include <modbus.h>
+#include "libmodio.h"
+#include "modio.h"
+#include "mbio.h"
+#include "udp.h"
+#include "plan.h"
+#include "dev.h"
+#include "value.h"
+
+#define MODIO_ERR_LEN 512       /* max length of an error message */
+
+/* library context */
+struct modio {
+    modbus_t *mb;               /* modbus context, NULL without a connection */
+    int unit;                   /* modbus slave id */
+    dvlist_t *dvl;              /* loaded devices */
+    int ndv;                    /* number of loaded devices */
+    dvlist_t *dv;               /* selected device, NULL if none */
+    int turnaround;             /* RTU turnaround of the unit in ms, 0 for the default */
+    char err[MODIO_ERR_LEN];    /* reason of the last failure */
+};
+
+/* reason of the last modio_open() failure */
+static char open_err[MODIO_ERR_LEN];
+
+/*
+ * keep the reason of a failure of m, or of modio_open() if m is NULL,
+ * and return -1 with errno of the failure
+ */
+static int
+modio_fail(modio_t *m, const char *fmt, ...)
+{
+    va_list va;
+    int e = errno;
+
+    va_start(va, fmt);
+    vsnprintf(m ? m->err : open_err, MODIO_ERR_LEN, fmt, va);
+    va_end(va);
+    errno = e;
+    return -1;
+}
+
+/*
+ * Open a connection to a unit, with the timeouts of modio. It doesn't
+ * print or exit on failure. Replayed and brokered transfers of modio,
+ * as the ones of Modbus/UDP, only need a context for the slave id.
+ */
+modio_t *
+modio_open(const char *port, const modio_serial_t *serial, int unit)
+{
+    serconf_t sc = { BAUD_RATE, PARITY, STOP_BIT, DATA_BIT };
+    modio_t *m;
+    char *host;
+    char *sp;
+    int rval;
+
+    if ((m = (modio_t *)calloc(1, sizeof(modio_t))) == NULL) {
+        modio_fail(NULL, "insufficient memory");
+        return NULL;
+    }
+    m->unit = unit;
+    if (port == NULL) {
+        return m;
+    }
+    if (serial != NULL) {
+        sc.baud = serial->baud;
+        sc.prty = serial->parity;
+        sc.dbit = serial->data_bits;
+        sc.sbit = serial->stop_bits;
+    }
+
+    if (mbio_replaying() || mbio_brokered()) {
+        m->mb = modbus_new_tcp("127.0.0.1", 502);
+        if (m->mb != NULL && mbio_set_slave(m->mb, unit) != -1) {
+            return m;
+        }
+    } else if (strstr(port, "/dev/tty") != NULL) {
+        m->mb = modbus_new_rtu(port, sc.baud, sc.prty, sc.dbit, sc.sbit);
+    } else if (udp_port(port)) {
+
+        /* Modbus/UDP has no connection, the context only carries the slave id */
+        m->mb = modbus_new_tcp("127.0.0.1", 502);
+        if (m->mb != NULL && mbio_udp(m->mb, port) == -1) {
+            modbus_free(m->mb);
+            m->mb = NULL;
+        } else if (m->mb != NULL && mbio_set_slave(m->mb, unit) != -1) {
+            return m;
+        }
+    } else if ((host = strdup(port)) != NULL) {
+        if ((sp = strchr(host, ':')) != NULL) {
+            *sp = '\0';
+            m->mb = modbus_new_tcp(host, (int )strtoul(sp + 1, NULL, 10));
+        } else {
+            m->mb = modbus_new_tcp(host, 502);
+        }
+        free(host);
+    }
+    if (m->mb == NULL) {
+        modio_fail(NULL, "%s: %s", port, modbus_strerror(errno));
+        free(m);
+        return NULL;
+    }
+
+    if (mbio_set_slave(m->mb, unit) == -1) {
+        modio_fail(NULL, "invalid modbus slave ID %d", unit);
+    } else if (modbus_connect(m->mb) == -1) {
+        modio_fail(NULL, "%s: unable to connect: %s", port, modbus_strerror(errno));
+    } else if (modbus_set_response_timeout(m->mb, MODRESP_TIMEOUT_s, MODRESP_TIMEOUT_us) == -1) {
+        modio_fail(NULL, "%s: %s", port, modbus_strerror(errno));
+    } else {
+        if (strstr(port, "/dev/tty") != NULL) {
+            rval = mbio_rtu_timing(m->mb, sc);
+        } else {
+            rval = modbus_set_byte_timeout(m->mb, MODBYTE_TIMEOUT_s, MODBYTE_TIMEOUT_us);
+        }
+        if (rval != -1) {
+            return m;
+        }
+        modio_fail(NULL, "%s: %s", port, modbus_strerror(errno));
+    }
+    mbio_udp_close(m->mb);
+    modbus_close(m->mb);
+    modbus_free(m->mb);
+    free(m);
+    return NULL;
+}
+
+/*
+ * free the loaded devices of m
+ */
+static void
+modio_unload(modio_t *m)
+{
+    for (int i = 0; i < m->ndv; i++) {
+        free_dev(&m->dvl[i]);
+    }
+    free(m->dvl);
+    m->dvl = NULL;
+    m->ndv = 0;
+    m->dv = NULL;
+}
+
+/*
+ * close the connection and free the context
+ */
+void
+modio_close(modio_t *m)
+{
+    if (m == NULL) {
+        return;
+    }
+    if (m->mb != NULL) {
+        mbio_udp_close(m->mb);
+        modbus_close(m->mb);
+        modbus_free(m->mb);
+    }
+    modio_unload(m);
+    free(m);
+}
+
+/*
+ * reason of the last failure
+ */
+const char *
+modio_error(const modio_t *m)
+{
+    return m ? m->err : open_err;
+}
+
+/*
+ * talk to another unit of the connection
+ */
+int
+modio_set_unit(modio_t *m, int unit)
+{
+    if (m->mb != NULL && mbio_set_slave(m->mb, unit) == -1) {
+        return modio_fail(m, "invalid modbus slave ID %d", unit);
+    }
+    m->unit = unit;
+    return 0;
+}
+
+/*
+ * RTU turnaround of the unit
+ */
+int
+modio_set_turnaround(modio_t *m, int ms)
+{
+    if (ms < 0) {
+        errno = EINVAL;
+        return modio_fail(m, "invalid turnaround %d", ms);
+    }
+    m->turnaround = ms;
+    return 0;
+}
+
+/*
+ * Load the device files of dir, or of REGISTER_PATH and $HOME/.modio
+ * if NULL. A directory that can't be opened is an error only if it's
+ * the one asked for.
+ */
+int
+modio_load(modio_t *m, const char *dir)
+{
+    char user_dir[PATH_MAX];
+    char path[PATH_MAX];
+    char **paths = NULL;
+    dvlist_t *dvl;
+    int n = 0;
+    int rval = 0;
+
+    if (dir != NULL) {
+        snprintf(path, sizeof(path), "%s%s", dir, dir[0] && dir[strlen(dir) - 1] == '/' ? "" : "/");
+        rval = list_dev_files(path, &paths, &n);
+    } else {
+        snprintf(user_dir, sizeof(user_dir), "%s/.%s/", getenv("HOME") ? getenv("HOME") : "",
+                 PROGR_DIR_NAME);
+        if (list_dev_files(REGISTER_PATH, &paths, &n) == -1 && errno == ENOMEM) {
+            rval = -1;
+        } else if (list_dev_files(user_dir, &paths, &n) == -1 && errno == ENOMEM) {
+            rval = -1;
+        }
+    }
+
+    if (rval == -1 || (dvl = (dvlist_t *)calloc(n ? n : 1, sizeof(dvlist_t))) == NULL) {
+        int e = rval == -1 ? errno : ENOMEM;
+
+        for (int i = 0; i < n; i++) {
+            free(paths[i]);
+        }
+        free(paths);
+        if (e == ENOMEM) {
+            return modio_fail(m, "insufficient memory");
+        }
+        return modio_fail(m, "%s: %s", dir, strerror(e));
+    }
+    modio_unload(m);
+    m->dvl = dvl;
+    m->err[0] = '\0';
+    if ((m->ndv = read_dev_files(paths, n, m->dvl, n, m->err, sizeof(m->err))) == -1) {
+        m->ndv = 0;
+        return -1;
+    }
+    return m->ndv;
+}
+
+/*
+ * number of devices loaded
+ */
+int
+modio_devices(const modio_t *m)
+{
+    return m->ndv;
+}
+
+/*
+ * manufacturer, model and type of a device
+ */
+int
+modio_device(const modio_t *m, int dev, const char **manfc, const char **model, const char **type)
+{
+    if (dev < 1 || dev > m->ndv) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (manfc != NULL) {
+        *manfc = m->dvl[dev - 1].manfc;
+    }
+    if (model != NULL) {
+        *model = m->dvl[dev - 1].model;
+    }
+    if (type != NULL) {
+        *type = m->dvl[dev - 1].type;
+    }
+    return 0;
+}
+
+/*
+ * select a device by number
+ */
+int
+modio_select(modio_t *m, int dev)
+{
+    if (dev < 0 || dev > m->ndv) {
+        return modio_fail(m, "no device %d, %d devices loaded", dev, m->ndv);
+    }
+    m->dv = dev ? &m->dvl[dev - 1] : NULL;
+    m->turnaround = m->dv ? m->dv->turnaround : 0;
+    return 0;
+}
+
+/*
+ * select a device by model and manufacturer
+ */
+int
+modio_select_model(modio_t *m, const char *manfc, const char *model)
+{
+    for (int i = 0; i < m->ndv; i++) {
+        if (strcmp(m->dvl[i].model, model) == 0 &&
+            (manfc == NULL || strcmp(m->dvl[i].manfc, manfc) == 0)) {
+            return modio_select(m, i + 1);
+        }
+    }
+    return modio_fail(m, "no device %s %s", manfc ? manfc : "", model);
+}
+
+/*
+ * Look up a register by name, or by number with the type offsets of
+ * -g. Names are matched first, so a register named by a number is
+ * still found by its name.
+ */
+int
+modio_find(modio_t *m, const char *reg, modio_reg_t *r)
+{
+    dreg_t *dr = NULL;
+    char *e;
+    long num;
+    int type;
+    int addr;
+
+    if (m->dv != NULL) {
+        for (int i = 0; i < m->dv->nor && dr == NULL; i++) {
+            if (strcmp(m->dv->regs[i].info->name, reg) == 0) {
+                dr = &m->dv->regs[i];
+            }
+        }
+    }
+    if (dr == NULL) {
+        errno = 0;
+        num = strtol(reg, &e, 0);
+        if (errno != 0 || e == reg || *e != '\0' || num < 0 || num > INT_MAX) {
+            return modio_fail(m, "no register %s", reg);
+        }
+        for (int i = 0; m->dv != NULL && i < m->dv->nor && dr == NULL; i++) {
+            if (m->dv->regs[i].num == num) {
+                dr = &m->dv->regs[i];
+            }
+        }
+    }
+
+    if (dr != NULL) {
+        r->num = dr->num;
+        r->type = dr->type;
+        r->addr = dr->addr & 0xffff;
+        r->len = dr->len;
+        r->format = dr->prfmt;
+        r->scale = dr->scale;
+        r->name = dr->info->name;
+        r->desc = dr->info->desc;
+        r->unit = dr->info->engu;
+        r->access = dr->info->acc;
+        return 0;
+    }
+
+    if ((addr = reg_xaddr((int )num, m->dv ? m->dv->zba : 1, &type)) == -1) {
+        return modio_fail(m, "invalid register number %s", reg);
+    }
+    r->num = (int )num;
+    r->type = type;
+    r->addr = addr & 0xffff;
+    r->len = 1;
+    r->format = MODIO_DEC;
+    r->scale = 1.0;
+    r->name = NULL;
+    r->desc = "";
+    r->unit = "";
+    r->access = "";
+    return 0;
+}
+
+/*
+ * Make the following transfers those of m, to its unit with the
+ * turnaround of its device. mbio keeps both for the process, so they
+ * are set for each transfer of a context.
+ */
+static int
+modio_use(modio_t *m)
+{
+    if (m->mb == NULL) {
+        return modio_fail(m, "no connection");
+    }
+    if (mbio_set_slave(m->mb, m->unit) == -1) {
+        return modio_fail(m, "invalid modbus slave ID %d", m->unit);
+    }
+    mbio_turnaround(m->turnaround);
+    return 0;
+}
+
+/*
+ * read a register, or a span of registers of one request, one word
+ * per bit for bit registers
+ */
+int
+modio_read(modio_t *m, const modio_reg_t *r, uint16_t *buf, int n)
+{
+    uint8_t bits[MODIO_READ_BITS];
+    int max = MODIO_READ_REGS;
+    int rval;
+
+    if (modio_use(m) == -1) {
+        return -1;
+    }
+    if (r->type == MODIO_COIL || r->type == MODIO_INPUT_BIT) {
+        max = MODIO_READ_BITS;
+    }
+    if (r->len < 1 || r->len > max || r->len > n) {
+        errno = EINVAL;
+        return modio_fail(m, "register %d: length %d doesn't fit in %d words", r->num, r->len, n);
+    }
+    switch (r->type) {
+        case MODIO_COIL:
+            rval = mbio_read_bits(m->mb, r->addr, r->len, bits);
+            break;
+        case MODIO_INPUT_BIT:
+            rval = mbio_read_input_bits(m->mb, r->addr, r->len, bits);
+            break;
+        case MODIO_INPUT_REG:
+            rval = mbio_read_input_registers(m->mb, r->addr, r->len, buf);
+            break;
+        case MODIO_HOLDING:
+            rval = mbio_read_registers(m->mb, r->addr, r->len, buf);
+            break;
+        default:
+            return modio_fail(m, "register %d: invalid type %d", r->num, r->type);
+    }
+    if (rval == -1) {
+        return modio_fail(m, "register %d: %s", r->num, modbus_strerror(errno));
+    }
+    if (r->type == MODIO_COIL || r->type == MODIO_INPUT_BIT) {
+        for (int j = 0; j < r->len; j++) {
+            buf[j] = bits[j];
+        }
+    }
+    return r->len;
+}
+
+/*
+ * write coils or holding registers, FC5 or FC6 for one value and
+ * FC15 or FC16 for more
+ */
+int
+modio_write(modio_t *m, const modio_reg_t *r, const uint16_t *buf, int n)
+{
+    uint8_t bits[PLAN_MAX_WBITS];
+    int rval;
+
+    if (modio_use(m) == -1) {
+        return -1;
+    }
+    if (n < 1 || n > PLAN_MAX_WBITS || (r->type == MODIO_HOLDING && n > PLAN_MAX_WREGS)) {
+        return modio_fail(m, "register %d: can't write %d values", r->num, n);
+    }
+    switch (r->type) {
+        case MODIO_COIL:
+            if (n == 1) {
+                rval = mbio_write_bit(m->mb, r->addr, buf[0] ? 1 : 0);
+                break;
+            }
+            for (int j = 0; j < n; j++) {
+                bits[j] = buf[j] ? 1 : 0;
+            }
+            rval = mbio_write_bits(m->mb, r->addr, n, bits);
+            break;
+        case MODIO_HOLDING:
+            if (n == 1) {
+                rval = mbio_write_register(m->mb, r->addr, buf[0]);
+            } else {
+                rval = mbio_write_registers(m->mb, r->addr, n, buf);
+            }
+            break;
+        default:
+            return modio_fail(m, "register %d: read only register type", r->num);
+    }
+    if (rval == -1) {
+        return modio_fail(m, "register %d: %s", r->num, modbus_strerror(errno));
+    }
+    return 0;
+}
+
+/*
+ * device register of the decoders of a modio_reg_t
+ */
+static void
+modio_dreg(const modio_reg_t *r, dreg_t *dr, dinfo_t *di)
+{
+    memset(dr, 0, sizeof(dreg_t));
+    memset(di, 0, sizeof(dinfo_t));
+    dr->num = r->num;
+    dr->addr = r->addr;
+    dr->len = r->len;
+    dr->type = r->type;
+    dr->prfmt = r->format;
+    dr->scale = r->scale;
+    dr->info = di;
+    di->engu = (char *)(r->unit ? r->unit : "");
+    dr->prval = prval_get(dr->type, dr->prfmt, r->name != NULL);
+}
+
+/*
+ * numeric value of a register
+ */
+double
+modio_value(const modio_reg_t *r, const uint16_t *buf, int n)
+{
+    dreg_t dr;
+    dinfo_t di;
+
+    modio_dreg(r, &dr, &di);
+    return dreg_value(&dr, buf, n < r->len ? n : r->len);
+}
+
+/*
+ * Print a register as modio does, the values of a register printed
+ * in parts separated by spaces. Returns -1 if the words don't fit the
+ * print format.
+ */
+int
+modio_format(const modio_reg_t *r, const uint16_t *buf, int n, char *s, size_t sz)
+{
+    char val[PRVAL_LEN];
+    uint8_t bits[MODIO_REG_MAX];
+    const void *v = buf;
+    dreg_t dr;
+    dinfo_t di;
+    size_t len = 0;
+
+    if (n > r->len) {
+        n = r->len;
+    }
+    if (n < 1 || n > MODIO_REG_MAX || sz < 1) {
+        errno = EINVAL;
+        return -1;
+    }
+    modio_dreg(r, &dr, &di);
+    if (r->type == MODIO_COIL || r->type == MODIO_INPUT_BIT) {
+        for (int j = 0; j < n; j++) {
+            bits[j] = (uint8_t )buf[j];
+        }
+        v = bits;
+    }
+    s[0] = '\0';
+    for (int j = 0, k; j < n; j += k) {
+        k = dr.prval(val, sizeof(val), v, j, n, dr.scale, di.engu);
+        if (k <= 0) {
+            errno = EINVAL;
+            return -1;
+        }
+        len += snprintf(s + len, len < sz ? sz - len : 0, "%s%s", j ? " " : "", val);
+        if (len >= sz) {
+            len = sz - 1;
+        }
+    }
+    return (int )len;
+}
+
+/*
+ * read and decode a register
+ */
+int
+modio_get(modio_t *m, const char *reg, double *v)
+{
+    uint16_t buf[MODIO_REG_MAX];
+    modio_reg_t r;
+    int n;
+
+    if (modio_find(m, reg, &r) == -1 || (n = modio_read(m, &r, buf, MODIO_REG_MAX)) == -1) {
+        return -1;
+    }
+    *v = modio_value(&r, buf, n);
+    if (isnan(*v)) {
+        return modio_fail(m, "register %s: not a number in its print format", reg);
+    }
+    return 0;
+}
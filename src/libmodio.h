@@ -0,0 +1,197 @@
+/*
+ *  modio - Modbus input output access tool
+ *
+ *  Copyright (C) 2022, Dimitris Economou (dimitris.s.economou@gmail.com)
+ *
+ *  This file is part of modio.
+ *
+ *  modio is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  modio is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with modio. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * libmodio - Modbus register access by device file register names.
+ *
+ * The library API of modio: open a connection to a Modbus/TCP server
+ * or an RTU serial line, load the device files of a directory, select
+ * the device of the unit and read, write and decode its registers by
+ * name or number, without running the modio program.
+ *
+ *     modio_t *m = modio_open("192.168.1.10:502", NULL, 1);
+ *     double v;
+ *
+ *     if (m == NULL) {
+ *         fprintf(stderr, "%s\n", modio_error(NULL));
+ *     } else if (modio_load(m, NULL) > 0 &&
+ *                modio_select_model(m, NULL, "CBI2801224A") == 0 &&
+ *                modio_get(m, "Battery voltage", &v) == 0) {
+ *         printf("%.2f\n", v);
+ *     }
+ *     modio_close(m);
+ *
+ * Functions that fail return -1, or NULL, and keep the reason for
+ * modio_error() and errno of the failing call; the library neither
+ * prints nor exits, running out of memory fails a call like any other
+ * error. Every read and write goes to the unit of its own context, so
+ * several contexts are used side by side. They share the transfer
+ * state of the process, the slave id and RTU timing of the last
+ * transfer among it, so a multi-threaded program serialises its calls
+ * on all contexts, not only on each one.
+ *
+ * The API is stable within a MODIO_API_VERSION: functions and the
+ * fields of modio_serial_t and modio_reg_t are only ever added.
+ */
+
+#ifndef LIBMODIO_H
+#define LIBMODIO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MODIO_API_VERSION 1
+
+#define MODIO_REG_MAX 64        /* max words or bits of a register */
+#define MODIO_READ_REGS 125     /* max words of a read */
+#define MODIO_READ_BITS 2000    /* max bits of a read */
+
+/* register types */
+enum modio_type {
+    MODIO_COIL = 0,             /* coil, FC1 / FC5 / FC15 */
+    MODIO_INPUT_BIT = 1,        /* discrete input, FC2 */
+    MODIO_INPUT_REG = 2,        /* input register, FC4 */
+    MODIO_HOLDING = 3           /* holding register, FC3 / FC6 / FC16 */
+};
+
+/* register print formats of the device files */
+enum modio_format {
+    MODIO_BIN = 0,              /* binary */
+    MODIO_HEX = 1,              /* hex */
+    MODIO_DEC = 2,              /* decimal */
+    MODIO_ASC = 3,              /* ASCII */
+    MODIO_BFD = 4,              /* decimal byte dot separated */
+    MODIO_BFX = 5,              /* hex byte dot separated */
+    MODIO_HLO = 6               /* high / low register word */
+};
+
+/* library context, one connection to a unit */
+typedef struct modio modio_t;
+
+/* serial line settings of an RTU connection */
+struct modio_serial {
+    int baud;                   /* baud rate */
+    char parity;                /* parity, 'N', 'E' or 'O' */
+    int data_bits;              /* data bits */
+    int stop_bits;              /* stop bits */
+};
+typedef struct modio_serial modio_serial_t;
+
+/* register of a device file, or a register number without one */
+struct modio_reg {
+    int num;                    /* register number */
+    int type;                   /* register type, enum modio_type */
+    int addr;                   /* address on the wire */
+    int len;                    /* words or bits */
+    int format;                 /* print format, enum modio_format */
+    double scale;               /* scale of the value */
+    const char *name;           /* name, NULL without a device file */
+    const char *desc;           /* description, "" without a device file */
+    const char *unit;           /* engineering unit, "" without a device file */
+    const char *access;         /* access, "" without a device file */
+};
+typedef struct modio_reg modio_reg_t;
+
+/*
+ * Open a connection to unit of port: "host", "host:port", a Modbus/UDP
+ * server "udp://host[:port]" or a serial device "/dev/tty...", with
+ * the serial settings of serial or 9600 8N1 if NULL. A NULL port opens
+ * a context without a connection, to look up and decode registers
+ * only. Returns NULL on failure, see modio_error(NULL).
+ */
+modio_t *modio_open(const char *port, const modio_serial_t *serial, int unit);
+
+/* close the connection and free the context */
+void modio_close(modio_t *m);
+
+/* reason of the last failure of m, or of modio_open() if m is NULL */
+const char *modio_error(const modio_t *m);
+
+/* talk to another unit of the connection */
+int modio_set_unit(modio_t *m, int unit);
+
+/*
+ * Set the turnaround of the unit of an RTU connection in ms, the time
+ * it takes to answer that its response timeouts allow for, 0 for the
+ * default of 100ms. modio_select() sets the one of the device file.
+ */
+int modio_set_turnaround(modio_t *m, int ms);
+
+/*
+ * Load the device files of directory dir, or of the modio device
+ * directories if NULL, replacing the devices loaded before. Files
+ * with errors are left out, modio_error() gives the first error, or
+ * else the first warning. Returns the number of devices.
+ */
+int modio_load(modio_t *m, const char *dir);
+
+/* number of devices loaded */
+int modio_devices(const modio_t *m);
+
+/* manufacturer, model and type of device dev, 1 to modio_devices(); the pointers may be NULL */
+int modio_device(const modio_t *m, int dev, const char **manfc, const char **model,
+                 const char **type);
+
+/* select device dev, 1 to modio_devices(), or none if 0 */
+int modio_select(modio_t *m, int dev);
+
+/* select the device of a model, and manufacturer if not NULL */
+int modio_select_model(modio_t *m, const char *manfc, const char *model);
+
+/*
+ * Look up register reg of the selected device by name or register
+ * number, decimal or 0x hex. Numbers without a device register are
+ * one word or bit long and print as decimal.
+ */
+int modio_find(modio_t *m, const char *reg, modio_reg_t *r);
+
+/*
+ * Read register r into buf, of n words. Bits are read one per word.
+ * r may also span several registers of the same type, up to the
+ * MODIO_READ_REGS words or MODIO_READ_BITS bits of one request.
+ * Returns the number of words read.
+ */
+int modio_read(modio_t *m, const modio_reg_t *r, uint16_t *buf, int n);
+
+/* write the n words or bits of buf to the coils or holding registers from r */
+int modio_write(modio_t *m, const modio_reg_t *r, const uint16_t *buf, int n);
+
+/* numeric value of the n words read of r, NAN if r isn't numeric */
+double modio_value(const modio_reg_t *r, const uint16_t *buf, int n);
+
+/*
+ * Print the n words read of r into s, of size sz, in the print format
+ * of r, as modio prints it. Returns the length of the string.
+ */
+int modio_format(const modio_reg_t *r, const uint16_t *buf, int n, char *s, size_t sz);
+
+/* read register reg by name or number and decode its numeric value into v */
+int modio_get(modio_t *m, const char *reg, double *v);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,141 @@
+/*
+ *  modio - Modbus input output access tool
+ *
+ *  Copyright (C) 2022, Dimitris Economou (dimitris.s.economou@gmail.com)
+ *
+ *  This file is part of modio.
+ *
+ *  modio is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  modio is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with modio. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * libmodio register image reader.
+ *
+ * modio --poll <ms> --shm <name> publishes the polled registers in the
+ * POSIX shared memory object /<name>, one fixed size record per device
+ * register. Other local processes, an HMI or a logger, attach to it
+ * and take consistent copies of the records:
+ *
+ *     shm_t *sh = shm_attach("modio");
+ *     shm_rec_t rec;
+ *     int i;
+ *
+ *     if (sh != NULL && (i = shm_find(sh, 1, "deviceUpTime")) != -1 &&
+ *         shm_read(sh, i, &rec) == 0 && (rec.qual & SHM_Q_NUMERIC)) {
+ *         printf("%.0f\n", rec.value);
+ *     }
+ *     shm_detach(sh);
+ *
+ * Every record is guarded by its own sequence lock: the publisher makes
+ * seq odd, updates the record and makes seq even again. A reader copies
+ * the record and retries if seq was odd or changed meanwhile, so
+ * readers never block the publisher or each other and need no system
+ * calls once the segment is attached.
+ *
+ * segment layout:
+ *
+ *   shm_hdr_t                      header, hsize bytes
+ *   shm_rec_t[nrec]                register records, rsize bytes each
+ *
+ * The layout is the one of SHM_VERSION, shm_attach() fails with EPROTO
+ * for a segment of another version. Functions that fail return -1, or
+ * NULL, with errno set and don't print.
+ */
+
+#ifndef LIBMODIO_SHM_H
+#define LIBMODIO_SHM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SHM_MAGIC 0x4d4f4453    /* 'MODS' */
+#define SHM_VERSION 1
+#define SHM_NAME_LEN 36         /* register name length, including '\0' */
+#define SHM_RAW_WORDS 64        /* raw register words per record */
+
+/* record quality flags */
+#define SHM_Q_VALID 0x01        /* record holds a value */
+#define SHM_Q_GOOD 0x02         /* last read of the register succeeded */
+#define SHM_Q_STALE 0x04        /* last read failed, value is from an earlier read */
+#define SHM_Q_NUMERIC 0x08      /* value field holds the decoded register value */
+#define SHM_Q_TRUNC 0x10        /* register is longer than SHM_RAW_WORDS */
+
+/* segment header */
+struct shm_hdr {
+    uint32_t magic;             /* SHM_MAGIC */
+    uint32_t version;           /* SHM_VERSION */
+    uint32_t hsize;             /* header size */
+    uint32_t rsize;             /* record size */
+    uint32_t nrec;              /* number of records */
+    uint32_t pid;               /* publisher pid, 0 if the publisher has exited */
+    uint64_t cycle;             /* completed poll cycles */
+    int64_t start_ns;           /* publisher start wall clock time */
+};
+typedef struct shm_hdr shm_hdr_t;
+
+/* register record */
+struct shm_rec {
+    uint32_t seq;               /* sequence lock, odd while the record is written */
+    uint16_t qual;              /* quality flags */
+    uint16_t uid;               /* modbus slave id */
+    uint16_t dnum;              /* device number in device list */
+    uint16_t rnum;              /* register index in device register list */
+    uint16_t type;              /* register type, enum modio_type of libmodio.h */
+    uint16_t len;               /* register length */
+    uint16_t prfmt;             /* register print format, enum modio_format of libmodio.h */
+    uint16_t rsvd0;             /* reserved */
+    int32_t num;                /* register number */
+    int32_t addr;               /* register address */
+    int32_t err;                /* errno of the last failed read */
+    uint32_t nw;                /* valid words in raw */
+    uint32_t rsvd1;             /* reserved */
+    int64_t mono_ns;            /* monotonic time of the value */
+    int64_t real_ns;            /* wall clock time of the value */
+    double value;               /* decoded value if SHM_Q_NUMERIC */
+    char name[SHM_NAME_LEN];    /* register name */
+    uint16_t raw[SHM_RAW_WORDS];/* raw register words, one per bit for bit registers */
+};
+typedef struct shm_rec shm_rec_t;
+
+/* attached segment */
+struct shm {
+    char *name;                 /* segment name */
+    int wr;                     /* publisher flag */
+    size_t size;                /* mapped size */
+    shm_hdr_t *hdr;             /* segment header */
+    shm_rec_t *rec;             /* segment records */
+};
+typedef struct shm shm_t;
+
+/* attach to the register image name for reading */
+shm_t *shm_attach(const char *name);
+
+/* detach from a register image, the publisher also removes it */
+void shm_detach(shm_t *sh);
+
+/* take a consistent copy of record idx */
+int shm_read(const shm_t *sh, int idx, shm_rec_t *rec);
+
+/* find the record of a register by slave id and name */
+int shm_find(const shm_t *sh, int uid, const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
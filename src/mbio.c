@@ -0,0 +1,1616 @@
+/*
+ *  modio - Modbus input output access tool
+ *
+ *  Copyright (C) 2022, Dimitris Economou (dimitris.s.economou@gmail.com)
+ *
+ *  This file is part of modio.
+ *
+ *  modio is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  modio is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with modio. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <limits.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "mbio.h"
+#include "rcache.h"
+#include "udp.h"
+
+/* pcap file constants */
+#define PCAP_MAGIC_NS 0xa1b23c4d    /* pcap with ns timestamps */
+#define PCAP_LINK_RAW 101           /* raw IPv4 packets */
+#define PCAP_SNAPLEN 65535
+#define MBTCP_PORT 502              /* Modbus/TCP server port of the synthetic session */
+#define MBTCP_CPORT 50200           /* client port of the synthetic session */
+
+/* replayed transfer: a request and its response or error */
+struct xfer {
+    uint8_t unit;               /* modbus slave id */
+    int reqlen;                 /* request PDU length */
+    uint8_t req[CAP_PDU_MAX];   /* request PDU */
+    int rsplen;                 /* response PDU length, -1 for no response */
+    uint8_t rsp[CAP_PDU_MAX];   /* response PDU */
+    int err;                    /* errno if no response */
+};
+typedef struct xfer xfer_t;
+
+/* Modbus/UDP port of a modbus context */
+struct udp_ctx {
+    modbus_t *mb;               /* modbus context */
+    udp_t *u;                   /* its Modbus/UDP port */
+    int unit;                   /* slave id of its transfers */
+    struct udp_ctx *nxt;        /* next context */
+};
+typedef struct udp_ctx udp_ctx_t;
+
+/* transfer state */
+static int mb_unit = 1;                 /* current slave id */
+static FILE *cap_f = NULL;              /* capture file */
+static int cap_pcap = 0;                /* capture file is pcap */
+static uint32_t pcap_cli = 0;           /* client ip address of pcap session */
+static uint32_t pcap_srv = 0;           /* server ip address of pcap session */
+static uint32_t pcap_cseq = 1;          /* client tcp sequence number */
+static uint32_t pcap_sseq = 1;          /* server tcp sequence number */
+static uint16_t pcap_tid = 0;           /* MBAP transaction id */
+static xfer_t *rp_x = NULL;             /* replayed transfers */
+static int rp_n = 0;                    /* number of replayed transfers */
+static int rp_cur = 0;                  /* next transfer to match */
+static int rtu_char_us = 0;             /* RTU character time, 0 if not RTU */
+static int rtu_t35_us = 0;              /* RTU end of frame gap */
+static int rtu_turn_us = RTU_TURNAROUND_ms * 1000;     /* RTU device turnaround */
+static int gap_us = 0;                  /* min gap between requests */
+static int64_t last_ns = 0;             /* monotonic time the last transfer ended */
+static rcache_t *rc = NULL;             /* response cache */
+static uint64_t rc_port = 0;            /* hash of the port of the response cache keys */
+static int rc_def_ms = 0;               /* default ttl of cached reads */
+static int rc_ms = 0;                   /* ttl of the following reads */
+static int bk_fd = -1;                  /* broker connection, -1 until (re)connected */
+static char bk_path[PATH_MAX];          /* broker socket path, empty without broker */
+static uint16_t raw_tid = 0;            /* MBAP transaction id of raw TCP requests */
+static udp_ctx_t *udp_l = NULL;         /* modbus contexts of Modbus/UDP ports */
+
+/*
+ * current wall clock time in ns
+ */
+static int64_t
+real_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t )ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * current monotonic time in ns
+ */
+static int64_t
+mono_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t )ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * wait until the gap since the end of the last transfer has passed
+ */
+static void
+gap_wait(void)
+{
+    int64_t ns;
+    struct timespec ts;
+
+    if (gap_us == 0 || last_ns == 0) {
+        return;
+    }
+    ns = last_ns + (int64_t )gap_us * 1000 - mono_ns();
+    if (ns > 0) {
+        ts.tv_sec = ns / 1000000000;
+        ts.tv_nsec = ns % 1000000000;
+        while (nanosleep(&ts, &ts) == -1 && errno == EINTR);
+    }
+}
+
+/*
+ * internet checksum of a buffer, continuing from sum
+ */
+static uint32_t
+csum_add(uint32_t sum, const uint8_t *p, int len)
+{
+    for (int i = 0; i + 1 < len; i += 2) {
+        sum += (p[i] << 8) | p[i + 1];
+    }
+    if (len & 1) {
+        sum += p[len - 1] << 8;
+    }
+    return sum;
+}
+
+/*
+ * fold a checksum sum into 16 bits
+ */
+static uint16_t
+csum_fold(uint32_t sum)
+{
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return (uint16_t )~sum;
+}
+
+/*
+ * Write a PDU as a Modbus/TCP frame in an IPv4/TCP packet of the
+ * synthetic pcap session. Requests go from client to server.
+ */
+static void
+pcap_put(int64_t ts, capdir_t dir, int unit, const uint8_t *pdu, int len)
+{
+    uint8_t pkt[20 + 20 + 7 + CAP_PDU_MAX];
+    uint8_t *ip = pkt;
+    uint8_t *tcp = pkt + 20;
+    uint8_t *mbap = pkt + 40;
+    uint32_t src = (dir == CAP_REQ) ? pcap_cli : pcap_srv;
+    uint32_t dst = (dir == CAP_REQ) ? pcap_srv : pcap_cli;
+    uint16_t sport = (dir == CAP_REQ) ? MBTCP_CPORT : MBTCP_PORT;
+    uint16_t dport = (dir == CAP_REQ) ? MBTCP_PORT : MBTCP_CPORT;
+    uint32_t *seq = (dir == CAP_REQ) ? &pcap_cseq : &pcap_sseq;
+    uint32_t ack = (dir == CAP_REQ) ? pcap_sseq : pcap_cseq;
+    int tlen = 20 + 7 + len;
+    uint32_t rec[4];
+    uint32_t sum;
+    uint8_t pseudo[12];
+
+    if (dir == CAP_REQ) {
+        pcap_tid++;
+    }
+
+    /* MBAP header */
+    mbap[0] = pcap_tid >> 8;
+    mbap[1] = pcap_tid & 0xff;
+    mbap[2] = 0;
+    mbap[3] = 0;
+    mbap[4] = (len + 1) >> 8;
+    mbap[5] = (len + 1) & 0xff;
+    mbap[6] = unit;
+    memcpy(mbap + 7, pdu, len);
+
+    /* TCP header, PSH | ACK */
+    memset(tcp, 0, 20);
+    tcp[0] = sport >> 8;
+    tcp[1] = sport & 0xff;
+    tcp[2] = dport >> 8;
+    tcp[3] = dport & 0xff;
+    *(uint32_t *)(tcp + 4) = htonl(*seq);
+    *(uint32_t *)(tcp + 8) = htonl(ack);
+    tcp[12] = 5 << 4;
+    tcp[13] = 0x18;
+    tcp[14] = 0xff;
+    tcp[15] = 0xff;
+    memcpy(pseudo, &src, 4);
+    memcpy(pseudo + 4, &dst, 4);
+    pseudo[8] = 0;
+    pseudo[9] = 6;
+    pseudo[10] = tlen >> 8;
+    pseudo[11] = tlen & 0xff;
+    sum = csum_add(csum_add(0, pseudo, 12), tcp, tlen);
+    *(uint16_t *)(tcp + 16) = htons(csum_fold(sum));
+    *seq += 7 + len;
+
+    /* IPv4 header */
+    memset(ip, 0, 20);
+    ip[0] = 0x45;
+    *(uint16_t *)(ip + 2) = htons(20 + tlen);
+    ip[8] = 64;
+    ip[9] = 6;
+    memcpy(ip + 12, &src, 4);
+    memcpy(ip + 16, &dst, 4);
+    *(uint16_t *)(ip + 10) = htons(csum_fold(csum_add(0, ip, 20)));
+
+    rec[0] = (uint32_t )(ts / 1000000000);
+    rec[1] = (uint32_t )(ts % 1000000000);
+    rec[2] = 20 + tlen;
+    rec[3] = 20 + tlen;
+    fwrite(rec, sizeof(rec), 1, cap_f);
+    fwrite(pkt, 20 + tlen, 1, cap_f);
+}
+
+/*
+ * log a request, response or error to the capture file
+ */
+static void
+cap_put(int64_t ts, capdir_t dir, const uint8_t *pdu, int len)
+{
+    cap_rec_t rec;
+
+    if (cap_f == NULL) {
+        return;
+    }
+    if (cap_pcap) {
+        if (dir != CAP_ERR) {
+            pcap_put(ts, dir, mb_unit, pdu, len);
+        }
+        return;
+    }
+    rec.real_ns = ts;
+    rec.dir = dir;
+    rec.unit = mb_unit;
+    rec.len = len;
+    fwrite(&rec, sizeof(rec), 1, cap_f);
+    fwrite(pdu, len, 1, cap_f);
+}
+
+/*
+ * Capture transfers to file path. peer is the server host of a TCP
+ * connection, it is the destination address of pcap captures.
+ */
+int
+mbio_capture(const char *path, const char *peer, int tcp)
+{
+    size_t plen = strlen(path);
+
+    cap_f = fopen(path, "w");
+    if (cap_f == NULL) {
+        printf("ERROR:(%s) fopen %s\n", strerror(errno), path);
+        return -1;
+    }
+    cap_pcap = (plen > 5 && strcmp(path + plen - 5, ".pcap") == 0);
+    if (cap_pcap) {
+        uint32_t ghdr[6] = { PCAP_MAGIC_NS, 2 | (4 << 16), 0, 0, PCAP_SNAPLEN, PCAP_LINK_RAW };
+        char host[64];
+
+        /* peer is <ip>[:<port>] */
+        snprintf(host, sizeof(host), "%s", peer);
+        host[strcspn(host, ":")] = '\0';
+        inet_pton(AF_INET, "127.0.0.1", &pcap_cli);
+        if (!tcp || inet_pton(AF_INET, host, &pcap_srv) != 1) {
+            inet_pton(AF_INET, "127.0.0.2", &pcap_srv);
+        }
+        fwrite(ghdr, sizeof(ghdr), 1, cap_f);
+    } else {
+        cap_hdr_t hdr = { CAP_MAGIC, CAP_VERSION, (uint16_t )tcp, real_ns() };
+
+        fwrite(&hdr, sizeof(hdr), 1, cap_f);
+    }
+    return 0;
+}
+
+/*
+ * add a request to the replayed transfers
+ */
+static void
+rp_add_req(int unit, const uint8_t *pdu, int len)
+{
+    xfer_t *x;
+
+    if (len <= 0 || len > CAP_PDU_MAX) {
+        return;
+    }
+    rp_x = (xfer_t *)realloc(rp_x, (rp_n + 1) * sizeof(xfer_t));
+    if (rp_x == NULL) {
+        fprintf(stderr, "malloc failed: insufficient memory!\n");
+        exit(EXIT_FAILURE);
+    }
+    x = &rp_x[rp_n++];
+    x->unit = unit;
+    x->reqlen = len;
+    memcpy(x->req, pdu, len);
+    x->rsplen = -1;
+    x->err = ETIMEDOUT;
+}
+
+/*
+ * attach a response to the last unanswered request of the same unit
+ */
+static void
+rp_add_rsp(int unit, const uint8_t *pdu, int len)
+{
+    for (int i = rp_n - 1; i >= 0; i--) {
+        if (rp_x[i].unit == unit && rp_x[i].rsplen == -1) {
+            if (len > 0 && len <= CAP_PDU_MAX) {
+                rp_x[i].rsplen = len;
+                memcpy(rp_x[i].rsp, pdu, len);
+            }
+            return;
+        }
+    }
+}
+
+/*
+ * load the Modbus/TCP frames of a pcap file, packets to port 502
+ * are requests and packets from port 502 responses
+ */
+static int
+rp_load_pcap(FILE *f, uint32_t magic)
+{
+    uint32_t ghdr[5];
+    uint32_t rec[4];
+    uint8_t pkt[PCAP_SNAPLEN];
+    int swap = (magic == 0x4d3cb2a1 || magic == 0xd4c3b2a1);
+    int off;
+
+    if (fread(ghdr, sizeof(ghdr), 1, f) != 1) {
+        return -1;
+    }
+    if ((swap ? ntohl(ghdr[4]) : ghdr[4]) != PCAP_LINK_RAW) {
+        printf("ERROR: only raw IP pcap captures can be replayed\n");
+        return -1;
+    }
+    while (fread(rec, sizeof(rec), 1, f) == 1) {
+        uint32_t incl = swap ? ntohl(rec[2]) : rec[2];
+        uint8_t *tcp;
+        int dlen;
+
+        if (incl > sizeof(pkt) || fread(pkt, incl, 1, f) != 1) {
+            break;
+        }
+        if ((pkt[0] >> 4) != 4 || pkt[9] != 6 || incl < 40) {
+            continue;
+        }
+        off = (pkt[0] & 0x0f) * 4;
+        tcp = pkt + off;
+        off += (tcp[12] >> 4) * 4;
+        dlen = ((pkt[2] << 8) | pkt[3]) - off;
+        if (dlen > (int )incl - off) {
+            dlen = incl - off;
+        }
+
+        /* a segment may carry several frames */
+        while (dlen >= 8) {
+            uint8_t *mbap = pkt + off;
+            int flen = (mbap[4] << 8) | mbap[5];
+            if (flen < 2 || flen + 6 > dlen) {
+                break;
+            }
+            if (((tcp[2] << 8) | tcp[3]) == MBTCP_PORT) {
+                rp_add_req(mbap[6], mbap + 7, flen - 1);
+            } else if (((tcp[0] << 8) | tcp[1]) == MBTCP_PORT) {
+                rp_add_rsp(mbap[6], mbap + 7, flen - 1);
+            }
+            off += flen + 6;
+            dlen -= flen + 6;
+        }
+    }
+    return 0;
+}
+
+/*
+ * load the records of a modio capture file
+ */
+static int
+rp_load_cap(FILE *f)
+{
+    cap_hdr_t hdr;
+    cap_rec_t rec;
+    uint8_t pdu[CAP_PDU_MAX];
+
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.version != CAP_VERSION) {
+        return -1;
+    }
+    while (fread(&rec, sizeof(rec), 1, f) == 1) {
+        if (rec.len > CAP_PDU_MAX || fread(pdu, rec.len, 1, f) != 1) {
+            break;
+        }
+        switch (rec.dir) {
+            case CAP_REQ:
+                rp_add_req(rec.unit, pdu, rec.len);
+                break;
+            case CAP_RSP:
+                rp_add_rsp(rec.unit, pdu, rec.len);
+                break;
+            case CAP_ERR:
+                for (int i = rp_n - 1; i >= 0; i--) {
+                    if (rp_x[i].unit == rec.unit && rp_x[i].rsplen == -1) {
+                        memcpy(&rp_x[i].err, pdu, sizeof(int32_t));
+                        rp_x[i].rsplen = -2;
+                        break;
+                    }
+                }
+                break;
+        }
+    }
+    for (int i = 0; i < rp_n; i++) {
+        if (rp_x[i].rsplen == -2) {
+            rp_x[i].rsplen = -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Replay transfers from capture file path, either a modio capture
+ * or a pcap file with Modbus/TCP traffic
+ */
+int
+mbio_replay(const char *path)
+{
+    FILE *f;
+    uint32_t magic;
+    int rval;
+
+    f = fopen(path, "r");
+    if (f == NULL) {
+        printf("ERROR:(%s) fopen %s\n", strerror(errno), path);
+        return -1;
+    }
+    if (fread(&magic, sizeof(magic), 1, f) != 1) {
+        magic = 0;
+    }
+    if (magic == CAP_MAGIC) {
+        rewind(f);
+        rval = rp_load_cap(f);
+    } else if (magic == PCAP_MAGIC_NS || magic == 0xa1b2c3d4 ||
+               magic == 0x4d3cb2a1 || magic == 0xd4c3b2a1) {
+        rval = rp_load_pcap(f, magic);
+    } else {
+        rval = -1;
+    }
+    fclose(f);
+    if (rval == -1 || rp_n == 0) {
+        printf("ERROR: no modbus transfers in %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * check if transfers are replayed
+ */
+int
+mbio_replaying(void)
+{
+    return (rp_x != NULL);
+}
+
+/*
+ * Answer the reads of the following transfers on port from the
+ * response cache file path if they are younger than ttl ms, and put
+ * their responses in it. Writes drop the cached reads they overlap.
+ */
+int
+mbio_cache(const char *path, const char *port, int ttl)
+{
+    rc = rcache_open(path);
+    if (rc == NULL) {
+        return -1;
+    }
+    rc_port = rcache_port(port);
+    rc_def_ms = rc_ms = (ttl > 0) ? ttl : 0;
+    return 0;
+}
+
+/*
+ * set the ttl in ms of the following cached reads, 0 reads from the
+ * bus and -1 is the default ttl of mbio_cache
+ */
+void
+mbio_cache_ttl(int ms)
+{
+    rc_ms = (ms < 0) ? rc_def_ms : ms;
+}
+
+/*
+ * Path of the broker socket of port, sys for the one of a broker run
+ * by root: /run/modio/broker-<port>, the socket of the other users is
+ * modio-broker-<port> in $XDG_RUNTIME_DIR or /run/user/<uid>. The '/'
+ * and ':' of port become '_', the server port of a TCP host defaults
+ * to 502.
+ */
+const char *
+mbio_broker_path(const char *port, int sys)
+{
+    static char path[PATH_MAX];
+    const char *xdg = getenv("XDG_RUNTIME_DIR");
+    char name[128];
+
+    snprintf(name, sizeof(name), "%s%s", (strncmp(port, "/dev/", 5) == 0) ? port + 5 : port,
+             (strstr(port, "/dev/tty") == NULL && strchr(port, ':') == NULL) ? ":502" : "");
+    for (char *p = name; *p; p++) {
+        if (*p == '/' || *p == ':') {
+            *p = '_';
+        }
+    }
+    if (sys) {
+        snprintf(path, sizeof(path), "/run/modio/broker-%s", name);
+    } else if (xdg != NULL && *xdg == '/') {
+        snprintf(path, sizeof(path), "%s/modio-broker-%s", xdg, name);
+    } else {
+        snprintf(path, sizeof(path), "/run/user/%u/modio-broker-%s", (unsigned )geteuid(), name);
+    }
+    return path;
+}
+
+/*
+ * connect to the broker socket bk_path. Returns -1 with errno set.
+ */
+static int
+bk_connect(void)
+{
+    struct sockaddr_un sa;
+    struct timeval tv = { BK_TIMEOUT_s, 0 };
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    strcpy(sa.sun_path, bk_path);
+    bk_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (bk_fd != -1 && connect(bk_fd, (struct sockaddr *)&sa, sizeof(sa)) == 0) {
+        setsockopt(bk_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        return 0;
+    }
+    if (bk_fd != -1) {
+        int e = errno;
+        close(bk_fd);
+        bk_fd = -1;
+        errno = e;
+    }
+    return -1;
+}
+
+/*
+ * drop the broker connection, the next transfer connects again
+ */
+static void
+bk_drop(void)
+{
+    if (bk_fd != -1) {
+        close(bk_fd);
+        bk_fd = -1;
+    }
+}
+
+/*
+ * Send the following transfers to the broker of port, the one of the
+ * user or else the one of root, if one runs. Returns -1 without a
+ * broker.
+ */
+int
+mbio_broker(const char *port)
+{
+    for (int sys = 0; sys <= 1; sys++) {
+        const char *path = mbio_broker_path(port, sys);
+
+        if (strlen(path) >= sizeof(((struct sockaddr_un *)0)->sun_path) || access(path, F_OK) == -1) {
+            continue;
+        }
+        strcpy(bk_path, path);
+        if (bk_connect() == 0) {
+            return 0;
+        }
+    }
+    bk_path[0] = '\0';
+    return -1;
+}
+
+/*
+ * check if transfers go through a broker
+ */
+int
+mbio_brokered(void)
+{
+    return (bk_path[0] != '\0');
+}
+
+/*
+ * Send or receive all len bytes of buf on stream socket fd. Returns
+ * -1 with errno set, ECONNRESET if the peer has closed it.
+ */
+int
+mbio_sockio(int fd, void *buf, size_t len, int wr)
+{
+    size_t done = 0;
+    ssize_t n;
+
+    while (done < len) {
+        if (wr) {
+            n = send(fd, (char *)buf + done, len - done, MSG_NOSIGNAL);
+        } else {
+            n = recv(fd, (char *)buf + done, len - done, 0);
+        }
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            if (n == 0) {
+                errno = ECONNRESET;
+            }
+            return -1;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+/*
+ * Run the transfer of a request PDU through the broker. Returns the
+ * response PDU length or -1 with errno set. A connection that fails
+ * after the request is sent may still bring its response, so it is
+ * dropped and the next transfer connects again instead of taking that
+ * response for its own.
+ */
+static int
+bk_xfer(const uint8_t *req, int reqlen, uint8_t *rsp)
+{
+    bk_msg_t m = { (uint16_t )reqlen, (uint8_t )mb_unit, 0, 0 };
+
+    if (bk_fd == -1 && bk_connect() == -1) {
+        return -1;
+    }
+    if (mbio_sockio(bk_fd, &m, sizeof(m), 1) == -1 ||
+        mbio_sockio(bk_fd, (void *)req, reqlen, 1) == -1 ||
+        mbio_sockio(bk_fd, &m, sizeof(m), 0) == -1) {
+        int e = errno;
+        bk_drop();
+        errno = e;
+        return -1;
+    }
+    if (m.len == 0) {
+        errno = m.err;
+        return -1;
+    }
+    if (m.len > CAP_PDU_MAX || mbio_sockio(bk_fd, rsp, m.len, 0) == -1) {
+        bk_drop();
+        errno = EMBBADDATA;
+        return -1;
+    }
+    return m.len;
+}
+
+/*
+ * Send the transfers of modbus context mb to the Modbus/UDP port
+ * udp://<host>[:<port>] instead of the connection of the context.
+ * Returns -1 with errno set if the port can't be opened.
+ */
+int
+mbio_udp(modbus_t *mb, const char *port)
+{
+    udp_ctx_t *c;
+    udp_t *u = udp_open(port);
+
+    if (u == NULL) {
+        return -1;
+    }
+    c = (udp_ctx_t *)malloc(sizeof(udp_ctx_t));
+    if (c == NULL) {
+        udp_close(u);
+        errno = ENOMEM;
+        return -1;
+    }
+    c->mb = mb;
+    c->u = u;
+    c->unit = mb_unit;
+    c->nxt = udp_l;
+    udp_l = c;
+    return 0;
+}
+
+/*
+ * the Modbus/UDP port of modbus context mb, NULL if it has none
+ */
+static udp_ctx_t *
+udp_of(modbus_t *mb)
+{
+    for (udp_ctx_t *c = udp_l; c != NULL; c = c->nxt) {
+        if (c->mb == mb) {
+            return c;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * close the Modbus/UDP port of modbus context mb, all if mb is NULL
+ */
+void
+mbio_udp_close(modbus_t *mb)
+{
+    udp_ctx_t **pc = &udp_l;
+
+    while (*pc != NULL) {
+        udp_ctx_t *c = *pc;
+
+        if (mb == NULL || c->mb == mb) {
+            *pc = c->nxt;
+            udp_close(c->u);
+            free(c);
+        } else {
+            pc = &c->nxt;
+        }
+    }
+}
+
+/*
+ * flush and close capture, replay and cache files, the broker
+ * connection and the Modbus/UDP ports
+ */
+void
+mbio_close(void)
+{
+    if (cap_f != NULL) {
+        fclose(cap_f);
+        cap_f = NULL;
+    }
+    rcache_close(rc);
+    rc = NULL;
+    bk_drop();
+    bk_path[0] = '\0';
+    mbio_udp_close(NULL);
+    free(rp_x);
+    rp_x = NULL;
+    rp_n = 0;
+}
+
+/*
+ * Answer a request from the replayed transfers. The capture is
+ * searched from the transfer after the last match onwards, wrapping
+ * around, so repeated reads replay successive responses. Returns the
+ * response length or -1 with errno set.
+ */
+static int
+rp_xfer(const uint8_t *req, int reqlen, uint8_t *rsp)
+{
+    for (int k = 0; k < rp_n; k++) {
+        int i = (rp_cur + k) % rp_n;
+        xfer_t *x = &rp_x[i];
+
+        if (x->unit != mb_unit || x->reqlen != reqlen || memcmp(x->req, req, reqlen) != 0) {
+            continue;
+        }
+        rp_cur = i + 1;
+        if (x->rsplen < 0) {
+            errno = x->err;
+            return -1;
+        }
+        memcpy(rsp, x->rsp, x->rsplen);
+        return x->rsplen;
+    }
+    errno = ENODATA;
+    return -1;
+}
+
+/*
+ * Build the request PDU of a transfer, nb is the value of single
+ * writes. Multiple writes carry the nb bits or registers of data.
+ */
+static int
+mk_req(uint8_t *pdu, int fc, int addr, int nb, const void *data)
+{
+    pdu[0] = fc;
+    pdu[1] = (addr >> 8) & 0xff;
+    pdu[2] = addr & 0xff;
+    pdu[3] = (nb >> 8) & 0xff;
+    pdu[4] = nb & 0xff;
+    switch (fc) {
+        case 0x0f:
+            pdu[5] = (nb + 7) / 8;
+            memset(pdu + 6, 0, pdu[5]);
+            for (int i = 0; i < nb; i++) {
+                if (((const uint8_t *)data)[i]) {
+                    pdu[6 + i / 8] |= 1 << (i % 8);
+                }
+            }
+            return 6 + pdu[5];
+        case 0x10:
+            pdu[5] = 2 * nb;
+            for (int i = 0; i < nb; i++) {
+                pdu[6 + 2 * i] = ((const uint16_t *)data)[i] >> 8;
+                pdu[7 + 2 * i] = ((const uint16_t *)data)[i] & 0xff;
+            }
+            return 6 + pdu[5];
+        default:
+            return 5;
+    }
+}
+
+/*
+ * Build the response PDU of a successful transfer from the data
+ * libmodbus returned. Write responses echo the request.
+ */
+static int
+mk_rsp(uint8_t *pdu, const uint8_t *req, int nb, const void *data)
+{
+    int fc = req[0];
+    int len = 0;
+
+    switch (fc) {
+        case 0x01:
+        case 0x02:
+            pdu[0] = fc;
+            pdu[1] = (nb + 7) / 8;
+            memset(pdu + 2, 0, pdu[1]);
+            for (int i = 0; i < nb; i++) {
+                if (((const uint8_t *)data)[i]) {
+                    pdu[2 + i / 8] |= 1 << (i % 8);
+                }
+            }
+            len = 2 + pdu[1];
+            break;
+        case 0x03:
+        case 0x04:
+            pdu[0] = fc;
+            pdu[1] = 2 * nb;
+            for (int i = 0; i < nb; i++) {
+                pdu[2 + 2 * i] = ((const uint16_t *)data)[i] >> 8;
+                pdu[3 + 2 * i] = ((const uint16_t *)data)[i] & 0xff;
+            }
+            len = 2 + pdu[1];
+            break;
+        default:
+            memcpy(pdu, req, 5);
+            len = 5;
+    }
+    return len;
+}
+
+/*
+ * Take the data out of a response PDU that didn't come through
+ * libmodbus: replayed, brokered or Modbus/UDP. Exception responses
+ * set errno like libmodbus does. Returns nb or -1.
+ */
+static int
+rd_rsp(const uint8_t *req, const uint8_t *rsp, int len, int nb, void *data)
+{
+    int fc = req[0];
+
+    if (len >= 2 && rsp[0] == (fc | 0x80)) {
+        errno = MODBUS_ENOBASE + rsp[1];
+        return -1;
+    }
+    if (len < 2 || rsp[0] != fc) {
+        errno = EMBBADDATA;
+        return -1;
+    }
+    switch (fc) {
+        case 0x01:
+        case 0x02:
+            if (rsp[1] < (nb + 7) / 8 || len < 2 + (nb + 7) / 8) {
+                errno = EMBBADDATA;
+                return -1;
+            }
+            for (int i = 0; i < nb; i++) {
+                ((uint8_t *)data)[i] = (rsp[2 + i / 8] >> (i % 8)) & 1;
+            }
+            break;
+        case 0x03:
+        case 0x04:
+            if (rsp[1] != 2 * nb || len < 2 + 2 * nb) {
+                errno = EMBBADDATA;
+                return -1;
+            }
+            for (int i = 0; i < nb; i++) {
+                ((uint16_t *)data)[i] = (rsp[2 + 2 * i] << 8) | rsp[3 + 2 * i];
+            }
+            break;
+        case 0x0f:
+        case 0x10:
+            if (len < 5 || memcmp(rsp + 1, req + 1, 4) != 0) {
+                errno = EMBBADDATA;
+                return -1;
+            }
+            break;
+        default:
+            return 1;
+    }
+    return nb;
+}
+
+/*
+ * Derive the RTU timeouts from the serial line settings. The byte
+ * timeout is the t1.5 inter character gap, plus the adapter latency.
+ * The response timeout is set per request from then on.
+ */
+int
+mbio_rtu_timing(modbus_t *mb, serconf_t sc)
+{
+    int bits = 1 + sc.dbit + sc.sbit + ((sc.prty == 'N') ? 0 : 1);
+    int t15;
+
+    if (sc.baud <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    rtu_char_us = (bits * 1000000 + sc.baud - 1) / sc.baud;
+    if (sc.baud > RTU_FIXED_GAP_BAUD) {
+        t15 = RTU_T15_FIXED_us;
+        rtu_t35_us = RTU_T35_FIXED_us;
+    } else {
+        t15 = (3 * rtu_char_us + 1) / 2;
+        rtu_t35_us = (7 * rtu_char_us + 1) / 2;
+    }
+    return modbus_set_byte_timeout(mb, 0, t15 + RTU_LATENCY_us);
+}
+
+/*
+ * set the RTU device turnaround in ms, 0 for the default
+ */
+void
+mbio_turnaround(int ms)
+{
+    rtu_turn_us = (ms > 0 ? ms : RTU_TURNAROUND_ms) * 1000;
+}
+
+/*
+ * set the min gap between the end of a transfer and the next request
+ * in ms, 0 for none
+ */
+void
+mbio_gap(int ms)
+{
+    gap_us = (ms > 0) ? ms * 1000 : 0;
+}
+
+/*
+ * Set the response timeout of an RTU request of reqlen PDU bytes that
+ * expects a response of rsplen PDU bytes: both frames with their slave
+ * id, CRC and t3.5 end of frame gap, the device turnaround and the
+ * adapter latency.
+ */
+static void
+rtu_timeout(modbus_t *mb, int reqlen, int rsplen)
+{
+    long us;
+
+    if (rtu_char_us == 0) {
+        return;
+    }
+    us = (long )(reqlen + 3) * rtu_char_us + rtu_t35_us + rtu_turn_us +
+         (long )(rsplen + 3) * rtu_char_us + rtu_t35_us + RTU_LATENCY_us;
+    modbus_set_response_timeout(mb, us / 1000000, us % 1000000);
+}
+
+/*
+ * length of the response PDU to a request of function code fc for nb
+ * bits or registers
+ */
+static int
+rsp_len(int fc, int nb)
+{
+    switch (fc) {
+        case 0x01:
+        case 0x02:
+            return 2 + (nb + 7) / 8;
+        case 0x03:
+        case 0x04:
+            return 2 + 2 * nb;
+        case 0x05:
+        case 0x06:
+        case 0x0f:
+        case 0x10:
+            return 5;
+        default:
+            return CAP_PDU_MAX - 3;
+    }
+}
+
+/*
+ * Run a transfer of function code fc, on the bus, through the broker
+ * or from the replay, and capture it. nb is the value of single
+ * writes, data the source of multiple writes and the destination of
+ * reads. Reads answered by the response cache aren't captured. A
+ * count over the protocol limit of fc fails with EMBMDATA, as
+ * libmodbus does, before the request is built.
+ */
+static int
+mbio_xfer(modbus_t *mb, int fc, int addr, int nb, void *data)
+{
+    uint8_t req[CAP_PDU_MAX];
+    uint8_t rsp[CAP_PDU_MAX];
+    rcache_key_t key = { rc_port, mb_unit, fc, addr, nb };
+    udp_ctx_t *uc = udp_of(mb);
+    uint64_t gen = 0;
+    int reqlen;
+    int rsplen;
+    int rval;
+    int err;
+
+    /* the data of a longer multiple write overruns req and its byte count wraps */
+    if (((fc == 0x01 || fc == 0x02) && (nb < 1 || nb > MODBUS_MAX_READ_BITS)) ||
+        ((fc == 0x03 || fc == 0x04) && (nb < 1 || nb > MODBUS_MAX_READ_REGISTERS)) ||
+        (fc == 0x0f && (nb < 1 || nb > MODBUS_MAX_WRITE_BITS)) ||
+        (fc == 0x10 && (nb < 1 || nb > MODBUS_MAX_WRITE_REGISTERS))) {
+        errno = EMBMDATA;
+        return -1;
+    }
+    reqlen = mk_req(req, fc, addr, nb, data);
+    if (mbio_replaying()) {
+        rsplen = rp_xfer(req, reqlen, rsp);
+        if (rsplen == -1) {
+            return -1;
+        }
+        return rd_rsp(req, rsp, rsplen, nb, data);
+    }
+    if (rc != NULL && fc <= 0x04) {
+        if (rc_ms > 0 && rcache_get(rc, &key, (int64_t )rc_ms * 1000000, data) == 0) {
+            return nb;
+        }
+        gen = rcache_gen(rc);
+    }
+
+    if (!mbio_brokered()) {
+        gap_wait();
+    }
+    cap_put(real_ns(), CAP_REQ, req, reqlen);
+    if (mbio_brokered()) {
+        rsplen = bk_xfer(req, reqlen, rsp);
+        rval = (rsplen == -1) ? -1 : rd_rsp(req, rsp, rsplen, nb, data);
+    } else if (uc != NULL) {
+        rsplen = udp_xfer(uc->u, uc->unit, req, reqlen, rsp, CAP_PDU_MAX);
+        rval = (rsplen == -1) ? -1 : rd_rsp(req, rsp, rsplen, nb, data);
+    } else {
+        rtu_timeout(mb, reqlen, rsp_len(fc, nb));
+        switch (fc) {
+            case 0x01:
+                rval = modbus_read_bits(mb, addr, nb, (uint8_t *)data);
+                break;
+            case 0x02:
+                rval = modbus_read_input_bits(mb, addr, nb, (uint8_t *)data);
+                break;
+            case 0x03:
+                rval = modbus_read_registers(mb, addr, nb, (uint16_t *)data);
+                break;
+            case 0x04:
+                rval = modbus_read_input_registers(mb, addr, nb, (uint16_t *)data);
+                break;
+            case 0x05:
+                rval = modbus_write_bit(mb, addr, nb ? 1 : 0);
+                break;
+            case 0x06:
+                rval = modbus_write_register(mb, addr, (uint16_t )nb);
+                break;
+            case 0x0f:
+                rval = modbus_write_bits(mb, addr, nb, (const uint8_t *)data);
+                break;
+            case 0x10:
+                rval = modbus_write_registers(mb, addr, nb, (const uint16_t *)data);
+                break;
+            default:
+                errno = EINVAL;
+                return -1;
+        }
+    }
+    err = errno;
+    last_ns = mono_ns();
+
+    /* writes drop the cached reads even if they failed, the unit may have taken them */
+    if (rc != NULL) {
+        if (fc <= 0x04) {
+            if (rval != -1) {
+                rcache_put(rc, &key, gen, data);
+            }
+        } else {
+            key.nb = (fc == 0x05 || fc == 0x06) ? 1 : nb;
+            rcache_inval(rc, &key);
+        }
+        errno = err;
+    }
+    if (cap_f != NULL) {
+        if (rval != -1) {
+            rsplen = mk_rsp(rsp, req, nb, data);
+            cap_put(real_ns(), CAP_RSP, rsp, rsplen);
+        } else if (err > MODBUS_ENOBASE && err < MODBUS_ENOBASE + MODBUS_EXCEPTION_MAX) {
+            rsp[0] = fc | 0x80;
+            rsp[1] = err - MODBUS_ENOBASE;
+            cap_put(real_ns(), CAP_RSP, rsp, 2);
+        } else {
+            int32_t e = err;
+            cap_put(real_ns(), CAP_ERR, (uint8_t *)&e, sizeof(e));
+        }
+        errno = err;
+    }
+    return rval;
+}
+
+/*
+ * Set the slave id of the following transfers. A Modbus/UDP context
+ * keeps its own, like libmodbus does for the others.
+ */
+int
+mbio_set_slave(modbus_t *mb, int id)
+{
+    udp_ctx_t *uc = udp_of(mb);
+
+    mb_unit = id;
+    if (uc != NULL) {
+        uc->unit = id;
+    }
+    if (mbio_replaying()) {
+        return 0;
+    }
+    return modbus_set_slave(mb, id);
+}
+
+/*
+ * read coils
+ */
+int
+mbio_read_bits(modbus_t *mb, int addr, int nb, uint8_t *dest)
+{
+    return mbio_xfer(mb, 0x01, addr, nb, dest);
+}
+
+/*
+ * read input bits
+ */
+int
+mbio_read_input_bits(modbus_t *mb, int addr, int nb, uint8_t *dest)
+{
+    return mbio_xfer(mb, 0x02, addr, nb, dest);
+}
+
+/*
+ * read holding registers
+ */
+int
+mbio_read_registers(modbus_t *mb, int addr, int nb, uint16_t *dest)
+{
+    return mbio_xfer(mb, 0x03, addr, nb, dest);
+}
+
+/*
+ * read input registers
+ */
+int
+mbio_read_input_registers(modbus_t *mb, int addr, int nb, uint16_t *dest)
+{
+    return mbio_xfer(mb, 0x04, addr, nb, dest);
+}
+
+/*
+ * write a coil
+ */
+int
+mbio_write_bit(modbus_t *mb, int addr, int status)
+{
+    return mbio_xfer(mb, 0x05, addr, status ? 0xff00 : 0x0000, NULL);
+}
+
+/*
+ * write a holding register
+ */
+int
+mbio_write_register(modbus_t *mb, int addr, uint16_t value)
+{
+    return mbio_xfer(mb, 0x06, addr, value, NULL);
+}
+
+/*
+ * write coils
+ */
+int
+mbio_write_bits(modbus_t *mb, int addr, int nb, const uint8_t *src)
+{
+    return mbio_xfer(mb, 0x0f, addr, nb, (void *)src);
+}
+
+/*
+ * write holding registers
+ */
+int
+mbio_write_registers(modbus_t *mb, int addr, int nb, const uint16_t *src)
+{
+    return mbio_xfer(mb, 0x10, addr, nb, (void *)src);
+}
+
+/*
+ * Receive len bytes of a raw response on fd, waiting up to us for each
+ * part of it. Returns -1 with errno set, ETIMEDOUT if they don't come.
+ */
+static int
+raw_recv(int fd, uint8_t *buf, int len, long us)
+{
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    int done = 0;
+    ssize_t n;
+
+    while (done < len) {
+        int rval = poll(&pfd, 1, (int )((us + 999) / 1000));
+
+        if (rval == -1 && errno == EINTR) {
+            continue;
+        }
+        if (rval <= 0) {
+            errno = (rval == 0) ? ETIMEDOUT : errno;
+            return -1;
+        }
+        n = read(fd, buf + done, len - done);
+        if (n == -1 && (errno == EINTR || errno == EAGAIN)) {
+            continue;
+        }
+        if (n <= 0) {
+            errno = (n == 0) ? ECONNRESET : errno;
+            return -1;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+/*
+ * Modbus RTU CRC of a frame
+ */
+static uint16_t
+rtu_crc(const uint8_t *p, int len)
+{
+    uint16_t crc = 0xffff;
+
+    for (int i = 0; i < len; i++) {
+        crc ^= p[i];
+        for (int b = 0; b < 8; b++) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xa001 : crc >> 1;
+        }
+    }
+    return crc;
+}
+
+/*
+ * Send a raw request PDU on the TCP connection of mb and receive its
+ * response ADU, framed by the MBAP length. Responses of other
+ * transactions, late ones of requests that timed out, are dropped.
+ * Returns the ADU length or -1 with errno set.
+ */
+static int
+raw_tcp(modbus_t *mb, const uint8_t *req, int reqlen, uint8_t *adu, long us)
+{
+    int fd = modbus_get_socket(mb);
+    int len;
+
+    raw_tid++;
+    adu[0] = raw_tid >> 8;
+    adu[1] = raw_tid & 0xff;
+    adu[2] = 0;
+    adu[3] = 0;
+    adu[4] = (reqlen + 1) >> 8;
+    adu[5] = (reqlen + 1) & 0xff;
+    adu[6] = mb_unit;
+    memcpy(adu + 7, req, reqlen);
+    if (mbio_sockio(fd, adu, reqlen + 7, 1) == -1) {
+        return -1;
+    }
+    for (;;) {
+        if (raw_recv(fd, adu, 7, us) == -1) {
+            return -1;
+        }
+        len = (adu[4] << 8) | adu[5];
+        if (adu[2] != 0 || adu[3] != 0 || len < 2 || len + 6 > MODBUS_MAX_ADU_LENGTH) {
+            errno = EMBBADDATA;
+            return -1;
+        }
+        if (raw_recv(fd, adu + 7, len - 1, us) == -1) {
+            return -1;
+        }
+        if (((adu[0] << 8) | adu[1]) == raw_tid && adu[6] == mb_unit) {
+            return len + 6;
+        }
+    }
+}
+
+/*
+ * receive the bytes of a raw RTU response up to n, waiting up to us
+ * for each part of them
+ */
+static int
+raw_upto(int fd, uint8_t *adu, int *got, int n, long us)
+{
+    if (n > MODBUS_RTU_MAX_ADU_LENGTH) {
+        errno = EMBBADDATA;
+        return -1;
+    }
+    if (n > *got) {
+        if (raw_recv(fd, adu + *got, n - *got, us) == -1) {
+            return -1;
+        }
+        *got = n;
+    }
+    return 0;
+}
+
+/*
+ * Send a raw request PDU on the serial line of mb and receive its
+ * response ADU. Its length follows from the function code, from the
+ * object list of a device identification response as it arrives, or
+ * else from the gap at the end of the frame. Returns the ADU length
+ * or -1 with errno set.
+ */
+static int
+raw_rtu(modbus_t *mb, const uint8_t *req, int reqlen, uint8_t *adu, long us)
+{
+    int fd = modbus_get_socket(mb);
+    uint32_t sec;
+    uint32_t usec;
+    long byte_us;
+    int got = 1;
+    int len;
+
+    adu[0] = mb_unit;
+    memcpy(adu + 1, req, reqlen);
+    if (modbus_send_raw_request(mb, adu, reqlen + 1) == -1) {
+        return -1;
+    }
+    modbus_get_byte_timeout(mb, &sec, &usec);
+    byte_us = (long )sec * 1000000 + usec;
+    if (byte_us == 0) {
+        byte_us = us;
+    }
+
+    /* the slave id within the response timeout, the rest within the byte timeout */
+    if (raw_recv(fd, adu, 1, us) == -1 || raw_upto(fd, adu, &got, 2, byte_us) == -1) {
+        return -1;
+    }
+    if (adu[1] & 0x80) {
+        len = 3;
+    } else if (adu[1] >= 0x01 && adu[1] <= 0x04) {
+        if (raw_upto(fd, adu, &got, 3, byte_us) == -1) {
+            return -1;
+        }
+        len = 3 + adu[2];
+    } else if (adu[1] == 0x05 || adu[1] == 0x06 || adu[1] == 0x0f || adu[1] == 0x10) {
+        len = 6;
+    } else if (adu[1] == 0x2b && reqlen >= 2 && req[1] == 0x0e) {
+
+        /* the header up to the number of objects, then <id> <len> <value> each */
+        len = 8;
+        if (raw_upto(fd, adu, &got, len, byte_us) == -1) {
+            return -1;
+        }
+        for (int k = 0; k < adu[7]; k++) {
+            if (raw_upto(fd, adu, &got, len + 2, byte_us) == -1) {
+                return -1;
+            }
+            len += 2 + adu[len + 1];
+            if (raw_upto(fd, adu, &got, len, byte_us) == -1) {
+                return -1;
+            }
+        }
+    } else {
+        while (got < MODBUS_RTU_MAX_ADU_LENGTH && raw_recv(fd, adu + got, 1, byte_us) == 0) {
+            got++;
+        }
+        if (got < MODBUS_RTU_MAX_ADU_LENGTH && errno != ETIMEDOUT) {
+            return -1;
+        }
+        len = got - 2;
+    }
+    if (len < 2 || raw_upto(fd, adu, &got, len + 2, byte_us) == -1) {
+        errno = (len < 2) ? EMBBADDATA : errno;
+        return -1;
+    }
+    if (rtu_crc(adu, len) != (adu[len] | (adu[len + 1] << 8))) {
+        errno = EMBBADCRC;
+        return -1;
+    }
+    if (adu[0] != mb_unit) {
+        errno = EMBBADDATA;
+        return -1;
+    }
+    return len + 2;
+}
+
+/*
+ * Run a transfer of a request PDU that libmodbus has no function
+ * for, on the bus, through the broker or from the replay, and capture
+ * it. libmodbus can't tell the length of the response to such a
+ * request, so it is framed by raw_tcp() or raw_rtu(). Returns the
+ * response PDU length or -1 with errno set.
+ */
+static int
+mbio_raw(modbus_t *mb, const uint8_t *req, int reqlen, uint8_t *rsp)
+{
+    uint8_t adu[MODBUS_MAX_ADU_LENGTH];
+    udp_ctx_t *uc = udp_of(mb);
+    uint32_t sec;
+    uint32_t usec;
+    int hdr;
+    int len;
+
+    if (mbio_replaying()) {
+        len = rp_xfer(req, reqlen, rsp);
+    } else if (mbio_brokered() || uc != NULL) {
+        if (!mbio_brokered()) {
+            gap_wait();
+        }
+        cap_put(real_ns(), CAP_REQ, req, reqlen);
+        if (mbio_brokered()) {
+            len = bk_xfer(req, reqlen, rsp);
+        } else {
+            len = udp_xfer(uc->u, uc->unit, req, reqlen, rsp, CAP_PDU_MAX);
+            last_ns = mono_ns();
+        }
+        if (len == -1) {
+            int32_t e = errno;
+            cap_put(real_ns(), CAP_ERR, (uint8_t *)&e, sizeof(e));
+            errno = e;
+            return -1;
+        }
+        cap_put(real_ns(), CAP_RSP, rsp, len);
+    } else {
+        gap_wait();
+        cap_put(real_ns(), CAP_REQ, req, reqlen);
+        rtu_timeout(mb, reqlen, rsp_len(req[0], 0));
+        modbus_get_response_timeout(mb, &sec, &usec);
+        hdr = modbus_get_header_length(mb);
+        if (hdr == 1) {
+            len = raw_rtu(mb, req, reqlen, adu, (long )sec * 1000000 + usec);
+        } else {
+            len = raw_tcp(mb, req, reqlen, adu, (long )sec * 1000000 + usec);
+        }
+        last_ns = mono_ns();
+        if (len == -1) {
+            int32_t e = errno;
+
+            /* a late or partly received response must not answer the next request */
+            if (hdr == 1) {
+                modbus_flush(mb);
+            } else {
+                modbus_close(mb);
+                modbus_connect(mb);
+            }
+            cap_put(real_ns(), CAP_ERR, (uint8_t *)&e, sizeof(e));
+            errno = e;
+            return -1;
+        }
+
+        /* strip the MBAP header or the slave id and the CRC */
+        len -= hdr + ((hdr == 1) ? 2 : 0);
+        if (len < 2 || len > CAP_PDU_MAX) {
+            errno = EMBBADDATA;
+            return -1;
+        }
+        memcpy(rsp, adu + hdr, len);
+        cap_put(real_ns(), CAP_RSP, rsp, len);
+    }
+    if (len >= 2 && rsp[0] == (req[0] | 0x80)) {
+        errno = MODBUS_ENOBASE + rsp[1];
+        return -1;
+    }
+    return len;
+}
+
+/*
+ * Run the transfer of request PDU req of slave id unit for a client
+ * of the broker, through the mbio function of its function code so
+ * that it keeps to the gap and the timeouts of the port and is
+ * captured. Exceptions are returned as exception responses. Returns
+ * the response PDU length or -1 with errno set.
+ */
+int
+mbio_pdu(modbus_t *mb, int unit, const uint8_t *req, int reqlen, uint8_t *rsp)
+{
+    uint16_t words[MODBUS_MAX_READ_REGISTERS];
+    uint8_t bits[MODBUS_MAX_READ_BITS];
+    int fc = req[0];
+    int addr = (reqlen >= 5) ? (req[1] << 8) | req[2] : 0;
+    int nb = (reqlen >= 5) ? (req[3] << 8) | req[4] : 0;
+    int rval;
+
+    mbio_set_slave(mb, unit);
+    switch (fc) {
+        case 0x01:
+        case 0x02:
+        case 0x03:
+        case 0x04:
+            if (reqlen != 5 || nb < 1 || nb > ((fc <= 0x02) ? MODBUS_MAX_READ_BITS : MODBUS_MAX_READ_REGISTERS)) {
+                errno = EMBXILVAL;
+                rval = -1;
+                break;
+            }
+            rval = mbio_xfer(mb, fc, addr, nb, (fc <= 0x02) ? (void *)bits : (void *)words);
+            if (rval != -1) {
+                return mk_rsp(rsp, req, nb, (fc <= 0x02) ? (void *)bits : (void *)words);
+            }
+            break;
+        case 0x05:
+        case 0x06:
+            if (reqlen != 5) {
+                errno = EMBXILVAL;
+                rval = -1;
+                break;
+            }
+            rval = mbio_xfer(mb, fc, addr, nb, NULL);
+            break;
+        case 0x0f:
+            if (reqlen < 6 || nb < 1 || nb > MODBUS_MAX_WRITE_BITS || reqlen < 6 + (nb + 7) / 8) {
+                errno = EMBXILVAL;
+                rval = -1;
+                break;
+            }
+            for (int i = 0; i < nb; i++) {
+                bits[i] = (req[6 + i / 8] >> (i % 8)) & 1;
+            }
+            rval = mbio_xfer(mb, fc, addr, nb, bits);
+            break;
+        case 0x10:
+            if (reqlen < 6 || nb < 1 || nb > MODBUS_MAX_WRITE_REGISTERS || reqlen < 6 + 2 * nb) {
+                errno = EMBXILVAL;
+                rval = -1;
+                break;
+            }
+            for (int i = 0; i < nb; i++) {
+                words[i] = (req[6 + 2 * i] << 8) | req[7 + 2 * i];
+            }
+            rval = mbio_xfer(mb, fc, addr, nb, words);
+            break;
+        default:
+            rval = mbio_raw(mb, req, reqlen, rsp);
+            if (rval != -1) {
+                return rval;
+            }
+    }
+    if (rval != -1) {
+        return mk_rsp(rsp, req, nb, NULL);
+    }
+    if (errno > MODBUS_ENOBASE && errno < MODBUS_ENOBASE + MODBUS_EXCEPTION_MAX) {
+        rsp[0] = fc | 0x80;
+        rsp[1] = errno - MODBUS_ENOBASE;
+        return 2;
+    }
+    return -1;
+}
+
+/*
+ * Read the basic device identification objects with FC43 / MEI 14.
+ * Objects that don't fit in one response are read with follow up
+ * requests from the next object id on.
+ */
+int
+mbio_read_devid(modbus_t *mb, devid_t *id)
+{
+    uint8_t req[4] = { 0x2b, 0x0e, 0x01, 0x00 };
+    uint8_t rsp[CAP_PDU_MAX];
+    char *obj[3] = { id->vendor, id->product, id->revision };
+    int len;
+
+    memset(id, 0, sizeof(devid_t));
+    for (int n = 0; n < 3; n++) {
+        int i = 7;
+
+        len = mbio_raw(mb, req, sizeof(req), rsp);
+        if (len == -1) {
+            return -1;
+        }
+        if (len < 7 || rsp[0] != 0x2b || rsp[1] != 0x0e) {
+            errno = EMBBADDATA;
+            return -1;
+        }
+
+        /* objects are <id> <len> <value> */
+        for (int k = 0; k < rsp[6] && i + 2 <= len; k++) {
+            int oid = rsp[i];
+            int olen = rsp[i + 1];
+
+            if (i + 2 + olen > len) {
+                break;
+            }
+            if (oid < 3) {
+                int cp = olen < DEVID_LEN ? olen : DEVID_LEN - 1;
+                memcpy(obj[oid], &rsp[i + 2], cp);
+                obj[oid][cp] = '\0';
+            }
+            i += 2 + olen;
+        }
+
+        /* more follows */
+        if (rsp[4] != 0xff || rsp[5] == 0 || rsp[5] > 2) {
+            break;
+        }
+        req[3] = rsp[5];
+    }
+    return 0;
+}
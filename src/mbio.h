@@ -0,0 +1,181 @@
+/*
+ *  modio - Modbus input output access tool
+ *
+ *  Copyright (C) 2022, Dimitris Economou (dimitris.s.economou@gmail.com)
+ *
+ *  This file is part of modio.
+ *
+ *  modio is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  modio is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with modio. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Modbus transfers with capture and replay.
+ *
+ * All register reads and writes of modio go through the mbio_*
+ * functions, which have the same semantics as their libmodbus
+ * counterparts. With capture enabled every request and its response
+ * or error are logged with timestamps as protocol data units. With
+ * replay enabled nothing goes to the bus and requests are answered
+ * with the responses of a capture file instead.
+ *
+ * capture file layout (host byte order):
+ *
+ *   cap_hdr_t                      file header
+ *   { cap_rec_t, uint8_t[len] }    one record per request, response or error
+ *
+ * An error record holds the errno (int32_t) of a request that got no
+ * response. Captures whose name ends in ".pcap" are written as pcap
+ * files instead, with the PDUs in Modbus/TCP frames of a synthetic
+ * TCP session, and pcap files of Modbus/TCP traffic can be replayed.
+ *
+ * With the response cache of rcache.h enabled reads are answered from
+ * the cache while they are younger than their ttl, without a transfer.
+ *
+ * When a broker (broker.h) owns the port the request PDUs are sent to
+ * it over its UNIX socket instead of the bus, each one as a bk_msg_t
+ * with the PDU after it, and it answers with a bk_msg_t and the
+ * response PDU, or with len 0 and the errno of a request that got no
+ * response.
+ *
+ * Modbus contexts of udp://<host>[:<port>] ports aren't connected, their
+ * request PDUs are sent as Modbus/UDP datagrams (udp.h) instead.
+ */
+
+#ifndef MXIO_MBIO_H
+#define MXIO_MBIO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <modbus.h>
+#include "modio.h"
+
+#define CAP_MAGIC 0x43444f4d    /* 'MODC' */
+#define CAP_VERSION 1
+#define CAP_PDU_MAX 256         /* max size of a PDU */
+#define BK_TIMEOUT_s 30         /* timeout of a transfer through the broker */
+
+/* capture record direction */
+enum capdir {
+    CAP_REQ = 0,                /* request */
+    CAP_RSP = 1,                /* response */
+    CAP_ERR = 2                 /* request without response */
+};
+typedef enum capdir capdir_t;
+
+/* capture file header */
+struct cap_hdr {
+    uint32_t magic;             /* CAP_MAGIC */
+    uint16_t version;           /* CAP_VERSION */
+    uint16_t tcp;               /* captured on a TCP connection */
+    int64_t start_ns;           /* wall clock time the capture started */
+};
+typedef struct cap_hdr cap_hdr_t;
+
+/* capture record header */
+struct cap_rec {
+    int64_t real_ns;            /* wall clock time */
+    uint8_t dir;                /* capture record direction */
+    uint8_t unit;               /* modbus slave id */
+    uint16_t len;               /* length of the PDU that follows */
+};
+typedef struct cap_rec cap_rec_t;
+
+/* broker message header */
+struct bk_msg {
+    uint16_t len;               /* length of the PDU that follows, 0 for no response */
+    uint8_t unit;               /* modbus slave id */
+    uint8_t rsvd;               /* reserved */
+    int32_t err;                /* errno of a request without response */
+};
+typedef struct bk_msg bk_msg_t;
+
+/* capture transfers to file path, peer is the server host or serial port */
+int mbio_capture(const char *path, const char *peer, int tcp);
+
+/* replay transfers from capture file path */
+int mbio_replay(const char *path);
+
+/* check if transfers are replayed */
+int mbio_replaying(void);
+
+/* answer reads on port from the response cache file path within ttl ms */
+int mbio_cache(const char *path, const char *port, int ttl);
+
+/* set the ttl of the following cached reads in ms, -1 for the default */
+void mbio_cache_ttl(int ms);
+
+/* path of the broker socket of port, sys for the broker of root */
+const char *mbio_broker_path(const char *port, int sys);
+
+/* send the following transfers to the broker of port, if one runs */
+int mbio_broker(const char *port);
+
+/* check if transfers go through a broker */
+int mbio_brokered(void);
+
+/* send or receive all len bytes of buf on a stream socket */
+int mbio_sockio(int fd, void *buf, size_t len, int wr);
+
+/* run the transfer of a request PDU of a broker client */
+int mbio_pdu(modbus_t *mb, int unit, const uint8_t *req, int reqlen, uint8_t *rsp);
+
+/* send the transfers of a modbus context to a Modbus/UDP port */
+int mbio_udp(modbus_t *mb, const char *port);
+
+/* close the Modbus/UDP port of a modbus context, all if NULL */
+void mbio_udp_close(modbus_t *mb);
+
+/* flush and close capture, replay and cache files, the broker connection and Modbus/UDP ports */
+void mbio_close(void);
+
+/* derive the RTU timeouts from the serial line settings */
+int mbio_rtu_timing(modbus_t *mb, serconf_t sc);
+
+/* set the RTU device turnaround in ms, 0 for the default */
+void mbio_turnaround(int ms);
+
+/* set the min gap between requests in ms, 0 for none */
+void mbio_gap(int ms);
+
+/* set the slave id of the following transfers */
+int mbio_set_slave(modbus_t *mb, int id);
+
+/* read coils */
+int mbio_read_bits(modbus_t *mb, int addr, int nb, uint8_t *dest);
+
+/* read input bits */
+int mbio_read_input_bits(modbus_t *mb, int addr, int nb, uint8_t *dest);
+
+/* read holding registers */
+int mbio_read_registers(modbus_t *mb, int addr, int nb, uint16_t *dest);
+
+/* read input registers */
+int mbio_read_input_registers(modbus_t *mb, int addr, int nb, uint16_t *dest);
+
+/* write a coil */
+int mbio_write_bit(modbus_t *mb, int addr, int status);
+
+/* write a holding register */
+int mbio_write_register(modbus_t *mb, int addr, uint16_t value);
+
+/* write coils */
+int mbio_write_bits(modbus_t *mb, int addr, int nb, const uint8_t *src);
+
+/* write holding registers */
+int mbio_write_registers(modbus_t *mb, int addr, int nb, const uint16_t *src);
+
+/* read the basic device identification objects */
+int mbio_read_devid(modbus_t *mb, devid_t *id);
+
+#endif
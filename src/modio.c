@@ -26,6 +26,8 @@
  *  along with modio.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
@@ -39,7 +41,31 @@
 #include <hashmap.h>
 #include <getopt.h>
 #include <stdarg.h>
+#include <ctype.h>
+#include <signal.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <time.h>
+#include <fnmatch.h>
+#include <regex.h>
+#include <limits.h>
+#include <sys/stat.h>
 #include "modio.h"
+#include "shm.h"
+#include "ring.h"
+#include "archive.h"
+#include "mbio.h"
+#include "plan.h"
+#include "dev.h"
+#include "value.h"
+#include "rcache.h"
+#include "broker.h"
+#include "udp.h"
+#include "derive.h"
+#include "alarm.h"
+#include "window.h"
+#include "libmodio.h"
 
 /* register store arrays */
 uint16_t ireg[REG_SIZE];    /* store input registers*/
@@ -47,41 +73,17 @@ uint16_t hreg[REG_SIZE];    /* store holding registers*/
 uint8_t creg[REG_SIZE];     /* store coil registers */
 uint8_t ibreg[REG_SIZE];    /* store input bit registers */
 
-/* return a string with binary representation of inum */
-char *int_to_bin(uint16_t inum);
-
-/* convert an integer to string */
-char *int_to_str(int inum);
-
-/* convert a hex to string */
-char *hex_to_str(int xnum);
-
-/* convert an array of words into a string of '.' separated bytes */
-char *mem_to_bytes(uint16_t *array, int size, char *(*conv)(int));
-
 /* initialize read register array */
 void init_rrega(void);
 
-/* convert an array of words with ASCII bytes into a string*/
-char *words_to_str(const uint16_t *array, int length);
-
-/* Concatenate and invert 16bit words to 32bit (length = 2) or 64bit (length = 4) */
-uint64_t concat_inv16(const uint16_t *array, int length);
-
 /* create a new modbus context */
 modbus_t *modbus_new(char *port, serconf_t sc);
 
 /* initialize modbus connection */
 modbus_t *modbus_init(char *port, serconf_t sc, int id);
 
-/* initialize supported devices' register list */
-int init_drlist(dvlist_t **lst);
-
-/* read supported devices and registers' info */
-void read_dreg(dvlist_t *lst);
-
-/* read registers from device files */
-dvlist_t *read_dreg_files(dvlist_t *lst, DIR *fd, char *cf_path);
+/* open a libmodio context of a unit */
+modio_t *modio_connect(char *port, serconf_t sc, int id);
 
 /* print supported devices' info */
 void print_dev_info(dvlist_t *lst, int sz);
@@ -90,16 +92,190 @@ void print_dev_info(dvlist_t *lst, int sz);
 void print_dev_reginfo(dvlist_t *lst, int num, int nor);
 
 /* read device registers */
-void read_dev_regs(modbus_t *mb, dvlist_t *dvl, int dnum);
+void read_dev_regs(modio_t *m, dvlist_t *dvl, int dnum);
+
+/* read the registers of several units over one connection */
+int read_units(modbus_t *mb, dvlist_t *dvl, unit_t *ul, int uc, int quiet);
+
+/* check if the polled registers need the scheduler */
+int sched_needed(dvlist_t *dvl, unit_t *ul, int uc);
+
+/* order scheduled block reads */
+int sjob_cmp(const void *a, const void *b);
+
+/* read the due registers of the units */
+int sched_units(modbus_t *mb, dvlist_t *dvl, unit_t *ul, int uc, int period, int quiet, sched_t *sc);
+
+/* poll the registers of the units periodically */
+void poll_units(modbus_t *mb, dvlist_t *dvl, unit_t *ul, int uc, int period, int quiet);
+
+/* pass a register sample to the enabled outputs */
+void smpl_out(dvlist_t *dvl, rsmpl_t *s);
+
+/* values of the registers and derived registers of a unit */
+double *unit_val(unit_t *u, dvlist_t *dv);
+
+/* evaluate and print the derived registers of a device */
+void drv_out(dvlist_t *dv, double *val, const char *pfx);
+
+/* aggregate the derived values of a unit and evaluate its alarm rules */
+void unit_done(dvlist_t *dv, unit_t *u);
+
+/* create the shared memory register image of the units */
+shm_t *shm_setup(const char *name, dvlist_t *dvl, unit_t *ul, int uc);
+
+/* write the register identity of the shared memory records of a unit */
+void shm_ident(shm_t *sh, dvlist_t *dvl, unit_t *u);
+
+/* print a shared memory register image */
+int shm_dump(const char *name);
+
+/* export the samples of a ring file as CSV */
+int record_export(const char *path, dvlist_t *dvl, int lsz, int64_t from, int64_t to);
+
+/* archive series of register j of unit u */
+void arch_ser_set(arch_ser_t *a, const unit_t *u, int j, const dreg_t *r);
+
+/* create the archive of the registers of the units */
+arch_t *arch_setup(const char *path, dvlist_t *dvl, unit_t *ul, int uc);
+
+/* export the samples of the selected series of an archive as CSV */
+int archive_query(const char *path, unit_t *ul, int uc, const char *pats, int64_t from, int64_t to);
+
+/* parse a time string into ns since the epoch */
+int64_t parse_time(const char *s);
+
+/* check a register name against name patterns */
+int name_match(const char *name, const char *pats);
+
+/* select the registers of a device by name patterns */
+dreg_t **select_regs(dvlist_t *dv, const char *pats, int *n);
+
+/* read a block of a read plan */
+int read_block(modbus_t *mb, pblk_t *b, uint16_t *words, uint8_t *bits);
+
+/* read the registers of one request through libmodio */
+int read_span(modio_t *m, int type, int addr, int len, int ttl, uint16_t *words, uint8_t *bits);
+
+/* move a register of a block read into the register store arrays */
+void store_reg(dreg_t *r, const uint16_t *words, const uint8_t *bits, int off, rsmpl_t *s);
+
+/* read and print the registers of a read plan */
+int read_plan(modbus_t *mb, plan_t *p, const char *pfx);
+
+/* parse a register number or address of a register list */
+long reg_list_num(const char *p, char **e);
+
+/* parse the unit list of -i into a new unit_t array */
+int unit_list_parse(const char *spec, unit_t **l, int *n);
+
+/* append the registers of a register list to an rreg_t array */
+int reg_list_parse(const char *spec, rreg_t **l, int *n, int *cap);
+
+/* append the registers of a register list file to an rreg_t array */
+int reg_list_file(const char *path, rreg_t **l, int *n, int *cap);
+
+/* trim leading and trailing white space of s */
+char *str_trim(char *s);
+
+/* read the values to write of a CSV file */
+wval_t *write_file_load(const char *path, dvlist_t *dv, int zba, int *n, int *nerr);
+
+/* write the values of a write plan and verify them */
+int write_plan(modbus_t *mb, wplan_t *p, int verify, int quiet);
+
+/* find the device of an identification in the device list */
+int devid_match(dvlist_t *dvl, int lsz, devid_t *id);
+
+/* path of a file in the cache directory */
+char *cache_path(const char *name, int mk);
+
+/* look up the device of a unit in the identification cache */
+int devid_cache_get(const char *host, int uid, dvlist_t *dvl, int lsz);
+
+/* store the device of a unit in the identification cache */
+void devid_cache_put(const char *host, int uid, dvlist_t *dv);
+
+/* path of the tuning file of a unit */
+char *tune_path(const char *host, int uid, int mk);
+
+/* read the tuning file of a unit */
+int tune_load(const char *host, int uid, tune_t *t);
+
+/* write the tuning file of a unit */
+int tune_save(const char *host, int uid, const tune_t *t);
+
+/* read words or bits of a register type for the probe */
+int probe_read(modbus_t *mb, int type, int addr, int len);
+
+/* find the largest read of a register type */
+int probe_max(modbus_t *mb, int type, int addr);
+
+/* find the most undefined addresses a read may span */
+int probe_span(modbus_t *mb, dvlist_t *dv, const tune_t *t);
+
+/* find the shortest gap between requests a unit sustains */
+int probe_rate(modbus_t *mb, int type, int addr, tune_t *t);
+
+/* probe the limits of a unit */
+int probe_unit(modbus_t *mb, dvlist_t *dv, tune_t *t);
+
+/* select the device of the units by their identification */
+int auto_dev(char *port, serconf_t sc, dvlist_t *dvl, int lsz, unit_t *ul, int uc);
+
+/* start watching the device files for changes */
+reload_t *reload_start(dvlist_t *dvl, int n);
+
+/* device file watcher thread */
+void *reload_watch(void *arg);
+
+/* apply the reloaded devices between poll cycles */
+void reload_apply(reload_t *rl, dvlist_t *dvl, unit_t *ul, int uc);
+
+/* check the registers of a reloaded device against the archive series */
+int reload_archived(dvlist_t *nd, int dnum, unit_t *ul, int uc);
+
+/* stop the device file watcher */
+void reload_stop(reload_t *rl);
+
+/* check if a request error means that the unit didn't answer */
+int unit_noresp(int err);
+
+/* read a device register and print its value */
+int read_dev_reg(modbus_t *mb, dreg_t *r, const char *pfx, rsmpl_t *s);
+
+/* print a device register value */
+void print_dev_reg(dreg_t *r, const char *pfx);
+
+/* register store array of a register type */
+const void *reg_store(int type);
+
+/* stop signal handler */
+void modio_sigstop(int sig);
 
 /* print the program usage */
 void usage(char *pname);
 
-/* debug function */
-void modio_debugx(int level, const char *fmt, ...);
+/* set by SIGINT and SIGTERM to end poll mode */
+volatile sig_atomic_t modio_stop = 0;
+
+/* shared memory register image, if enabled */
+shm_t *modio_shm = NULL;
+
+/* ring file recorder, if enabled */
+ring_t *modio_ring = NULL;
 
-/* modio debug level */
-int modio_dbg_lvl = 0;
+/* archive recorder, if enabled */
+arch_t *modio_arch = NULL;
+
+/* alarm event stream of poll mode */
+FILE *modio_alarm = NULL;
+
+/* device file watcher of poll mode */
+reload_t *modio_reload = NULL;
+
+/* response cache ttl of --cache in ms, -1 without the response cache */
+int modio_cache_ms = -1;
 
 /*
  * main
@@ -111,6 +287,7 @@ main(int argc, char **argv)
     int lsz = 0;                /* device list size */
     dvlist_t *dvl;              /* the supported devices' list */
     modbus_t *mb;               /* modbus context */
+    modio_t *lm;                /* libmodio context of the one-shot reads and writes */
     HASHMAP(char, struct dreg) regmap;
 
     /*
@@ -121,15 +298,19 @@ main(int argc, char **argv)
     int xreg = 0x0;             /* register hex address */
     rreg_t *reg_l = NULL;       /* list of registers */
     int reg_c = 0;              /* count of registers */
+    int reg_n = 0;              /* number of registers in reg_l */
+    int reg_cap = 0;            /* capacity of reg_l */
     char *port = NULL;          /* port to connect */
 
-    char *tkn;                  /* temp token pointer for strtok */
+    uint8_t *seen;              /* registers listed, by type and address */
     int rread = FALSE;          /* register read flag */
     int rwrite = FALSE;         /* register write flag */
     int len = 1;                /* len of read or write */
     int addrac = FALSE;         /* register address access */
     int dev_info = FALSE;       /* print device info */
     int id = MODBUS_SLAVE_ID;   /* modbus slave id */
+    unit_t *unit_l = NULL;      /* list of units */
+    int unit_c = 0;             /* count of units */
     int zba = TRUE;             /* zero based addressing flag */
     int rall = FALSE;           /* read all device's info flag */
     int dnum = 0;               /* device number for printing registers' info */
@@ -143,6 +324,24 @@ main(int argc, char **argv)
             DATA_BIT
     };                          /* serial configuration */
     uint16_t val = 0;           /* value to write */
+    int poll_ms = 0;            /* poll period in ms, 0 reads once */
+    char *shm_name = NULL;      /* shared memory register image name */
+    char *shmd_name = NULL;     /* shared memory register image to print */
+    char *rec_path = NULL;      /* ring file to record to */
+    char *alarm_path = NULL;    /* alarm event file, stderr if NULL */
+    int win_ms = 0;             /* aggregation window in ms, 0 prints every value */
+    uint64_t rec_cap = RING_DEF_CAP;    /* ring file capacity in records */
+    char *rexp_path = NULL;     /* ring file to export */
+    char *arch_path = NULL;     /* archive to record to */
+    char *archq_path = NULL;    /* archive to export */
+    int64_t from_ns = INT64_MIN;        /* start of exported time range */
+    int64_t to_ns = INT64_MAX;          /* end of exported time range */
+    char *cap_path = NULL;      /* file to capture transfers to */
+    char *rpl_path = NULL;      /* file to replay transfers from */
+    char *name_pat = NULL;      /* register name patterns */
+    char *wf_path = NULL;       /* CSV file of register values to write */
+    tune_t tune;                /* limits of the unit of -i */
+    char *host;                 /* port of -p before modbus_init */
 
     enum opt_flag {
         BRF = 0,
@@ -151,7 +350,31 @@ main(int argc, char **argv)
         PAR = 3,
         SBT = 4,
         DBT = 5,
-        DBG = 6
+        DBG = 6,
+        POL = 7,
+        QUI = 8,
+        SHM = 9,
+        SHD = 10,
+        REC = 11,
+        RSZ = 12,
+        REX = 13,
+        FRM = 14,
+        TOO = 15,
+        CAP = 16,
+        RPL = 17,
+        AUT = 18,
+        NAM = 19,
+        WRF = 20,
+        VFY = 21,
+        RGF = 22,
+        PRB = 23,
+        CAC = 24,
+        BRK = 25,
+        ALM = 26,
+        WIN = 27,
+        SDV = 28,
+        ARC = 29,
+        ARQ = 30
     };                          /* option flag values for getopt_long */
     static int verbose_flag;    /* flag set by ‘--verbose’. */
     static int baud_o;          /* flag set by '--baud' */
@@ -159,6 +382,30 @@ main(int argc, char **argv)
     static int sbit_o;          /* flag set by '--sbit' */
     static int dbit_o;          /* flag set by '--dbit' */
     static int dbglvl_o;        /* flag set by '--debug' */
+    static int poll_o;          /* flag set by '--poll' */
+    static int quiet_o;         /* flag set by '--quiet' */
+    static int shm_o;           /* flag set by '--shm' */
+    static int shmdump_o;       /* flag set by '--shm-dump' */
+    static int rec_o;           /* flag set by '--record' */
+    static int recsz_o;         /* flag set by '--record-size' */
+    static int recexp_o;        /* flag set by '--record-export' */
+    static int from_o;          /* flag set by '--from' */
+    static int to_o;            /* flag set by '--to' */
+    static int cap_o;           /* flag set by '--capture' */
+    static int rpl_o;           /* flag set by '--replay' */
+    static int auto_o;          /* flag set by '--auto' */
+    static int name_o;          /* flag set by '--name' */
+    static int wrfile_o;        /* flag set by '--write-file' */
+    static int verify_o;        /* flag set by '--verify' */
+    static int regfile_o;       /* flag set by '--reg-file' */
+    static int probe_o;         /* flag set by '--probe' */
+    static int cache_o;         /* flag set by '--cache' */
+    static int broker_o;        /* flag set by '--broker' */
+    static int alarm_o;         /* flag set by '--alarms' */
+    static int window_o;        /* flag set by '--window' */
+    static int stddev_o;        /* flag set by '--stddev' */
+    static int arch_o;          /* flag set by '--archive' */
+    static int archq_o;         /* flag set by '--archive-query' */
     static struct option long_options[] = {
             {"verbose",     no_argument,       &verbose_flag, VER},
             {"brief",       no_argument,       &verbose_flag, BRF},
@@ -181,6 +428,30 @@ main(int argc, char **argv)
             {"reg_info",    required_argument, 0,             'o'},
             {"help",        no_argument,       0,             'h'},
             {"debug",       required_argument, &dbglvl_o,     DBG},
+            {"poll",        required_argument, &poll_o,       POL},
+            {"quiet",       no_argument,       &quiet_o,      QUI},
+            {"shm",         required_argument, &shm_o,        SHM},
+            {"shm-dump",    required_argument, &shmdump_o,    SHD},
+            {"record",      required_argument, &rec_o,        REC},
+            {"record-size", required_argument, &recsz_o,      RSZ},
+            {"record-export", required_argument, &recexp_o,   REX},
+            {"from",        required_argument, &from_o,       FRM},
+            {"to",          required_argument, &to_o,         TOO},
+            {"capture",     required_argument, &cap_o,        CAP},
+            {"replay",      required_argument, &rpl_o,        RPL},
+            {"auto",        no_argument,       &auto_o,       AUT},
+            {"name",        required_argument, &name_o,       NAM},
+            {"write-file",  required_argument, &wrfile_o,     WRF},
+            {"verify",      no_argument,       &verify_o,     VFY},
+            {"reg-file",    required_argument, &regfile_o,    RGF},
+            {"probe",       no_argument,       &probe_o,      PRB},
+            {"cache",       required_argument, &cache_o,      CAC},
+            {"broker",      no_argument,       &broker_o,     BRK},
+            {"alarms",      required_argument, &alarm_o,      ALM},
+            {"window",      required_argument, &window_o,     WIN},
+            {"stddev",      no_argument,       &stddev_o,     SDV},
+            {"archive",     required_argument, &arch_o,       ARC},
+            {"archive-query", required_argument, &archq_o,    ARQ},
             {0,             0,                 0,               0}
     };
 
@@ -227,39 +498,115 @@ main(int argc, char **argv)
                     modio_dbg_lvl = (int )strtoul(optarg, NULL, 10);
                     dbit_o = 0;
                 }
+                if (poll_o == POL) {
+                    poll_ms = (int )strtoul(optarg, NULL, 10);
+                    poll_o = 0;
+                }
+                if (shm_o == SHM) {
+                    shm_name = optarg;
+                    shm_o = 0;
+                }
+                if (shmdump_o == SHD) {
+                    shmd_name = optarg;
+                    shmdump_o = 0;
+                }
+                if (rec_o == REC) {
+                    rec_path = optarg;
+                    rec_o = 0;
+                }
+                if (recsz_o == RSZ) {
+                    rec_cap = strtoull(optarg, NULL, 0);
+                    if (rec_cap == 0) {
+                        usage(argv[0]);
+                        exit(EXIT_FAILURE);
+                    }
+                    recsz_o = 0;
+                }
+                if (recexp_o == REX) {
+                    rexp_path = optarg;
+                    recexp_o = 0;
+                }
+                if (from_o == FRM || to_o == TOO) {
+                    int64_t t = parse_time(optarg);
+                    if (t == -1) {
+                        printf("ERROR: invalid time %s\n", optarg);
+                        exit(EXIT_FAILURE);
+                    }
+                    if (from_o == FRM) {
+                        from_ns = t;
+                    } else {
+                        to_ns = t;
+                    }
+                    from_o = 0;
+                    to_o = 0;
+                }
+                if (cap_o == CAP) {
+                    cap_path = optarg;
+                    cap_o = 0;
+                }
+                if (rpl_o == RPL) {
+                    rpl_path = optarg;
+                    rpl_o = 0;
+                }
+                if (name_o == NAM) {
+                    name_pat = optarg;
+                    name_o = 0;
+                }
+                if (wrfile_o == WRF) {
+                    wf_path = optarg;
+                    wrfile_o = 0;
+                }
+                if (regfile_o == RGF) {
+                    if (reg_list_file(optarg, &reg_l, &reg_n, &reg_cap) == -1) {
+                        exit(EXIT_FAILURE);
+                    }
+                    regfile_o = 0;
+                }
+                if (cache_o == CAC) {
+                    modio_cache_ms = (int )strtoul(optarg, NULL, 10);
+                    cache_o = 0;
+                }
+                if (alarm_o == ALM) {
+                    alarm_path = optarg;
+                    alarm_o = 0;
+                }
+                if (window_o == WIN) {
+                    win_ms = (int )strtoul(optarg, NULL, 10);
+                    window_o = 0;
+                }
+                if (arch_o == ARC) {
+                    arch_path = optarg;
+                    arch_o = 0;
+                }
+                if (archq_o == ARQ) {
+                    archq_path = optarg;
+                    archq_o = 0;
+                }
                 break;
             case 'p':
                 port = (char *)malloc((strlen(optarg) + 1) * sizeof(char));
                 strcpy(port, optarg);
                 break;
+
+            /* get comma separated slave ids in unit_l array, each with an optional ':<dev num>' */
             case 'i':
-                id = (int )strtoul(optarg, NULL, 0);
+                free(unit_l);
+                if (unit_list_parse(optarg, &unit_l, &unit_c) == -1) {
+                    printf("ERROR: invalid slave id list %s, ids are 1 - %d\n", optarg, UNIT_MAX_ID);
+                    exit(EXIT_FAILURE);
+                }
+                modio_debugx(2, "units = %d\n", unit_c);
+                id = unit_l->id;
                 break;
             case 'z':
                 zba = FALSE;
                 break;
 
-            /* get comma separated registers/addresses in reg_l array */
+            /* get comma separated registers/addresses and ranges of them in reg_l array */
             case 'g':
-                tkn = optarg;
-                while (*tkn) {              /* calculate number of ',' */
-                    if (',' == *tkn) {
-                        reg_c++;            /* increase reg/address counter */
-                    }
-                    tkn++;
-                }
-                modio_debugx(2, "regs = %d\n", reg_c);
-
-                /* allocate memory for reg_l array with size reg_c */
-                reg_l = (rreg_t *)malloc(sizeof(rreg_t) * (reg_c + 1));
-                tkn = strtok(optarg, ",");
-                reg_l->reg = (int )strtoul(tkn, NULL, 0);
-                if (reg_c != 0) {
-                    int i = 1;
-                    while ((tkn = strtok(NULL, ",")) != NULL) {
-                        (reg_l + i)->reg = (int )strtoul(tkn, NULL, 0);
-                        i++;
-                    }
+                if (reg_list_parse(optarg, &reg_l, &reg_n, &reg_cap) == -1) {
+                    printf("ERROR: invalid register list %s\n", optarg);
+                    exit(EXIT_FAILURE);
                 }
                 break;
             case 'r':
@@ -343,6 +690,16 @@ main(int argc, char **argv)
         exit(EXIT_FAILURE);
     }
 
+    /* --shm-dump <name> prints a register image published by another modio */
+    if (shmd_name != NULL) {
+        exit(shm_dump(shmd_name) ? EXIT_FAILURE : EXIT_SUCCESS);
+    }
+
+    /* --archive-query <file> prints archived samples, the archive names its registers */
+    if (archq_path != NULL) {
+        exit(archive_query(archq_path, unit_l, unit_c, name_pat, from_ns, to_ns) ? EXIT_FAILURE : EXIT_SUCCESS);
+    }
+
     modio_debugx(1,"COM:\n");
     modio_debugx(1, "port = %s\n", port);
     modio_debugx(1, "baud = %d\n", sc.baud);
@@ -351,6 +708,9 @@ main(int argc, char **argv)
     modio_debugx(1, "dbit = %d\n\n", sc.dbit);
     modio_debugx(1, "MODBUS:\n");
     modio_debugx(1, "slave id   = %d\n", id);
+    for (int i = 1; i < unit_c; i++) {
+        modio_debugx(1, "slave id   = %d\n", unit_l[i].id);
+    }
     modio_debugx(1, "device num = %d\n\n", dnum);
 
     /* use DEVICE_PATH if port hasn't been defined */
@@ -359,21 +719,65 @@ main(int argc, char **argv)
         strcpy(port, DEVICE_PATH);
     }
 
+    /* --capture <file> logs all transfers, --replay <file> answers them from a capture */
+    if (cap_path != NULL && rpl_path != NULL) {
+        printf("ERROR: --capture and --replay can't be used together\n");
+        exit(EXIT_FAILURE);
+    }
+    if (cap_path != NULL && mbio_capture(cap_path, port, strstr(port, "/dev/tty") == NULL) == -1) {
+        exit(EXIT_FAILURE);
+    }
+    if (rpl_path != NULL && mbio_replay(rpl_path) == -1) {
+        exit(EXIT_FAILURE);
+    }
+
+    /* --broker owns the port and runs the transfers of the modio processes of the port */
+    if (broker_o) {
+        struct sigaction sa;
+
+        if (rpl_path != NULL) {
+            printf("ERROR: --broker can't be used with --replay\n");
+            exit(EXIT_FAILURE);
+        }
+
+        /* initialize modbus connection, it cuts the port of its host */
+        host = strdup(port);
+        mb = modbus_init(port, sc, id);
+        if (mb == NULL) {
+            exit(EXIT_FAILURE);
+        }
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = modio_sigstop;
+        sigaction(SIGINT, &sa, NULL);
+        sigaction(SIGTERM, &sa, NULL);
+        rval = broker_run(mb, host, &modio_stop);
+        free(host);
+        modbus_close(mb);
+        modbus_free(mb);
+        mbio_close();
+        exit(rval ? EXIT_FAILURE : EXIT_SUCCESS);
+    }
+
+    /* the transfers go through the broker of the port if one runs */
+    if (rpl_path == NULL) {
+        mbio_broker(port);
+    }
+
     /* initialize the device list */
     lsz = init_drlist(&dvl);
 
     /* initialize register memory area */
     init_rrega();
 
+    /* read device and registers' info from device files */
+    lsz = read_dreg(dvl, lsz);
+
     /* if device number greater than device list size exit */
     if (dnum > lsz) {
         usage(argv[0]);
         exit(EXIT_SUCCESS);
     }
 
-    /* read device and registers' info from device files */
-    read_dreg(dvl);
-
     if (dev_info) {
         if (dnum) {
             print_dev_reginfo(dvl, dnum - 1, dvl[dnum-1].nor);
@@ -385,15 +789,286 @@ main(int argc, char **argv)
         exit(EXIT_SUCCESS);
     }
 
-    /* if -e <dev_num> read device registers defined in configuration file */
-    if (rall && dnum) {
+    /* if --record-export <file> print the recorded samples as CSV */
+    if (rexp_path != NULL) {
+        exit(record_export(rexp_path, dvl, lsz, from_ns, to_ns) ? EXIT_FAILURE : EXIT_SUCCESS);
+    }
+
+    /*
+     * --auto selects the device of the units without device number by their
+     * identification, a single unit without -g reads all registers as -e <dev_num>
+     */
+    if (auto_o && dnum == 0) {
+        if (unit_l == NULL) {
+            unit_l = (unit_t *)calloc(1, sizeof(unit_t));
+            if (unit_l == NULL) {
+                fprintf(stderr, "malloc failed: insufficient memory!\n");
+                exit(EXIT_FAILURE);
+            }
+            unit_l->id = id;
+            unit_c = 1;
+        }
+        if (auto_dev(port, sc, dvl, lsz, unit_l, unit_c) == -1) {
+            exit(EXIT_FAILURE);
+        }
+        if (unit_c == 1 && reg_l == NULL && name_pat == NULL && wf_path == NULL) {
+            rall = TRUE;
+        }
+    }
+
+    /* a single unit with its own device number acts as -o <dev_num> */
+    if (unit_c == 1 && unit_l->dnum) {
+        dnum = unit_l->dnum;
+        if (dnum > lsz) {
+            usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    /* in poll mode a single device, given by -e <dev_num> or -i <id:dev_num>, is polled as a unit */
+    if (poll_ms && unit_c <= 1) {
+        if (dnum == 0 || !(rall || unit_c == 1)) {
+            printf("ERROR: --poll needs -e <dev_num> or a list of units\n");
+            exit(EXIT_FAILURE);
+        }
+        if (unit_l == NULL) {
+            unit_l = (unit_t *)calloc(1, sizeof(unit_t));
+            if (unit_l == NULL) {
+                fprintf(stderr, "malloc failed: insufficient memory!\n");
+                exit(EXIT_FAILURE);
+            }
+            unit_l->id = id;
+            unit_c = 1;
+        }
+        unit_l->dnum = dnum;
+    }
+    if ((shm_name != NULL || rec_path != NULL || arch_path != NULL || alarm_path != NULL || win_ms) && !poll_ms) {
+        printf("ERROR: --shm, --record, --archive, --alarms and --window need --poll <ms>\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /*
+     * --probe finds the limits of the unit and writes them to its tuning file,
+     * the reads of the unit use the limits of its tuning file from then on
+     */
+    if (probe_o) {
+        if (unit_c > 1 || poll_ms) {
+            printf("ERROR: --probe can't be used with --poll or several units\n");
+            exit(EXIT_FAILURE);
+        }
+
+        /* initialize modbus connection, it cuts the port of its host */
+        host = strdup(port);
+        mb = modbus_init(port, sc, id);
+        if (mb == NULL) {
+            exit(EXIT_FAILURE);
+        }
+        if (dnum) {
+            mbio_turnaround(dvl[dnum - 1].turnaround);
+        }
+        rval = probe_unit(mb, dnum ? &dvl[dnum - 1] : NULL, &tune);
+        if (rval == 0) {
+            rval = tune_save(host, id, &tune);
+        }
+        if (rval == 0) {
+            printf("tuning file: %s\n", tune_path(host, id, 0));
+        }
+        free(host);
+        modbus_close(mb);
+        modbus_free(mb);
+        mbio_close();
+        exit(rval ? EXIT_FAILURE : EXIT_SUCCESS);
+    }
+    tune_load(port, id, &tune);
+
+    /*
+     * --cache <ms> answers the reads from the response cache of the user, the
+     * registers of the device files without a ttl of their own take <ms>
+     */
+    if (modio_cache_ms >= 0) {
+        if (!mbio_replaying() && mbio_cache(rcache_path(), port, modio_cache_ms) == -1) {
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < lsz; i++) {
+            dev_ttl(&dvl[i], modio_cache_ms);
+        }
+    }
+
+    /* --name <pattern> reads the matching registers of the device in as few requests as possible */
+    if (name_pat != NULL) {
+        dreg_t **sel;
+        plan_t *plan;
+        int n;
+
+        if (unit_c > 1 || poll_ms) {
+            printf("ERROR: --name can't be used with --poll or several units\n");
+            exit(EXIT_FAILURE);
+        }
+        if (dnum == 0) {
+            printf("ERROR: --name needs a device, -o <dev_num>, -e <dev_num> or --auto\n");
+            exit(EXIT_FAILURE);
+        }
+        sel = select_regs(&dvl[dnum - 1], name_pat, &n);
+        if (n == 0) {
+            printf("ERROR: no register name matches %s\n", name_pat);
+            exit(EXIT_FAILURE);
+        }
+        plan = plan_build(sel, n, &tune);
+        if (plan == NULL) {
+            fprintf(stderr, "malloc failed: insufficient memory!\n");
+            exit(EXIT_FAILURE);
+        }
+        modio_debugx(1, "plan: %d registers in %d requests\n", plan->nreg, plan->nblk);
+
+        /* initialize modbus connection */
+        mb = modbus_init(port, sc, id);
+        if (mb == NULL) {
+            exit(EXIT_FAILURE);
+        }
+        mbio_turnaround(dvl[dnum - 1].turnaround);
+        mbio_gap(tune.gap);
+        printf("%s %s %s:\n", dvl[dnum - 1].type, dvl[dnum - 1].manfc, dvl[dnum - 1].model);
+        printf("%-5s %-35s %-10s %-8s\n", "REG", "NAME", "ADDRESS", "VALUE");
+        rval = read_plan(mb, plan, "");
+        plan_free(plan);
+        free(sel);
+        modbus_close(mb);
+        modbus_free(mb);
+        mbio_close();
+        exit(rval ? EXIT_FAILURE : EXIT_SUCCESS);
+    }
+
+    /*
+     * --write-file <file> writes the register values of a CSV file in as few
+     * requests as possible, nothing is written if any line is invalid
+     */
+    if (wf_path != NULL) {
+        dvlist_t *dv = dnum ? &dvl[dnum - 1] : NULL;
+        wval_t *wv;
+        wplan_t *wplan;
+        int n;
+        int nerr;
+
+        if (unit_c > 1 || poll_ms || rwrite || name_pat != NULL) {
+            printf("ERROR: --write-file can't be used with -w, --name, --poll or several units\n");
+            exit(EXIT_FAILURE);
+        }
+        wv = write_file_load(wf_path, dv, dv ? dv->zba : zba, &n, &nerr);
+        if (wv == NULL) {
+            exit(EXIT_FAILURE);
+        }
+        if (nerr) {
+            printf("ERROR: %d invalid lines in %s, nothing written\n", nerr, wf_path);
+            exit(EXIT_FAILURE);
+        }
+        wplan = wplan_build(wv, n);
+        if (wplan == NULL) {
+            fprintf(stderr, "malloc failed: insufficient memory!\n");
+            exit(EXIT_FAILURE);
+        }
+        modio_debugx(1, "write plan: %d values in %d requests\n", wplan->nval, wplan->nblk);
+
+        /* initialize modbus connection */
+        mb = modbus_init(port, sc, id);
+        if (mb == NULL) {
+            exit(EXIT_FAILURE);
+        }
+        if (dv != NULL) {
+            mbio_turnaround(dv->turnaround);
+        }
+        mbio_gap(tune.gap);
+        rval = write_plan(mb, wplan, verify_o, quiet_o);
+        wplan_free(wplan);
+        free(wv);
+        modbus_close(mb);
+        modbus_free(mb);
+        mbio_close();
+        exit(rval ? EXIT_FAILURE : EXIT_SUCCESS);
+    }
+
+    /*
+     * if -i <id:dev_num,...> read device registers of all units over the same
+     * connection, if --poll <ms> repeat it every <ms>
+     */
+    if (unit_c > 1 || poll_ms) {
+        int slots = 0;
+        for (int i = 0; i < unit_c; i++) {
+            if (unit_l[i].dnum == 0) {
+                unit_l[i].dnum = dnum;
+            }
+            if (unit_l[i].dnum == 0 || unit_l[i].dnum > lsz) {
+                printf("ERROR: no valid device number for unit %d\n", unit_l[i].id);
+                exit(EXIT_FAILURE);
+            }
+            unit_l[i].base = slots;
+            slots += dvl[unit_l[i].dnum - 1].nor;
+            tune_load(port, unit_l[i].id, &unit_l[i].tune);
+        }
 
         /* initialize modbus connection */
         mb = modbus_init(port, sc, id);
         if (mb == NULL) {
             exit(EXIT_FAILURE);
         }
-        read_dev_regs(mb, dvl, dnum - 1);
+        if (poll_ms) {
+            if (shm_name != NULL) {
+                modio_shm = shm_setup(shm_name, dvl, unit_l, unit_c);
+                if (modio_shm == NULL) {
+                    exit(EXIT_FAILURE);
+                }
+            }
+            if (rec_path != NULL) {
+                modio_ring = ring_open(rec_path, rec_cap);
+                if (modio_ring == NULL) {
+                    exit(EXIT_FAILURE);
+                }
+            }
+            if (arch_path != NULL) {
+                modio_arch = arch_setup(arch_path, dvl, unit_l, unit_c);
+                if (modio_arch == NULL) {
+                    exit(EXIT_FAILURE);
+                }
+            }
+            modio_alarm = alarm_open(alarm_path);
+            if (modio_alarm == NULL) {
+                exit(EXIT_FAILURE);
+            }
+            if (!quiet_o) {
+                window_init(win_ms, stddev_o);
+            }
+            modio_reload = reload_start(dvl, lsz);
+            poll_units(mb, dvl, unit_l, unit_c, poll_ms, quiet_o || win_ms);
+            for (int i = 0; i < unit_c; i++) {
+                window_flush(&dvl[unit_l[i].dnum - 1], &unit_l[i]);
+            }
+            reload_stop(modio_reload);
+            shm_detach(modio_shm);
+            ring_close(modio_ring);
+            arch_close(modio_arch);
+            alarm_close(modio_alarm);
+            rval = 0;
+        } else {
+            rval = read_units(mb, dvl, unit_l, unit_c, quiet_o);
+        }
+        modbus_close(mb);
+        modbus_free(mb);
+        mbio_close();
+        exit(rval ? EXIT_FAILURE : EXIT_SUCCESS);
+    }
+
+    /* if -e <dev_num> read device registers defined in configuration file */
+    if (rall && dnum) {
+
+        /* initialize modbus connection */
+        lm = modio_connect(port, sc, id);
+        if (lm == NULL) {
+            exit(EXIT_FAILURE);
+        }
+        modio_set_turnaround(lm, dvl[dnum - 1].turnaround);
+        mbio_gap(tune.gap);
+        read_dev_regs(lm, dvl, dnum - 1);
+        modio_close(lm);
+        mbio_close();
         exit(EXIT_SUCCESS);
     }
 
@@ -419,122 +1094,96 @@ main(int argc, char **argv)
         }
     }
 
-    /* allocate memory for address array if it's still NULL (-a wasn't present) */
+    /* allocate memory for address array if it's still NULL (-g wasn't present) */
     if (reg_l == NULL) {
-        reg_l = (rreg_t *)malloc(sizeof(rreg_t) * (reg_c + 1));
-        reg_l->reg = reg;  /* reg_c = 1 */
+        reg_l = (rreg_t *)malloc(sizeof(rreg_t));
+        if (reg_l == NULL) {
+            fprintf(stderr, "malloc failed: insufficient memory!\n");
+            exit(EXIT_FAILURE);
+        }
+        reg_l->reg = reg;
+        reg_n = 1;
     }
 
-    /* if -a, address based access is enabled calculate register access address */
-    if (addrac) {
-
-        /* loop over the register list... */
-        for (int i = 0; i <= reg_c; i++) {
-
-            /* calculate the digits of the register address and allocate the proper memory size */
-            char *hexreg = NULL;
-            if (reg_l[i].reg != 0) {
-                hexreg = (char *)malloc(sizeof(char) * (int) (log10(reg_l[i].reg) + 1));
-            } else {
-                hexreg = (char *)malloc(sizeof(char));
-            }
-            sprintf(hexreg, "%x", reg_l[i].reg);
-            size_t nod = strlen(hexreg);
-            if (nod > 4) {
+    /*
+     * calculate the register access address of every register number, or
+     * with -a the register number of every address of type -t, and drop the
+     * registers listed more than once
+     */
+    seen = (uint8_t *)calloc(4 * 0x10000 / 8, sizeof(uint8_t));
+    if (seen == NULL) {
+        fprintf(stderr, "malloc failed: insufficient memory!\n");
+        exit(EXIT_FAILURE);
+    }
+    reg_c = 0;
+    for (int i = 0; i < reg_n; i++) {
+        rreg_t *rr = &reg_l[reg_c];
+        int slot;
+
+        *rr = reg_l[i];
+        if (addrac) {
+            if (rr->reg < 0 || rr->reg > 0xffff) {
                 printf("ERROR: invalid register number\n");
                 exit(EXIT_FAILURE);
             }
-            reg_l[i].raddr = (int )(0x0 + strtoul(hexreg, NULL, 16));
-            modio_debugx(2, "register type: %d\n", rtype);
-            modio_debugx(2, "register address: %d\n", reg_l[i].raddr);
+            rr->raddr = rr->reg;
             switch (rtype) {
                 case COIL:
-                    reg_l[i].reg = 0 + reg_l[i].raddr + zba;
-                    reg_l[i].xaddr = 0x00000 + reg_l[i].raddr;
+                    rr->reg = 0 + rr->raddr + zba;
+                    rr->xaddr = 0x00000 + rr->raddr;
                     break;
                 case INPUT_B:
-                    reg_l[i].reg = 10000 + reg_l[i].raddr + zba;
-                    reg_l[i].xaddr = 0x10000 + reg_l[i].raddr;
+                    rr->reg = 10000 + rr->raddr + zba;
+                    rr->xaddr = 0x10000 + rr->raddr;
                     break;
                 case INPUT_R:
-                    reg_l[i].reg = 30000 + reg_l[i].raddr + zba;
-                    reg_l[i].xaddr = 0x30000 + reg_l[i].raddr;
+                    rr->reg = 30000 + rr->raddr + zba;
+                    rr->xaddr = 0x30000 + rr->raddr;
                     break;
                 case HOLDING:
-                    reg_l[i].reg = 40000 + reg_l[i].raddr + zba;
-                    reg_l[i].xaddr = 0x40000 + reg_l[i].raddr;
+                    rr->reg = 40000 + rr->raddr + zba;
+                    rr->xaddr = 0x40000 + rr->raddr;
                     break;
                 default:
                     usage(argv[0]);
                     exit(EXIT_FAILURE);
             }
-            reg_l[i].rtype = rtype;
-            modio_debugx(2, "register: %d\n", reg_l[i].reg);
-            modio_debugx(2, "register hex address: 0x%x\n", reg_l[i].xaddr);
-        }
-
-    /* ...otherwise calculate register address from number and store it into raddr_l array */
-    } else {
-        for (int i = 0; i <= reg_c; i++) {
+            rr->rtype = rtype;
+        } else {
+            int rt;
 
-            /* if register number access, calculate rtype */
-            char *rgnum = int_to_str(reg_l[i].reg);
-            size_t nod = strlen(rgnum);      /* calculate the number of digits */
-            modio_debugx(3,"reg: %s, nod: %d\n", rgnum, nod);
-            if (nod < 5) {                      /* if nod < 5 it's COIL */
-                rtype = COIL;
-            } else if (nod == 5) {              /* calculate the 5th digit */
-                int msd = rgnum[0] - '0';       /* calculate the most significant digit */
-                if (msd > 2) {                  /* if msd > 2 */
-                    rtype = msd - 1;            /* subtract 1 to map address on register type encoding */
-                } else if (msd < 2) {           /* if msd 1 or 0 matches register type encoding */
-                    rtype = msd;
-                } else {                        /* if msd is 2 invalid address */
-                    printf("ERROR: invalid address\n");
-                    exit(EXIT_FAILURE);
-                }
-            } else {                            /* if nod > 5 invalid register number */
+            rr->xaddr = reg_xaddr(rr->reg, zba, &rt);
+            if (rr->xaddr == -1) {
                 printf("ERROR: invalid address\n");
                 exit(EXIT_FAILURE);
             }
-            modio_debugx(2, "register number: %d\n", reg_l[i].reg);
-            modio_debugx(2, "register type: %d\n", rtype);
-            switch (rtype) {
-                case COIL:
-                    reg_l[i].raddr = reg_l[i].reg - zba - 0;
-                    reg_l[i].xaddr = reg_l[i].raddr + 0x0;
-                    break;
-                case INPUT_B:
-                    reg_l[i].raddr = reg_l[i].reg - zba - 10000;
-                    reg_l[i].xaddr = reg_l[i].raddr + 0x10000;
-                    break;
-                case INPUT_R:
-                    reg_l[i].raddr = reg_l[i].reg - zba - 30000;
-                    reg_l[i].xaddr = reg_l[i].raddr + 0x30000;
-                    break;
-                case HOLDING:
-                    reg_l[i].raddr = reg_l[i].reg - zba - 40000;
-                    reg_l[i].xaddr = reg_l[i].raddr + 0x40000;
-                    break;
-                default:
-                    usage(argv[0]);
-                    exit(EXIT_FAILURE);
-            }
-            reg_l[i].rtype = rtype;
-            modio_debugx(2, "register address: %d\n", reg_l[i].raddr);
-            modio_debugx(2, "register hex address: 0x%x\n", reg_l[i].xaddr);
+            rr->raddr = rr->xaddr & 0xffff;
+            rr->rtype = rt;
         }
+        modio_debugx(2, "register: %d type: %d hex address: 0x%x\n", rr->reg, rr->rtype, rr->xaddr);
+        slot = rr->rtype * 0x10000 + rr->raddr;
+        if (seen[slot / 8] & (1 << (slot % 8))) {
+            continue;
+        }
+        seen[slot / 8] |= 1 << (slot % 8);
+        reg_c++;
     }
+    free(seen);
+    modio_debugx(2, "regs = %d\n", reg_c);
+    reg_c--;            /* index of the last register */
 
     /* make current address first address in reg_l array of regs/addresses */
     xreg = reg_l[0].xaddr;
 
     /* initialize modbus connection */
-    mb = modbus_init(port, sc, id);
-    if (mb == NULL) {
-        printf("ERROR: modbus_init failed\n");
+    lm = modio_connect(port, sc, id);
+    if (lm == NULL) {
         exit(EXIT_FAILURE);
     }
+    if (dnum) {
+        modio_set_turnaround(lm, dvl[dnum - 1].turnaround);
+    }
+    mbio_gap(tune.gap);
 
     /* if -w <data> and -t 0|3 write <data> to <address> */
     if (rwrite == TRUE) {
@@ -553,8 +1202,11 @@ main(int argc, char **argv)
             }
             modio_debugx(2, "reg: %d, addr: 0x%x type: %d val:%d\n", reg, xreg, rtype, val);
             for (int j = 0; j < len; j++) {
+                modio_reg_t wr = { reg, rtype, xreg & 0xffff, 1, MODIO_DEC, 1.0, NULL, "", "", "" };
+                uint16_t wv = (uint16_t )val;
+
                 if (rtype == HOLDING) {
-                    rval = modbus_write_register(mb, xreg, val);
+                    rval = modio_write(lm, &wr, &wv, 1);
                     if (rval == -1) {
                         printf("ERROR:(%s) modbus_write_register reg:0x%08x, path:%s\n",
                                modbus_strerror(errno),
@@ -564,7 +1216,7 @@ main(int argc, char **argv)
                         exit(EXIT_FAILURE);
                     }
                 } else if (rtype == COIL) {
-                    rval = modbus_write_bit(mb, xreg, val);
+                    rval = modio_write(lm, &wr, &wv, 1);
                     if (rval == -1) {
                         printf("ERROR:(%s) modbus_write_bit reg:0x%08x, path:%s\n",
                                modbus_strerror(errno),
@@ -583,749 +1235,2570 @@ main(int argc, char **argv)
         }
     }
 
-    /* if -r (read register/address) */
+    /*
+     * if -r (read register/address), the registers are read in as few
+     * requests as possible and printed in the order they were listed
+     */
     if (rread == TRUE) {
-        uint16_t *reg16p;       /* pointer to 16bit register */
-        uint8_t *reg8p;         /* pointer to 8bit register */
-
-        int len_i = len;        /* save initial len */
-
-        /* loop over all addresses or registers */
+        char rv[PRVAL_LEN];     /* printed value */
+        dreg_t *rl;             /* registers to read */
+        dreg_t **sel;           /* pointers to the registers to read */
+        int *rblk;              /* block read of every register */
+        void **bbuf;            /* values of every block read, NULL if it failed */
+        plan_t *plan;
+        int fail = 0;
+
+        rl = (dreg_t *)calloc(reg_c + 1, sizeof(dreg_t));
+        sel = (dreg_t **)malloc((reg_c + 1) * sizeof(dreg_t *));
+        rblk = (int *)malloc((reg_c + 1) * sizeof(int));
+        if (rl == NULL || sel == NULL || rblk == NULL) {
+            fprintf(stderr, "malloc failed: insufficient memory!\n");
+            exit(EXIT_FAILURE);
+        }
         for (int i = 0; i <= reg_c; i++) {
-            reg = reg_l[i].reg;
-            xreg = reg_l[i].xaddr;
-            if (dnum != 0) {
-                len = len_i;    /* restore len */
+            dreg_t *dr = NULL;  /* register of the device, if defined */
+            dreg_t *r = &rl[i];
 
-                /* set print format to decimal */
-                int prfmt = 2;
-                rtype = (hashmap_get(&regmap, int_to_str(reg)) ?
-                         hashmap_get(&regmap, int_to_str(reg))->type :
-                         reg_l[i].rtype
-                );
-                len = (hashmap_get(&regmap, int_to_str(reg)) ?
-                       hashmap_get(&regmap, int_to_str(reg))->len :
-                       len
-                );
-                pfm = (hashmap_get(&regmap, int_to_str(reg)) ?
-                       hashmap_get(&regmap, int_to_str(reg))->prfmt :
-                       prfmt
-                );
+            /* print registers the device file doesn't define as decimal */
+            if (dnum != 0) {
+                dr = hashmap_get(&regmap, int_to_str(reg_l[i].reg));
             }
-            modio_debugx(1, 
-                         "reg: %d reg_c: %d addr: 0x%x rtype: %d len: %d pfm: %d\n", 
-                         reg,
+            r->num = reg_l[i].reg;
+            r->addr = reg_l[i].xaddr;
+            r->type = dr ? dr->type : (int )reg_l[i].rtype;
+            r->len = dr ? dr->len : len;
+            r->prfmt = dnum ? (dr ? dr->prfmt : DEC) : (int )pfm;
+            r->scale = dr ? dr->scale : 1;
+            r->info = dr ? dr->info : NULL;
+            r->ttl = dr ? dr->ttl : modio_cache_ms;
+            r->prval = prval_get(r->type, r->prfmt, dnum != 0);
+            modio_debugx(1,
+                         "reg: %d reg_c: %d addr: 0x%x rtype: %d len: %d pfm: %d\n",
+                         r->num,
                          reg_c,
-                         xreg,
-                         rtype,
-                         len,
-                         pfm
+                         r->addr,
+                         r->type,
+                         r->len,
+                         r->prfmt
             );
-            switch (rtype) {
-                case COIL:
-                case INPUT_B:
-                    if (rtype == COIL) {
-                            rval = modbus_read_bits(mb, xreg, len, creg);
-                            reg8p = creg;
-                    } else {
-                        rval = modbus_read_input_bits(mb, xreg, len, ibreg);
-                        reg8p = ibreg;
-                    }
-                    if (rval == -1) {
-                        printf("ERROR:(%s) modbus_read_xx reg:0x%x, count: %d, path: %s\n",
-                               modbus_strerror(errno),
-                               reg,
-                               len,
-                               port
-                        );
-                        exit(EXIT_FAILURE);
-                    } else {
-                        for (int j = 0; j < len; j++) {
-                            if (pfm == BIN) {
-                                if (dnum) {
-                                    const char *fmt_m = "reg: %05d name: %-35s address: 0x%08x value: %16s";
-                                    const char *fmt_s = "reg: %05d name: %s address: 0x%08x value: %16s";
-                                    if (reg_c >= 1 || len > 1) {
-                                        printf(fmt_m,
-                                               reg_l[i].reg + j,
-                                               ((hashmap_get(&regmap, int_to_str(reg_l[i].reg))) ?
-                                                 hashmap_get(&regmap, int_to_str(reg_l[i].reg))->name :
-                                                 "UNDEFINED"),
-                                               xreg,
-                                               int_to_bin(*(uint8_t *) reg8p)
-                                        );
-                                    } else {
-                                        printf(fmt_s,
-                                               reg_l[i].reg + j,
-                                               ((hashmap_get(&regmap, int_to_str(reg_l[i].reg))) ?
-                                                 hashmap_get(&regmap, int_to_str(reg_l[i].reg))->name :
-                                                 "UNDEFINED"),
-                                               xreg,
-                                               int_to_bin(*(uint8_t *) reg8p)
-                                        );
-                                    }
-                                } else {
-                                    printf("reg: %05d address: 0x%08x value: %16s\n",
-                                           reg_l[i].reg + j,
-                                           xreg,
-                                           int_to_bin(*(uint8_t *) reg8p)
-                                    );
-                                }
-                            } else if (pfm == HEX) {
-                                if (dnum) {
-                                    const char *fmt_m = "reg: %05d name: %-35s address: 0x%08x value: 0x%x\n";
-                                    const char *fmt_s = "reg: %05d name: %s address: 0x%08x value: 0x%x\n";
-                                    if (reg_c >= 1 || len > 1) {
-                                        printf(fmt_m,
-                                               reg_l[i].reg + j,
-                                               ((hashmap_get(&regmap, int_to_str(reg_l[i].reg))) ?
-                                                 hashmap_get(&regmap, int_to_str(reg_l[i].reg))->name :
-                                                 "UNDEFINED"),
-                                               xreg,
-                                               *(uint8_t *) reg8p
-                                        );
-                                    } else {
-                                        printf(fmt_s,
-                                               reg_l[i].reg + j,
-                                               ((hashmap_get(&regmap, int_to_str(reg_l[i].reg))) ?
-                                                 hashmap_get(&regmap, int_to_str(reg_l[i].reg))->name :
-                                                 "UNDEFINED"),
-                                               xreg,
-                                               *(uint8_t *) reg8p
-                                        );
-                                    }
-                                } else {
-                                    printf("reg: %05d address: 0x%08x value: 0x%x\n",
-                                           reg_l[i].reg + j,
-                                           xreg,
-                                           *(uint8_t *) reg8p
-                                    );
-                                }
-                            } else if (pfm == ASC) {
-                                if (dnum) {
-                                    const char *fmt_m = "reg: %05d name: %-35s address: 0x%08x value: %s\n";
-                                    const char *fmt_s = "reg: %05d name: %s address: 0x%08x value: %s\n";
-                                    if (reg_c >= 1) {
-                                        printf(fmt_m,
-                                               reg_l[i].reg + j,
-                                               ((hashmap_get(&regmap, int_to_str(reg_l[i].reg))) ?
-                                                 hashmap_get(&regmap, int_to_str(reg_l[i].reg))->name :
-                                                 "UNDEFINED"),
-                                               xreg,
-                                               (char *) reg8p
-                                        );
-                                    } else {
-                                        printf(fmt_s,
-                                               reg_l[i].reg + j,
-                                               ((hashmap_get(&regmap, int_to_str(reg_l[i].reg))) ?
-                                                 hashmap_get(&regmap, int_to_str(reg_l[i].reg))->name :
-                                                 "UNDEFINED"),
-                                               xreg,
-                                               (char *) reg8p
-                                        );
-                                    }
-                                } else {
-                                    printf("reg: %05d address: 0x%08x value: %s\n",
-                                           reg_l[i].reg + j,
-                                           xreg,
-                                           (char *) reg8p
-                                    );
-                                }
-                                break;
-                            } else if (pfm == DEC) {
-                                if (dnum) {
-                                    const char *fmt_m = "reg: %05d name: %-35s address: 0x%08x value: %d\n";
-                                    const char *fmt_s = "reg: %05d name: %s address: 0x%08x value: %d\n";
-                                    if (reg_c >= 1 || len > 1) {
-                                        printf(fmt_m,
-                                               reg_l[i].reg + j,
-                                               ((hashmap_get(&regmap, int_to_str(reg_l[i].reg))) ?
-                                                 hashmap_get(&regmap, int_to_str(reg_l[i].reg))->name :
-                                                 "UNDEFINED"),
-                                               xreg,
-                                               *(uint8_t *) reg8p
-                                        );
-                                    } else {
-                                        printf(fmt_s,
-                                               reg_l[i].reg + j,
-                                               ((hashmap_get(&regmap, int_to_str(reg_l[i].reg))) ?
-                                                 hashmap_get(&regmap, int_to_str(reg_l[i].reg))->name :
-                                                 "UNDEFINED"),
-                                               xreg,
-                                               *(uint8_t *) reg8p
-                                        );
-
-                                    }
-                                } else {
-                                    printf("reg: %05d address: 0x%08x value: %d\n",
-                                           reg_l[i].reg + j,
-                                           xreg, *(uint8_t *) reg8p
-                                    );
-                                }
-                            }
-                            reg8p++;
-                            reg++;
-                            xreg++;
-                        }
-                    }
+            if (r->len < 1 || r->len > ((r->type == COIL || r->type == INPUT_B) ? PLAN_MAX_BITS : PLAN_MAX_REGS)) {
+                printf("ERROR: invalid length %d of register %d\n", r->len, r->num);
+                exit(EXIT_FAILURE);
+            }
+            sel[i] = r;
+        }
+        plan = plan_build(sel, reg_c + 1, &tune);
+        if (plan == NULL || (bbuf = (void **)calloc(plan->nblk ? plan->nblk : 1, sizeof(void *))) == NULL) {
+            fprintf(stderr, "malloc failed: insufficient memory!\n");
+            exit(EXIT_FAILURE);
+        }
+        modio_debugx(1, "plan: %d registers in %d requests\n", plan->nreg, plan->nblk);
+
+        /* read every block */
+        for (int b = 0; b < plan->nblk; b++) {
+            pblk_t *bk = &plan->blk[b];
+
+            bbuf[b] = calloc(bk->len, (bk->type == COIL || bk->type == INPUT_B) ? sizeof(uint8_t) : sizeof(uint16_t));
+            if (bbuf[b] == NULL) {
+                fprintf(stderr, "malloc failed: insufficient memory!\n");
+                exit(EXIT_FAILURE);
+            }
+            if (read_span(lm, bk->type, bk->addr, bk->len, bk->ttl, (uint16_t *)bbuf[b], (uint8_t *)bbuf[b]) == -1) {
+                printf("ERROR:(%s) modbus_read_xx addr:0x%x, count: %d, path: %s\n",
+                       modbus_strerror(errno),
+                       bk->addr,
+                       bk->len,
+                       port
+                );
+                free(bbuf[b]);
+                bbuf[b] = NULL;
+                fail = 1;
+            }
+            for (int j = bk->first; j < bk->first + bk->nreg; j++) {
+                rblk[plan->regs[j] - rl] = b;
+            }
+        }
+
+        /* print the registers from their block */
+        for (int i = 0; i <= reg_c; i++) {
+            dreg_t *r = &rl[i];
+            int b = rblk[i];
+            int off;
+            const void *v;
+
+            if (bbuf[b] == NULL) {
+                continue;
+            }
+            off = (r->addr & 0xffff) - plan->blk[b].addr;
+            if (r->type == COIL || r->type == INPUT_B) {
+                v = (const uint8_t *)bbuf[b] + off;
+            } else {
+                v = (const uint16_t *)bbuf[b] + off;
+            }
+            for (int j = 0, n; j < r->len; j += n) {
+                n = r->prval(rv, sizeof(rv), v, j, r->len, r->scale, r->info ? r->info->engu : "");
+                if (n <= 0) {
+                    printf("Error, not aligned memory size\n");
                     break;
-                case INPUT_R:
-                case HOLDING:
-                    if (rtype == HOLDING) {
-                        rval = modbus_read_registers(mb, xreg, len, hreg);
-                        reg16p = hreg;
-                    } else {
-                        rval = modbus_read_input_registers(mb, xreg, len, ireg);
-                        reg16p = ireg;
-                    }
-                    if (rval == -1) {
-                        printf("ERROR:(%s) modbus_read_xx reg: 0x%x count:%d path:%s\n",
-                               modbus_strerror(errno),
-                               reg,
-                               len,
-                               port
-                        );
-                        exit(EXIT_FAILURE);
-                    } else {
-                        for (int j = 0; j < len; j++) {
-                            if (pfm == BIN) {
-                                const char *fmt_m = "reg: %05d name: %-35s address: 0x%08x value: %16s";
-                                const char *fmt_s = "reg: %05d name: %s address: 0x%08x value: %16s";
-                                if (dnum) {
-                                    if (reg_c >= 1 || len > 1) {
-                                        printf(fmt_m,
-                                               reg_l[i].reg + j,
-                                               ((hashmap_get(&regmap, int_to_str(reg_l[i].reg))) ?
-                                                 hashmap_get(&regmap, int_to_str(reg_l[i].reg))->name :
-                                                 "UNDEFINED"),
-                                               xreg,
-                                               int_to_bin(*(uint16_t *) reg16p)
-                                        );
-                                    } else {
-                                        printf(fmt_s,
-                                               reg_l[i].reg + j,
-                                               ((hashmap_get(&regmap, int_to_str(reg_l[i].reg))) ?
-                                                 hashmap_get(&regmap, int_to_str(reg_l[i].reg))->name :
-                                                 "UNDEFINED"),
-                                               xreg,
-                                               int_to_bin(*(uint16_t *) reg16p)
-                                        );
-                                    }
-                                } else {
-                                    printf("reg: %05d address: 0x%08x value: %16s\n",
-                                           reg_l[i].reg + j,
-                                           xreg,
-                                           int_to_bin(*(uint16_t *) reg16p)
-                                    );
-                                }
-                            } else if (pfm == HEX) {
-                                if (dnum) {
-                                    const char *fmt_m = "reg: %05d name: %-35s address: 0x%08x value: 0x%x\n";
-                                    const char *fmt_s = "reg: %05d name: %s address: 0x%08x value: 0x%x\n";
-                                    if (reg_c >= 1 || len > 1) {
-                                        printf(fmt_m,
-                                               reg_l[i].reg + j,
-                                               ((hashmap_get(&regmap, int_to_str(reg_l[i].reg))) ?
-                                                 hashmap_get(&regmap, int_to_str(reg_l[i].reg))->name :
-                                                 "UNDEFINED"),
-                                               xreg,
-                                               *(uint16_t *) reg16p
-                                        );
-                                    } else {
-                                        printf(fmt_s,
-                                               reg_l[i].reg + j,
-                                               ((hashmap_get(&regmap, int_to_str(reg_l[i].reg))) ?
-                                                 hashmap_get(&regmap, int_to_str(reg_l[i].reg))->name :
-                                                 "UNDEFINED"),
-                                               xreg,
-                                               *(uint16_t *) reg16p
-                                        );
-
-                                    }
-                                } else {
-                                    printf("reg: %05d address: 0x%08x value: 0x%x\n",
-                                           reg_l[i].reg + j,
-                                           xreg,
-                                           *(uint16_t *) reg16p
-                                    );
-                                }
-                            } else if (pfm == ASC) {
-                                char *s = words_to_str(reg16p, len);
-                                if (dnum) {
-                                    const char *fmt_m = "reg: %05d name: %-35s address: 0x%08x value: %s\n";
-                                    const char *fmt_s = "reg: %05d name: %s address: 0x%08x value: %s\n";
-                                    if (reg_c >= 1) {
-                                        printf(fmt_m,
-                                               reg_l[i].reg + j,
-                                               ((hashmap_get(&regmap, int_to_str(reg_l[i].reg))) ?
-                                                 hashmap_get(&regmap, int_to_str(reg_l[i].reg))->name :
-                                                 "UNDEFINED"),
-                                               xreg,
-                                               s
-                                        );
-                                    } else {
-                                        printf(fmt_s,
-                                               reg_l[i].reg + j,
-                                               ((hashmap_get(&regmap, int_to_str(reg_l[i].reg))) ?
-                                                 hashmap_get(&regmap, int_to_str(reg_l[i].reg))->name :
-                                                 "UNDEFINED"),
-                                               xreg,
-                                               s
-                                        );
-                                    }
-                                } else {
-                                    printf("reg: %05d address: 0x%08x value: %s\n",
-                                           reg_l[i].reg + j,
-                                           xreg,
-                                           s
-                                    );
-                                }
-                                break;
-                            } else if (pfm == BFD || pfm == BFX) {
-                                char *s = (pfm == BFD) ? mem_to_bytes(reg16p, len, int_to_str)
-                                                       : mem_to_bytes(reg16p, len, hex_to_str);
-                                if (dnum) {
-                                    const char *fmt_m = "reg: %05d name: %-35s address: 0x%08x value: %s\n";
-                                    const char *fmt_s = "reg: %05d name: %s address: 0x%08x value: %s\n";
-                                    if (reg_c >= 1) {
-                                        printf(fmt_m,
-                                               reg_l[i].reg + j,
-                                               ((hashmap_get(&regmap, int_to_str(reg_l[i].reg))) ?
-                                                 hashmap_get(&regmap, int_to_str(reg_l[i].reg))->name :
-                                                 "UNDEFINED"),
-                                               xreg,
-                                               s
-                                        );
-                                    } else {
-                                        printf(fmt_s,
-                                               reg_l[i].reg + j,
-                                               ((hashmap_get(&regmap, int_to_str(reg_l[i].reg))) ?
-                                                 hashmap_get(&regmap, int_to_str(reg_l[i].reg))->name :
-                                                 "UNDEFINED"),
-                                               xreg,
-                                               s
-                                        );
-                                    }
-                                } else {
-                                    printf("reg: %05d address: 0x%08x value: %s\n",
-                                           reg_l[i].reg + j,
-                                           xreg,
-                                           s
-                                    );
-                                }
-                                break;
-                            } else if (pfm == HLO) {
-                                if (len % 2 != 0) {
-                                    printf("Error, not aligned memory size\n");
-                                    break;
-                                }
-                                int hlw = len / 2;
-                                for (int k = 0; k < hlw; k++) {
-                                    if (dnum) {
-                                        const char *fmt_m = "reg: %05d name: %-35s address: 0x%08x value: %li%s\n";
-                                        const char *fmt_s = "reg: %05d name: %s address: 0x%08x value: %li%s\n";
-                                        if (reg_c >= 1) {
-                                            printf(fmt_m,
-                                                   reg_l[i].reg + 2 * k,
-                                                   ((hashmap_get(&regmap, int_to_str(reg_l[i].reg))) ?
-                                                     hashmap_get(&regmap, int_to_str(reg_l[i].reg))->name :
-                                                     "UNDEFINED"),
-                                                   xreg + 2 * k,
-                                                   concat_inv16(reg16p, 2),
-                                                   ((hashmap_get(&regmap, int_to_str(reg_l[i].reg))) ?
-                                                     hashmap_get(&regmap, int_to_str(reg_l[i].reg))->engu :
-                                                     "")
-                                            );
-                                        } else {
-                                            printf(fmt_s,
-                                                   reg_l[i].reg + 2 * k,
-                                                   ((hashmap_get(&regmap, int_to_str(reg_l[i].reg))) ?
-                                                     hashmap_get(&regmap, int_to_str(reg_l[i].reg))->name :
-                                                     "UNDEFINED"),
-                                                   xreg + 2 * k,
-                                                   concat_inv16(reg16p, 2),
-                                                   ((hashmap_get(&regmap, int_to_str(reg_l[i].reg))) ?
-                                                     hashmap_get(&regmap, int_to_str(reg_l[i].reg))->engu :
-                                                     "")
-                                            );
-                                        }
-                                    } else {
-                                        printf("reg: %05d address: 0x%08x value: %li\n",
-                                               reg_l[i].reg + 2 * k,
-                                               xreg + 2  * k,
-                                               concat_inv16(reg16p, 2)
-                                        );
-                                    }
-                                    reg16p += 2;
-                                }
-                                break;
-                            } else if (pfm == DEC) {
-                                if (dnum) {
-                                    const char *fmt_m = "reg: %05d name: %-35s address: 0x%08x value: %.2f%s\n";
-                                    const char *fmt_s = "reg: %05d name: %s address: 0x%08x value: %.2f%s\n";
-                                    if (reg_c >= 1 || len > 1) {
-                                        printf(fmt_m,
-                                               reg_l[i].reg + j,
-                                               ((hashmap_get(&regmap, int_to_str(reg_l[i].reg))) ?
-                                                 hashmap_get(&regmap, int_to_str(reg_l[i].reg))->name :
-                                                 "UNDEFINED"),
-                                               xreg,
-                                               *(uint16_t *) reg16p *
-                                               ((hashmap_get(&regmap, int_to_str(reg_l[i].reg))) ?
-                                                 hashmap_get(&regmap, int_to_str(reg_l[i].reg))->scale : 1),
-                                               ((hashmap_get(&regmap, int_to_str(reg_l[i].reg))) ?
-                                                 hashmap_get(&regmap, int_to_str(reg_l[i].reg))->engu :
-                                                 "")
-                                        );
-                                    } else {
-                                        printf(fmt_s,
-                                               reg_l[i].reg + j,
-                                               ((hashmap_get(&regmap, int_to_str(reg_l[i].reg))) ?
-                                                 hashmap_get(&regmap, int_to_str(reg_l[i].reg))->name :
-                                                 "UNDEFINED"),
-                                               xreg,
-                                               *(uint16_t *) reg16p *
-                                               ((hashmap_get(&regmap, int_to_str(reg_l[i].reg))) ?
-                                                 hashmap_get(&regmap, int_to_str(reg_l[i].reg))->scale : 1),
-                                               ((hashmap_get(&regmap, int_to_str(reg_l[i].reg))) ?
-                                                 hashmap_get(&regmap, int_to_str(reg_l[i].reg))->engu :
-                                                "")
-                                        );
-                                    }
-                                } else {
-                                    printf("reg: %05d address: 0x%08x value: %d\n",
-                                           reg_l[i].reg + j,
-                                           xreg,
-                                           *(uint16_t *) reg16p
-                                    );
-                                }
-                            } else {
-                                printf("pfm = %d\n", pfm);
-                            }
-                            reg16p++;
-                            reg++;
-                            if (pfm != HLO) {
-                                xreg++;
-                            }
-                        }
+                }
+                if (dnum) {
+
+                    /* pad the names if more than one line is printed */
+                    printf((reg_c >= 1 || n < r->len) ? "reg: %05d name: %-35s address: 0x%08x value: %s\n"
+                               : "reg: %05d name: %s address: 0x%08x value: %s\n",
+                           r->num + j,
+                           r->info ? r->info->name : "UNDEFINED",
+                           r->addr + j,
+                           rv
+                    );
+                } else {
+                    printf("reg: %05d address: 0x%08x value: %s\n", r->num + j, r->addr + j, rv);
+                }
+            }
+        }
+        for (int b = 0; b < plan->nblk; b++) {
+            free(bbuf[b]);
+        }
+        free(bbuf);
+        plan_free(plan);
+        free(rblk);
+        free(sel);
+        free(rl);
+        modio_close(lm);
+        mbio_close();
+        exit(fail ? EXIT_FAILURE : EXIT_SUCCESS);
+    }
+    modio_close(lm);
+    mbio_close();
+    exit(EXIT_SUCCESS);
+}
+
+/*
+ * Read device registers through libmodio, one request per register
+ */
+void
+read_dev_regs(modio_t *m, dvlist_t *dvl, int dnum)
+{
+    printf("%s %s %s:\n", dvl[dnum].type, dvl[dnum].manfc, dvl[dnum].model);
+    printf("%-5s %-35s %-10s %-8s\n", "REG", "NAME", "ADDRESS", "VALUE");
+    dvlist_t *dv = &dvl[dnum];
+    dreg_t *r = dv->regs;
+    double *val = NULL;
+    uint16_t words[PLAN_MAX_REGS];
+    uint8_t bits[PLAN_MAX_BITS];
+    rsmpl_t smp;
+
+    if (dv->nod) {
+        val = (double *)malloc((dv->nor + dv->nod) * sizeof(double));
+        if (val == NULL) {
+            fprintf(stderr, "malloc failed: insufficient memory!\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int i = 0; i < dv->nor; i++) {
+        if (read_span(m, r[i].type, r[i].addr & 0xffff, r[i].len, r[i].ttl, words, bits) == -1) {
+            printf("ERROR:(%s) modbus_read_xx addr:0x%x, count: %d\n",
+                   modbus_strerror(errno),
+                   r[i].addr,
+                   r[i].len
+            );
+            exit(EXIT_FAILURE);
+        }
+        store_reg(&r[i], words, bits, 0, &smp);
+        print_dev_reg(&r[i], "");
+        if (val != NULL) {
+            val[i] = dreg_value(&r[i], smp.raw, smp.nw);
+        }
+    }
+    if (val != NULL) {
+        drv_out(dv, val, "");
+        free(val);
+    }
+}
+
+/*
+ * Read the registers of several units sharing one modbus connection.
+ * Units are served round robin, one request per unit on every turn, so
+ * a slow unit only delays the others by its own requests. A unit that
+ * doesn't answer UNIT_MAX_FAILS requests in a row is dropped, and left
+ * out for UNIT_RETRY_CYCLES calls when polling. Values are not printed
+ * if quiet is set. Returns the number of dropped units.
+ */
+int
+read_units(modbus_t *mb, dvlist_t *dvl, unit_t *ul, int uc, int quiet)
+{
+    char pfx[16];       /* unit id prefix of printed lines */
+    int pend = 0;       /* units with pending registers */
+    int dead = 0;       /* dropped units */
+    rsmpl_t smp;        /* register sample */
+
+    for (int i = 0; i < uc; i++) {
+        ul[i].nxt = 0;
+        if (ul[i].dead && --ul[i].retry <= 0) {
+            ul[i].dead = FALSE;
+            ul[i].fails = 0;
+        }
+        if (!ul[i].dead) {
+            pend++;
+        }
+        unit_val(&ul[i], &dvl[ul[i].dnum - 1]);
+    }
+    if (!quiet) {
+        printf("%-3s %-5s %-35s %-10s %-8s\n", "UID", "REG", "NAME", "ADDRESS", "VALUE");
+    }
+    while (pend > 0) {
+        pend = 0;
+        for (int i = 0; i < uc; i++) {
+            unit_t *u = &ul[i];
+            dvlist_t *dv = &dvl[u->dnum - 1];
+
+            if (u->dead || u->nxt >= dv->nor) {
+                continue;
+            }
+            mbio_set_slave(mb, u->id);
+            mbio_turnaround(dv->turnaround);
+            mbio_gap(u->tune.gap);
+            snprintf(pfx, sizeof(pfx), "%-3d ", u->id);
+            smp.uid = u->id;
+            smp.dnum = u->dnum;
+            smp.rnum = u->nxt;
+            smp.slot = u->base + u->nxt;
+            if (read_dev_reg(mb, &dv->regs[u->nxt], quiet ? NULL : pfx, &smp) == -1 &&
+                unit_noresp(smp.err)) {
+
+                /* drop late responses so they are not taken for the next unit's */
+                modbus_flush(mb);
+                if (++u->fails >= UNIT_MAX_FAILS) {
+                    printf("ERROR: unit %d not responding, skipping %d registers\n",
+                           u->id,
+                           dv->nor - u->nxt - 1
+                    );
+                    u->dead = TRUE;
+                    u->retry = UNIT_RETRY_CYCLES;
+                    dead++;
+
+                    /* the skipped registers failed as well */
+                    for (; u->nxt < dv->nor; u->nxt++) {
+                        smp.rnum = u->nxt;
+                        smp.slot = u->base + u->nxt;
+                        smpl_out(dvl, &smp);
+                        u->val[u->nxt] = NAN;
+                        window_add(dv, u, u->nxt, NAN, TRUE);
                     }
-                    break;
-                default:
-                    usage( argv[0]);
-                    exit(EXIT_FAILURE);
+                    drv_out(dv, u->val, quiet ? NULL : pfx);
+                    unit_done(dv, u);
+                    continue;
+                }
+            } else {
+                u->fails = 0;
+            }
+            smpl_out(dvl, &smp);
+            u->val[u->nxt] = smp.err ? NAN : dreg_value(&dv->regs[u->nxt], smp.raw, smp.nw);
+            window_add(dv, u, u->nxt, u->val[u->nxt], smp.err != 0);
+            if (++u->nxt < dv->nor) {
+                pend++;
+            } else {
+                drv_out(dv, u->val, quiet ? NULL : pfx);
+                unit_done(dv, u);
             }
         }
-        exit(EXIT_SUCCESS);
     }
-    modbus_close(mb);
-    modbus_free(mb);
-    exit(EXIT_SUCCESS);
+    return dead;
+}
+
+/*
+ * check if a register of the polled units has its own period or
+ * priority, or a unit has a tuning file, so the poll cycles need the
+ * scheduler
+ */
+int
+sched_needed(dvlist_t *dvl, unit_t *ul, int uc)
+{
+    for (int i = 0; i < uc; i++) {
+        dvlist_t *dv = &dvl[ul[i].dnum - 1];
+
+        if (ul[i].tune.probed) {
+            return TRUE;
+        }
+        for (int j = 0; j < dv->nor; j++) {
+            if (dv->regs[j].period || dv->regs[j].prio) {
+                return TRUE;
+            }
+        }
+    }
+    return FALSE;
+}
+
+/*
+ * order scheduled block reads by priority, then by period, registers
+ * read every cycle first, then by unit and address
+ */
+int
+sjob_cmp(const void *a, const void *b)
+{
+    const sjob_t *ja = (const sjob_t *)a;
+    const sjob_t *jb = (const sjob_t *)b;
+
+    if (ja->blk->prio != jb->blk->prio) {
+        return jb->blk->prio - ja->blk->prio;
+    }
+    if (ja->blk->period != jb->blk->period) {
+        return ja->blk->period - jb->blk->period;
+    }
+    if (ja->unit != jb->unit) {
+        return ja->unit - jb->unit;
+    }
+    return (ja->blk < jb->blk) ? -1 : (ja->blk > jb->blk);
+}
+
+/*
+ * Read the due registers of the units, for poll cycles of registers
+ * with their own period or priority. The due registers of every unit
+ * are merged into block reads, which are read by priority and period.
+ * Once the cycle has used up its period the remaining blocks are left
+ * due for the next cycle, so a saturated bus serves the high priority
+ * and fast registers first. Units are dropped as in read_units.
+ * Returns the number of dropped units.
+ */
+int
+sched_units(modbus_t *mb, dvlist_t *dvl, unit_t *ul, int uc, int period, int quiet, sched_t *sc)
+{
+    uint16_t words[PLAN_MAX_REGS];
+    uint8_t bits[PLAN_MAX_BITS];
+    char pfx[16];               /* unit id prefix of printed lines */
+    plan_t **pl;                /* read plan of every unit */
+    sjob_t *job = NULL;         /* block reads of the cycle */
+    int nj = 0;
+    int nslot = 0;
+    int dead = 0;
+    int deferred = 0;
+    struct timespec ts;
+    int64_t start;
+    rsmpl_t smp;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    start = (int64_t )ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+    /* register slots change with reloaded device files */
+    for (int i = 0; i < uc; i++) {
+        nslot += dvl[ul[i].dnum - 1].nor;
+    }
+    if (nslot != sc->nslot) {
+        free(sc->due);
+        sc->due = (int64_t *)calloc(nslot ? nslot : 1, sizeof(int64_t));
+        if (sc->due == NULL) {
+            fprintf(stderr, "malloc failed: insufficient memory!\n");
+            exit(EXIT_FAILURE);
+        }
+        sc->nslot = nslot;
+    }
+
+    /* plan the due registers of every unit */
+    pl = (plan_t **)calloc(uc > 0 ? uc : 1, sizeof(plan_t *));
+    if (pl == NULL) {
+        fprintf(stderr, "malloc failed: insufficient memory!\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < uc; i++) {
+        unit_t *u = &ul[i];
+        dvlist_t *dv = &dvl[u->dnum - 1];
+        dreg_t **sel;
+        int n = 0;
+
+        if (u->dead && --u->retry <= 0) {
+            u->dead = FALSE;
+            u->fails = 0;
+        }
+        if (u->dead) {
+            continue;
+        }
+        sel = (dreg_t **)malloc((dv->nor ? dv->nor : 1) * sizeof(dreg_t *));
+        if (sel == NULL) {
+            fprintf(stderr, "malloc failed: insufficient memory!\n");
+            exit(EXIT_FAILURE);
+        }
+        for (int k = 0; k < dv->nor; k++) {
+            int j = dv->order[k];
+
+            if (sc->due[u->base + j] <= start) {
+                sel[n++] = &dv->regs[j];
+            }
+        }
+        pl[i] = plan_build(sel, n, &u->tune);
+        free(sel);
+        if (pl[i] == NULL) {
+            fprintf(stderr, "malloc failed: insufficient memory!\n");
+            exit(EXIT_FAILURE);
+        }
+        if (pl[i]->nblk == 0) {
+            continue;
+        }
+        job = (sjob_t *)realloc(job, (nj + pl[i]->nblk) * sizeof(sjob_t));
+        if (job == NULL) {
+            fprintf(stderr, "malloc failed: insufficient memory!\n");
+            exit(EXIT_FAILURE);
+        }
+        for (int k = 0; k < pl[i]->nblk; k++) {
+            job[nj].unit = i;
+            job[nj].blk = &pl[i]->blk[k];
+            nj++;
+        }
+    }
+    qsort(job, nj, sizeof(sjob_t), sjob_cmp);
+
+    if (!quiet && nj) {
+        printf("%-3s %-5s %-35s %-10s %-8s\n", "UID", "REG", "NAME", "ADDRESS", "VALUE");
+    }
+    for (int k = 0; k < nj; k++) {
+        unit_t *u = &ul[job[k].unit];
+        dvlist_t *dv = &dvl[u->dnum - 1];
+        plan_t *p = pl[job[k].unit];
+        pblk_t *b = job[k].blk;
+        int err = 0;
+
+        /* the first block is always read, the others while the period lasts */
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        if (k > 0 && (int64_t )ts.tv_sec * 1000000000 + ts.tv_nsec - start >= (int64_t )period * 1000000) {
+            deferred += b->nreg;
+            continue;
+        }
+        if (u->dead) {
+            err = ETIMEDOUT;
+        } else {
+            mbio_set_slave(mb, u->id);
+            mbio_turnaround(dv->turnaround);
+            mbio_gap(u->tune.gap);
+            if (read_block(mb, b, words, bits) == -1) {
+                err = errno;
+                printf("ERROR:(%s) modbus_read_xx addr:0x%x, count: %d\n", modbus_strerror(err), b->addr, b->len);
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &smp.mono);
+        clock_gettime(CLOCK_REALTIME, &smp.real);
+        snprintf(pfx, sizeof(pfx), "%-3d ", u->id);
+        unit_val(u, dv);
+        for (int j = b->first; j < b->first + b->nreg; j++) {
+            dreg_t *r = p->regs[j];
+
+            smp.uid = u->id;
+            smp.dnum = u->dnum;
+            smp.rnum = r - dv->regs;
+            smp.slot = u->base + smp.rnum;
+            smp.err = err;
+            smp.nw = (r->len > REG_SIZE) ? REG_SIZE : r->len;
+            if (err == 0) {
+                store_reg(r, words, bits, (r->addr & 0xffff) - b->addr, &smp);
+                if (!quiet) {
+                    print_dev_reg(r, pfx);
+                }
+            }
+            smpl_out(dvl, &smp);
+            u->val[smp.rnum] = err ? NAN : dreg_value(r, smp.raw, smp.nw);
+            window_add(dv, u, smp.rnum, u->val[smp.rnum], err != 0);
+            sc->due[smp.slot] = r->period ? start + (int64_t )r->period * 1000000 : 0;
+        }
+        if (u->dead) {
+            continue;
+        }
+        if (err && unit_noresp(err)) {
+
+            /* drop late responses so they are not taken for the next unit's */
+            modbus_flush(mb);
+            if (++u->fails >= UNIT_MAX_FAILS) {
+                printf("ERROR: unit %d not responding\n", u->id);
+                u->dead = TRUE;
+                u->retry = UNIT_RETRY_CYCLES;
+                dead++;
+            }
+        } else {
+            u->fails = 0;
+        }
+    }
+    if (deferred) {
+        modio_debugx(1, "poll cycle: %d registers deferred\n", deferred);
+    }
+
+    /* the derived registers of the units read in the cycle, over their last values */
+    for (int i = 0; i < uc; i++) {
+        if (pl[i] != NULL && pl[i]->nblk && ul[i].val != NULL) {
+            snprintf(pfx, sizeof(pfx), "%-3d ", ul[i].id);
+            drv_out(&dvl[ul[i].dnum - 1], ul[i].val, quiet ? NULL : pfx);
+            unit_done(&dvl[ul[i].dnum - 1], &ul[i]);
+        }
+    }
+    for (int i = 0; i < uc; i++) {
+        plan_free(pl[i]);
+    }
+    free(pl);
+    free(job);
+    return dead;
+}
+
+/*
+ * Poll the registers of the units every period ms until SIGINT or
+ * SIGTERM. A cycle that overruns the period starts the next one
+ * immediately, missed cycles are not made up for.
+ */
+void
+poll_units(modbus_t *mb, dvlist_t *dvl, unit_t *ul, int uc, int period, int quiet)
+{
+    struct sigaction sa;
+    struct timespec nxt;    /* start of next cycle */
+    struct timespec now;
+    sched_t sc = { 0, NULL };   /* register scheduler state */
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = modio_sigstop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &nxt);
+    while (!modio_stop) {
+        if (sched_needed(dvl, ul, uc)) {
+            sched_units(mb, dvl, ul, uc, period, quiet, &sc);
+        } else {
+            read_units(mb, dvl, ul, uc, quiet);
+        }
+        if (modio_shm != NULL) {
+            shm_cycle(modio_shm);
+        }
+        if (modio_reload != NULL) {
+            reload_apply(modio_reload, dvl, ul, uc);
+        }
+        fflush(stdout);
+
+        nxt.tv_sec += period / 1000;
+        nxt.tv_nsec += (period % 1000) * 1000000L;
+        if (nxt.tv_nsec >= 1000000000L) {
+            nxt.tv_sec++;
+            nxt.tv_nsec -= 1000000000L;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (now.tv_sec > nxt.tv_sec || (now.tv_sec == nxt.tv_sec && now.tv_nsec > nxt.tv_nsec)) {
+            modio_debugx(1, "poll cycle overrun\n");
+            nxt = now;
+        }
+        while (!modio_stop && clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &nxt, NULL) == EINTR) {
+            ;
+        }
+    }
+    free(sc.due);
+}
+
+/*
+ * Start watching the device files of the n devices in dvl for
+ * changes. Returns NULL if inotify is not available or memory runs out,
+ * polling then goes on without reloads.
+ */
+reload_t *
+reload_start(dvlist_t *dvl, int n)
+{
+    reload_t *rl;
+    char user_dir[PATH_MAX];
+
+    rl = (reload_t *)calloc(1, sizeof(reload_t));
+    if (rl == NULL) {
+        return NULL;
+    }
+    rl->fd = inotify_init1(IN_CLOEXEC);
+    if (rl->fd == -1) {
+        modio_debugx(1, "inotify: %s\n", strerror(errno));
+        free(rl);
+        return NULL;
+    }
+    snprintf(user_dir, sizeof(user_dir), "%s/.%s/", getenv("HOME") ? getenv("HOME") : "", PROGR_DIR_NAME);
+    rl->dir[0] = strdup(REGISTER_PATH);
+    rl->dir[1] = strdup(user_dir);
+
+    /* the watcher keeps its own copy of the file names, dvl entries are swapped under it */
+    rl->file = (char **)calloc(n ? n : 1, sizeof(char *));
+    rl->pend = (dvlist_t **)calloc(n ? n : 1, sizeof(dvlist_t *));
+    if (rl->dir[0] == NULL || rl->dir[1] == NULL || rl->file == NULL || rl->pend == NULL) {
+        reload_stop(rl);
+        return NULL;
+    }
+    rl->n = n;
+    for (int i = 0; i < n; i++) {
+        if ((rl->file[i] = strdup(dvl[i].file)) == NULL) {
+            reload_stop(rl);
+            return NULL;
+        }
+    }
+    for (int i = 0; i < 2; i++) {
+        rl->wd[i] = inotify_add_watch(rl->fd, rl->dir[i], IN_CLOSE_WRITE | IN_MOVED_TO);
+    }
+    if (pthread_create(&rl->tid, NULL, reload_watch, rl) != 0) {
+        reload_stop(rl);
+        return NULL;
+    }
+    rl->run = 1;
+    return rl;
+}
+
+/*
+ * Device file watcher thread. A device file that has been written or
+ * moved into a device directory is read again, the new device waits
+ * in its pending slot until the poll loop applies it. A device that
+ * was reloaded again before that replaces the pending one.
+ */
+void *
+reload_watch(void *arg)
+{
+    reload_t *rl = (reload_t *)arg;
+    char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    struct pollfd pfd = { rl->fd, POLLIN, 0 };
+    char path[PATH_MAX];
+    char err[512];
+
+    while (!modio_stop && !rl->quit) {
+        ssize_t len;
+
+        if (poll(&pfd, 1, 500) <= 0) {
+            continue;
+        }
+        len = read(rl->fd, buf, sizeof(buf));
+        for (char *p = buf; len > 0 && p < buf + len; ) {
+            struct inotify_event *ev = (struct inotify_event *)p;
+
+            p += sizeof(struct inotify_event) + ev->len;
+            if (ev->len == 0) {
+                continue;
+            }
+            snprintf(path, sizeof(path), "%s%s", rl->dir[ev->wd == rl->wd[0] ? 0 : 1], ev->name);
+            for (int i = 0; i < rl->n; i++) {
+                dvlist_t *nd;
+
+                if (strcmp(rl->file[i], path) != 0) {
+                    continue;
+                }
+                nd = (dvlist_t *)malloc(sizeof(dvlist_t));
+                if (nd == NULL) {
+                    break;
+                }
+                if (read_dev_file(path, nd, err, sizeof(err)) == -1) {
+                    fprintf(stderr, "reload: %s\n", err);
+                    free_dev(nd);
+                    free(nd);
+                    break;
+                }
+                nd = __atomic_exchange_n(&rl->pend[i], nd, __ATOMIC_ACQ_REL);
+                if (nd != NULL) {
+                    free_dev(nd);
+                    free(nd);
+                }
+                break;
+            }
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Check the registers of reloaded device nd, device number dnum,
+ * against the archive series of the units of the device. Returns the
+ * index of the first register whose series would change, -1 if none.
+ */
+int
+reload_archived(dvlist_t *nd, int dnum, unit_t *ul, int uc)
+{
+    arch_ser_t a;
+
+    for (int i = 0; i < uc; i++) {
+        if (ul[i].dnum != dnum) {
+            continue;
+        }
+        for (int j = 0; j < nd->nor; j++) {
+            arch_ser_set(&a, &ul[i], j, &nd->regs[j]);
+            if (memcmp(&a, &modio_arch->ser[ul[i].base + j], sizeof(arch_ser_t)) != 0) {
+                return j;
+            }
+        }
+    }
+    return -1;
+}
+
+/*
+ * Apply the reloaded devices between two poll cycles. The register
+ * arrays of a replaced device are retired, not freed, and reclaimed
+ * once a whole poll cycle has run on the new ones. With a shared
+ * memory image a device must keep its number of registers, as the
+ * image can't be resized, and with an archive every register must
+ * keep its series.
+ */
+void
+reload_apply(reload_t *rl, dvlist_t *dvl, unit_t *ul, int uc)
+{
+    rtdev_t **rp = &rl->retired;
+    int j;
+
+    rl->cycle++;
+
+    /* reclaim the devices retired before the last cycle */
+    while (*rp != NULL) {
+        rtdev_t *rt = *rp;
+        if (rt->cycle < rl->cycle - 1) {
+            *rp = rt->nxt;
+            free_dev(&rt->dv);
+            free(rt);
+        } else {
+            rp = &rt->nxt;
+        }
+    }
+
+    for (int i = 0; i < rl->n; i++) {
+        dvlist_t *nd = __atomic_exchange_n(&rl->pend[i], NULL, __ATOMIC_ACQ_REL);
+        rtdev_t *rt;
+        int slots = 0;
+
+        if (nd == NULL) {
+            continue;
+        }
+        if ((modio_shm != NULL || modio_arch != NULL) && nd->nor != dvl[i].nor) {
+            fprintf(stderr, "reload: %s: the number of registers changed, restart to apply it\n",
+                    rl->file[i]);
+            free_dev(nd);
+            free(nd);
+            continue;
+        }
+        if (modio_arch != NULL && (j = reload_archived(nd, i + 1, ul, uc)) != -1) {
+            fprintf(stderr, "reload: %s: register %d is archived as another one, restart to apply it\n",
+                    rl->file[i], nd->regs[j].num);
+            free_dev(nd);
+            free(nd);
+            continue;
+        }
+        rt = (rtdev_t *)malloc(sizeof(rtdev_t));
+        if (rt == NULL) {
+            free_dev(nd);
+            free(nd);
+            continue;
+        }
+        dev_ttl(nd, modio_cache_ms);
+        rt->dv = dvl[i];
+        rt->cycle = rl->cycle;
+        rt->nxt = rl->retired;
+        rl->retired = rt;
+        dvl[i] = *nd;
+        free(nd);
+
+        /* register slots of the units follow the new register counts */
+        for (int j = 0; j < uc; j++) {
+            ul[j].base = slots;
+            slots += dvl[ul[j].dnum - 1].nor;
+            if (ul[j].dnum == i + 1 && modio_shm != NULL) {
+                shm_ident(modio_shm, dvl, &ul[j]);
+            }
+        }
+        modio_debugx(1, "reloaded %s\n", rl->file[i]);
+    }
+}
+
+/*
+ * stop the device file watcher and free it with the retired devices
+ */
+void
+reload_stop(reload_t *rl)
+{
+    if (rl == NULL) {
+        return;
+    }
+    if (rl->run) {
+        rl->quit = 1;
+        pthread_join(rl->tid, NULL);
+    }
+    close(rl->fd);
+    while (rl->retired != NULL) {
+        rtdev_t *rt = rl->retired;
+        rl->retired = rt->nxt;
+        free_dev(&rt->dv);
+        free(rt);
+    }
+    for (int i = 0; i < rl->n; i++) {
+        if (rl->pend[i] != NULL) {
+            free_dev(rl->pend[i]);
+            free(rl->pend[i]);
+        }
+        free(rl->file[i]);
+    }
+    free(rl->pend);
+    free(rl->file);
+    free(rl->dir[0]);
+    free(rl->dir[1]);
+    free(rl);
+}
+
+/*
+ * stop signal handler
+ */
+void
+modio_sigstop(int sig)
+{
+    modio_stop = 1;
+}
+
+/*
+ * pass a register sample to the enabled outputs
+ */
+void
+smpl_out(dvlist_t *dvl, rsmpl_t *s)
+{
+    dreg_t *r = &dvl[s->dnum - 1].regs[s->rnum];
+
+    if (modio_shm != NULL) {
+        shm_rec_t rec;
+
+        /* the publisher is the only writer, so it can read its records directly */
+        rec = modio_shm->rec[s->slot];
+        rec.err = s->err;
+        if (s->err == 0) {
+            rec.qual = SHM_Q_VALID | SHM_Q_GOOD | (rec.qual & SHM_Q_TRUNC);
+            rec.mono_ns = (int64_t )s->mono.tv_sec * 1000000000 + s->mono.tv_nsec;
+            rec.real_ns = (int64_t )s->real.tv_sec * 1000000000 + s->real.tv_nsec;
+            rec.nw = (s->nw > SHM_RAW_WORDS) ? SHM_RAW_WORDS : s->nw;
+            memcpy(rec.raw, s->raw, rec.nw * sizeof(uint16_t));
+            rec.value = dreg_value(r, s->raw, s->nw);
+            if (!isnan(rec.value)) {
+                rec.qual |= SHM_Q_NUMERIC;
+            }
+        } else if (rec.qual & SHM_Q_VALID) {
+            rec.qual = (rec.qual & ~SHM_Q_GOOD) | SHM_Q_STALE;
+        }
+        shm_write(modio_shm, s->slot, &rec);
+    }
+    if (modio_ring != NULL) {
+        ring_put(modio_ring, s);
+    }
+    if (modio_arch != NULL) {
+        arch_put(modio_arch, s->slot, s);
+    }
+}
+
+/*
+ * Values of the registers and of the derived registers of unit u,
+ * of its device dv, in this order. They are reset to NAN when the
+ * number of registers of the device changed with a reload.
+ */
+double *
+unit_val(unit_t *u, dvlist_t *dv)
+{
+    int n = dv->nor + dv->nod;
+
+    if (u->nval != n || u->val == NULL) {
+        free(u->val);
+        u->val = (double *)malloc((n ? n : 1) * sizeof(double));
+        if (u->val == NULL) {
+            fprintf(stderr, "malloc failed: insufficient memory!\n");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < n; i++) {
+            u->val[i] = NAN;
+        }
+        u->nval = n;
+    }
+    return u->val;
+}
+
+/*
+ * Evaluate the derived registers of device dv over the register values
+ * at the start of val and print them after the registers, every line
+ * starting with pfx. Nothing is printed if pfx is NULL.
+ */
+void
+drv_out(dvlist_t *dv, double *val, const char *pfx)
+{
+    char buf[PRVAL_LEN];
+
+    if (dv->nod == 0) {
+        return;
+    }
+    drv_update(dv, val);
+    if (pfx == NULL) {
+        return;
+    }
+    for (int i = 0; i < dv->nod; i++) {
+        drv_print(buf, sizeof(buf), &dv->drv[i], val[dv->nor + i]);
+        printf("%s%-5s %-35s %-10s %s\n", pfx, "", dv->drv[i].name, "derived", buf);
+    }
+}
+
+/*
+ * Add the derived values of unit u, of device dv, to their windows
+ * and evaluate the alarm rules of the unit over its last values in
+ * poll mode. A derived value is NAN when a register it uses failed.
+ */
+void
+unit_done(dvlist_t *dv, unit_t *u)
+{
+    struct timespec ts;
+
+    for (int i = dv->nor; i < dv->nor + dv->nod && u->val != NULL; i++) {
+        window_add(dv, u, i, u->val[i], isnan(u->val[i]));
+    }
+    if (modio_alarm == NULL || dv->noa == 0) {
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    alarm_eval(modio_alarm, dv, u, (int64_t )ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+/*
+ * Export the samples of a ring file with wall clock time in
+ * [from, to] as CSV. Register metadata are taken from the device
+ * list, so it must be the same list the samples were recorded with.
+ */
+int
+record_export(const char *path, dvlist_t *dvl, int lsz, int64_t from, int64_t to)
+{
+    ring_t *rg;
+    uint64_t head;
+    char tstr[32];
+
+    rg = ring_map(path);
+    if (rg == NULL) {
+        return -1;
+    }
+    head = __atomic_load_n(&rg->hdr->head, __ATOMIC_ACQUIRE);
+    printf("time,mono_ns,uid,dev,reg,name,address,status,value,raw\n");
+    for (uint64_t i = ring_first(rg); i < head; i++) {
+        const ring_smpl_t *r = ring_get(rg, i);
+        dreg_t *dr = NULL;
+        time_t t;
+        struct tm tm;
+        int nw;
+
+        if (r->real_ns < from || r->real_ns > to) {
+            continue;
+        }
+        if (r->dnum >= 1 && r->dnum <= lsz && r->rnum < dvl[r->dnum - 1].nor) {
+            dr = &dvl[r->dnum - 1].regs[r->rnum];
+        }
+        t = r->real_ns / 1000000000;
+        localtime_r(&t, &tm);
+        strftime(tstr, sizeof(tstr), "%Y-%m-%d %H:%M:%S", &tm);
+        printf("%s.%03ld,%ld,%d,%d,%d,\"%s\",0x%08x,%d,",
+               tstr,
+               (long )(r->real_ns % 1000000000 / 1000000),
+               (long )r->mono_ns,
+               r->uid,
+               r->dnum,
+               dr ? dr->num : 0,
+               dr ? dr->info->name : "",
+               dr ? dr->addr : 0,
+               r->err
+        );
+        nw = (r->nw > RING_RAW_WORDS) ? RING_RAW_WORDS : r->nw;
+        if (dr != NULL && nw > 0) {
+            double v = dreg_value(dr, r->raw, nw);
+            if (!isnan(v)) {
+                printf("%.6g", v);
+            } else if (dr->prfmt == ASC && dr->type >= INPUT_R) {
+                char *s = words_to_str(r->raw, nw);
+                for (char *c = s; *c; c++) {
+                    if (*c == '"' || *c == ',') {
+                        *c = ' ';
+                    }
+                }
+                printf("\"%s\"", s);
+                free(s);
+            }
+        }
+        printf(",");
+        for (int j = 0; j < nw; j++) {
+            printf((j == 0) ? "%04x" : " %04x", r->raw[j]);
+        }
+        printf("\n");
+    }
+    ring_close(rg);
+    return 0;
+}
+
+/*
+ * Create the archive of the registers of the units, one series per
+ * register slot, identified by the registers of the device list
+ */
+arch_t *
+arch_setup(const char *path, dvlist_t *dvl, unit_t *ul, int uc)
+{
+    arch_t *ar;
+    arch_ser_t *ser;
+    int nser = 0;
+
+    for (int i = 0; i < uc; i++) {
+        nser += dvl[ul[i].dnum - 1].nor;
+    }
+    ser = (arch_ser_t *)calloc(nser ? nser : 1, sizeof(arch_ser_t));
+    if (ser == NULL) {
+        fprintf(stderr, "malloc failed: insufficient memory!\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < uc; i++) {
+        dvlist_t *dv = &dvl[ul[i].dnum - 1];
+
+        for (int j = 0; j < dv->nor; j++) {
+            arch_ser_set(&ser[ul[i].base + j], &ul[i], j, &dv->regs[j]);
+        }
+    }
+    ar = arch_open(path, ser, nser);
+    free(ser);
+    modio_debugx(1, "archive %s: %d series\n", path, nser);
+    return ar;
+}
+
+/*
+ * archive series of register r, register j of the device of unit u
+ */
+void
+arch_ser_set(arch_ser_t *a, const unit_t *u, int j, const dreg_t *r)
+{
+    memset(a, 0, sizeof(arch_ser_t));
+    a->uid = u->id;
+    a->dnum = u->dnum;
+    a->rnum = j;
+    a->type = r->type;
+    a->len = r->len;
+    a->prfmt = r->prfmt;
+    a->num = r->num;
+    a->addr = r->addr;
+    a->scale = r->scale;
+    strncpy(a->name, r->info->name, ARCH_NAME_LEN - 1);
+    strncpy(a->engu, r->info->engu, ARCH_ENGU_LEN - 1);
+}
+
+/*
+ * Export the samples of an archive with wall clock time in [from, to]
+ * as CSV, series by series. Only the series of the slave ids of ul,
+ * if any, and of the register names matching pats, if set, are
+ * exported, and only the blocks of the index that overlap the time
+ * range are read.
+ */
+int
+archive_query(const char *path, unit_t *ul, int uc, const char *pats, int64_t from, int64_t to)
+{
+    arch_t *ar;
+    arch_smpl_t *smp;
+    char tstr[32];
+    uint32_t nrd = 0;
+
+    ar = arch_load(path);
+    if (ar == NULL) {
+        return -1;
+    }
+    smp = (arch_smpl_t *)malloc(ARCH_BLK_SMPL * sizeof(arch_smpl_t));
+    if (smp == NULL) {
+        fprintf(stderr, "malloc failed: insufficient memory!\n");
+        exit(EXIT_FAILURE);
+    }
+    printf("time,uid,dev,reg,name,address,status,value,raw\n");
+    for (uint32_t i = 0; i < ar->hdr.nser; i++) {
+        arch_ser_t *a = &ar->ser[i];
+        dreg_t dr;
+        int sel = (uc == 0);
+
+        for (int k = 0; k < uc; k++) {
+            sel |= (ul[k].id == a->uid);
+        }
+        if (!sel || (pats != NULL && !name_match(a->name, pats))) {
+            continue;
+        }
+
+        /* the values decode as those of the register the series was archived from */
+        memset(&dr, 0, sizeof(dr));
+        dr.type = a->type;
+        dr.len = a->len;
+        dr.prfmt = a->prfmt;
+        dr.scale = a->scale;
+
+        for (uint32_t b = 0; b < ar->nidx; b++) {
+            const arch_blk_t *blk = &ar->idx[b].blk;
+            int n;
+
+            if (blk->ser != i || blk->t1 < from || blk->t0 > to) {
+                continue;
+            }
+            n = arch_block(ar, b, smp);
+            nrd++;
+            if (n == -1) {
+                printf("ERROR: corrupt block at offset %llu of %s\n",
+                       (unsigned long long )ar->idx[b].off,
+                       path
+                );
+                continue;
+            }
+            for (int j = 0; j < n; j++) {
+                arch_smpl_t *s = &smp[j];
+                time_t t;
+                struct tm tm;
+
+                if (s->real_ns < from || s->real_ns > to) {
+                    continue;
+                }
+                t = s->real_ns / 1000000000;
+                localtime_r(&t, &tm);
+                strftime(tstr, sizeof(tstr), "%Y-%m-%d %H:%M:%S", &tm);
+                printf("%s.%03ld,%d,%d,%d,\"%s\",0x%08x,%d,",
+                       tstr,
+                       (long )(s->real_ns % 1000000000 / 1000000),
+                       a->uid,
+                       a->dnum,
+                       a->num,
+                       a->name,
+                       a->addr,
+                       s->err
+                );
+                if (s->nw > 0) {
+                    double v = dreg_value(&dr, s->raw, s->nw);
+                    if (!isnan(v)) {
+                        printf("%.6g", v);
+                    } else if (dr.prfmt == ASC && dr.type >= INPUT_R) {
+                        char *str = words_to_str(s->raw, s->nw);
+                        for (char *c = str; *c; c++) {
+                            if (*c == '"' || *c == ',') {
+                                *c = ' ';
+                            }
+                        }
+                        printf("\"%s\"", str);
+                        free(str);
+                    }
+                }
+                printf(",");
+                for (int k = 0; k < s->nw; k++) {
+                    printf((k == 0) ? "%04x" : " %04x", s->raw[k]);
+                }
+                printf("\n");
+            }
+        }
+    }
+    modio_debugx(1, "archive %s: %u of %u blocks read\n", path, nrd, ar->nidx);
+    free(smp);
+    arch_close(ar);
+    return 0;
+}
+
+/*
+ * Parse a time given as seconds since the epoch, fractions allowed,
+ * or as local time "YYYY-MM-DD HH:MM:SS" ('T' separator also
+ * accepted). Returns ns since the epoch or -1 if invalid.
+ */
+int64_t
+parse_time(const char *s)
+{
+    struct tm tm;
+    char *end;
+    double sec;
+
+    memset(&tm, 0, sizeof(tm));
+    if (strptime(s, "%Y-%m-%d %H:%M:%S", &tm) != NULL ||
+        strptime(s, "%Y-%m-%dT%H:%M:%S", &tm) != NULL) {
+        tm.tm_isdst = -1;
+        return (int64_t )mktime(&tm) * 1000000000;
+    }
+    sec = strtod(s, &end);
+    if (end == s || *end != '\0' || sec < 0) {
+        return -1;
+    }
+    return (int64_t )(sec * 1e9);
+}
+
+/*
+ * Create the shared memory register image of the units, with one
+ * record per register. Records carry the register identity from the
+ * start so readers can look them up before the first poll cycle.
+ */
+shm_t *
+shm_setup(const char *name, dvlist_t *dvl, unit_t *ul, int uc)
+{
+    shm_t *sh;
+    int nrec = 0;
+
+    for (int i = 0; i < uc; i++) {
+        nrec += dvl[ul[i].dnum - 1].nor;
+    }
+    sh = shm_create(name, nrec);
+    if (sh == NULL) {
+        return NULL;
+    }
+    for (int i = 0; i < uc; i++) {
+        shm_ident(sh, dvl, &ul[i]);
+    }
+    modio_debugx(1, "shm %s: %d records\n", name, nrec);
+    return sh;
+}
+
+/*
+ * write the register identity of the records of unit u, their
+ * values are cleared
+ */
+void
+shm_ident(shm_t *sh, dvlist_t *dvl, unit_t *u)
+{
+    dvlist_t *dv = &dvl[u->dnum - 1];
+    shm_rec_t rec;
+
+    for (int j = 0; j < dv->nor; j++) {
+        dreg_t *r = &dv->regs[j];
+        memset(&rec, 0, sizeof(rec));
+        rec.uid = u->id;
+        rec.dnum = u->dnum;
+        rec.rnum = j;
+        rec.type = r->type;
+        rec.len = r->len;
+        rec.prfmt = r->prfmt;
+        rec.num = r->num;
+        rec.addr = r->addr;
+        rec.qual = (r->len > SHM_RAW_WORDS) ? SHM_Q_TRUNC : 0;
+        strncpy(rec.name, r->info->name, SHM_NAME_LEN - 1);
+        shm_write(sh, u->base + j, &rec);
+    }
+}
+
+/*
+ * print a shared memory register image
+ */
+int
+shm_dump(const char *name)
+{
+    shm_t *sh;
+    shm_rec_t rec;
+    struct timespec now;
+    char flg[8];
+
+    sh = shm_attach(name);
+    if (sh == NULL) {
+        if (errno == EINVAL) {
+            printf("ERROR: %s is not a modio register image\n", name);
+        } else if (errno == EPROTO) {
+            printf("ERROR: %s is a register image of another modio version\n", name);
+        } else {
+            printf("ERROR:(%s) shm_open %s\n", strerror(errno), name);
+        }
+        return -1;
+    }
+    clock_gettime(CLOCK_REALTIME, &now);
+    printf("publisher pid: %u cycles: %lu\n",
+           sh->hdr->pid,
+           (unsigned long )__atomic_load_n(&sh->hdr->cycle, __ATOMIC_ACQUIRE)
+    );
+    printf("%-3s %-5s %-35s %-10s %-5s %-10s %-8s\n", "UID", "REG", "NAME", "ADDRESS", "QUAL", "AGE(ms)", "VALUE");
+    for (uint32_t i = 0; i < sh->hdr->nrec; i++) {
+        if (shm_read(sh, i, &rec) == -1) {
+            printf("%-3s %-5s record %u is in the middle of a write\n", "-", "-", i);
+            continue;
+        }
+        snprintf(flg, sizeof(flg), "%c%c%c%c%c",
+                 (rec.qual & SHM_Q_VALID) ? 'V' : '-',
+                 (rec.qual & SHM_Q_GOOD) ? 'G' : '-',
+                 (rec.qual & SHM_Q_STALE) ? 'S' : '-',
+                 (rec.qual & SHM_Q_NUMERIC) ? 'N' : '-',
+                 (rec.qual & SHM_Q_TRUNC) ? 'T' : '-'
+        );
+        printf("%-3d %05d %-35s 0x%08x %-5s %-10ld ",
+               rec.uid,
+               rec.num,
+               rec.name,
+               rec.addr,
+               flg,
+               (rec.qual & SHM_Q_VALID) ?
+                 (long )(((int64_t )now.tv_sec * 1000000000 + now.tv_nsec - rec.real_ns) / 1000000) : -1L
+        );
+        if (!(rec.qual & SHM_Q_VALID)) {
+            printf("-\n");
+        } else if (rec.prfmt == ASC && rec.type >= INPUT_R) {
+            printf("%s\n", words_to_str(rec.raw, rec.nw));
+        } else if (rec.qual & SHM_Q_NUMERIC) {
+            printf("%.2f\n", rec.value);
+        } else {
+            printf("%s\n", mem_to_bytes(rec.raw, rec.nw, hex_to_str));
+        }
+    }
+    shm_detach(sh);
+    return 0;
+}
+
+/*
+ * Check if a register name matches one of the comma separated
+ * patterns in pats. A pattern is a shell pattern, or an extended
+ * regular expression if enclosed in '/'.
+ */
+int
+name_match(const char *name, const char *pats)
+{
+    char *pl = strdup(pats);
+    char *pat;
+    char *save;
+    int hit = 0;
+
+    if (pl == NULL) {
+        fprintf(stderr, "malloc failed: insufficient memory!\n");
+        exit(EXIT_FAILURE);
+    }
+    for (pat = strtok_r(pl, ",", &save); pat != NULL && !hit; pat = strtok_r(NULL, ",", &save)) {
+        size_t plen = strlen(pat);
+        regex_t re;
+
+        if (plen > 2 && pat[0] == '/' && pat[plen - 1] == '/') {
+            pat[plen - 1] = '\0';
+            if (regcomp(&re, pat + 1, REG_EXTENDED | REG_NOSUB) != 0) {
+                printf("ERROR: invalid regular expression %s\n", pat + 1);
+                exit(EXIT_FAILURE);
+            }
+            hit = (regexec(&re, name, 0, NULL, 0) == 0);
+            regfree(&re);
+        } else {
+            hit = (fnmatch(pat, name, 0) == 0);
+        }
+    }
+    free(pl);
+    return hit;
+}
+
+/*
+ * Select the registers of a device whose name matches one of the
+ * comma separated patterns in pats, see name_match(). Returns the
+ * selected registers, *n is set to their count.
+ */
+dreg_t **
+select_regs(dvlist_t *dv, const char *pats, int *n)
+{
+    dreg_t **sel;
+
+    sel = (dreg_t **)malloc((dv->nor ? dv->nor : 1) * sizeof(dreg_t *));
+    if (sel == NULL) {
+        fprintf(stderr, "malloc failed: insufficient memory!\n");
+        exit(EXIT_FAILURE);
+    }
+    *n = 0;
+    for (int k = 0; k < dv->nor; k++) {
+        if (name_match(dv->regs[dv->order[k]].info->name, pats)) {
+            sel[(*n)++] = &dv->regs[dv->order[k]];
+        }
+    }
+    return sel;
+}
+
+/*
+ * read a block of a read plan into words or bits, from the response
+ * cache if it is younger than the ttl of the block
+ */
+int
+read_block(modbus_t *mb, pblk_t *b, uint16_t *words, uint8_t *bits)
+{
+    int len = b->len;
+
+    mbio_cache_ttl(b->ttl);
+    switch (b->type) {
+        case COIL:
+            return mbio_read_bits(mb, b->addr, len > PLAN_MAX_BITS ? PLAN_MAX_BITS : len, bits);
+        case INPUT_B:
+            return mbio_read_input_bits(mb, b->addr, len > PLAN_MAX_BITS ? PLAN_MAX_BITS : len, bits);
+        case INPUT_R:
+            return mbio_read_input_registers(mb, b->addr, len > PLAN_MAX_REGS ? PLAN_MAX_REGS : len, words);
+        case HOLDING:
+            return mbio_read_registers(mb, b->addr, len > PLAN_MAX_REGS ? PLAN_MAX_REGS : len, words);
+        default:
+            errno = EINVAL;
+            return -1;
+    }
+}
+
+/*
+ * Read len registers of type from address addr in one request through
+ * libmodio into words or bits, from the response cache if it is
+ * younger than ttl. Returns -1 with errno set on failure.
+ */
+int
+read_span(modio_t *m, int type, int addr, int len, int ttl, uint16_t *words, uint8_t *bits)
+{
+    modio_reg_t r = { addr, type, addr, len, MODIO_DEC, 1.0, NULL, "", "", "" };
+    uint16_t buf[PLAN_MAX_BITS];
+
+    mbio_cache_ttl(ttl);
+    if (type != COIL && type != INPUT_B) {
+        return modio_read(m, &r, words, PLAN_MAX_REGS);
+    }
+    if (modio_read(m, &r, buf, PLAN_MAX_BITS) == -1) {
+        return -1;
+    }
+    for (int j = 0; j < len; j++) {
+        bits[j] = (uint8_t )buf[j];
+    }
+    return len;
+}
+
+/*
+ * Move register r of a block read, at offset off of words or bits,
+ * into the register store arrays, and into sample s if not NULL
+ */
+void
+store_reg(dreg_t *r, const uint16_t *words, const uint8_t *bits, int off, rsmpl_t *s)
+{
+    int nw = (r->len > REG_SIZE) ? REG_SIZE : r->len;
+
+    switch (r->type) {
+        case COIL:
+            memcpy(creg, &bits[off], nw);
+            break;
+        case INPUT_B:
+            memcpy(ibreg, &bits[off], nw);
+            break;
+        case INPUT_R:
+            memcpy(ireg, &words[off], nw * sizeof(uint16_t));
+            break;
+        default:
+            memcpy(hreg, &words[off], nw * sizeof(uint16_t));
+    }
+    if (s != NULL) {
+        s->nw = nw;
+        for (int j = 0; j < nw; j++) {
+            s->raw[j] = (r->type == COIL || r->type == INPUT_B) ? bits[off + j] : words[off + j];
+        }
+    }
+}
+
+/*
+ * Read the registers of a read plan, one request per block, and print
+ * them with prefix pfx. A failed block is reported and the remaining
+ * blocks are still read. Returns -1 if any block failed.
+ */
+int
+read_plan(modbus_t *mb, plan_t *p, const char *pfx)
+{
+    uint16_t words[PLAN_MAX_REGS];
+    uint8_t bits[PLAN_MAX_BITS];
+    int rval = 0;
+
+    for (int i = 0; i < p->nblk; i++) {
+        pblk_t *b = &p->blk[i];
+
+        if (read_block(mb, b, words, bits) == -1) {
+            printf("ERROR:(%s) modbus_read_xx addr:0x%x, count: %d\n", modbus_strerror(errno), b->addr, b->len);
+            rval = -1;
+            continue;
+        }
+
+        /* move every register of the block into the register store arrays and print it */
+        for (int j = b->first; j < b->first + b->nreg; j++) {
+            dreg_t *r = p->regs[j];
+            store_reg(r, words, bits, (r->addr & 0xffff) - b->addr, NULL);
+            print_dev_reg(r, pfx);
+        }
+    }
+    return rval;
+}
+
+/*
+ * parse a register number or address, decimal or 0x hex, of a register list
+ */
+long
+reg_list_num(const char *p, char **e)
+{
+    if (!isdigit((unsigned char )*p)) {
+        *e = (char *)p;
+        return -1;
+    }
+    errno = 0;
+    if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+        return strtol(p, e, 16);
+    }
+    return strtol(p, e, 10);
+}
+
+/*
+ * Parse unit list spec into a new array l of n units: comma separated
+ * slave ids of 1 - UNIT_MAX_ID, each with an optional ':<dev num>'.
+ * Returns -1 if spec is invalid, an empty, non numeric or out of range
+ * field.
+ */
+int
+unit_list_parse(const char *spec, unit_t **l, int *n)
+{
+    const char *p = spec;
+    int cnt = 1;
+
+    for (const char *q = spec; *q; q++) {
+        if (*q == ',') {
+            cnt++;
+        }
+    }
+    *l = (unit_t *)calloc(cnt, sizeof(unit_t));
+    if (*l == NULL) {
+        fprintf(stderr, "malloc failed: insufficient memory!\n");
+        exit(EXIT_FAILURE);
+    }
+    for (*n = 0; *n < cnt; p++) {
+        unit_t *u = &(*l)[*n];
+        char *e;
+        long v = reg_list_num(p, &e);
+
+        if (e == p || errno != 0 || v < 1 || v > UNIT_MAX_ID) {
+            break;
+        }
+        u->id = (int )v;
+        if (*e == ':') {
+            p = e + 1;
+            v = reg_list_num(p, &e);
+            if (e == p || errno != 0 || v < 1 || v > INT_MAX) {
+                break;
+            }
+            u->dnum = (int )v;
+        }
+        (*n)++;
+        if (*e != ',') {
+            if (*e == '\0' && *n == cnt) {
+                return 0;
+            }
+            break;
+        }
+        p = e;
+    }
+    free(*l);
+    *l = NULL;
+    *n = 0;
+    return -1;
+}
+
+/*
+ * Append the registers of register list spec to array l of n registers
+ * and capacity cap. The registers are separated by commas or white
+ * space, each one a register number or address, a first-last range or
+ * a first+count span of them. Returns -1 if spec is invalid.
+ */
+int
+reg_list_parse(const char *spec, rreg_t **l, int *n, int *cap)
+{
+    const char *p = spec;
+
+    while (*p) {
+        long first;
+        long last;
+        char *e;
+
+        if (*p == ',' || isspace((unsigned char )*p)) {
+            p++;
+            continue;
+        }
+        first = reg_list_num(p, &e);
+        if (e == p || errno != 0) {
+            return -1;
+        }
+        last = first;
+        if (*e == '-' || *e == '+') {
+            const char *q = e + 1;
+            long v = reg_list_num(q, &e);
+
+            if (e == q || errno != 0) {
+                return -1;
+            }
+            last = (*(q - 1) == '-') ? v : first + v - 1;
+        }
+        if ((*e != '\0' && *e != ',' && !isspace((unsigned char )*e)) ||
+            last < first || last - first >= 0x10000 || last > INT_MAX) {
+            return -1;
+        }
+        if (*n + (last - first + 1) > *cap) {
+            while (*n + (last - first + 1) > *cap) {
+                *cap = *cap ? 2 * *cap : 64;
+            }
+            *l = (rreg_t *)realloc(*l, *cap * sizeof(rreg_t));
+            if (*l == NULL) {
+                fprintf(stderr, "malloc failed: insufficient memory!\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        for (long r = first; r <= last; r++) {
+            (*l)[(*n)++].reg = (int )r;
+        }
+        p = e;
+    }
+    return 0;
+}
+
+/*
+ * Append the registers of register list file path to array l of n
+ * registers and capacity cap. The file holds a register list as -g
+ * does, over any number of lines, text after '#' is ignored. Returns
+ * -1 if the file can't be read or is invalid.
+ */
+int
+reg_list_file(const char *path, rreg_t **l, int *n, int *cap)
+{
+    FILE *f;
+    char *buf = NULL;
+    size_t len = 0;
+    size_t sz = 0;
+    size_t rd;
+    int rval;
+
+    f = fopen(path, "r");
+    if (f == NULL) {
+        printf("ERROR:(%s) can't open %s\n", strerror(errno), path);
+        return -1;
+    }
+    do {
+        if (len + 1 >= sz) {
+            sz = sz ? 2 * sz : 4096;
+            buf = (char *)realloc(buf, sz);
+            if (buf == NULL) {
+                fprintf(stderr, "malloc failed: insufficient memory!\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        rd = fread(buf + len, 1, sz - len - 1, f);
+        len += rd;
+    } while (rd > 0);
+    fclose(f);
+    buf[len] = '\0';
+
+    /* blank out the comments */
+    for (char *c = buf; (c = strchr(c, '#')) != NULL; ) {
+        while (*c != '\0' && *c != '\n') {
+            *c++ = ' ';
+        }
+    }
+    rval = reg_list_parse(buf, l, n, cap);
+    if (rval == -1) {
+        printf("ERROR: invalid register list in %s\n", path);
+    }
+    free(buf);
+    return rval;
+}
+
+/*
+ * trim leading and trailing white space of s in place
+ */
+char *
+str_trim(char *s)
+{
+    char *e;
+
+    while (isspace((unsigned char )*s)) {
+        s++;
+    }
+    e = s + strlen(s);
+    while (e > s && isspace((unsigned char )e[-1])) {
+        *--e = '\0';
+    }
+    return s;
+}
+
+/*
+ * Read the values to write of CSV file path, one register per line: a
+ * register number or a register name of device dv, followed by its
+ * values, one per word or bit. Registers of dv take their type, address
+ * and length from the device file, other register numbers are mapped
+ * like -g with zero based addressing zba and their values go to the
+ * following addresses. Empty lines and text after '#' are ignored.
+ * Every invalid line is reported and counted in nerr. Returns the
+ * values and their count in n, or NULL if the file can't be read.
+ */
+wval_t *
+write_file_load(const char *path, dvlist_t *dv, int zba, int *n, int *nerr)
+{
+    FILE *f;
+    char line[1024];
+    wval_t *val = NULL;
+    int cap = 0;
+    int ln = 0;
+
+    *n = 0;
+    *nerr = 0;
+    f = fopen(path, "r");
+    if (f == NULL) {
+        printf("ERROR:(%s) can't open %s\n", strerror(errno), path);
+        return NULL;
+    }
+    while (fgets(line, sizeof(line), f) != NULL) {
+        dreg_t *r = NULL;
+        char *save;
+        char *key;
+        char *tok;
+        char *c;
+        int type = COIL;
+        int addr = -1;
+        int len = 0;
+        int reg;
+        int first = *n;
+        int bad = 0;
+
+        ln++;
+        if (strchr(line, '\n') == NULL && !feof(f)) {
+            int ch;
+
+            printf("ERROR: %s:%d: line too long\n", path, ln);
+            (*nerr)++;
+            while ((ch = fgetc(f)) != EOF && ch != '\n');
+            continue;
+        }
+        if ((c = strchr(line, '#')) != NULL) {
+            *c = '\0';
+        }
+        key = strtok_r(line, ",", &save);
+        if (key == NULL || *(key = str_trim(key)) == '\0') {
+            continue;
+        }
+
+        /* resolve the register number or name */
+        if (isdigit((unsigned char )*key)) {
+            reg = (int )strtol(key, &c, 10);
+            if (*c != '\0') {
+                printf("ERROR: %s:%d: invalid register number %s\n", path, ln, key);
+                (*nerr)++;
+                continue;
+            }
+            for (int i = 0; dv != NULL && i < dv->nor; i++) {
+                if (dv->regs[i].num == reg) {
+                    r = &dv->regs[i];
+                    break;
+                }
+            }
+            if (r == NULL && (addr = reg_xaddr(reg, zba, &type)) == -1) {
+                printf("ERROR: %s:%d: invalid register number %s\n", path, ln, key);
+                (*nerr)++;
+                continue;
+            }
+        } else {
+            for (int i = 0; dv != NULL && i < dv->nor; i++) {
+                if (strcmp(dv->regs[i].info->name, key) == 0) {
+                    r = &dv->regs[i];
+                    break;
+                }
+            }
+            if (r == NULL) {
+                printf("ERROR: %s:%d: unknown register %s%s\n", path, ln, key,
+                       dv == NULL ? ", register names need a device" : "");
+                (*nerr)++;
+                continue;
+            }
+        }
+        if (r != NULL) {
+            if (r->info->acc != NULL && strchr(r->info->acc, 'W') == NULL) {
+                printf("ERROR: %s:%d: register %s is read only\n", path, ln, r->info->name);
+                (*nerr)++;
+                continue;
+            }
+            reg = r->num;
+            type = r->type;
+            addr = r->addr;
+            len = r->len;
+        }
+        if (type != COIL && type != HOLDING) {
+            printf("ERROR: %s:%d: register %s is not a coil or holding register\n", path, ln, key);
+            (*nerr)++;
+            continue;
+        }
+
+        /* parse its values */
+        while ((tok = strtok_r(NULL, ",", &save)) != NULL) {
+            long v;
+
+            tok = str_trim(tok);
+            errno = 0;
+            v = strtol(tok, &c, 0);
+            if (*tok == '\0' || *c != '\0' || errno != 0 ||
+                (type == COIL && v != 0 && v != 1) || (type == HOLDING && (v < -32768 || v > 65535))) {
+                printf("ERROR: %s:%d: invalid value '%s' for register %s\n", path, ln, tok, key);
+                bad = 1;
+                break;
+            }
+            if ((addr & 0xffff) + *n - first > 0xffff) {
+                printf("ERROR: %s:%d: values of register %s beyond the last address\n", path, ln, key);
+                bad = 1;
+                break;
+            }
+            if (*n == cap) {
+                cap = cap ? 2 * cap : 64;
+                val = (wval_t *)realloc(val, cap * sizeof(wval_t));
+                if (val == NULL) {
+                    fprintf(stderr, "malloc failed: insufficient memory!\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            val[*n].type = type;
+            val[*n].addr = (addr & 0xffff) + *n - first;
+            val[*n].val = (uint16_t )v;
+            val[*n].reg = reg;
+            val[*n].line = ln;
+            (*n)++;
+        }
+        if (!bad && *n == first) {
+            printf("ERROR: %s:%d: no value for register %s\n", path, ln, key);
+            bad = 1;
+        }
+        if (!bad && len > 0 && *n - first != len) {
+            printf("ERROR: %s:%d: %d values for register %s of length %d\n", path, ln, *n - first, key, len);
+            bad = 1;
+        }
+        if (bad) {
+            *n = first;
+            (*nerr)++;
+        }
+    }
+    fclose(f);
+    if (val == NULL) {
+        val = (wval_t *)malloc(sizeof(wval_t));
+        if (val == NULL) {
+            fprintf(stderr, "malloc failed: insufficient memory!\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return val;
+}
+
+/*
+ * Write the values of a write plan, one FC15 or FC16 request per block,
+ * and print a line per block unless quiet. A failed block is reported
+ * and the remaining blocks are still written. With verify every written
+ * block is read back and every value that differs is reported. Returns
+ * the number of failed requests and mismatched values.
+ */
+int
+write_plan(modbus_t *mb, wplan_t *p, int verify, int quiet)
+{
+    uint16_t words[PLAN_MAX_WREGS];
+    uint16_t rwords[PLAN_MAX_WREGS];
+    uint8_t bits[PLAN_MAX_WBITS];
+    uint8_t rbits[PLAN_MAX_WBITS];
+    int nfail = 0;
+    int nbad = 0;
+    int nwr = 0;
+
+    if (!quiet) {
+        printf("%-8s %-8s %-5s %s\n", "TYPE", "ADDRESS", "COUNT", "RESULT");
+    }
+    for (int i = 0; i < p->nblk; i++) {
+        wblk_t *b = &p->blk[i];
+        wval_t *v = &p->vals[b->first];
+        const char *tname = (b->type == COIL) ? "COIL" : "HOLDING";
+        int bad = 0;
+        int rval;
+
+        if (b->type == COIL) {
+            for (int j = 0; j < b->len; j++) {
+                bits[j] = v[j].val ? 1 : 0;
+            }
+            rval = mbio_write_bits(mb, b->addr, b->len, bits);
+        } else {
+            for (int j = 0; j < b->len; j++) {
+                words[j] = v[j].val;
+            }
+            rval = mbio_write_registers(mb, b->addr, b->len, words);
+        }
+        if (rval == -1) {
+            printf("ERROR:(%s) modbus_write_xx addr:0x%x, count: %d, regs: %d-%d\n", modbus_strerror(errno),
+                   b->addr, b->len, v[0].reg, v[b->len - 1].reg);
+            nfail++;
+            continue;
+        }
+        nwr += b->len;
+        if (!verify) {
+            if (!quiet) {
+                printf("%-8s 0x%04x   %-5d %s\n", tname, b->addr, b->len, "OK");
+            }
+            continue;
+        }
+
+        /* read the block back and compare */
+        if (b->type == COIL) {
+            rval = mbio_read_bits(mb, b->addr, b->len, rbits);
+        } else {
+            rval = mbio_read_registers(mb, b->addr, b->len, rwords);
+        }
+        if (rval == -1) {
+            printf("ERROR:(%s) modbus_read_xx addr:0x%x, count: %d, regs: %d-%d not verified\n",
+                   modbus_strerror(errno), b->addr, b->len, v[0].reg, v[b->len - 1].reg);
+            nfail++;
+            continue;
+        }
+        for (int j = 0; j < b->len; j++) {
+            if ((b->type == COIL) ? rbits[j] != bits[j] : rwords[j] != words[j]) {
+                bad++;
+            }
+        }
+        if (!quiet) {
+            printf("%-8s 0x%04x   %-5d %s\n", tname, b->addr, b->len, bad ? "MISMATCH" : "VERIFIED");
+        }
+        for (int j = 0; bad && j < b->len; j++) {
+            int rd = (b->type == COIL) ? rbits[j] : rwords[j];
+            int wr = (b->type == COIL) ? bits[j] : words[j];
+
+            if (rd != wr) {
+                printf("MISMATCH reg %d (line %d) addr:0x%04x wrote %d read %d\n", v[j].reg, v[j].line,
+                       v[j].addr, wr, rd);
+            }
+        }
+        nbad += bad;
+    }
+    printf("%d of %d values written in %d requests, %d failed requests", nwr, p->nval, p->nblk, nfail);
+    if (verify) {
+        printf(", %d mismatches", nbad);
+    }
+    if (p->ndup) {
+        printf(", %d values overridden by later lines", p->ndup);
+    }
+    printf("\n");
+    return nfail + nbad;
+}
+
+/*
+ * Find the device of an identification in the device list. Devices
+ * with a vendor pattern are candidates, the defined vendor, product
+ * and revision patterns must all match and the device with the most
+ * patterns wins. Returns the device number or 0.
+ */
+int
+devid_match(dvlist_t *dvl, int lsz, devid_t *id)
+{
+    int dnum = 0;
+    int best = 0;
+
+    for (int i = 0; i < lsz; i++) {
+        dvlist_t *dv = &dvl[i];
+        int n = 1;
+
+        if (dv->vendor == NULL || fnmatch(dv->vendor, id->vendor, FNM_CASEFOLD) != 0) {
+            continue;
+        }
+        if (dv->product != NULL) {
+            if (fnmatch(dv->product, id->product, FNM_CASEFOLD) != 0) {
+                continue;
+            }
+            n++;
+        }
+        if (dv->revision != NULL) {
+            if (fnmatch(dv->revision, id->revision, FNM_CASEFOLD) != 0) {
+                continue;
+            }
+            n++;
+        }
+        if (n > best) {
+            best = n;
+            dnum = i + 1;
+        }
+    }
+    return dnum;
+}
+
+/*
+ * path of file name in the cache directory, $XDG_CACHE_HOME/modio or
+ * $HOME/.cache/modio, the directories are created if mk is set
+ */
+char *
+cache_path(const char *name, int mk)
+{
+    static char path[PATH_MAX];
+    const char *xdg = getenv("XDG_CACHE_HOME");
+
+    if (xdg != NULL && *xdg == '/') {
+        snprintf(path, sizeof(path), "%s/%s", xdg, PROGR_DIR_NAME);
+    } else if (getenv("HOME") != NULL) {
+        snprintf(path, sizeof(path), "%s/.cache", getenv("HOME"));
+        if (mk) {
+            mkdir(path, 0755);
+        }
+        snprintf(path, sizeof(path), "%s/.cache/%s", getenv("HOME"), PROGR_DIR_NAME);
+    } else {
+        return NULL;
+    }
+    if (mk) {
+        mkdir(path, 0755);
+    }
+    strncat(path, "/", sizeof(path) - strlen(path) - 1);
+    strncat(path, name, sizeof(path) - strlen(path) - 1);
+    return path;
+}
+
+/*
+ * Look up the device of unit uid at host in the identification cache.
+ * Entries are "<host>\t<uid>\t<manufacturer>\t<model>" lines, the
+ * device is found again by its manufacturer and model so entries stay
+ * valid when device files are added. Returns the device number or 0.
+ */
+int
+devid_cache_get(const char *host, int uid, dvlist_t *dvl, int lsz)
+{
+    char *path = cache_path("devid", 0);
+    char line[512];
+    FILE *f;
+    int dnum = 0;
+
+    if (path == NULL || (f = fopen(path, "r")) == NULL) {
+        return 0;
+    }
+    while (dnum == 0 && fgets(line, sizeof(line), f) != NULL) {
+        char *h = strtok(line, "\t");
+        char *u = strtok(NULL, "\t");
+        char *manfc = strtok(NULL, "\t");
+        char *model = strtok(NULL, "\n");
+
+        if (model == NULL || strcmp(h, host) != 0 || (int )strtol(u, NULL, 10) != uid) {
+            continue;
+        }
+        for (int i = 0; i < lsz; i++) {
+            if (!strcmp(dvl[i].manfc, manfc) && !strcmp(dvl[i].model, model)) {
+                dnum = i + 1;
+                break;
+            }
+        }
+    }
+    fclose(f);
+    return dnum;
+}
+
+/*
+ * store the device of unit uid at host in the identification cache,
+ * replacing an older entry of the unit
+ */
+void
+devid_cache_put(const char *host, int uid, dvlist_t *dv)
+{
+    char *path = cache_path("devid", 1);
+    char tmp[PATH_MAX + 8];
+    char line[512];
+    char key[300];
+    FILE *f;
+    FILE *t;
+
+    if (path == NULL) {
+        return;
+    }
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    t = fopen(tmp, "w");
+    if (t == NULL) {
+        modio_debugx(1, "devid cache %s: %s\n", tmp, strerror(errno));
+        return;
+    }
+    snprintf(key, sizeof(key), "%s\t%d\t", host, uid);
+    f = fopen(path, "r");
+    if (f != NULL) {
+        while (fgets(line, sizeof(line), f) != NULL) {
+            if (strncmp(line, key, strlen(key)) != 0) {
+                fputs(line, t);
+            }
+        }
+        fclose(f);
+    }
+    fprintf(t, "%s%s\t%s\n", key, dv->manfc, dv->model);
+    fclose(t);
+    rename(tmp, path);
+}
+
+/*
+ * Path of the tuning file of unit uid at host, tune-<host>-<uid> in the
+ * cache directory with the '/' of serial ports replaced by '_'
+ */
+char *
+tune_path(const char *host, int uid, int mk)
+{
+    char name[NAME_MAX];
+
+    snprintf(name, sizeof(name), "tune-%s-%d", host, uid);
+    for (char *c = name; *c; c++) {
+        if (*c == '/') {
+            *c = '_';
+        }
+    }
+    return cache_path(name, mk);
+}
+
+/*
+ * Read the tuning file of unit uid at host into t, t is left with the
+ * protocol limits if the unit has none. Returns -1 if there is no valid
+ * tuning file.
+ */
+int
+tune_load(const char *host, int uid, tune_t *t)
+{
+    char *path = tune_path(host, uid, 0);
+    config_t cfg;
+    config_setting_t *max;
+
+    memset(t, 0, sizeof(tune_t));
+    if (path == NULL || access(path, R_OK) != 0) {
+        return -1;
+    }
+    config_init(&cfg);
+    if (!config_read_file(&cfg, path)) {
+        printf("ERROR: tuning file %s:%d - %s\n", path, config_error_line(&cfg), config_error_text(&cfg));
+        config_destroy(&cfg);
+        return -1;
+    }
+    max = config_lookup(&cfg, "max");
+    if (max == NULL || config_setting_length(max) != 4) {
+        printf("ERROR: tuning file %s: no max of the 4 register types\n", path);
+        config_destroy(&cfg);
+        return -1;
+    }
+    for (int i = 0; i < 4; i++) {
+        t->max[i] = config_setting_get_int(config_setting_get_elem(max, i));
+    }
+    config_lookup_int(&cfg, "span", &t->span);
+    config_lookup_int(&cfg, "gap", &t->gap);
+    config_lookup_int(&cfg, "rate", &t->rate);
+    config_destroy(&cfg);
+    t->probed = TRUE;
+    modio_debugx(1, "tuning %s: max: %d %d %d %d span: %d gap: %dms\n", path, t->max[0], t->max[1],
+                 t->max[2], t->max[3], t->span, t->gap);
+    return 0;
+}
+
+/*
+ * write the tuning of unit uid at host, replacing its tuning file.
+ * Returns -1 on error.
+ */
+int
+tune_save(const char *host, int uid, const tune_t *t)
+{
+    char *path = tune_path(host, uid, 1);
+    char tmp[PATH_MAX + 8];
+    FILE *f;
+
+    if (path == NULL) {
+        printf("ERROR: no cache directory for the tuning file, $HOME is not set\n");
+        return -1;
+    }
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    f = fopen(tmp, "w");
+    if (f == NULL) {
+        printf("ERROR:(%s) tuning file %s\n", strerror(errno), tmp);
+        return -1;
+    }
+    fprintf(f, "# modio tuning of unit %d at %s, written by --probe\n", uid, host);
+    fprintf(f, "#\n");
+    fprintf(f, "# max:  largest read of coils, input bits, input and holding registers, 0 for the\n");
+    fprintf(f, "#       protocol limit\n");
+    fprintf(f, "# span: undefined addresses a read may span\n");
+    fprintf(f, "# gap:  min gap between requests in ms\n");
+    fprintf(f, "# rate: sustained requests per second\n");
+    fprintf(f, "max = [ %d, %d, %d, %d ];\n", t->max[0], t->max[1], t->max[2], t->max[3]);
+    fprintf(f, "span = %d;\n", t->span);
+    fprintf(f, "gap = %d;\n", t->gap);
+    fprintf(f, "rate = %d;\n", t->rate);
+    if (fclose(f) != 0 || rename(tmp, path) == -1) {
+        printf("ERROR:(%s) tuning file %s\n", strerror(errno), path);
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
 }
 
 /*
- * Read device registers
+ * Read len words or bits of a register type from address addr for the
+ * probe, the values are dropped. Late responses of a request that timed
+ * out are flushed. Returns -1 on error.
  */
-void
-read_dev_regs(modbus_t *mb, dvlist_t *dvl, int dnum)
+int
+probe_read(modbus_t *mb, int type, int addr, int len)
 {
-    uint16_t *reg16p;   /* pointer to 16bit register */
-    uint8_t *reg8p;     /* pointer to 8bit register */
-    int addr;
-    int rval;
-
-    printf("%s %s %s:\n", dvl[dnum].type, dvl[dnum].manfc, dvl[dnum].model);
-    printf("%-5s %-35s %-10s %-8s\n", "REG", "NAME", "ADDRESS", "VALUE");
-    dreg_t *r = dvl[dnum].regs;
-    for (int i = 0; i < dvl[dnum].nor; i++) {
-        switch(r[i].type) {
-            case COIL:
-            case INPUT_B:
-                addr = r[i].addr;
-                if (r[i].type == COIL) {
-                    rval = modbus_read_bits(mb, addr, r[i].len, creg);
-                    reg8p = creg;
-                } else {
-                    rval = modbus_read_input_bits(mb, addr, r[i].len, ibreg);
-                    reg8p = ibreg;
-                }
-                if (rval == -1) {
-                    printf("ERROR:(%s) modbus_read_xx addr:0x%x, count: %d\n",
-                           modbus_strerror(errno),
-                           addr,
-                           r[i].len
-                    );
-                    exit(EXIT_FAILURE);
-                } else {
-                    for (int j = 0; j < r[i].len; j++) {
-                        if (r[i].prfmt == BIN) {
-                            printf("%05d %-35s 0x%08x %s\n",
-                                   r[i].num + j,
-                                   r[i].name,
-                                   r[i].addr + j,
-                                   int_to_bin(*(uint16_t *) reg8p)
-                            );
-                        } else if (r[i].prfmt == HEX) {
-                            printf("%05d %-35s 0x%08x 0x%x\n",
-                                   r[i].num + j,
-                                   r[i].name,
-                                   r[i].addr + j,
-                                   *reg8p
-                            );
-                        } else if (r[i].prfmt == ASC) {
-                            printf("%05d %-35s 0x%08x %s\n",
-                                   r[i].num + j,
-                                   r[i].name,
-                                   r[i].addr + j,
-                                   (char *) reg8p
-                            );
-                        } else {
-                            printf("%05d %-35s 0x%08x %d\n",
-                                   r[i].num + j,
-                                   r[i].name,
-                                   r[i].addr + j,
-                                   *reg8p
-                            );
-                        }
-                        reg8p++;
-                    }
-                }
-                break;
-            case INPUT_R:
-            case HOLDING:
-                addr = r[i].addr;
-                if (r[i].type == HOLDING) {
-                    rval = modbus_read_registers(mb, addr, r[i].len, hreg);
-                    reg16p = hreg;
-                } else {
-                    rval = modbus_read_input_registers(mb, addr, r[i].len, ireg);
-                    reg16p = ireg;
-                }
-                if (rval == -1) {
-                    printf("ERROR:(%s) modbus_read_xx addr:0x%x, count: %d\n",
-                           modbus_strerror(errno),
-                           addr,
-                           r[i].len
-                    );
-                    exit(EXIT_FAILURE);
-                }
-                for (int j = 0; j < r[i].len; j++) {
-                    if (r[i].prfmt == BIN) {
-                        printf("%05d %-35s 0x%08x %s\n",
-                               r[i].num,
-                               r[i].name,
-                               r[i].addr + j,
-                               int_to_bin(*(uint16_t *) reg16p)
-                        );
-                    } else if (r[i].prfmt == HEX) {
-                        printf("%05d %-35s 0x%08x 0x%x\n",
-                               r[i].num,
-                               r[i].name,
-                               r[i].addr + j,
-                               *reg16p
-                        );
-                    } else if (r[i].prfmt == ASC) {
-                        char *s = words_to_str(reg16p, r[i].len);
-                        printf("%05d %-35s 0x%08x %s\n",
-                               r[i].num,
-                               r[i].name,
-                               r[i].addr + j,
-                               s
-                        );
-                        break;
-                    } else if (r[i].prfmt == BFX) {
-                        char *s = mem_to_bytes(reg16p, r[i].len, hex_to_str);
-                        printf("%05d %-35s 0x%08x %s\n",
-                               r[i].num,
-                               r[i].name,
-                               r[i].addr + j,
-                               s
-                        );
-                        break;
-                    } else if (r[i].prfmt == BFD) {
-                        char *s = mem_to_bytes(reg16p, r[i].len, int_to_str);
-                        printf("%05d %-35s 0x%08x %s\n",
-                               r[i].num,
-                               r[i].name,
-                               r[i].addr + j,
-                               s
-                        );
-                        break;
-                    } else if (r[i].prfmt == HLO) {
-                        if (r[i].len%2 != 0) {
-                            printf("Error, not aligned memory size\n");
-                            break;
-                        }
-                        int hlw = r[i].len / 2;
-                        for (int k = 0; k < hlw; k++) {
-                            printf("%05d %-35s 0x%08x %.2f%s\n",
-                                   r[i].num + 2 * k,
-                                   r[i].name,
-                                   r[i].addr + 2 * k,
-                                   (double )concat_inv16(reg16p, 2) * r[i].scale,
-                                   r[i].engu
-                            );
-                            reg16p += 2;
-                        }
-                       break;
-                    } else {
-                        if (r[i].len == 2) {
-                            printf("%05d %-35s 0x%08x %li%s\n",
-                                   r[i].num,
-                                   r[i].name,
-                                   r[i].addr + j,
-                                   concat_inv16(reg16p, r[i].len),
-                                   r[i].engu
-                            );
-                            break;
-                        } else {
-                            printf("%05d %-35s 0x%08x %.2f%s\n",
-                                   r[i].num + j,
-                                   r[i].name,
-                                   r[i].addr + j,
-                                   *reg16p * r[i].scale,
-                                   r[i].engu
-                            );
-                        }
-                    }
-                    reg16p++;
-                }
-                break;
-            default:
-                exit(EXIT_FAILURE);
+    uint16_t words[PLAN_MAX_REGS];
+    uint8_t bits[PLAN_MAX_BITS];
+    pblk_t b = { type, addr, len, 0, 1, 0, 0, 0 };
+    int err;
+
+    if (read_block(mb, &b, words, bits) == -1) {
+        err = errno;
+        if (unit_noresp(err)) {
+            modbus_flush(mb);
         }
+        errno = err;
+        return -1;
     }
+    return 0;
 }
 
-
 /*
- * format a memory of words into a string of '.' separated bytes.
- * bytes in words are swapped and converted by char *(*conv)(int) func
- * accordingly
- *
- * word 0: byte01.byte00
- * word 1: byte11.byte10
- *
- * string: byte00.byte01.byte10.byte11
+ * Find the largest read of a register type from address addr that the
+ * unit answers, by doubling the count up to the protocol limit and then
+ * bisecting between the last answered and the first failed count.
+ * Returns the count, 0 if not even one is answered, or -1 if the unit
+ * doesn't respond at all.
  */
-char *
-mem_to_bytes(uint16_t *array, int size, char *(*conv)(int)) {
-    int slen = 0;
-    unsigned char *p = (unsigned char *)array;
+int
+probe_max(modbus_t *mb, int type, int addr)
+{
+    int lim = (type == COIL || type == INPUT_B) ? PLAN_MAX_BITS : PLAN_MAX_REGS;
+    int ok = 0;
+    int bad;
 
-    for (int i = 0; i < size * 2; i++) {
-        slen += snprintf(NULL, 0, "%i", p[i]);
+    if (lim > 0x10000 - addr) {
+        lim = 0x10000 - addr;
+    }
+    bad = lim + 1;
+    for (int n = 1; ok < lim; n = (2 * n > lim) ? lim : 2 * n) {
+        if (probe_read(mb, type, addr, n) == -1) {
+            if (ok == 0 && unit_noresp(errno)) {
+                return -1;
+            }
+            bad = n;
+            break;
+        }
+        ok = n;
     }
-    char *s = (char *)malloc((slen + size) * sizeof(char));
+    while (bad - ok > 1) {
+        int n = (ok + bad) / 2;
 
-    p = (unsigned char *)array;
-    s = strcpy(s, conv(p[1]));
-    s = strcat(strcat(s, "."), conv(p[0]));
-    for (int i = 1; i < size; i++) {
-        array += 1;
-        p = (unsigned char *)array;
-        s = strcat(strcat(s, "."), conv(p[1]));
-        s = strcat(strcat(s, "."), conv(p[0]));
+        if (probe_read(mb, type, addr, n) == -1) {
+            bad = n;
+        } else {
+            ok = n;
+        }
     }
-    return s;
+    modio_debugx(1, "probe: type %d addr 0x%04x: max %d\n", type, addr, ok);
+    return ok;
 }
 
-
 /*
- * return a string with binary representation of inum
+ * Find the most undefined addresses between the registers of device dv
+ * that a read may span. The gaps of the device are read across from the
+ * smallest up, from the last address before the gap to the first after
+ * it, as long as the read is within the max of t. Returns the largest
+ * gap read before the first one that failed.
  */
-char *
-int_to_bin(uint16_t inum)
+int
+probe_span(modbus_t *mb, dvlist_t *dv, const tune_t *t)
 {
-    size_t bits = sizeof(uint16_t) * CHAR_BIT;
+    int span = 0;
 
-    char * str = malloc((bits + 1) * sizeof(char));
-    if(!str) return NULL;
-    str[bits] = 0;
+    for (int tries = 0; tries < PROBE_SPANS; tries++) {
+        int gap = INT_MAX;      /* smallest gap above span */
+        int type = 0;
+        int addr = 0;
+        int end = -1;           /* end of the registers of the type so far */
 
-    // type punning because signed shift is implementation-defined
-    uint16_t u = *(unsigned *) & inum;
-    for(; bits--; u >>= 1)
-        str[bits] = u & 1 ? '1' : '0';
+        for (int k = 0; k < dv->nor; k++) {
+            dreg_t *r = &dv->regs[dv->order[k]];
+            int a = r->addr & 0xffff;
+            int max = (r->type == COIL || r->type == INPUT_B) ? PLAN_MAX_BITS : PLAN_MAX_REGS;
 
-    return str;
+            if (t->max[r->type] > 0) {
+                max = t->max[r->type];
+            }
+            if (k > 0 && r->type == dv->regs[dv->order[k - 1]].type && a - end > span &&
+                a - end < gap && a - end + 2 <= max) {
+                gap = a - end;
+                type = r->type;
+                addr = end - 1;
+            }
+            if (k == 0 || r->type != dv->regs[dv->order[k - 1]].type || a + r->len > end) {
+                end = a + r->len;
+            }
+        }
+        if (gap == INT_MAX) {
+            break;
+        }
+        if (probe_read(mb, type, addr, gap + 2) == -1) {
+            modio_debugx(1, "probe: type %d addr 0x%04x: gap %d failed\n", type, addr, gap);
+            break;
+        }
+        span = gap;
+    }
+    return span;
 }
 
-/* 
- * initialize read register array
+/*
+ * Find the shortest gap between requests that the unit sustains, with
+ * bursts of PROBE_BURST reads of a register of a type at address addr
+ * and the gaps of PROBE_GAPS, from the longest down, until a burst has
+ * a failed read. Sets the gap and the request rate of the last full
+ * burst in t. Returns -1 if no burst got through.
  */
-void
-init_rrega(void) {
+int
+probe_rate(modbus_t *mb, int type, int addr, tune_t *t)
+{
+    static const int gaps[] = { PROBE_GAPS };
+    struct timespec ts;
+    int rval = -1;
 
-    for(int i = 0; i < REG_SIZE; i++) {
-        creg[i] = 0;
-        ibreg[i] = 0;
-        ireg[i] = 0;
-        hreg[i] = 0;
+    for (int g = 0; g < (int )(sizeof(gaps) / sizeof(gaps[0])); g++) {
+        int64_t start;
+        int64_t ns;
+        int fail = 0;
+
+        mbio_gap(gaps[g]);
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        start = (int64_t )ts.tv_sec * 1000000000 + ts.tv_nsec;
+        for (int i = 0; i < PROBE_BURST && !fail; i++) {
+            fail = (probe_read(mb, type, addr, 1) == -1);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        ns = (int64_t )ts.tv_sec * 1000000000 + ts.tv_nsec - start;
+        modio_debugx(1, "probe: gap %dms: %s, %lld us\n", gaps[g], fail ? "failed" : "ok", (long long )ns / 1000);
+        if (fail) {
+            break;
+        }
+        t->gap = gaps[g];
+        t->rate = (int )(PROBE_BURST * 1000000000LL / (ns > 0 ? ns : 1));
+        rval = 0;
     }
+    mbio_gap(0);
+    return rval;
 }
 
-/* 
- * convert an array of uint16_t words with ASCCI characters to a string 
+/*
+ * Probe the limits of a unit into t and print them: the shortest gap
+ * between requests with its request rate, which the other probes keep
+ * to, the largest read of every register type, from the first register
+ * of the type of device dv, or from address 0 of every type if dv is
+ * NULL, and the undefined addresses a read may span. Returns -1 if the
+ * unit doesn't respond.
  */
-char *
-words_to_str(const uint16_t *array, int length)
+int
+probe_unit(modbus_t *mb, dvlist_t *dv, tune_t *t)
 {
-    char *s = malloc(length * sizeof(uint16_t));
-    char *r = s;
+    static const char *tname[] = { "COIL", "INPUT_B", "INPUT_R", "HOLDING" };
+    static const int fc[] = { 1, 2, 4, 3 };
+    static const int rorder[] = { HOLDING, INPUT_R, COIL, INPUT_B };
+    int addr[4] = { 0, 0, 0, 0 };
+    int has[4] = { 1, 1, 1, 1 };
+    int nresp = 0;
+    int rate = -1;
+
+    memset(t, 0, sizeof(tune_t));
+
+    /* start at the first register of every type of the device */
+    if (dv != NULL) {
+        memset(has, 0, sizeof(has));
+        for (int k = dv->nor - 1; k >= 0; k--) {
+            dreg_t *r = &dv->regs[dv->order[k]];
+
+            addr[r->type] = r->addr & 0xffff;
+            has[r->type] = 1;
+        }
+    }
+
+    /* the request rate with single register reads of the first type that answers */
+    for (int i = 0; i < 4 && rate == -1; i++) {
+        if (has[rorder[i]]) {
+            rate = probe_rate(mb, rorder[i], addr[rorder[i]], t);
+        }
+    }
+    mbio_gap(t->gap);
 
-    for (int i = 0; i < length; i++) {
-        for (int j = 1; j >= 0; j--) {
-            *s = *(((char *)array) + j);
-            s += 1;
+    printf("%-3s %-8s %-8s %s\n", "FC", "TYPE", "ADDRESS", "MAX");
+    for (int i = COIL; i <= HOLDING; i++) {
+        int n;
+
+        if (!has[i]) {
+            continue;
         }
-        array += 1;
+        n = probe_max(mb, i, addr[i]);
+        if (n == -1) {
+            printf("%-3d %-8s 0x%04x   %s\n", fc[i], tname[i], addr[i], "NO RESPONSE");
+            continue;
+        }
+        nresp++;
+        t->max[i] = n;
+        if (n == 0) {
+            printf("%-3d %-8s 0x%04x   %s\n", fc[i], tname[i], addr[i], "UNSUPPORTED");
+        } else {
+            printf("%-3d %-8s 0x%04x   %d\n", fc[i], tname[i], addr[i], n);
+        }
+    }
+    if (nresp == 0) {
+        printf("ERROR: unit not responding\n");
+        mbio_gap(0);
+        return -1;
+    }
+
+    if (dv != NULL) {
+        t->span = probe_span(mb, dv, t);
+        printf("span: reads across up to %d undefined addresses\n", t->span);
+    }
+    if (rate == -1) {
+        printf("rate: no burst of %d requests got through\n", PROBE_BURST);
+    } else {
+        printf("rate: %d requests/s with a gap of %dms\n", t->rate, t->gap);
     }
-    return r;
+    mbio_gap(0);
+    return 0;
 }
 
 /*
- * Concatenate and invert 16bit words to 32bit (length = 2)
- * or 64bit (length = 4) which are stored in array. Returns
- * a 64bit integer.
+ * Select the device of the units without device number by their
+ * FC43 device identification, or by the identification cache of
+ * earlier runs. Returns -1 if a unit could not be identified.
  */
-uint64_t
-concat_inv16(const uint16_t *array, int length)
+int
+auto_dev(char *port, serconf_t sc, dvlist_t *dvl, int lsz, unit_t *ul, int uc)
 {
-    uint64_t inum = 0;
-    uint16_t *p;
+    modbus_t *mb = NULL;
+    char *host = strdup(port);
+    char *cport = strdup(port);
+    devid_t did;
+    int rval = 0;
+
+    for (int i = 0; i < uc; i++) {
+        if (ul[i].dnum) {
+            continue;
+        }
+        ul[i].dnum = devid_cache_get(host, ul[i].id, dvl, lsz);
+        if (ul[i].dnum) {
+            modio_debugx(1, "unit %d: cached device %d\n", ul[i].id, ul[i].dnum);
+            continue;
+        }
 
-    p = (uint16_t *)&inum;
-    for (int i = 0; i < length; i++) {
-        *(p + length - i - 1) |= array[i];
+        /* connect on the first unit that is not in the cache */
+        if (mb == NULL) {
+            mb = modbus_init(cport, sc, ul[i].id);
+            if (mb == NULL) {
+                rval = -1;
+                break;
+            }
+        }
+        mbio_set_slave(mb, ul[i].id);
+        if (mbio_read_devid(mb, &did) == -1) {
+            printf("ERROR:(%s) device identification of unit %d\n", modbus_strerror(errno), ul[i].id);
+            rval = -1;
+            continue;
+        }
+        modio_debugx(1, "unit %d: vendor: %s product: %s revision: %s\n", ul[i].id, did.vendor,
+                     did.product, did.revision);
+        ul[i].dnum = devid_match(dvl, lsz, &did);
+        if (ul[i].dnum == 0) {
+            printf("ERROR: no device matches unit %d (vendor: %s product: %s revision: %s)\n",
+                   ul[i].id, did.vendor, did.product, did.revision);
+            rval = -1;
+            continue;
+        }
+        devid_cache_put(host, ul[i].id, &dvl[ul[i].dnum - 1]);
+    }
+    if (mb != NULL) {
+        modbus_close(mb);
+        modbus_free(mb);
     }
+    free(cport);
+    free(host);
+    return rval;
+}
 
-    return inum;
+/*
+ * check if a request error means that the unit didn't answer at all,
+ * as opposed to an exception response of a live unit
+ */
+int
+unit_noresp(int err)
+{
+    return (err == ETIMEDOUT || err == EMBXGPATH || err == EMBXGTAR);
 }
 
 /*
- * convert a decimal integer to string
+ * Read a device register and print its value. Every printed line
+ * starts with pfx, nothing is printed if pfx is NULL. If s is not
+ * NULL the read is stored in it. The response cache answers the read
+ * within the ttl of the register. Returns -1 on error.
  */
-char *
-int_to_str(int inum)
+int
+read_dev_reg(modbus_t *mb, dreg_t *r, const char *pfx, rsmpl_t *s)
 {
-    int sz = snprintf(NULL, 0, "%d", inum);
-    char *key = (char *) malloc((sz + 1) * sizeof(char));
+    int rval;
+    int err;
+
+    mbio_cache_ttl(r->ttl);
+    switch(r->type) {
+        case COIL:
+            rval = mbio_read_bits(mb, r->addr, r->len, creg);
+            break;
+        case INPUT_B:
+            rval = mbio_read_input_bits(mb, r->addr, r->len, ibreg);
+            break;
+        case INPUT_R:
+            rval = mbio_read_input_registers(mb, r->addr, r->len, ireg);
+            break;
+        case HOLDING:
+            rval = mbio_read_registers(mb, r->addr, r->len, hreg);
+            break;
+        default:
+            printf("ERROR: invalid type %d of register %d\n", r->type, r->num);
+            errno = EINVAL;
+            return -1;
+    }
+    err = (rval == -1) ? errno : 0;
+    if (s != NULL) {
+        clock_gettime(CLOCK_MONOTONIC, &s->mono);
+        clock_gettime(CLOCK_REALTIME, &s->real);
+        s->err = err;
+        s->nw = (r->len > REG_SIZE) ? REG_SIZE : r->len;
+        if (err == 0) {
+            for (int j = 0; j < s->nw; j++) {
+                switch (r->type) {
+                    case COIL:
+                        s->raw[j] = creg[j];
+                        break;
+                    case INPUT_B:
+                        s->raw[j] = ibreg[j];
+                        break;
+                    case INPUT_R:
+                        s->raw[j] = ireg[j];
+                        break;
+                    default:
+                        s->raw[j] = hreg[j];
+                }
+            }
+        }
+    }
+    if (rval == -1) {
+        printf("ERROR:(%s) modbus_read_xx addr:0x%x, count: %d\n",
+               modbus_strerror(err),
+               r->addr,
+               r->len
+        );
+        errno = err;
+        return -1;
+    }
+    if (pfx != NULL) {
+        print_dev_reg(r, pfx);
+    }
+    return 0;
+}
 
-    snprintf(key, sz + 1, "%d", inum);
-    return key;
+/*
+ * Print the value of a device register from the register store
+ * arrays with its value printer. Every printed line starts with pfx.
+ */
+void
+print_dev_reg(dreg_t *r, const char *pfx)
+{
+    char val[PRVAL_LEN];
+    const void *v = reg_store(r->type);
+
+    for (int j = 0, n; j < r->len; j += n) {
+        n = r->prval(val, sizeof(val), v, j, r->len, r->scale, r->info->engu);
+        if (n <= 0) {
+            printf("Error, not aligned memory size\n");
+            break;
+        }
+        printf("%s%05d %-35s 0x%08x %s\n", pfx, r->num + j, r->info->name, r->addr + j, val);
+    }
 }
 
 /*
- * convert a hex integer to string
+ * register store array of a register type
  */
-char *
-hex_to_str(int xnum)
+const void *
+reg_store(int type)
 {
-    int sz = snprintf(NULL, 0, "%d", xnum);
-    char *key = (char *) malloc((sz + 1) * sizeof(char));
+    switch (type) {
+        case COIL:
+            return creg;
+        case INPUT_B:
+            return ibreg;
+        case INPUT_R:
+            return ireg;
+        default:
+            return hreg;
+    }
+}
 
-    snprintf(key, sz + 1, "%x", xnum);
-    return key;
+/* 
+ * initialize read register array
+ */
+void
+init_rrega(void) {
+
+    for(int i = 0; i < REG_SIZE; i++) {
+        creg[i] = 0;
+        ibreg[i] = 0;
+        ireg[i] = 0;
+        hreg[i] = 0;
+    }
 }
 
 
@@ -1374,6 +3847,20 @@ modbus_init(char *port, serconf_t sc, int id)
     modbus_t *mb;       /* modbus context */
     int rval = -1;
 
+    /* replayed, brokered and Modbus/UDP transfers don't need a connection, only a context */
+    if (mbio_replaying() || mbio_brokered() || udp_port(port)) {
+        mb = modbus_new_tcp("127.0.0.1", 502);
+        if (mb != NULL) {
+            mbio_set_slave(mb, id);
+        }
+        if (mb != NULL && !mbio_replaying() && !mbio_brokered() && mbio_udp(mb, port) == -1) {
+            printf("ERROR:(%s) %s\n", modbus_strerror(errno), port);
+            modbus_free(mb);
+            return NULL;
+        }
+        return mb;
+    }
+
     /* open modbus port and create a new modbus context */
     mb = modbus_new(port, sc);
     if (mb == NULL) {
@@ -1382,7 +3869,7 @@ modbus_init(char *port, serconf_t sc, int id)
     }
 
     /* set slave ID */
-    rval = modbus_set_slave(mb, id);    /* slave ID */
+    rval = mbio_set_slave(mb, id);      /* slave ID */
     if (rval < 0) {
         modbus_free(mb);
         printf("modbus_set_slave: Invalid modbus slave ID %d\n", id);
@@ -1405,8 +3892,12 @@ modbus_init(char *port, serconf_t sc, int id)
         exit(EXIT_FAILURE);
     }
 
-    /* set modbus response time out to 200ms */
-    rval = modbus_set_byte_timeout(mb, MODBYTE_TIMEOUT_s, MODBYTE_TIMEOUT_us);
+    /* set modbus byte time out to 500ms, serial lines use their character time */
+    if (strstr(port, "/dev/tty") != NULL) {
+        rval = mbio_rtu_timing(mb, sc);
+    } else {
+        rval = modbus_set_byte_timeout(mb, MODBYTE_TIMEOUT_s, MODBYTE_TIMEOUT_us);
+    }
     if (rval < 0) {
         modbus_free(mb);
         printf("modbus_set_byte_timeout: error(%s)", modbus_strerror(errno));
@@ -1415,276 +3906,21 @@ modbus_init(char *port, serconf_t sc, int id)
     return mb;
 }
 
-/* 
- * Initialize device register list 
- */
-int
-init_drlist(dvlist_t **lst)
-{
-    DIR* FD;
-    struct dirent* in_file;
-    dreg_t *drarr = NULL;
-    char *home;
-    char *user_dir;
-    int cnt = 0;
-
-    /* Scanning the devices' directory */
-    if (NULL == (FD = opendir(REGISTER_PATH))) {
-        fprintf(stderr, "Error: Failed to open devices' directory (%s)\n", REGISTER_PATH);
-    } else {
-        while ((in_file = readdir(FD))) {
-            /* On linux/Unix we don't want current and parent directories */
-            if (!strcmp (in_file->d_name, ".")) {
-                continue;
-            }
-            if (!strcmp (in_file->d_name, "..")) {
-                continue;
-            }
-            cnt++;
-        }
-    }
-    closedir(FD);
-
-    /* construct user path for config files */
-    home = (char *)malloc(strlen(getenv("HOME")));
-    strcpy(home, getenv("HOME"));
-    user_dir = (char *)malloc((strlen(home) + strlen("/.modio/" + 1)) * sizeof(char));
-    strcpy(user_dir, strcat(home, "/.modio/"));
-
-    modio_debugx(2, "user dir: %s\n", user_dir);
-
-    /* Scanning the devices' directory */
-    if (NULL == (FD = opendir(user_dir))) {
-        fprintf(stderr, "Error: Failed to open devices' directory (%s)\n", user_dir);
-    } else {
-        while ((in_file = readdir(FD))) {
-            /* On linux/Unix we don't want current and parent directories */
-            if (!strcmp (in_file->d_name, ".")) {
-                continue;
-            }
-            if (!strcmp (in_file->d_name, "..")) {
-                continue;
-            }
-            cnt++;
-        }
-    }
-    closedir(FD);
-
-    modio_debugx(2, "number of config files: %d\n", cnt);
-
-    /* allocate memory for device list */
-    *lst = (dvlist_t *)malloc(cnt * sizeof(dvlist_t));
-
-    /* allocate memory for device register array of size cnt */
-    drarr = (dreg_t *)malloc(sizeof(dreg_t));
-    (*lst)->regs = drarr;
-
-    free(user_dir);
-    free(home);
-
-    return cnt;
-}
-
-/* 
- * read device and register info 
- */
-void
-read_dreg(dvlist_t *lst)
-{
-    dvlist_t *last;
-    char *home;
-    char *user_dir;
-
-    /* directory operations vars */
-    DIR* FD;
-
-    /* construct user path for config files */
-    home = (char *)malloc(strlen(getenv("HOME")));
-    strcpy(home, getenv("HOME"));
-    user_dir = (char *)malloc((strlen(home) + strlen("./modio/")) * sizeof(char));
-    strcpy(user_dir, strcat(home, "/.modio/"));
-
-    modio_debugx(2, "user dir: %s\n", user_dir);
-
-    /* Scanning the devices' directory */
-    if (NULL == (FD = opendir(REGISTER_PATH))) {
-        fprintf(stderr, "Error: Failed to open devices' directory (%s)\n", REGISTER_PATH);
-    } else {
-        last = read_dreg_files(lst, FD, REGISTER_PATH);
-        closedir(FD);
-    }
-
-    if (NULL == (FD = opendir(user_dir))) {
-        fprintf(stderr, "Error: Failed to open devices' directory (%s)\n", user_dir);
-    } else {
-        last = read_dreg_files(last, FD, user_dir);
-        closedir(FD);
-    }
-
-    free(user_dir);
-    free(home);
-}
-
 /*
- * read registers from device files
- * it returns a pointer to the last device entry in list
+ * Open a libmodio context of unit id of port, with the serial settings
+ * of sc on a serial line, and report why it failed
  */
-dvlist_t *
-read_dreg_files(dvlist_t *lst, DIR *fd, char *cf_path)
+modio_t *
+modio_connect(char *port, serconf_t sc, int id)
 {
-    /* configuration vars */
-    config_t cfg;
-    const char *str;
-    char *path;
-    config_setting_t *regs;
-    dvlist_t *dvl = lst;
-    
-    /* directory operations vars */
-    struct dirent* in_file;
-
-    modio_debugx(3, "DEVICES:\n");
-    while ((in_file = readdir(fd))) {
-
-        modio_debugx(3, "file name: %s\n", in_file->d_name);
-
-        /* On linux/Unix we don't want current and parent directories */
-        if (!strcmp (in_file->d_name, ".")) {
-            continue;
-        }
-        if (!strcmp (in_file->d_name, "..")) {
-            continue;
-        }
-        path = (char *)malloc((strlen(cf_path) + strlen(in_file->d_name) + 1) * sizeof(char));
-        if (!path) {
-            fprintf(stderr, "malloc failed: insufficient memory!\n");
-            exit(EXIT_FAILURE);
-        }
-        strcpy(path, cf_path);
-        strcat(path, in_file->d_name);
-
-        config_init(&cfg);
+    modio_serial_t ser = { sc.baud, sc.prty, sc.dbit, sc.sbit };
+    modio_t *m;
 
-        /* Read the file. If there is an error, report it and exit. */
-        if (!config_read_file(&cfg, path)) {
-            fprintf(stderr, "%s:%d - %s\n", config_error_file(&cfg),
-                    config_error_line(&cfg), config_error_text(&cfg));
-            config_destroy(&cfg);
-            exit(EXIT_FAILURE);
-        }
-
-        /* Get the device manufacturer */
-        if (config_lookup_string(&cfg, "device.manfc", &str)) {
-            //printf("Device mfr: %s\n", str);
-            dvl->manfc = malloc((strlen(str) + 1) * sizeof(char));
-            strcpy(dvl->manfc, str);
-        } else {
-            fprintf(stderr, "No 'device manfc' in configuration file.\n");
-        }
-
-        /* Get the device type */
-        if (config_lookup_string(&cfg, "device.type", &str)) {
-            //printf("Device type: %s\n", str);
-            dvl->type = malloc((strlen(str) + 1) * sizeof(char));
-            strcpy(dvl->type, str);
-        } else {
-            fprintf(stderr, "No 'device type' in configuration file.\n");
-        }
-
-        /* Get the device model */
-        if (config_lookup_string(&cfg, "device.model", &str)) {
-            //printf("Device model: %s\n", str);
-            dvl->model = malloc((strlen(str) + 1) * sizeof(char));
-            strcpy(dvl->model, str);
-        } else {
-            fprintf(stderr, "No 'device model' in configuration file.\n");
-        }
-
-        /* Get the zero based addressing configuration */
-        if (config_lookup_int(&cfg, "device.zba", &dvl->zba) == 0) {
-            fprintf(stderr, "No 'device zba' in configuration file.\n");
-            config_destroy(&cfg);
-            exit(EXIT_FAILURE);
-        }
-
-        modio_debugx(3, "manfc: %s type: %s model: %s zba: %d\n", dvl->manfc,
-                                                                  dvl->type,
-                                                                  dvl->model,
-                                                                  dvl->zba
-        );
-        /* Output a list of all books in the inventory. */
-        regs = config_lookup(&cfg, "regs");
-        if (regs != NULL) {
-            int cnt = config_setting_length(regs);
-            if (cnt != 0) {
-                dvl->regs = (dreg_t *)malloc(cnt * sizeof(dreg_t));
-                dreg_t *r = dvl->regs;
-                dvl->nor = cnt;
-                for (int i = 0; i < cnt; ++i) {
-                    config_setting_t *reg = config_setting_get_elem(regs, i);
-                    const char *name;
-                    const char *desc;
-                    const char *range;
-                    const char *engu;
-                    const char *access;
-                    if (!(config_setting_lookup_int(reg, "num", &r->num) &&
-                    config_setting_lookup_int(reg, "addr", &r->addr) &&
-                    config_setting_lookup_int(reg, "len", &r->len) &&
-                    config_setting_lookup_int(reg, "type", &r->type) &&
-                    config_setting_lookup_string(reg, "name", &name) &&
-                    config_setting_lookup_string(reg, "descr", &desc) &&
-                    config_setting_lookup_string(reg, "range", &range) &&
-                    config_setting_lookup_float(reg, "scale", &r->scale) &&
-                    config_setting_lookup_int(reg, "print", &r->prfmt) &&
-                    config_setting_lookup_string(reg, "engu", &engu) &&
-                    config_setting_lookup_string(reg, "access", &access))) {
-                        dvl->nor--;
-                        continue;
-                    }
-                    r->name = (char *)malloc((strlen(name) + 1) * sizeof(char));
-                    strcpy(r->name, name);
-                    r->desc = (char *)malloc((strlen(desc) + 1) * sizeof(char));
-                    strcpy(r->desc, desc);
-                    r->range = (char *)malloc((strlen(range) + 1) * sizeof(char));
-                    strcpy(r->range, range);
-                    r->engu = (char *)malloc((strlen(engu) + 1) * sizeof(char));
-                    strcpy(r->engu, engu);
-                    r->acc = (char *)malloc((strlen(access) + 1) * sizeof(char));
-                    strcpy(r->acc, access);
-
-                    modio_debugx(3, "reg: %-5d name: %s ", r->num, r->name);
-                    if (r->addr == 0) {
-                        int rnum = r->num;
-                        switch (r->type) {
-                            case COIL:
-                                r->addr = 0x0 + rnum - dvl->zba;
-                                break;
-                            case INPUT_B:
-                                rnum -= 10000;
-                                r->addr = 0x10000 + rnum - dvl->zba;
-                                break;
-                            case INPUT_R:
-                                rnum -= 30000;
-                                r->addr = 0x30000 + rnum - dvl->zba;
-                                break;
-                            case HOLDING:
-                                rnum -= 40000;
-                                r->addr = 0x40000 + rnum - dvl->zba;
-                                break;
-                            default:
-                                printf("Invalid register type\n");
-                        }
-                        modio_debugx(3, "addr: 0x%x\n", r->addr);
-                    }
-                    r++;
-                }
-            }
-            modio_debugx(3, "nor: %d\n\n", dvl->nor);
-        }
-        config_destroy(&cfg);
-        free(path);
-        dvl++;
+    m = modio_open(port, &ser, id);
+    if (m == NULL) {
+        printf("ERROR: %s\n", modio_error(NULL));
     }
-    return dvl;
+    return m;
 }
 
 /* 
@@ -1744,36 +3980,36 @@ print_dev_reginfo(dvlist_t *lst, int num, int nor)
     while (cnt < nor) {
 
         /* if size of description less equal to max length... */
-        if ((dl = strlen(regs->desc)) <= dmxl) {
+        if ((dl = strlen(regs->info->desc)) <= dmxl) {
             printf("%-5d 0x%-10x %-35s %-90s %-3d %-10s %-7.2f %-12s %-3s\n", 
                    regs->num,
                    regs->addr,
-                   regs->name,
-                   regs->desc,
+                   regs->info->name,
+                   regs->info->desc,
                    regs->len,
-                   regs->range,
+                   regs->info->range,
                    regs->scale,
-                   regs->engu,
-                   regs->acc
+                   regs->info->engu,
+                   regs->info->acc
             );
 
         /* ...else split description in two lines */
         } else {
             char *s_b = malloc((dl - dmxl + 1) * sizeof(char));
             char *s_a = malloc((dmxl + 1) * sizeof(char));
-            strcpy(s_b, regs->desc + dmxl);
-            strncpy(s_a, regs->desc, dmxl);
+            strcpy(s_b, regs->info->desc + dmxl);
+            strncpy(s_a, regs->info->desc, dmxl);
             strcpy(s_a + dmxl, "");
             printf("%-5d 0x%-10x %-35s %-90s %-3d %-10s %-7.2f %-12s %-3s\n", 
                     regs->num,
                     regs->addr,
-                    regs->name,
+                    regs->info->name,
                     s_a,
                     regs->len,
-                    regs->range,
+                    regs->info->range,
                     regs->scale,
-                    regs->engu,
-                    regs->acc
+                    regs->info->engu,
+                    regs->info->acc
             );
             printf("%-5s   %-10s %-35s %-90s\n", "", "", "", s_b);
             free(s_a);
@@ -1782,22 +4018,23 @@ print_dev_reginfo(dvlist_t *lst, int num, int nor)
         cnt++;
         regs++;
     }
-}
-
-/*
- * debug function
- */
-void
-modio_debugx(int level, const char *fmt, ...) {
-    int rval;
-    va_list va;
 
-    if (modio_dbg_lvl < level) {
-        return;
+    /* derived registers, with their expression as description */
+    for (int i = 0; i < dvl[num].nod; i++) {
+        dvar_t *d = &dvl[num].drv[i];
+
+        printf("%-5s %-12s %-35s %-90s %-3s %-10s %-7s %-12s %-3s\n",
+               "",
+               "derived",
+               d->name,
+               d->expr,
+               "",
+               "",
+               "",
+               d->engu,
+               "R"
+        );
     }
-    va_start(va, fmt);
-    rval = vprintf(fmt, va);
-    va_end(va);
 }
 
 /*
@@ -1808,18 +4045,28 @@ usage(char *pname)
 {
     printf("Usage: %s [OPTIONS]...\n", pname);
     printf("--(p)ort     <val> device port can be either a file or an IP address (default: /dev/ttyUSB0)\n");
-    printf("                   example: /dev/tty<PORT>, 192.0.12.3, 192.168.1.2:1502 (default TCP port 502)\n");
+    printf("                   example: /dev/tty<PORT>, 192.0.12.3, 192.168.1.2:1502 (default TCP port 502),\n");
+    printf("                   udp://192.168.1.2:1502 for Modbus/UDP (default UDP port 502)\n");
     printf("--baud       <val> serial port baud rate (default 9600)\n");
     printf("--parity     <val> serial port parity (N:none O:odd E:even M:mark default N)\n");
     printf("--sbit       <val> serial port stop bit (default 1)\n");
     printf("--dbit       <val> serial port data bits (default 8)\n");
     printf("--dev_(i)d   <val> modbus slave device id (default 1)\n");
+    printf("   <id:num,id:num>  comma separated slave ids, each with an optional device number, sharing\n");
+    printf("                   one connection. All registers of every unit's device are read, ids without\n");
+    printf("                   device number use the device of -e <id>\n");
+    printf("                   example: modio -p192.168.2.10 -i1:2,2:2,7:1\n");
     printf("--(z)ero           disable modbus zero based addressing (address = register - type offset)\n");
     printf("                   example: address = 35021(reg_num) - 30000(type_offset) = 5021\n");
     printf("--re(g)     <val>| register number (default number 1)\n");
     printf("        <address>| register address (default 0) if -a has been specified\n");
     printf("        <v,v,v,v>  comma separated values of register numbers or addresses\n");
     printf("                   example: modio -p/dev/ttyUSB0 --baud 38400 --parity E -g40032,40101,40078 -r\n");
+    printf("        <a-b,a+n>  register ranges, from a to b or n registers from a, read with as few\n");
+    printf("                   requests as possible and printed in the order listed\n");
+    printf("                   example: modio -p192.168.2.104 -i1 -g40001-40200,30001+16 -r\n");
+    printf("--reg-file <file>  add the register numbers, addresses and ranges of <file> to --re(g),\n");
+    printf("                   separated by commas or white space, '#' starts a comment\n");
     printf("--(r)ead           read data from register number or address\n");
     printf("--(w)rite    <val> write <val> to addresses or register numbers, if multiple registers defined <val>\n");
     printf("                   is written to all registers with the proper type casting\n");
@@ -1841,6 +4088,59 @@ usage(char *pname)
     printf("--(d)ev_info  [id] id is optional, if defined print registers' info for selected device otherwise\n");
     printf("                   print list of supported devices\n");
     printf("--r(e)ad_all  <id> read all registers' from device with <id> in the list of supported devices\n");
+    printf("--name   <pattern> read the registers of the device of -o, -e or --auto whose name matches\n");
+    printf("                   <pattern>, a shell pattern or a /regular expression/, or a comma\n");
+    printf("                   separated list of them. Adjacent registers are read in one request\n");
+    printf("                   example: modio -p192.168.2.104 -o2 --name 'DI_*,/^lan(Ip|Mac)$/'\n");
+    printf("--write-file <file> write the values of CSV file <file>, one register per line: a register\n");
+    printf("                   number or a register name of the device of -o, -e or --auto, followed by\n");
+    printf("                   one value per word or bit. Adjacent registers are written in one FC15 or\n");
+    printf("                   FC16 request, nothing is written if any line is invalid\n");
+    printf("                   example: modio -p192.168.2.104 -o2 --write-file e1212.csv --verify\n");
+    printf("--verify           read back the registers written by --write-file and report mismatches\n");
+    printf("--probe            find the limits of unit -i: the shortest gap between requests, the largest\n");
+    printf("                   read of every register type and, with the device of -o, -e or --auto, the\n");
+    printf("                   undefined addresses a read may span. They are written to the tuning file\n");
+    printf("                   of the unit in $XDG_CACHE_HOME/modio, which its reads and polls keep to\n");
+    printf("                   example: modio -p192.168.2.104 -i1 -o1 --probe\n");
+    printf("--cache      <val> answer reads from the response cache of the user if they are younger\n");
+    printf("                   than <val> ms or the ttl of their registers, and cache the responses.\n");
+    printf("                   Writes drop the cached reads they overlap\n");
+    printf("                   example: modio -p192.168.2.104 -i1 -e2 --cache 2000\n");
+    printf("--broker           own the port of -p and run the transfers of the other modio processes of\n");
+    printf("                   the port, which connect to its UNIX socket, until interrupted. Their\n");
+    printf("                   requests are served in turn and overlapping or adjacent reads merged\n");
+    printf("                   example: modio -p/dev/ttyUSB0 --baud 19200 --parity E --broker\n");
+    printf("--auto             select the device of -i <id> by its FC43 device identification, matched\n");
+    printf("                   against the vendor, product and revision of the device files and cached\n");
+    printf("                   per host and id in $XDG_CACHE_HOME/modio/devid, reads all registers if -g\n");
+    printf("                   is not defined\n");
+    printf("--poll       <val> read the registers of -e <id> or of the units of -i every <val> ms until\n");
+    printf("                   interrupted. Changed device files are reloaded between poll cycles\n");
+    printf("--quiet            don't print read values\n");
+    printf("--shm       <name> publish the polled values as a register image in shared memory <name>\n");
+    printf("--shm-dump  <name> print the register image in shared memory <name>\n");
+    printf("--record    <file> record the polled samples to ring file <file>, an existing ring file of\n");
+    printf("                   the same size is continued, other files are left as they are and fail\n");
+    printf("--record-size <n>  ring file capacity in samples (default %d)\n", RING_DEF_CAP);
+    printf("--archive   <file> append the polled samples to compressed archive <file>, an existing\n");
+    printf("                   archive of the same registers is continued, other files are left\n");
+    printf("                   as they are and fail\n");
+    printf("--alarms    <file> append the alarms raised and cleared by the alarm rules of the device\n");
+    printf("                   files to <file> as they happen, '-' for stdout (default stderr)\n");
+    printf("--window     <val> print a summary of the polled values of every register for each window\n");
+    printf("                   of <val> ms instead of the values: count, failed reads, quality, min,\n");
+    printf("                   max, mean and last value. A 'window' of the device file overrides <val>\n");
+    printf("--stddev           add the standard deviation to the --window summaries\n");
+    printf("--record-export <file> print the samples of ring file <file> as CSV\n");
+    printf("--archive-query <file> print the samples of archive <file> as CSV, of the units of -i <id,...>\n");
+    printf("                   and the registers of --name <pattern,...> if defined\n");
+    printf("--from      <time> export samples from <time>, seconds since the epoch or \"YYYY-MM-DD HH:MM:SS\"\n");
+    printf("--to        <time> export samples up to <time>\n");
+    printf("--capture   <file> log every request and response PDU to <file>, <file> is written as pcap\n");
+    printf("                   with Modbus/TCP frames if its name ends in .pcap\n");
+    printf("--replay    <file> answer requests from the capture or Modbus/TCP pcap <file> instead of a\n");
+    printf("                   device\n");
     printf("--debug      <val> print debug messages of debug level <val>\n");
     printf("--(h)elp           print usage\n");
 }
@@ -22,6 +22,10 @@
 #ifndef MXIO_H
 #define MXIO_H
 
+#include <time.h>
+#include <pthread.h>
+#include "arena.h"
+
 #define PROGR_DIR_NAME "modio"
 
 #ifndef REGISTER_PATH
@@ -45,6 +49,41 @@
 #define MODBYTE_TIMEOUT_s 0
 #define MODBYTE_TIMEOUT_us 500000
 
+/*
+ * RTU timing, derived from the serial line settings:
+ * the inter character gap is 1.5 (t1.5) and the end of frame gap
+ * 3.5 (t3.5) character times, fixed at 750us and 1750us above 19200
+ * baud. The response timeout of a request is the time to send the
+ * request and the expected response, plus the device turnaround,
+ * which device files may override, and the latency of the serial
+ * adapter.
+ */
+#define RTU_FIXED_GAP_BAUD 19200        /* baud rate above which gaps are fixed */
+#define RTU_T15_FIXED_us 750            /* t1.5 above RTU_FIXED_GAP_BAUD */
+#define RTU_T35_FIXED_us 1750           /* t3.5 above RTU_FIXED_GAP_BAUD */
+#define RTU_TURNAROUND_ms 100           /* default device turnaround */
+#define RTU_LATENCY_us 16000            /* serial adapter latency allowance */
+
+/*
+ * number of requests in a row a unit may leave unanswered
+ * before it is dropped from a multi unit read
+ */
+#define UNIT_MAX_FAILS 2
+
+/* poll cycles a dropped unit is left out before it is tried again */
+#define UNIT_RETRY_CYCLES 10
+
+/* highest modbus slave id of a unit of -i, 0 is the broadcast address */
+#define UNIT_MAX_ID 247
+
+/* reads of every gap between requests that --probe tries */
+#define PROBE_BURST 20
+
+/* gaps between requests in ms that --probe tries, from the longest down */
+#define PROBE_GAPS 100, 50, 20, 10, 5, 2, 1, 0
+
+/* max gaps between registers that --probe reads across */
+#define PROBE_SPANS 16
 
 /* definition of register type */
 enum regtype {
@@ -73,33 +112,246 @@ struct rreg {
 };
 typedef struct rreg rreg_t;
 
-/* device register struct */
-struct dreg {
-    int num;                    /* register number */
-    int addr;                   /* register address */
-    int len;                    /* register length */
-    int type;                   /* register type */
+/*
+ * Value printer of a register print format. Formats the value at word
+ * or bit j of the len words or bits of a register, in v, into buf of
+ * size sz. Returns the number of words or bits it used, or -1 if the
+ * register can't be printed in its format.
+ */
+typedef int (*prval_t)(char *buf, size_t sz, const void *v, int j, int len, double scale, const char *engu);
+
+#define PRVAL_LEN 1024          /* max length of a printed value */
+
+/* descriptive info of a device register, not needed to read it */
+struct dinfo {
     char *name;                 /* register name */
     char *desc;                 /* register description */
     char *range;                /* register range */
-    double scale;               /* register scale */
     char *engu;                 /* register engineering unit */
     char *acc;                  /* register access */
+};
+typedef struct dinfo dinfo_t;
+
+/*
+ * device register struct, the fields read on every poll, the
+ * descriptive info is kept apart so the registers of a device stay
+ * packed in fewer cache lines
+ */
+struct dreg {
+    int addr;                   /* register address */
+    int len;                    /* register length */
+    int type;                   /* register type */
     int prfmt;                  /* register print format */
+    double scale;               /* register scale */
+    int num;                    /* register number */
+    int period;                 /* poll period in ms, 0 for every poll cycle */
+    int prio;                   /* poll priority, higher is read first */
+    int ttl;                    /* response cache ttl in ms, -1 for the --cache ttl */
+    int window;                 /* aggregation window in ms, 0 for the --window window */
+    dinfo_t *info;              /* register info */
+    prval_t prval;              /* value printer of its type and print format */
 };
 typedef struct dreg dreg_t;
 
+/*
+ * instruction of a compiled derived register expression, an operation
+ * of a stack machine with its register index or constant
+ */
+struct dins {
+    int op;                     /* operation */
+    int arg;                    /* value index of DOP_VAL */
+    double k;                   /* constant of DOP_K */
+};
+typedef struct dins dins_t;
+
+/*
+ * derived register, a value computed from the values of the other
+ * registers of a device by a compiled expression
+ */
+struct dvar {
+    char *name;                 /* derived register name */
+    char *desc;                 /* derived register description */
+    char *engu;                 /* derived register engineering unit */
+    char *expr;                 /* expression source */
+    int prfmt;                  /* print format, HEX or DEC */
+    int window;                 /* aggregation window in ms, 0 for the --window window */
+    int ncode;                  /* number of instructions */
+    dins_t *code;               /* compiled expression */
+};
+typedef struct dvar dvar_t;
+
+/* alarm conditions */
+enum alkind {
+    AL_NONE = 0,                /* no alarm */
+    AL_HIGH = 1,                /* above the high limit */
+    AL_LOW = 2,                 /* below the low limit */
+    AL_FLAG = 3                 /* a bit flag of the mask is set */
+};
+
+/* alarm rule of a register or derived register */
+struct alrule {
+    int vi;                     /* value index, a register or nor + derived register */
+    double high;                /* high limit, NAN if none */
+    double low;                 /* low limit, NAN if none */
+    double hyst;                /* hysteresis of the limits when the alarm is raised */
+    uint32_t mask;              /* bit flags that raise the alarm, 0 if none */
+    int on;                     /* ms a condition must last to raise the alarm */
+    int off;                    /* ms the condition must be gone to clear the alarm */
+};
+typedef struct alrule alrule_t;
+
+/* alarm state of an alarm rule on a unit */
+struct alstate {
+    int act;                    /* raised alarm condition, AL_NONE if clear */
+    int cand;                   /* alarm condition of the last value */
+    int64_t since;              /* monotonic time in ns of the last condition change */
+};
+typedef struct alstate alstate_t;
+
+/* aggregate of the values of a register or derived register in a window */
+struct wagg {
+    int64_t win;                /* window number, wall clock time / window length */
+    int n;                      /* number of values */
+    int err;                    /* number of failed reads */
+    double min;                 /* min value */
+    double max;                 /* max value */
+    double mean;                /* mean value */
+    double m2;                  /* sum of the squared differences from the mean */
+    double last;                /* last value */
+};
+typedef struct wagg wagg_t;
+
 /* device list struct */
 struct dvlst {
     char *manfc;                /* device manufacturer */
     char *type;                 /* device type */
     char *model;                /* device model */
+    char *vendor;               /* identification vendor name pattern */
+    char *product;              /* identification product code pattern */
+    char *revision;             /* identification revision pattern */
     int zba;                    /* zero based addressing */
     int nor;                    /* number of registers */
     dreg_t *regs;               /* register list */
+    dinfo_t *info;              /* register info list */
+    int *order;                 /* register indexes sorted by type and address */
+    int nod;                    /* number of derived registers */
+    dvar_t *drv;                /* derived register list */
+    int noa;                    /* number of alarm rules */
+    alrule_t *alarm;            /* alarm rule list */
+    int turnaround;             /* RTU turnaround in ms, 0 for default */
+    char *file;                 /* device file path */
+    arena_t *mem;               /* arena of the device data */
 };
 typedef struct dvlst dvlist_t;
 
+/* max number of threads reading device files */
+#define DEV_MAX_WORKERS 64
+
+/* device file read task */
+struct dftask {
+    char *path;                 /* device file path */
+    dvlist_t dv;                /* device read from the file */
+    int rval;                   /* read_dev_file return value */
+    char err[512];              /* error message of a failed read */
+};
+typedef struct dftask dftask_t;
+
+/* pool of device file read tasks */
+struct dfpool {
+    dftask_t *task;             /* tasks in directory order */
+    int n;                      /* number of tasks */
+    int next;                   /* next task to run */
+};
+typedef struct dfpool dfpool_t;
+
+/* size of a device identification object string */
+#define DEVID_LEN 64
+
+/* device identification, the basic objects of FC43 / MEI 14 */
+struct devid {
+    char vendor[DEVID_LEN];     /* VendorName */
+    char product[DEVID_LEN];    /* ProductCode */
+    char revision[DEVID_LEN];   /* MajorMinorRevision */
+};
+typedef struct devid devid_t;
+
+/* device replaced by a reload, freed once no poll cycle uses it */
+struct rtdev {
+    dvlist_t dv;                /* replaced device */
+    unsigned long cycle;        /* poll cycle it was replaced in */
+    struct rtdev *nxt;          /* next retired device */
+};
+typedef struct rtdev rtdev_t;
+
+/* device file watcher */
+struct reload {
+    int fd;                     /* inotify instance */
+    int wd[2];                  /* watches of the device directories */
+    char *dir[2];               /* watched device directories */
+    int n;                      /* number of devices */
+    char **file;                /* device file of every device */
+    dvlist_t **pend;            /* reloaded devices not applied yet */
+    rtdev_t *retired;           /* replaced devices */
+    unsigned long cycle;        /* poll cycles so far */
+    pthread_t tid;              /* watcher thread */
+    int run;                    /* watcher thread started */
+    volatile int quit;          /* stop the watcher thread */
+};
+typedef struct reload reload_t;
+
+/*
+ * Limits of a unit found by --probe and kept in its tuning file, 0 for
+ * the protocol limits. Used by the read plans and the poll scheduler.
+ */
+struct tune {
+    int probed;                 /* limits read from a tuning file */
+    int max[4];                 /* max words or bits of a read by register type */
+    int span;                   /* max undefined addresses a block read may span */
+    int gap;                    /* min gap between requests in ms */
+    int rate;                   /* sustained requests per second */
+};
+typedef struct tune tune_t;
+
+/* modbus unit sharing the connection with other units */
+struct unit {
+    int id;                     /* modbus slave id */
+    int dnum;                   /* device number in device list */
+    int nxt;                    /* next register to read */
+    int fails;                  /* unanswered requests in a row */
+    int dead;                   /* unit dropped flag */
+    int retry;                  /* poll cycles until a dropped unit is retried */
+    int base;                   /* slot of the first register of the unit */
+    int nval;                   /* number of values in val */
+    double *val;                /* last values of the registers and derived registers, NAN if unknown */
+    int nals;                   /* number of alarm states in als */
+    alstate_t *als;             /* state of every alarm rule of the device */
+    int nagg;                   /* number of aggregates in agg */
+    wagg_t *agg;                /* window aggregate of every value in val */
+    tune_t tune;                /* limits of the unit */
+};
+typedef struct unit unit_t;
+
+/* register sample, the outcome of one register read */
+struct rsmpl {
+    int uid;                    /* modbus slave id */
+    int dnum;                   /* device number in device list */
+    int rnum;                   /* register index in device register list */
+    int slot;                   /* register slot among all polled registers */
+    int err;                    /* errno of a failed read, 0 on success */
+    struct timespec mono;       /* monotonic time of the read */
+    struct timespec real;       /* wall clock time of the read */
+    int nw;                     /* number of words in raw */
+    uint16_t raw[REG_SIZE];     /* register words, one per bit for bit registers */
+};
+typedef struct rsmpl rsmpl_t;
+
+/* poll scheduler state of registers with their own period or priority */
+struct sched {
+    int nslot;                  /* number of register slots */
+    int64_t *due;               /* monotonic time every slot is due next in ns */
+};
+typedef struct sched sched_t;
+
 /* register print format */
 enum prfmt {
    BIN = 0,                     /* binary format */
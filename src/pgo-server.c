@@ -0,0 +1,154 @@
+/*
+ *  modio - Modbus input output access tool
+ *
+ *  Copyright (C) 2022, Dimitris Economou (dimitris.s.economou@gmail.com)
+ *
+ *  This file is part of modio.
+ *
+ *  modio is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  modio is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with modio. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Loopback Modbus/TCP server of the make pgo training workload. It serves
+ * every unit id from one register image of fixed values, so that the
+ * training runs of pgo-train.sh are the same on every build host. It
+ * answers Modbus/UDP datagrams on the same port number as well.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <modbus.h>
+
+#define PGO_REGS    0x10000     /* registers of each type */
+
+/*
+ * Answer the Modbus/UDP request waiting on socket us. The socket is
+ * connected to the client for the reply of mu, which sends on it.
+ */
+static void
+udp_reply(modbus_t *mu, int us, modbus_mapping_t *map)
+{
+    uint8_t req[MODBUS_TCP_MAX_ADU_LENGTH];
+    struct sockaddr_in cli;
+    struct sockaddr_in any;
+    socklen_t clen = sizeof(cli);
+    ssize_t len;
+
+    len = recvfrom(us, req, sizeof(req), 0, (struct sockaddr *)&cli, &clen);
+    if (len < 8 || connect(us, (struct sockaddr *)&cli, clen) == -1) {
+        return;
+    }
+    modbus_reply(mu, req, (int )len, map);
+
+    /* take datagrams of any client again */
+    memset(&any, 0, sizeof(any));
+    any.sin_family = AF_UNSPEC;
+    connect(us, (struct sockaddr *)&any, sizeof(any));
+}
+
+int
+main(int argc, char *argv[])
+{
+    modbus_t *mb;
+    modbus_t *mu;
+    modbus_mapping_t *map;
+    uint8_t req[MODBUS_TCP_MAX_ADU_LENGTH];
+    struct sockaddr_in sa;
+    struct pollfd pfd[2];
+    int port = 1502;
+    int sock;
+    int us;
+    int len;
+    int i;
+
+    if (argc > 1) {
+        port = (int )strtoul(argv[1], NULL, 10);
+    }
+
+    mb = modbus_new_tcp("127.0.0.1", port);
+    mu = modbus_new_tcp("127.0.0.1", port);
+    map = modbus_mapping_new(PGO_REGS, PGO_REGS, PGO_REGS, PGO_REGS);
+    if (mb == NULL || mu == NULL || map == NULL) {
+        fprintf(stderr, "malloc failed: insufficient memory!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* a mix of small, large, negative and printable values */
+    for (i = 0; i < PGO_REGS; i++) {
+        map->tab_bits[i] = i & 1;
+        map->tab_input_bits[i] = (i >> 1) & 1;
+        map->tab_input_registers[i] = (uint16_t )(i * 40503u);
+        map->tab_registers[i] = (i & 0x10) ? 0x4142 + (i & 0x0f) * 0x0101 : (uint16_t )(1000 + i);
+    }
+
+    if ((sock = modbus_tcp_listen(mb, 4)) < 0) {
+        fprintf(stderr, "ERROR: listen on 127.0.0.1:%d failed: %s\n", port, modbus_strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port);
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    us = socket(AF_INET, SOCK_DGRAM, 0);
+    if (us == -1 || bind(us, (struct sockaddr *)&sa, sizeof(sa)) == -1) {
+        fprintf(stderr, "ERROR: udp bind on 127.0.0.1:%d failed: %s\n", port, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    modbus_set_socket(mu, us);
+
+    /* serve one TCP client at a time and the UDP datagrams in between until killed */
+    pfd[1].fd = us;
+    pfd[1].events = POLLIN;
+    for (;;) {
+        pfd[0].fd = sock;
+        pfd[0].events = POLLIN;
+        if (poll(pfd, 2, -1) <= 0) {
+            continue;
+        }
+        if (pfd[1].revents & POLLIN) {
+            udp_reply(mu, us, map);
+        }
+        if (!(pfd[0].revents & POLLIN) || modbus_tcp_accept(mb, &sock) < 0) {
+            continue;
+        }
+        pfd[0].fd = modbus_get_socket(mb);
+        for (;;) {
+            if (poll(pfd, 2, -1) <= 0) {
+                continue;
+            }
+            if (pfd[1].revents & POLLIN) {
+                udp_reply(mu, us, map);
+            }
+            if (pfd[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+                if ((len = modbus_receive(mb, req)) < 0) {
+                    break;
+                }
+                if (len > 0) {
+                    modbus_reply(mb, req, len, map);
+                }
+            }
+        }
+        close(modbus_get_socket(mb));
+    }
+
+    return 0;
+}
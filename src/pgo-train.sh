@@ -0,0 +1,93 @@
+#! /bin/sh
+#
+# pgo-train.sh - training workload of make pgo
+#
+# usage: pgo-train.sh <modio> <pgo-server> <regs dir> [port]
+#
+# Runs a -fprofile-generate build of modio against the loopback server of
+# pgo-server.c: reads of all registers, register ranges in every print
+# format, Modbus/UDP reads, a block write and a poll run with shared memory,
+# recording and an archive.
+# The device files of <regs dir> are read from a temporary $HOME.
+
+MODIO=$1
+SERVER=$2
+REGS=$3
+PORT=${4:-15020}
+P="-p127.0.0.1:$PORT"
+
+if [ ! -x "$MODIO" ] || [ ! -x "$SERVER" ] || [ ! -d "$REGS" ]; then
+	echo "usage: $0 <modio> <pgo-server> <regs dir> [port]"
+	exit 1
+fi
+
+TMP=$(mktemp -d) || exit 1
+mkdir "$TMP/.modio" && cp "$REGS"/*.cfg "$TMP/.modio/" || exit 1
+
+"$SERVER" "$PORT" &
+SPID=$!
+trap 'kill $SPID 2>/dev/null; rm -rf "$TMP"' EXIT INT TERM
+sleep 1
+
+export HOME="$TMP"
+export XDG_CACHE_HOME="$TMP/.cache"
+
+run() {
+	"$MODIO" "$@" > /dev/null 2>&1
+}
+
+echo "pgo: training modio on 127.0.0.1:$PORT"
+
+# device files, read all and register info
+run -d
+for dev in 1 2; do
+	run -d$dev
+	run -o$dev
+	i=0
+	while [ $i -lt 50 ]; do
+		run $P -i1 -e$dev
+		i=$((i + 1))
+	done
+done
+
+# register lists and ranges in every print format
+for fmt in 0 1 2 3 4 5 6; do
+	i=0
+	while [ $i -lt 10 ]; do
+		run $P -i1 -g40001-40300,30001+64,10001+32,1-64 -r -f$fmt
+		run $P -i1 -g0x100 -a -t3 -l8 -r -f$fmt
+		i=$((i + 1))
+	done
+done
+run $P -i1 -o2 --name 'DI_*,/^lan/'
+
+# Modbus/UDP reads of the same server
+i=0
+while [ $i -lt 20 ]; do
+	run -p"udp://127.0.0.1:$PORT" -i1 -e1
+	i=$((i + 1))
+done
+
+# block write with read back
+cat > "$TMP/pgo.csv" << EOF
+# register number, values
+40001, 1, 2, 3, 4
+40010, 0x10
+1, 1, 0, 1
+EOF
+run $P -i1 --write-file "$TMP/pgo.csv" --verify
+
+# poll with shared memory, recording, archive and export, stopped by SIGTERM
+"$MODIO" $P -i1,2 -e1 --poll 5 --quiet --shm modio-pgo --record "$TMP/pgo.ring" --record-size 4096 \
+	--archive "$TMP/pgo.arch" > /dev/null 2>&1 &
+MPID=$!
+sleep 5
+kill -TERM $MPID
+wait $MPID
+run --shm-dump modio-pgo
+run --record-export "$TMP/pgo.ring"
+run --archive-query "$TMP/pgo.arch"
+rm -f /dev/shm/modio-pgo
+
+echo "pgo: training done"
+exit 0
@@ -0,0 +1,222 @@
+/*
+ *  modio - Modbus input output access tool
+ *
+ *  Copyright (C) 2022, Dimitris Economou (dimitris.s.economou@gmail.com)
+ *
+ *  This file is part of modio.
+ *
+ *  modio is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  modio is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with modio. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "plan.h"
+
+/*
+ * order registers by type and address
+ */
+static int
+plan_cmp(const void *a, const void *b)
+{
+    const dreg_t *ra = *(dreg_t * const *)a;
+    const dreg_t *rb = *(dreg_t * const *)b;
+
+    if (ra->type != rb->type) {
+        return ra->type - rb->type;
+    }
+    if ((ra->addr & 0xffff) != (rb->addr & 0xffff)) {
+        return (ra->addr & 0xffff) - (rb->addr & 0xffff);
+    }
+    return rb->len - ra->len;
+}
+
+/*
+ * Build the read plan of the n registers in sel. A register joins the
+ * open block when it has the same type, starts at or before the end
+ * of the block, or within the span of undefined addresses of tuning
+ * t, and the block doesn't outgrow the limit of its type. The limits
+ * of t replace the protocol limits that they are below of.
+ * Returns NULL if out of memory.
+ */
+plan_t *
+plan_build(dreg_t **sel, int n, const tune_t *t)
+{
+    plan_t *p;
+    pblk_t *b = NULL;
+
+    p = (plan_t *)calloc(1, sizeof(plan_t));
+    if (p == NULL) {
+        return NULL;
+    }
+    p->regs = (dreg_t **)malloc((n ? n : 1) * sizeof(dreg_t *));
+    p->blk = (pblk_t *)malloc((n ? n : 1) * sizeof(pblk_t));
+    if (p->regs == NULL || p->blk == NULL) {
+        plan_free(p);
+        return NULL;
+    }
+    memcpy(p->regs, sel, n * sizeof(dreg_t *));
+
+    /* registers selected in the sorted order of their device need no sort */
+    for (int i = 1; i < n; i++) {
+        if (plan_cmp(&p->regs[i - 1], &p->regs[i]) > 0) {
+            qsort(p->regs, n, sizeof(dreg_t *), plan_cmp);
+            break;
+        }
+    }
+    p->nreg = n;
+
+    for (int i = 0; i < n; i++) {
+        dreg_t *r = p->regs[i];
+        int addr = r->addr & 0xffff;
+        int max = (r->type == COIL || r->type == INPUT_B) ? PLAN_MAX_BITS : PLAN_MAX_REGS;
+        int span = (t != NULL) ? t->span : 0;
+
+        if (t != NULL && r->type >= COIL && r->type <= HOLDING && t->max[r->type] > 0 &&
+            t->max[r->type] < max) {
+            max = t->max[r->type];
+        }
+        if (b != NULL && b->type == r->type && addr <= b->addr + b->len + span) {
+            int end = addr + r->len;
+
+            if (end - b->addr <= max || end <= b->addr + b->len) {
+                if (end > b->addr + b->len) {
+                    b->len = end - b->addr;
+                }
+                b->nreg++;
+                if (r->prio > b->prio) {
+                    b->prio = r->prio;
+                }
+                if (r->period < b->period) {
+                    b->period = r->period;
+                }
+                if (r->ttl < b->ttl) {
+                    b->ttl = r->ttl;
+                }
+                continue;
+            }
+        }
+        b = &p->blk[p->nblk++];
+        b->type = r->type;
+        b->addr = addr;
+        b->len = r->len;
+        b->first = i;
+        b->nreg = 1;
+        b->prio = r->prio;
+        b->period = r->period;
+        b->ttl = r->ttl;
+    }
+    return p;
+}
+
+/*
+ * free a read plan
+ */
+void
+plan_free(plan_t *p)
+{
+    if (p == NULL) {
+        return;
+    }
+    free(p->regs);
+    free(p->blk);
+    free(p);
+}
+
+/*
+ * order values by type, address and line
+ */
+static int
+wplan_cmp(const void *a, const void *b)
+{
+    const wval_t *va = (const wval_t *)a;
+    const wval_t *vb = (const wval_t *)b;
+
+    if (va->type != vb->type) {
+        return va->type - vb->type;
+    }
+    if (va->addr != vb->addr) {
+        return va->addr - vb->addr;
+    }
+    return va->line - vb->line;
+}
+
+/*
+ * Build the write plan of the n values in val. Of several values for
+ * the same address the one of the last line is written. A value joins
+ * the open block when it has the same type, follows the last address
+ * of the block and the block doesn't outgrow the limit of its type.
+ * Returns NULL if out of memory.
+ */
+wplan_t *
+wplan_build(const wval_t *val, int n)
+{
+    wplan_t *p;
+    wblk_t *b = NULL;
+    int k = 0;
+
+    p = (wplan_t *)calloc(1, sizeof(wplan_t));
+    if (p == NULL) {
+        return NULL;
+    }
+    p->vals = (wval_t *)malloc((n ? n : 1) * sizeof(wval_t));
+    p->blk = (wblk_t *)malloc((n ? n : 1) * sizeof(wblk_t));
+    if (p->vals == NULL || p->blk == NULL) {
+        wplan_free(p);
+        return NULL;
+    }
+    memcpy(p->vals, val, n * sizeof(wval_t));
+    qsort(p->vals, n, sizeof(wval_t), wplan_cmp);
+
+    /* keep the last value of every address */
+    for (int i = 0; i < n; i++) {
+        if (k > 0 && p->vals[k - 1].type == p->vals[i].type && p->vals[k - 1].addr == p->vals[i].addr) {
+            p->vals[k - 1] = p->vals[i];
+            p->ndup++;
+            continue;
+        }
+        p->vals[k++] = p->vals[i];
+    }
+    p->nval = k;
+
+    for (int i = 0; i < k; i++) {
+        wval_t *v = &p->vals[i];
+        int max = (v->type == COIL) ? PLAN_MAX_WBITS : PLAN_MAX_WREGS;
+
+        if (b != NULL && b->type == v->type && v->addr == b->addr + b->len && b->len < max) {
+            b->len++;
+            continue;
+        }
+        b = &p->blk[p->nblk++];
+        b->type = v->type;
+        b->addr = v->addr;
+        b->len = 1;
+        b->first = i;
+    }
+    return p;
+}
+
+/*
+ * free a write plan
+ */
+void
+wplan_free(wplan_t *p)
+{
+    if (p == NULL) {
+        return;
+    }
+    free(p->vals);
+    free(p->blk);
+    free(p);
+}
@@ -0,0 +1,118 @@
+/*
+ *  modio - Modbus input output access tool
+ *
+ *  Copyright (C) 2022, Dimitris Economou (dimitris.s.economou@gmail.com)
+ *
+ *  This file is part of modio.
+ *
+ *  modio is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  modio is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with modio. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Read plans of device registers.
+ *
+ * A plan holds a set of device registers sorted by type and address,
+ * merged into the fewest block reads: registers of the same type that
+ * are contiguous or overlap share one request, as long as the block
+ * stays within the PDU limits of its function code. With the tuning of
+ * a unit the blocks stay within its probed limits instead, and may span
+ * as many undefined addresses as the unit tolerates.
+ *
+ * A write plan does the same for values to write: values of
+ * contiguous coils or holding registers share one FC15 or FC16
+ * request.
+ */
+
+#ifndef MXIO_PLAN_H
+#define MXIO_PLAN_H
+
+#include <stdint.h>
+#include "modio.h"
+
+#define PLAN_MAX_REGS 125       /* max words of a FC3/FC4 read */
+#define PLAN_MAX_BITS 2000      /* max bits of a FC1/FC2 read */
+#define PLAN_MAX_WREGS 123      /* max words of a FC16 write */
+#define PLAN_MAX_WBITS 1968     /* max bits of a FC15 write */
+
+/* block read of a plan */
+struct pblk {
+    int type;                   /* register type */
+    int addr;                   /* first address on the wire */
+    int len;                    /* words or bits to read */
+    int first;                  /* index of the first register of the block */
+    int nreg;                   /* number of registers of the block */
+    int prio;                   /* highest poll priority of the registers */
+    int period;                 /* shortest poll period of the registers */
+    int ttl;                    /* shortest response cache ttl of the registers */
+};
+typedef struct pblk pblk_t;
+
+/* block read of a unit, scheduled in a poll cycle */
+struct sjob {
+    int unit;                   /* index of the unit */
+    pblk_t *blk;                /* block read */
+};
+typedef struct sjob sjob_t;
+
+/* read plan */
+struct plan {
+    dreg_t **regs;              /* registers sorted by type and address */
+    int nreg;                   /* number of registers */
+    pblk_t *blk;                /* block reads */
+    int nblk;                   /* number of block reads */
+};
+typedef struct plan plan_t;
+
+/* value of a write plan */
+struct wval {
+    int type;                   /* register type, COIL or HOLDING */
+    int addr;                   /* address on the wire */
+    uint16_t val;               /* value to write */
+    int reg;                    /* register number */
+    int line;                   /* line of the value in its file */
+};
+typedef struct wval wval_t;
+
+/* block write of a write plan */
+struct wblk {
+    int type;                   /* register type */
+    int addr;                   /* first address on the wire */
+    int len;                    /* words or bits to write */
+    int first;                  /* index of the first value of the block */
+};
+typedef struct wblk wblk_t;
+
+/* write plan */
+struct wplan {
+    wval_t *vals;               /* values sorted by type and address */
+    int nval;                   /* number of values */
+    int ndup;                   /* number of values overridden by a later one */
+    wblk_t *blk;                /* block writes */
+    int nblk;                   /* number of block writes */
+};
+typedef struct wplan wplan_t;
+
+/* build the read plan of n registers, within the limits of tuning t if not NULL */
+plan_t *plan_build(dreg_t **sel, int n, const tune_t *t);
+
+/* free a read plan */
+void plan_free(plan_t *p);
+
+/* build the write plan of n values */
+wplan_t *wplan_build(const wval_t *val, int n);
+
+/* free a write plan */
+void wplan_free(wplan_t *p);
+
+#endif
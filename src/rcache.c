@@ -0,0 +1,423 @@
+/*
+ *  modio - Modbus input output access tool
+ *
+ *  Copyright (C) 2022, Dimitris Economou (dimitris.s.economou@gmail.com)
+ *
+ *  This file is part of modio.
+ *
+ *  modio is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  modio is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with modio. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "rcache.h"
+
+/* entry body copied under the sequence lock */
+#define ENT_BODY(e) ((char *)(e) + sizeof(uint32_t))
+#define ENT_BODY_SZ (sizeof(rcache_ent_t) - sizeof(uint32_t))
+
+/* attempts to lock an entry that is written by another process */
+#define ENT_LOCK_SPIN 10000
+
+/* FNV-1a 64 bit hash */
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+/*
+ * current wall clock time in ns
+ */
+static int64_t
+real_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t )ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * continue the FNV-1a hash h with len bytes of p
+ */
+static uint64_t
+fnv_add(uint64_t h, const void *p, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        h ^= ((const uint8_t *)p)[i];
+        h *= FNV_PRIME;
+    }
+    return h;
+}
+
+/*
+ * Default cache file path of the user: /run/modio/cache for root,
+ * modio-cache in $XDG_RUNTIME_DIR or /run/user/<uid> for the others,
+ * so that a user never reads responses another user has put. The
+ * directory of root is created.
+ */
+const char *
+rcache_path(void)
+{
+    static char path[PATH_MAX];
+    const char *xdg = getenv("XDG_RUNTIME_DIR");
+
+    if (geteuid() == 0) {
+        mkdir("/run/modio", 0755);
+        snprintf(path, sizeof(path), "/run/modio/cache");
+    } else if (xdg != NULL && *xdg == '/') {
+        snprintf(path, sizeof(path), "%s/modio-cache", xdg);
+    } else {
+        snprintf(path, sizeof(path), "/run/user/%u/modio-cache", (unsigned )geteuid());
+    }
+    return path;
+}
+
+/*
+ * Hash a port, a serial device or a TCP host. The server port of a
+ * TCP host defaults to 502, so that both spellings share entries.
+ */
+uint64_t
+rcache_port(const char *port)
+{
+    uint64_t h = fnv_add(FNV_OFFSET, port, strlen(port));
+
+    if (strstr(port, "/dev/tty") == NULL && strchr(port, ':') == NULL) {
+        h = fnv_add(h, ":502", 4);
+    }
+    return h;
+}
+
+/*
+ * bytes of the response data of a key, -1 if an entry can't hold it
+ */
+static int
+key_bytes(const rcache_key_t *k)
+{
+    int n;
+
+    switch (k->fc) {
+        case 0x01:
+        case 0x02:
+            n = (k->nb + 7) / 8;
+            break;
+        case 0x03:
+        case 0x04:
+            n = 2 * k->nb;
+            break;
+        default:
+            return -1;
+    }
+    return (k->nb > 0 && n <= RCACHE_DATA) ? n : -1;
+}
+
+/*
+ * index of the first entry a key may be kept in
+ */
+static uint32_t
+key_slot(const rcache_key_t *k)
+{
+    uint64_t h = FNV_OFFSET;
+
+    h = fnv_add(h, &k->port, sizeof(k->port));
+    h = fnv_add(h, &k->unit, sizeof(k->unit));
+    h = fnv_add(h, &k->fc, sizeof(k->fc));
+    h = fnv_add(h, &k->addr, sizeof(k->addr));
+    h = fnv_add(h, &k->nb, sizeof(k->nb));
+    return (uint32_t )(h % RCACHE_ENTS);
+}
+
+/*
+ * check if entry e holds the response of key k
+ */
+static int
+key_match(const rcache_ent_t *e, const rcache_key_t *k)
+{
+    return e->fc == k->fc && e->unit == (k->unit & 0xff) && e->addr == (k->addr & 0xffff) &&
+           e->nb == k->nb && e->port == k->port;
+}
+
+/*
+ * Open the cache file path, it is created, or initialized again if it
+ * has another layout, under an exclusive lock. Returns NULL on error.
+ */
+rcache_t *
+rcache_open(const char *path)
+{
+    rcache_t *c;
+    rcache_hdr_t *h;
+    struct stat st;
+    int fd;
+
+    c = (rcache_t *)calloc(1, sizeof(rcache_t));
+    if (c == NULL) {
+        fprintf(stderr, "malloc failed: insufficient memory!\n");
+        exit(EXIT_FAILURE);
+    }
+    c->size = sizeof(rcache_hdr_t) + RCACHE_ENTS * sizeof(rcache_ent_t);
+
+    fd = open(path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        printf("ERROR:(%s) open %s\n", strerror(errno), path);
+        free(c);
+        return NULL;
+    }
+    if (flock(fd, LOCK_EX) == -1 || fstat(fd, &st) == -1) {
+        printf("ERROR:(%s) lock %s\n", strerror(errno), path);
+        close(fd);
+        free(c);
+        return NULL;
+    }
+
+    /* never trust responses another user could have put */
+    if (!S_ISREG(st.st_mode) || st.st_uid != geteuid()) {
+        printf("ERROR: %s is not a modio cache file of the user\n", path);
+        close(fd);
+        free(c);
+        return NULL;
+    }
+    if ((size_t )st.st_size != c->size &&
+        (ftruncate(fd, 0) == -1 || ftruncate(fd, c->size) == -1)) {
+        printf("ERROR:(%s) ftruncate %s\n", strerror(errno), path);
+        close(fd);
+        free(c);
+        return NULL;
+    }
+    c->hdr = (rcache_hdr_t *)mmap(NULL, c->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (c->hdr == MAP_FAILED) {
+        printf("ERROR:(%s) mmap %s\n", strerror(errno), path);
+        close(fd);
+        free(c);
+        return NULL;
+    }
+    c->ent = (rcache_ent_t *)(c->hdr + 1);
+
+    /* a new file is zero filled, a file of another layout is cleared */
+    h = c->hdr;
+    if (__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != RCACHE_MAGIC ||
+        h->version != RCACHE_VERSION ||
+        h->hsize != sizeof(rcache_hdr_t) ||
+        h->esize != sizeof(rcache_ent_t) ||
+        h->nent != RCACHE_ENTS) {
+        memset(h, 0, c->size);
+        h->version = RCACHE_VERSION;
+        h->hsize = sizeof(rcache_hdr_t);
+        h->esize = sizeof(rcache_ent_t);
+        h->nent = RCACHE_ENTS;
+        __atomic_store_n(&h->magic, RCACHE_MAGIC, __ATOMIC_RELEASE);
+    }
+    close(fd);
+    return c;
+}
+
+/*
+ * unmap the cache file
+ */
+void
+rcache_close(rcache_t *c)
+{
+    if (c == NULL) {
+        return;
+    }
+    munmap(c->hdr, c->size);
+    free(c);
+}
+
+/*
+ * current write generation, taken before a read whose response may be
+ * put in the cache
+ */
+uint64_t
+rcache_gen(const rcache_t *c)
+{
+    return __atomic_load_n(&c->hdr->wgen, __ATOMIC_SEQ_CST);
+}
+
+/*
+ * Copy the data of the cached read of key k into data, in the layout
+ * of libmodbus: one byte per bit or one word per register. The read
+ * must be younger than max_ns, a read from the future after a clock
+ * step is too old. Returns -1 on a miss.
+ */
+int
+rcache_get(const rcache_t *c, const rcache_key_t *k, int64_t max_ns, void *data)
+{
+    uint32_t slot;
+    int64_t now;
+
+    if (key_bytes(k) == -1) {
+        return -1;
+    }
+    slot = key_slot(k);
+    for (int p = 0; p < RCACHE_PROBES; p++) {
+        const rcache_ent_t *e = &c->ent[(slot + p) % RCACHE_ENTS];
+        rcache_ent_t cp;
+        uint32_t s1;
+        uint32_t s2;
+
+        /* an entry that is being written is a miss, readers don't wait */
+        s1 = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+        if (s1 & 1) {
+            continue;
+        }
+        memcpy(ENT_BODY(&cp), ENT_BODY(e), ENT_BODY_SZ);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        s2 = __atomic_load_n(&e->seq, __ATOMIC_RELAXED);
+        if (s1 != s2 || !key_match(&cp, k)) {
+            continue;
+        }
+        now = real_ns();
+        if (cp.real_ns > now || now - cp.real_ns > max_ns) {
+            return -1;
+        }
+        if (k->fc == 0x01 || k->fc == 0x02) {
+            for (int i = 0; i < k->nb; i++) {
+                ((uint8_t *)data)[i] = (cp.data[i / 8] >> (i % 8)) & 1;
+            }
+        } else {
+            memcpy(data, cp.data, 2 * k->nb);
+        }
+        return 0;
+    }
+    return -1;
+}
+
+/*
+ * Lock entry e for writing, spinning a while if another process
+ * writes it. Returns the even seq it had, or -1 if it stays locked.
+ */
+static int64_t
+ent_lock(rcache_ent_t *e, int spin)
+{
+    uint32_t s;
+
+    for (int i = 0; i <= spin; i++) {
+        s = __atomic_load_n(&e->seq, __ATOMIC_RELAXED);
+        if (!(s & 1) &&
+            __atomic_compare_exchange_n(&e->seq, &s, s + 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            __atomic_thread_fence(__ATOMIC_RELEASE);
+            return s;
+        }
+    }
+    return -1;
+}
+
+/*
+ * unlock entry e, locked when its seq was s
+ */
+static void
+ent_unlock(rcache_ent_t *e, uint32_t s)
+{
+    __atomic_store_n(&e->seq, s + 2, __ATOMIC_SEQ_CST);
+}
+
+/*
+ * Put the data of the read of key k, in the layout of libmodbus, in
+ * the cache. The read must have been done since write generation gen:
+ * its response may be older than a write that has invalidated the
+ * cache meanwhile, so it is dropped again. The entry of the key, an
+ * empty one or the oldest one of the entries the key may be kept in
+ * is replaced, unless another process writes it.
+ */
+void
+rcache_put(rcache_t *c, const rcache_key_t *k, uint64_t gen, const void *data)
+{
+    uint32_t slot;
+    rcache_ent_t *e = NULL;
+    int64_t s;
+    int n;
+
+    if ((n = key_bytes(k)) == -1 || rcache_gen(c) != gen) {
+        return;
+    }
+    slot = key_slot(k);
+    for (int p = 0; p < RCACHE_PROBES; p++) {
+        rcache_ent_t *pe = &c->ent[(slot + p) % RCACHE_ENTS];
+
+        if (key_match(pe, k)) {
+            e = pe;
+            break;
+        }
+        if (e == NULL || (e->fc != 0 && (pe->fc == 0 || pe->real_ns < e->real_ns))) {
+            e = pe;
+        }
+    }
+    if ((s = ent_lock(e, 0)) == -1) {
+        return;
+    }
+    e->fc = k->fc;
+    e->unit = k->unit;
+    e->addr = k->addr;
+    e->nb = k->nb;
+    e->port = k->port;
+    e->real_ns = real_ns();
+    if (k->fc == 0x01 || k->fc == 0x02) {
+        memset(e->data, 0, n);
+        for (int i = 0; i < k->nb; i++) {
+            if (((const uint8_t *)data)[i]) {
+                e->data[i / 8] |= 1 << (i % 8);
+            }
+        }
+    } else {
+        memcpy(e->data, data, n);
+    }
+    ent_unlock(e, s);
+
+    /* an invalidation since gen may have scanned the entry before it was put */
+    if (rcache_gen(c) != gen && (s = ent_lock(e, ENT_LOCK_SPIN)) != -1) {
+        if (key_match(e, k)) {
+            e->fc = 0;
+        }
+        ent_unlock(e, s);
+    }
+}
+
+/*
+ * Drop the cached reads that write k overlaps: the coils of FC5 and
+ * FC15 or the holding registers of FC6 and FC16, of the same port and
+ * slave id. k->nb is the count of the write, 1 for single writes.
+ */
+void
+rcache_inval(rcache_t *c, const rcache_key_t *k)
+{
+    int fc = (k->fc == 0x05 || k->fc == 0x0f) ? 0x01 : 0x03;
+    int first = k->addr & 0xffff;
+    int end = first + k->nb;
+
+    __atomic_add_fetch(&c->hdr->wgen, 1, __ATOMIC_SEQ_CST);
+    for (int i = 0; i < RCACHE_ENTS; i++) {
+        rcache_ent_t *e = &c->ent[i];
+        int64_t s;
+
+        if (e->fc != fc || e->unit != (k->unit & 0xff) || e->port != k->port ||
+            e->addr >= end || e->addr + e->nb <= first) {
+            continue;
+        }
+        if ((s = ent_lock(e, ENT_LOCK_SPIN)) == -1) {
+            continue;
+        }
+        if (e->fc == fc && e->unit == (k->unit & 0xff) && e->port == k->port &&
+            e->addr < end && e->addr + e->nb > first) {
+            e->fc = 0;
+        }
+        ent_unlock(e, s);
+    }
+}
@@ -0,0 +1,122 @@
+/*
+ *  modio - Modbus input output access tool
+ *
+ *  Copyright (C) 2022, Dimitris Economou (dimitris.s.economou@gmail.com)
+ *
+ *  This file is part of modio.
+ *
+ *  modio is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  modio is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with modio. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Response cache shared by modio processes.
+ *
+ * Read responses are kept in a small memory mapped file, keyed by the
+ * port, slave id, function code, address and count of the request, so
+ * that modio invocations that follow each other within the TTL of a
+ * register are answered without a bus transfer. Every entry is guarded
+ * by its own sequence lock like the records of shm.h: readers never
+ * wait, an entry that is being written is a miss. A writer takes an
+ * entry by making its seq odd with a compare and swap and gives up if
+ * another writer holds it, a cache put is best effort. Writes to the
+ * device drop the cached reads they overlap and count a write
+ * generation, a read that raced with a write isn't put in the cache.
+ *
+ * file layout (host byte order):
+ *
+ *   rcache_hdr_t                   header, hsize bytes
+ *   rcache_ent_t[nent]             entries, esize bytes each
+ */
+
+#ifndef MXIO_RCACHE_H
+#define MXIO_RCACHE_H
+
+#include <stdint.h>
+
+#define RCACHE_MAGIC 0x4b444f4d     /* 'MODK' */
+#define RCACHE_VERSION 1
+#define RCACHE_ENTS 1024            /* number of entries */
+#define RCACHE_PROBES 8             /* entries an entry key may be kept in */
+#define RCACHE_DATA 256             /* response data bytes of an entry */
+
+/* cache file header */
+struct rcache_hdr {
+    uint32_t magic;                 /* RCACHE_MAGIC */
+    uint32_t version;               /* RCACHE_VERSION */
+    uint32_t hsize;                 /* header size */
+    uint32_t esize;                 /* entry size */
+    uint32_t nent;                  /* number of entries */
+    uint32_t rsvd;                  /* reserved */
+    uint64_t wgen;                  /* write generation, counts invalidations */
+};
+typedef struct rcache_hdr rcache_hdr_t;
+
+/* cached read response */
+struct rcache_ent {
+    uint32_t seq;                   /* sequence lock, odd while the entry is written */
+    uint8_t fc;                     /* read function code, 0 for an empty entry */
+    uint8_t unit;                   /* modbus slave id */
+    uint16_t addr;                  /* first address */
+    uint16_t nb;                    /* bits or registers read */
+    uint16_t rsvd0;                 /* reserved */
+    uint32_t rsvd1;                 /* reserved */
+    uint64_t port;                  /* hash of the port */
+    int64_t real_ns;                /* wall clock time of the response */
+    uint8_t data[RCACHE_DATA];      /* registers, or bits packed first bit lowest */
+};
+typedef struct rcache_ent rcache_ent_t;
+
+/* key of a transfer */
+struct rcache_key {
+    uint64_t port;                  /* hash of the port */
+    int unit;                       /* modbus slave id */
+    int fc;                         /* function code */
+    int addr;                       /* first address */
+    int nb;                         /* bits or registers */
+};
+typedef struct rcache_key rcache_key_t;
+
+/* mapped cache file */
+struct rcache {
+    size_t size;                    /* mapped size */
+    rcache_hdr_t *hdr;              /* file header */
+    rcache_ent_t *ent;              /* entries */
+};
+typedef struct rcache rcache_t;
+
+/* default cache file path of the user */
+const char *rcache_path(void);
+
+/* hash a port, the server port of a TCP host defaults to 502 */
+uint64_t rcache_port(const char *port);
+
+/* open or create the cache file path */
+rcache_t *rcache_open(const char *path);
+
+/* unmap the cache file */
+void rcache_close(rcache_t *c);
+
+/* current write generation, taken before a read that may be put */
+uint64_t rcache_gen(const rcache_t *c);
+
+/* copy the data of a cached read younger than max_ns */
+int rcache_get(const rcache_t *c, const rcache_key_t *k, int64_t max_ns, void *data);
+
+/* put the data of a read done since write generation gen */
+void rcache_put(rcache_t *c, const rcache_key_t *k, uint64_t gen, const void *data);
+
+/* drop the cached reads a write overlaps */
+void rcache_inval(rcache_t *c, const rcache_key_t *k);
+
+#endif
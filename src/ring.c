@@ -0,0 +1,263 @@
+/*
+ *  modio - Modbus input output access tool
+ *
+ *  Copyright (C) 2022, Dimitris Economou (dimitris.s.economou@gmail.com)
+ *
+ *  This file is part of modio.
+ *
+ *  modio is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  modio is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with modio. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "ring.h"
+
+/*
+ * check the header of a mapped ring file
+ */
+static int
+ring_valid(const ring_hdr_t *hdr, size_t size)
+{
+    return (size >= sizeof(ring_hdr_t) &&
+            hdr->magic == RING_MAGIC &&
+            hdr->version == RING_VERSION &&
+            hdr->hsize == sizeof(ring_hdr_t) &&
+            hdr->rsize == sizeof(ring_smpl_t) &&
+            hdr->cap > 0 &&
+            hdr->hsize + hdr->cap * hdr->rsize <= size);
+}
+
+/*
+ * Open a ring file for recording. A new or empty file becomes a ring
+ * of cap records, allocated up front so recording never extends it.
+ * A ring file of cap records is continued, other files are left as
+ * they are and fail. The file stays locked while it is recorded, a
+ * second recorder of it fails.
+ */
+ring_t *
+ring_open(const char *path, uint64_t cap)
+{
+    ring_t *rg;
+    struct stat st;
+    struct timespec ts;
+    int fd;
+    int rval = 0;
+
+    rg = (ring_t *)calloc(1, sizeof(ring_t));
+    if (rg == NULL) {
+        fprintf(stderr, "malloc failed: insufficient memory!\n");
+        exit(EXIT_FAILURE);
+    }
+    rg->wr = 1;
+    rg->size = sizeof(ring_hdr_t) + cap * sizeof(ring_smpl_t);
+
+    fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        printf("ERROR:(%s) open %s\n", strerror(errno), path);
+        if (fd != -1) {
+            close(fd);
+        }
+        free(rg);
+        return NULL;
+    }
+    if (flock(fd, LOCK_EX | LOCK_NB) == -1) {
+        if (errno == EWOULDBLOCK) {
+            printf("ERROR: %s is recorded by another modio\n", path);
+        } else {
+            printf("ERROR:(%s) lock %s\n", strerror(errno), path);
+        }
+        close(fd);
+        free(rg);
+        return NULL;
+    }
+
+    /* continue an existing recording of the same capacity */
+    if (st.st_size > 0) {
+        ring_hdr_t *hdr = (ring_hdr_t *)mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+        if (hdr == MAP_FAILED) {
+            printf("ERROR:(%s) mmap %s\n", strerror(errno), path);
+        } else if (!ring_valid(hdr, st.st_size)) {
+            printf("ERROR: %s is not a modio ring file\n", path);
+        } else if (hdr->cap != cap) {
+            printf("ERROR: ring file %s holds %llu samples, not %llu, see --record-size\n",
+                   path, (unsigned long long )hdr->cap, (unsigned long long )cap);
+        } else {
+            rval = 1;
+        }
+        if (hdr != MAP_FAILED) {
+            munmap(hdr, st.st_size);
+        }
+        if (rval == 0) {
+            close(fd);
+            free(rg);
+            return NULL;
+        }
+        rg->hdr = (ring_hdr_t *)mmap(NULL, rg->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (rg->hdr == MAP_FAILED) {
+            printf("ERROR:(%s) mmap %s\n", strerror(errno), path);
+            close(fd);
+            free(rg);
+            return NULL;
+        }
+        rg->fd = fd;
+        rg->smpl = (ring_smpl_t *)(rg->hdr + 1);
+        return rg;
+    }
+
+    /* posix_fallocate() returns its error instead of setting errno */
+    if ((rval = posix_fallocate(fd, 0, rg->size)) != 0) {
+        printf("ERROR:(%s) allocating %zu bytes for %s\n",
+               strerror(rval),
+               rg->size,
+               path
+        );
+        close(fd);
+        free(rg);
+        return NULL;
+    }
+    rg->hdr = (ring_hdr_t *)mmap(NULL, rg->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (rg->hdr == MAP_FAILED) {
+        printf("ERROR:(%s) mmap %s\n", strerror(errno), path);
+        close(fd);
+        free(rg);
+        return NULL;
+    }
+    rg->fd = fd;
+    rg->smpl = (ring_smpl_t *)(rg->hdr + 1);
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    rg->hdr->version = RING_VERSION;
+    rg->hdr->hsize = sizeof(ring_hdr_t);
+    rg->hdr->rsize = sizeof(ring_smpl_t);
+    rg->hdr->cap = cap;
+    rg->hdr->head = 0;
+    rg->hdr->start_ns = (int64_t )ts.tv_sec * 1000000000 + ts.tv_nsec;
+    rg->hdr->magic = RING_MAGIC;
+    return rg;
+}
+
+/*
+ * map a ring file for reading
+ */
+ring_t *
+ring_map(const char *path)
+{
+    ring_t *rg;
+    struct stat st;
+    int fd;
+
+    rg = (ring_t *)calloc(1, sizeof(ring_t));
+    if (rg == NULL) {
+        fprintf(stderr, "malloc failed: insufficient memory!\n");
+        exit(EXIT_FAILURE);
+    }
+    fd = open(path, O_RDONLY);
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        printf("ERROR:(%s) open %s\n", strerror(errno), path);
+        free(rg);
+        return NULL;
+    }
+    rg->fd = -1;
+    rg->size = st.st_size;
+    rg->hdr = (ring_hdr_t *)mmap(NULL, rg->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (rg->hdr == MAP_FAILED) {
+        printf("ERROR:(%s) mmap %s\n", strerror(errno), path);
+        free(rg);
+        return NULL;
+    }
+    if (!ring_valid(rg->hdr, rg->size)) {
+        printf("ERROR: %s is not a modio ring file\n", path);
+        munmap(rg->hdr, rg->size);
+        free(rg);
+        return NULL;
+    }
+    rg->smpl = (ring_smpl_t *)(rg->hdr + 1);
+    return rg;
+}
+
+/*
+ * unmap a ring file, the recorder also flushes it to disk and unlocks it
+ */
+void
+ring_close(ring_t *rg)
+{
+    if (rg == NULL) {
+        return;
+    }
+    if (rg->wr) {
+        msync(rg->hdr, rg->size, MS_SYNC);
+    }
+    munmap(rg->hdr, rg->size);
+    if (rg->fd != -1) {
+        close(rg->fd);
+    }
+    free(rg);
+}
+
+/*
+ * Record a register sample in the next slot. Failed reads are kept
+ * as well, with their errno and without raw words.
+ */
+void
+ring_put(ring_t *rg, const rsmpl_t *s)
+{
+    uint64_t head = rg->hdr->head;
+    ring_smpl_t *r = &rg->smpl[head % rg->hdr->cap];
+    int nw = (s->nw > RING_RAW_WORDS) ? RING_RAW_WORDS : s->nw;
+
+    r->mono_ns = (int64_t )s->mono.tv_sec * 1000000000 + s->mono.tv_nsec;
+    r->real_ns = (int64_t )s->real.tv_sec * 1000000000 + s->real.tv_nsec;
+    r->uid = s->uid;
+    r->dnum = s->dnum;
+    r->rnum = s->rnum;
+    r->err = s->err;
+    if (s->err == 0) {
+        r->nw = s->nw;
+        memcpy(r->raw, s->raw, nw * sizeof(uint16_t));
+    } else {
+        r->nw = 0;
+    }
+
+    /* readers of a live file see the record only once it is complete */
+    __atomic_store_n(&rg->hdr->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * index of the oldest record in the ring
+ */
+uint64_t
+ring_first(const ring_t *rg)
+{
+    uint64_t head = __atomic_load_n(&rg->hdr->head, __ATOMIC_ACQUIRE);
+
+    return (head > rg->hdr->cap) ? head - rg->hdr->cap : 0;
+}
+
+/*
+ * the record with index idx, ring_first() <= idx < head
+ */
+const ring_smpl_t *
+ring_get(const ring_t *rg, uint64_t idx)
+{
+    return &rg->smpl[idx % rg->hdr->cap];
+}
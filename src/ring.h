@@ -0,0 +1,101 @@
+/*
+ *  modio - Modbus input output access tool
+ *
+ *  Copyright (C) 2022, Dimitris Economou (dimitris.s.economou@gmail.com)
+ *
+ *  This file is part of modio.
+ *
+ *  modio is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  modio is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with modio. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Ring file recorder of polled register samples.
+ *
+ * The file is preallocated and memory mapped. Samples are fixed size
+ * records written in place, the oldest record is overwritten once the
+ * ring is full. head counts all records ever written, so the ring
+ * holds records [head - count, head) at slots index % cap.
+ *
+ * file layout:
+ *
+ *   ring_hdr_t                     header, hsize bytes
+ *   ring_smpl_t[cap]               sample records, rsize bytes each
+ */
+
+#ifndef MXIO_RING_H
+#define MXIO_RING_H
+
+#include <stdint.h>
+#include "modio.h"
+
+#define RING_MAGIC 0x4d4f4452   /* 'MODR' */
+#define RING_VERSION 1
+#define RING_RAW_WORDS 32       /* raw register words per record */
+#define RING_DEF_CAP 262144     /* default capacity in records */
+
+/* ring file header */
+struct ring_hdr {
+    uint32_t magic;             /* RING_MAGIC */
+    uint32_t version;           /* RING_VERSION */
+    uint32_t hsize;             /* header size */
+    uint32_t rsize;             /* record size */
+    uint64_t cap;               /* capacity in records */
+    uint64_t head;              /* number of records ever written */
+    int64_t start_ns;           /* wall clock time the file was created */
+};
+typedef struct ring_hdr ring_hdr_t;
+
+/* sample record */
+struct ring_smpl {
+    int64_t mono_ns;            /* monotonic time of the read */
+    int64_t real_ns;            /* wall clock time of the read */
+    uint16_t uid;               /* modbus slave id */
+    uint16_t dnum;              /* device number in device list */
+    uint16_t rnum;              /* register index in device register list */
+    uint16_t nw;                /* register words read, raw holds up to RING_RAW_WORDS */
+    int32_t err;                /* errno of a failed read, 0 on success */
+    uint32_t rsvd;              /* reserved */
+    uint16_t raw[RING_RAW_WORDS];   /* raw register words, one per bit for bit registers */
+};
+typedef struct ring_smpl ring_smpl_t;
+
+/* mapped ring file */
+struct ring {
+    int wr;                     /* recorder flag */
+    int fd;                     /* locked file of the recorder, -1 for a reader */
+    size_t size;                /* mapped size */
+    ring_hdr_t *hdr;            /* file header */
+    ring_smpl_t *smpl;          /* file records */
+};
+typedef struct ring ring_t;
+
+/* open a ring file of cap records for recording, creating it if new or empty */
+ring_t *ring_open(const char *path, uint64_t cap);
+
+/* map a ring file for reading */
+ring_t *ring_map(const char *path);
+
+/* unmap a ring file */
+void ring_close(ring_t *rg);
+
+/* record a register sample */
+void ring_put(ring_t *rg, const rsmpl_t *s);
+
+/* index of the oldest record in the ring */
+uint64_t ring_first(const ring_t *rg);
+
+/* the record with index idx */
+const ring_smpl_t *ring_get(const ring_t *rg, uint64_t idx);
+
+#endif
@@ -0,0 +1,315 @@
+/*
+ *  modio - Modbus input output access tool
+ *
+ *  Copyright (C) 2022, Dimitris Economou (dimitris.s.economou@gmail.com)
+ *
+ *  This file is part of modio.
+ *
+ *  modio is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  modio is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with modio. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shm.h"
+
+/* record body copied under the sequence lock */
+#define REC_BODY(r) ((char *)(r) + sizeof(uint32_t))
+#define REC_BODY_SZ (sizeof(shm_rec_t) - sizeof(uint32_t))
+
+/* reads of an odd or changing seq before shm_read gives up */
+#define SHM_READ_SPINS 1000000
+
+/*
+ * build a posix shared memory object name, it must start with '/'
+ */
+static char *
+shm_path(const char *name)
+{
+    char *path = (char *)malloc((strlen(name) + 2) * sizeof(char));
+
+    if (path == NULL) {
+        return NULL;
+    }
+    if (name[0] == '/') {
+        strcpy(path, name);
+    } else {
+        strcpy(path, "/");
+        strcat(path, name);
+    }
+    return path;
+}
+
+/*
+ * publisher pid of the segment of shared memory object fd, 0 if it
+ * isn't a register image or its publisher has exited
+ */
+static pid_t
+shm_owner(int fd)
+{
+    struct stat st;
+    shm_hdr_t *hdr;
+    pid_t pid = 0;
+
+    if (fstat(fd, &st) == -1 || (size_t )st.st_size < sizeof(shm_hdr_t)) {
+        return 0;
+    }
+    hdr = (shm_hdr_t *)mmap(NULL, sizeof(shm_hdr_t), PROT_READ, MAP_SHARED, fd, 0);
+    if (hdr == MAP_FAILED) {
+        return 0;
+    }
+    if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) == SHM_MAGIC) {
+        pid = (pid_t )__atomic_load_n(&hdr->pid, __ATOMIC_ACQUIRE);
+    }
+    munmap(hdr, sizeof(shm_hdr_t));
+    return pid;
+}
+
+/*
+ * Create a segment with nrec records for publishing. An existing
+ * segment with the same name is replaced once its publisher has
+ * exited, while it runs creating the segment fails with EEXIST.
+ */
+shm_t *
+shm_create(const char *name, int nrec)
+{
+    shm_t *sh;
+    struct timespec ts;
+    int fd;
+
+    sh = (shm_t *)calloc(1, sizeof(shm_t));
+    if (sh == NULL || (sh->name = shm_path(name)) == NULL) {
+        fprintf(stderr, "malloc failed: insufficient memory!\n");
+        exit(EXIT_FAILURE);
+    }
+    sh->wr = 1;
+    sh->size = sizeof(shm_hdr_t) + nrec * sizeof(shm_rec_t);
+
+    /* the readers of a live publisher would keep an orphaned segment */
+    fd = shm_open(sh->name, O_RDONLY, 0);
+    if (fd != -1) {
+        pid_t pid = shm_owner(fd);
+
+        close(fd);
+        if (pid > 0 && (kill(pid, 0) == 0 || errno == EPERM)) {
+            printf("ERROR: %s is published by pid %d\n", sh->name, (int )pid);
+            free(sh->name);
+            free(sh);
+            errno = EEXIST;
+            return NULL;
+        }
+        shm_unlink(sh->name);
+    }
+    fd = shm_open(sh->name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd == -1) {
+        printf("ERROR:(%s) shm_open %s\n", strerror(errno), sh->name);
+        free(sh->name);
+        free(sh);
+        return NULL;
+    }
+    if (ftruncate(fd, sh->size) == -1) {
+        printf("ERROR:(%s) ftruncate %s\n", strerror(errno), sh->name);
+        close(fd);
+        shm_unlink(sh->name);
+        free(sh->name);
+        free(sh);
+        return NULL;
+    }
+    sh->hdr = (shm_hdr_t *)mmap(NULL, sh->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (sh->hdr == MAP_FAILED) {
+        printf("ERROR:(%s) mmap %s\n", strerror(errno), sh->name);
+        shm_unlink(sh->name);
+        free(sh->name);
+        free(sh);
+        return NULL;
+    }
+    sh->rec = (shm_rec_t *)(sh->hdr + 1);
+
+    /* ftruncate zero fills, so all records start even and without quality */
+    clock_gettime(CLOCK_REALTIME, &ts);
+    sh->hdr->hsize = sizeof(shm_hdr_t);
+    sh->hdr->rsize = sizeof(shm_rec_t);
+    sh->hdr->nrec = nrec;
+    sh->hdr->pid = getpid();
+    sh->hdr->start_ns = (int64_t )ts.tv_sec * 1000000000 + ts.tv_nsec;
+    sh->hdr->version = SHM_VERSION;
+
+    /* readers check magic last */
+    __atomic_store_n(&sh->hdr->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+    return sh;
+}
+
+/*
+ * Attach to a segment for reading. Returns NULL with errno set, EINVAL
+ * if it isn't a register image and EPROTO if its layout is of another
+ * SHM_VERSION.
+ */
+shm_t *
+shm_attach(const char *name)
+{
+    shm_t *sh;
+    struct stat st;
+    int fd;
+    int e;
+
+    sh = (shm_t *)calloc(1, sizeof(shm_t));
+    if (sh == NULL || (sh->name = shm_path(name)) == NULL) {
+        free(sh);
+        errno = ENOMEM;
+        return NULL;
+    }
+    fd = shm_open(sh->name, O_RDONLY, 0);
+    if (fd == -1 || fstat(fd, &st) == -1 || (size_t )st.st_size < sizeof(shm_hdr_t)) {
+        e = (fd == -1) ? errno : EINVAL;
+        if (fd != -1) {
+            close(fd);
+        }
+        free(sh->name);
+        free(sh);
+        errno = e;
+        return NULL;
+    }
+    sh->size = st.st_size;
+    sh->hdr = (shm_hdr_t *)mmap(NULL, sh->size, PROT_READ, MAP_SHARED, fd, 0);
+    e = errno;
+    close(fd);
+    if (sh->hdr == MAP_FAILED) {
+        free(sh->name);
+        free(sh);
+        errno = e;
+        return NULL;
+    }
+    sh->rec = (shm_rec_t *)((char *)sh->hdr + sh->hdr->hsize);
+
+    /* check the layout before anybody reads a record */
+    if (__atomic_load_n(&sh->hdr->magic, __ATOMIC_ACQUIRE) != SHM_MAGIC) {
+        e = EINVAL;
+    } else if (sh->hdr->version != SHM_VERSION ||
+               sh->hdr->rsize != sizeof(shm_rec_t) ||
+               sh->hdr->hsize + (size_t )sh->hdr->nrec * sh->hdr->rsize > sh->size) {
+        e = EPROTO;
+    } else {
+        return sh;
+    }
+    munmap(sh->hdr, sh->size);
+    free(sh->name);
+    free(sh);
+    errno = e;
+    return NULL;
+}
+
+/*
+ * detach from a segment, the publisher also removes it
+ */
+void
+shm_detach(shm_t *sh)
+{
+    if (sh == NULL) {
+        return;
+    }
+    if (sh->wr) {
+        __atomic_store_n(&sh->hdr->pid, 0, __ATOMIC_RELEASE);
+        shm_unlink(sh->name);
+    }
+    munmap(sh->hdr, sh->size);
+    free(sh->name);
+    free(sh);
+}
+
+/*
+ * publish a record, rec->seq is ignored
+ */
+void
+shm_write(shm_t *sh, int idx, const shm_rec_t *rec)
+{
+    shm_rec_t *r = &sh->rec[idx];
+    uint32_t seq = r->seq;
+
+    __atomic_store_n(&r->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(REC_BODY(r), REC_BODY(rec), REC_BODY_SZ);
+    __atomic_store_n(&r->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/*
+ * count a completed poll cycle
+ */
+void
+shm_cycle(shm_t *sh)
+{
+    __atomic_add_fetch(&sh->hdr->cycle, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Take a consistent copy of a record. Returns -1 with errno EINVAL if
+ * idx is out of range, EAGAIN if the record stays in the middle of a
+ * write, as it does when the publisher dies there.
+ */
+int
+shm_read(const shm_t *sh, int idx, shm_rec_t *rec)
+{
+    const shm_rec_t *r;
+    uint32_t s1;
+    uint32_t s2;
+
+    if (idx < 0 || (uint32_t )idx >= sh->hdr->nrec) {
+        errno = EINVAL;
+        return -1;
+    }
+    r = &sh->rec[idx];
+    for (long n = 0; n < SHM_READ_SPINS; n++) {
+        if ((s1 = __atomic_load_n(&r->seq, __ATOMIC_ACQUIRE)) & 1) {
+            continue;   /* writer in progress */
+        }
+        memcpy(REC_BODY(rec), REC_BODY(r), REC_BODY_SZ);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        s2 = __atomic_load_n(&r->seq, __ATOMIC_RELAXED);
+        if (s1 == s2) {
+            rec->seq = s1;
+            return 0;
+        }
+    }
+    errno = EAGAIN;
+    return -1;
+}
+
+/*
+ * find the record of a register by slave id and name, uid < 0
+ * matches any slave id. Returns the record index or -1 with errno
+ * ENOENT, records in the middle of a write are skipped.
+ */
+int
+shm_find(const shm_t *sh, int uid, const char *name)
+{
+    shm_rec_t rec;
+
+    for (uint32_t i = 0; i < sh->hdr->nrec; i++) {
+        if (shm_read(sh, i, &rec) == -1) {
+            continue;
+        }
+        if ((uid < 0 || rec.uid == uid) && strncmp(rec.name, name, SHM_NAME_LEN) == 0) {
+            return i;
+        }
+    }
+    errno = ENOENT;
+    return -1;
+}
@@ -0,0 +1,45 @@
+/*
+ *  modio - Modbus input output access tool
+ *
+ *  Copyright (C) 2022, Dimitris Economou (dimitris.s.economou@gmail.com)
+ *
+ *  This file is part of modio.
+ *
+ *  modio is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  modio is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with modio. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Live register image in POSIX shared memory, the publisher side.
+ *
+ * The poll mode publisher keeps one fixed size record per device
+ * register, in the versioned layout and under the sequence locks that
+ * libmodio_shm.h documents for the readers. A name has one publisher
+ * at a time.
+ */
+
+#ifndef MXIO_SHM_H
+#define MXIO_SHM_H
+
+#include "libmodio_shm.h"
+
+/* create a segment with nrec records for publishing */
+shm_t *shm_create(const char *name, int nrec);
+
+/* publish a record */
+void shm_write(shm_t *sh, int idx, const shm_rec_t *rec);
+
+/* count a completed poll cycle */
+void shm_cycle(shm_t *sh);
+
+#endif
@@ -0,0 +1,222 @@
+/*
+ *  modio - Modbus input output access tool
+ *
+ *  Copyright (C) 2022, Dimitris Economou (dimitris.s.economou@gmail.com)
+ *
+ *  This file is part of modio.
+ *
+ *  modio is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  modio is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with modio. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <modbus.h>
+#include "udp.h"
+#include "dev.h"
+
+/*
+ * check if port is a Modbus/UDP port
+ */
+int
+udp_port(const char *port)
+{
+    return (port != NULL && strncmp(port, UDP_SCHEME, strlen(UDP_SCHEME)) == 0);
+}
+
+/*
+ * Open the Modbus/UDP port udp://<host>[:<port>], an IPv6 host in
+ * brackets. The socket is connected to the first address of the host
+ * it can be, so only its datagrams are received and an unreachable
+ * server port fails the transfers at once. Returns NULL with errno
+ * set on error, EHOSTUNREACH if the host can't be resolved.
+ */
+udp_t *
+udp_open(const char *port)
+{
+    struct addrinfo hints;
+    struct addrinfo *res;
+    struct addrinfo *ai;
+    char host[256];
+    char serv[16];
+    char *sp;
+    udp_t *u;
+    int rval;
+
+    snprintf(host, sizeof(host), "%s", port + strlen(UDP_SCHEME));
+    snprintf(serv, sizeof(serv), "%d", UDP_PORT);
+    sp = (host[0] == '[') ? strchr(host, ']') : host;
+    if (sp != NULL && (sp = strrchr(sp, ':')) != NULL) {
+        snprintf(serv, sizeof(serv), "%s", sp + 1);
+        *sp = '\0';
+    }
+    if (host[0] == '[') {
+        memmove(host, host + 1, strlen(host));
+        host[strcspn(host, "]")] = '\0';
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    if ((rval = getaddrinfo(host, serv, &hints, &res)) != 0) {
+        modio_debugx(1, "udp: %s: %s\n", port, gai_strerror(rval));
+        errno = (rval == EAI_SYSTEM) ? errno : EHOSTUNREACH;
+        return NULL;
+    }
+    u = (udp_t *)calloc(1, sizeof(udp_t));
+    if (u == NULL) {
+        freeaddrinfo(res);
+        errno = ENOMEM;
+        return NULL;
+    }
+    u->fd = -1;
+    for (ai = res; ai != NULL && u->fd == -1; ai = ai->ai_next) {
+        u->fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (u->fd != -1 && connect(u->fd, ai->ai_addr, ai->ai_addrlen) == -1) {
+            close(u->fd);
+            u->fd = -1;
+        }
+    }
+    rval = errno;
+    freeaddrinfo(res);
+    if (u->fd == -1) {
+        free(u);
+        errno = rval;
+        return NULL;
+    }
+    u->tid = (uint16_t )(time(NULL) ^ getpid());
+    u->tmo_ms = UDP_TIMEOUT_ms;
+    u->retries = UDP_RETRIES;
+    modio_debugx(1, "udp: %s:%s\n", host, serv);
+    return u;
+}
+
+/*
+ * close a Modbus/UDP port
+ */
+void
+udp_close(udp_t *u)
+{
+    if (u == NULL) {
+        return;
+    }
+    modio_debugx(1, "udp: %llu datagrams sent, %llu sent again\n",
+                 (unsigned long long )u->sent,
+                 (unsigned long long )u->lost
+    );
+    close(u->fd);
+    free(u);
+}
+
+/*
+ * wait up to ms for the response of the request in adu, returns its
+ * PDU length or -1 with errno set, ETIMEDOUT without a response
+ */
+static int
+udp_wait(udp_t *u, const uint8_t *adu, uint8_t *rsp, int rspmax, int ms)
+{
+    struct pollfd pfd = { u->fd, POLLIN, 0 };
+    struct timespec t0;
+    struct timespec t1;
+    uint8_t buf[UDP_ADU_MAX];
+    ssize_t n;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (;;) {
+        int left;
+        int rval;
+
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        left = ms - (int )((t1.tv_sec - t0.tv_sec) * 1000 + (t1.tv_nsec - t0.tv_nsec) / 1000000);
+        if (left <= 0) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        rval = poll(&pfd, 1, left);
+        if (rval == -1 && errno == EINTR) {
+            continue;
+        }
+        if (rval <= 0) {
+            errno = (rval == 0) ? ETIMEDOUT : errno;
+            return -1;
+        }
+        n = recv(u->fd, buf, sizeof(buf), 0);
+        if (n == -1) {
+            if (errno == EINTR || errno == EAGAIN) {
+                continue;
+            }
+            return -1;
+        }
+
+        /* a response of another transaction or unit, or no Modbus frame */
+        if (n < 9 || buf[0] != adu[0] || buf[1] != adu[1] || buf[2] != 0 || buf[3] != 0 ||
+            ((buf[4] << 8) | buf[5]) != n - 6 || buf[6] != adu[6]) {
+            modio_debugx(2, "udp: dropped %zd bytes of tid 0x%04x\n", n, (buf[0] << 8) | buf[1]);
+            continue;
+        }
+        if (n - 7 > rspmax) {
+            errno = EMBBADDATA;
+            return -1;
+        }
+        memcpy(rsp, buf + 7, n - 7);
+        return (int )(n - 7);
+    }
+}
+
+/*
+ * Run the transfer of request PDU req of slave id unit, sending it
+ * again while it gets no response. Returns the response PDU length,
+ * exception responses included, or -1 with errno set.
+ */
+int
+udp_xfer(udp_t *u, int unit, const uint8_t *req, int reqlen, uint8_t *rsp, int rspmax)
+{
+    uint8_t adu[UDP_ADU_MAX];
+    int len = -1;
+
+    if (reqlen < 1 || reqlen + 7 > UDP_ADU_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+    u->tid++;
+    adu[0] = u->tid >> 8;
+    adu[1] = u->tid & 0xff;
+    adu[2] = 0;
+    adu[3] = 0;
+    adu[4] = (reqlen + 1) >> 8;
+    adu[5] = (reqlen + 1) & 0xff;
+    adu[6] = unit;
+    memcpy(adu + 7, req, reqlen);
+    for (int i = 0; i <= u->retries; i++) {
+        if (i > 0) {
+            u->lost++;
+            modio_debugx(2, "udp: tid 0x%04x sent again\n", u->tid);
+        }
+        if (send(u->fd, adu, reqlen + 7, MSG_NOSIGNAL) == -1) {
+            return -1;
+        }
+        u->sent++;
+        len = udp_wait(u, adu, rsp, rspmax, u->tmo_ms);
+        if (len != -1 || errno != ETIMEDOUT) {
+            break;
+        }
+    }
+    return len;
+}
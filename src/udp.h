@@ -0,0 +1,69 @@
+/*
+ *  modio - Modbus input output access tool
+ *
+ *  Copyright (C) 2022, Dimitris Economou (dimitris.s.economou@gmail.com)
+ *
+ *  This file is part of modio.
+ *
+ *  modio is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  modio is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with modio. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Modbus/UDP transport.
+ *
+ * Ports of the form udp://<host>[:<port>] send every request as one
+ * datagram with the MBAP header of Modbus/TCP, whose transaction id
+ * is incremented for every request. The response is the datagram from
+ * the server with the same transaction id, unit id and protocol, all
+ * others, like the late responses of earlier requests, are dropped. A
+ * request without response within UDP_TIMEOUT_ms is sent again, with
+ * the same transaction id, up to UDP_RETRIES times, which the function
+ * codes modio uses are safe with.
+ */
+
+#ifndef MXIO_UDP_H
+#define MXIO_UDP_H
+
+#include <stdint.h>
+
+#define UDP_SCHEME "udp://"     /* port prefix of Modbus/UDP */
+#define UDP_PORT 502            /* default server port */
+#define UDP_TIMEOUT_ms 500      /* response timeout of a datagram */
+#define UDP_RETRIES 2           /* requests sent again without response */
+#define UDP_ADU_MAX 260         /* max size of an MBAP frame */
+
+/* Modbus/UDP server association */
+struct udp {
+    int fd;                     /* socket connected to the server */
+    uint16_t tid;               /* transaction id of the last request */
+    int tmo_ms;                 /* response timeout of a datagram */
+    int retries;                /* requests sent again without response */
+    uint64_t sent;              /* datagrams sent */
+    uint64_t lost;              /* requests sent again */
+};
+typedef struct udp udp_t;
+
+/* check if a port is a Modbus/UDP port */
+int udp_port(const char *port);
+
+/* open the Modbus/UDP port udp://<host>[:<port>] */
+udp_t *udp_open(const char *port);
+
+/* close a Modbus/UDP port */
+void udp_close(udp_t *u);
+
+/* run the transfer of a request PDU of a unit, returns the response PDU length */
+int udp_xfer(udp_t *u, int unit, const uint8_t *req, int reqlen, uint8_t *rsp, int rspmax);
+
+#endif
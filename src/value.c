@@ -0,0 +1,399 @@
+/*
+ *  modio - Modbus input output access tool
+ *
+ *  Copyright (C) 2022, Dimitris Economou (dimitris.s.economou@gmail.com)
+ *
+ *  This file is part of modio.
+ *
+ *  modio is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  modio is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with modio. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include "value.h"
+
+/*
+ * value printers by register class (bits, words), print format and
+ * plain (raw value) or decorated (scale and engineering unit of the
+ * device file)
+ */
+static prval_t prval_tab[2][HLO + 1][2] = {
+    {
+        { pv_bit_bin, pv_bit_bin },     /* BIN */
+        { pv_bit_hex, pv_bit_hex },     /* HEX */
+        { pv_bit_dec, pv_bit_dec },     /* DEC */
+        { pv_bit_dec, pv_bit_dec },     /* ASC */
+        { pv_bit_dec, pv_bit_dec },     /* BFD */
+        { pv_bit_dec, pv_bit_dec },     /* BFX */
+        { pv_bit_dec, pv_bit_dec }      /* HLO */
+    },
+    {
+        { pv_bin, pv_bin },             /* BIN */
+        { pv_hex, pv_hex },             /* HEX */
+        { pv_dec_raw, pv_dec },         /* DEC */
+        { pv_asc, pv_asc },             /* ASC */
+        { pv_bfd, pv_bfd },             /* BFD */
+        { pv_bfx, pv_bfx },             /* BFX */
+        { pv_hlo_raw, pv_hlo }          /* HLO */
+    }
+};
+
+/*
+ * Value printer of a register type and print format, decorated for
+ * the registers of a device file. Unknown formats print as DEC.
+ */
+prval_t
+prval_get(int type, int prfmt, int decorated)
+{
+    if (prfmt < BIN || prfmt > HLO) {
+        prfmt = DEC;
+    }
+    return prval_tab[(type == COIL || type == INPUT_B) ? 0 : 1][prfmt][decorated ? 1 : 0];
+}
+
+/*
+ * bit as binary
+ */
+int
+pv_bit_bin(char *buf, size_t sz, const void *v, int j, int len, double scale, const char *engu)
+{
+    char *s = int_to_bin(((const uint8_t *)v)[j]);
+
+    snprintf(buf, sz, "%s", s ? s : "");
+    free(s);
+    return 1;
+}
+
+/*
+ * bit as hex
+ */
+int
+pv_bit_hex(char *buf, size_t sz, const void *v, int j, int len, double scale, const char *engu)
+{
+    snprintf(buf, sz, "0x%x", ((const uint8_t *)v)[j]);
+    return 1;
+}
+
+/*
+ * bit as dec
+ */
+int
+pv_bit_dec(char *buf, size_t sz, const void *v, int j, int len, double scale, const char *engu)
+{
+    snprintf(buf, sz, "%d", ((const uint8_t *)v)[j]);
+    return 1;
+}
+
+/*
+ * word as binary
+ */
+int
+pv_bin(char *buf, size_t sz, const void *v, int j, int len, double scale, const char *engu)
+{
+    char *s = int_to_bin(((const uint16_t *)v)[j]);
+
+    snprintf(buf, sz, "%s", s ? s : "");
+    free(s);
+    return 1;
+}
+
+/*
+ * word as hex
+ */
+int
+pv_hex(char *buf, size_t sz, const void *v, int j, int len, double scale, const char *engu)
+{
+    snprintf(buf, sz, "0x%x", ((const uint16_t *)v)[j]);
+    return 1;
+}
+
+/*
+ * all words of the register as ASCII characters
+ */
+int
+pv_asc(char *buf, size_t sz, const void *v, int j, int len, double scale, const char *engu)
+{
+    char *s = words_to_str((const uint16_t *)v + j, len - j);
+
+    snprintf(buf, sz, "%s", s);
+    free(s);
+    return len - j;
+}
+
+/*
+ * all words of the register as '.' separated bytes in dec
+ */
+int
+pv_bfd(char *buf, size_t sz, const void *v, int j, int len, double scale, const char *engu)
+{
+    char *s = mem_to_bytes((uint16_t *)v + j, len - j, int_to_str);
+
+    snprintf(buf, sz, "%s", s);
+    free(s);
+    return len - j;
+}
+
+/*
+ * all words of the register as '.' separated bytes in hex
+ */
+int
+pv_bfx(char *buf, size_t sz, const void *v, int j, int len, double scale, const char *engu)
+{
+    char *s = mem_to_bytes((uint16_t *)v + j, len - j, hex_to_str);
+
+    snprintf(buf, sz, "%s", s);
+    free(s);
+    return len - j;
+}
+
+/*
+ * high/low word pair as 32bit dec
+ */
+int
+pv_hlo_raw(char *buf, size_t sz, const void *v, int j, int len, double scale, const char *engu)
+{
+    if (len % 2 != 0) {
+        return -1;
+    }
+    snprintf(buf, sz, "%li", (long )concat_inv16((const uint16_t *)v + j, 2));
+    return 2;
+}
+
+/*
+ * high/low word pair as 32bit dec, scaled with its engineering unit
+ */
+int
+pv_hlo(char *buf, size_t sz, const void *v, int j, int len, double scale, const char *engu)
+{
+    if (len % 2 != 0) {
+        return -1;
+    }
+    snprintf(buf, sz, "%.2f%s", (double )concat_inv16((const uint16_t *)v + j, 2) * scale, engu);
+    return 2;
+}
+
+/*
+ * word as dec
+ */
+int
+pv_dec_raw(char *buf, size_t sz, const void *v, int j, int len, double scale, const char *engu)
+{
+    snprintf(buf, sz, "%d", ((const uint16_t *)v)[j]);
+    return 1;
+}
+
+/*
+ * Value of DEC words w of a register of len words, as pv_dec prints it
+ * and dreg_value returns it: the two words of a register of two words
+ * are one 32bit value, the words of the other registers are values of
+ * their own. Both are scaled.
+ */
+static double
+dec_value(const uint16_t *w, int len, double scale)
+{
+    if (len == 2) {
+        return (double )concat_inv16(w, 2) * scale;
+    }
+    return w[0] * scale;
+}
+
+/*
+ * word as dec, scaled with its engineering unit, a register of two
+ * words as one 32bit dec
+ */
+int
+pv_dec(char *buf, size_t sz, const void *v, int j, int len, double scale, const char *engu)
+{
+    const uint16_t *w = (const uint16_t *)v + j;
+
+    if (len == 2) {
+        if (scale == 1.0) {
+            snprintf(buf, sz, "%li%s", (long )concat_inv16(w, 2), engu);
+        } else {
+            snprintf(buf, sz, "%.2f%s", dec_value(w, 2, scale), engu);
+        }
+        return 2;
+    }
+    snprintf(buf, sz, "%.2f%s", dec_value(w, 1, scale), engu);
+    return 1;
+}
+
+/*
+ * format a memory of words into a string of '.' separated bytes.
+ * bytes in words are swapped and converted by char *(*conv)(int) func
+ * accordingly
+ *
+ * word 0: byte01.byte00
+ * word 1: byte11.byte10
+ *
+ * string: byte00.byte01.byte10.byte11
+ */
+char *
+mem_to_bytes(uint16_t *array, int size, char *(*conv)(int)) {
+    size_t slen = 0;
+    unsigned char *p = (unsigned char *)array;
+
+    if (size < 1) {
+        return strdup("");
+    }
+    for (int i = 0; i < size * 2; i++) {
+        slen += snprintf(NULL, 0, "%i", p[i]);
+    }
+
+    /* the bytes, a '.' after each byte but the last and the terminator */
+    char *s = (char *)malloc((slen + 2 * (size_t )size) * sizeof(char));
+
+    p = (unsigned char *)array;
+    s = strcpy(s, conv(p[1]));
+    s = strcat(strcat(s, "."), conv(p[0]));
+    for (int i = 1; i < size; i++) {
+        array += 1;
+        p = (unsigned char *)array;
+        s = strcat(strcat(s, "."), conv(p[1]));
+        s = strcat(strcat(s, "."), conv(p[0]));
+    }
+    return s;
+}
+
+
+/*
+ * return a string with binary representation of inum
+ */
+char *
+int_to_bin(uint16_t inum)
+{
+    size_t bits = sizeof(uint16_t) * CHAR_BIT;
+
+    char * str = malloc((bits + 1) * sizeof(char));
+    if(!str) return NULL;
+    str[bits] = 0;
+
+    uint16_t u = inum;
+    for(; bits--; u >>= 1)
+        str[bits] = u & 1 ? '1' : '0';
+
+    return str;
+}
+
+/* 
+ * convert an array of uint16_t words with ASCCI characters to a string 
+ */
+char *
+words_to_str(const uint16_t *array, int length)
+{
+    char *s = malloc(length * sizeof(uint16_t) + 1);
+    char *r = s;
+
+    for (int i = 0; i < length; i++) {
+        for (int j = 1; j >= 0; j--) {
+            *s = *(((char *)array) + j);
+            s += 1;
+        }
+        array += 1;
+    }
+    *s = '\0';
+    return r;
+}
+
+/*
+ * Concatenate and invert 16bit words to 32bit (length = 2)
+ * or 64bit (length = 4) which are stored in array. Returns
+ * a 64bit integer.
+ */
+uint64_t
+concat_inv16(const uint16_t *array, int length)
+{
+    uint64_t inum = 0;
+    uint16_t *p;
+
+    p = (uint16_t *)&inum;
+    for (int i = 0; i < length; i++) {
+        *(p + length - i - 1) |= array[i];
+    }
+
+    return inum;
+}
+
+/*
+ * Decode the numeric value of a register from its raw words. The
+ * bits of bit registers are packed, first bit lowest. A DEC register
+ * has the value its value printer prints first, the one of a register
+ * of more than two words is its first word. Returns NAN for registers
+ * printed as strings or bytes.
+ */
+double
+dreg_value(dreg_t *r, const uint16_t *raw, int nw)
+{
+    uint64_t bits = 0;
+
+    if (nw <= 0) {
+        return NAN;
+    }
+    if (r->type == COIL || r->type == INPUT_B) {
+        for (int j = 0; j < nw && j < 64; j++) {
+            bits |= (uint64_t )(raw[j] & 1) << j;
+        }
+        return (double )bits;
+    }
+    switch (r->prfmt) {
+        case ASC:
+        case BFD:
+        case BFX:
+            return NAN;
+        case HLO:
+            return (nw >= 2) ? (double )concat_inv16(raw, 2) * r->scale : NAN;
+        case DEC:
+            if (r->prval == pv_dec_raw) {
+                return raw[0];
+            }
+            if (r->len == 2) {
+                return (nw >= 2) ? dec_value(raw, 2, r->scale) : NAN;
+            }
+            return dec_value(raw, 1, r->scale);
+        default:
+            if (nw == 2 || nw == 4) {
+                return (double )concat_inv16(raw, nw) * r->scale;
+            }
+            return raw[0] * r->scale;
+    }
+}
+
+/*
+ * convert a decimal integer to string
+ */
+char *
+int_to_str(int inum)
+{
+    int sz = snprintf(NULL, 0, "%d", inum);
+    char *key = (char *) malloc((sz + 1) * sizeof(char));
+
+    snprintf(key, sz + 1, "%d", inum);
+    return key;
+}
+
+/*
+ * convert a hex integer to string
+ */
+char *
+hex_to_str(int xnum)
+{
+    int sz = snprintf(NULL, 0, "%d", xnum);
+    char *key = (char *) malloc((sz + 1) * sizeof(char));
+
+    snprintf(key, sz + 1, "%x", xnum);
+    return key;
+}
@@ -0,0 +1,76 @@
+/*
+ *  modio - Modbus input output access tool
+ *
+ *  Copyright (C) 2022, Dimitris Economou (dimitris.s.economou@gmail.com)
+ *
+ *  This file is part of modio.
+ *
+ *  modio is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  modio is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with modio. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Register values.
+ *
+ * Decoding of the raw words of a register into its numeric value and
+ * the value printers of the print formats of -f and the device files.
+ */
+
+#ifndef MXIO_VALUE_H
+#define MXIO_VALUE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "modio.h"
+
+/* return a string with binary representation of inum */
+char *int_to_bin(uint16_t inum);
+
+/* convert an integer to string */
+char *int_to_str(int inum);
+
+/* convert a hex to string */
+char *hex_to_str(int xnum);
+
+/* convert an array of words into a string of '.' separated bytes */
+char *mem_to_bytes(uint16_t *array, int size, char *(*conv)(int));
+
+/* convert an array of words with ASCII bytes into a string*/
+char *words_to_str(const uint16_t *array, int length);
+
+/* Concatenate and invert 16bit words to 32bit (length = 2) or 64bit (length = 4) */
+uint64_t concat_inv16(const uint16_t *array, int length);
+
+/* decode the numeric value of a register */
+double dreg_value(dreg_t *r, const uint16_t *raw, int nw);
+
+/* value printers of bit registers */
+int pv_bit_bin(char *buf, size_t sz, const void *v, int j, int len, double scale, const char *engu);
+int pv_bit_hex(char *buf, size_t sz, const void *v, int j, int len, double scale, const char *engu);
+int pv_bit_dec(char *buf, size_t sz, const void *v, int j, int len, double scale, const char *engu);
+
+/* value printers of 16bit registers */
+int pv_bin(char *buf, size_t sz, const void *v, int j, int len, double scale, const char *engu);
+int pv_hex(char *buf, size_t sz, const void *v, int j, int len, double scale, const char *engu);
+int pv_asc(char *buf, size_t sz, const void *v, int j, int len, double scale, const char *engu);
+int pv_bfd(char *buf, size_t sz, const void *v, int j, int len, double scale, const char *engu);
+int pv_bfx(char *buf, size_t sz, const void *v, int j, int len, double scale, const char *engu);
+int pv_hlo_raw(char *buf, size_t sz, const void *v, int j, int len, double scale, const char *engu);
+int pv_hlo(char *buf, size_t sz, const void *v, int j, int len, double scale, const char *engu);
+int pv_dec_raw(char *buf, size_t sz, const void *v, int j, int len, double scale, const char *engu);
+int pv_dec(char *buf, size_t sz, const void *v, int j, int len, double scale, const char *engu);
+
+/* value printer of a register type and print format */
+prval_t prval_get(int type, int prfmt, int decorated);
+
+#endif
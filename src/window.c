@@ -0,0 +1,174 @@
+/*
+ *  modio - Modbus input output access tool
+ *
+ *  Copyright (C) 2022, Dimitris Economou (dimitris.s.economou@gmail.com)
+ *
+ *  This file is part of modio.
+ *
+ *  modio is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  modio is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with modio. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include "window.h"
+
+static int win_ms = 0;          /* window of --window, 0 if not aggregating */
+static int win_sd = 0;          /* print the standard deviation */
+
+/*
+ * aggregate the polled values in windows of ms ms, and print the
+ * standard deviation of the windows if sd is set
+ */
+void
+window_init(int ms, int sd)
+{
+    win_ms = ms;
+    win_sd = sd;
+}
+
+/*
+ * window length in ms of value index vi of device dv
+ */
+static int
+window_len(dvlist_t *dv, int vi)
+{
+    int ms = (vi < dv->nor) ? dv->regs[vi].window : dv->drv[vi - dv->nor].window;
+
+    return (ms > 0) ? ms : win_ms;
+}
+
+/*
+ * print the summary of window a of value index vi of unit u
+ */
+static void
+window_print(dvlist_t *dv, unit_t *u, int vi, const wagg_t *a)
+{
+    int ms = window_len(dv, vi);
+    int64_t start = a->win * ms;
+    time_t t = start / 1000;
+    struct tm tm;
+    char tstr[32];
+    char num[8];
+    const char *name;
+    const char *engu;
+
+    if (vi < dv->nor) {
+        snprintf(num, sizeof(num), "%05d", dv->regs[vi].num);
+        name = dv->regs[vi].info->name;
+        engu = dv->regs[vi].info->engu;
+    } else {
+        snprintf(num, sizeof(num), "%s", "");
+        name = dv->drv[vi - dv->nor].name;
+        engu = dv->drv[vi - dv->nor].engu;
+    }
+    localtime_r(&t, &tm);
+    strftime(tstr, sizeof(tstr), "%Y-%m-%d %H:%M:%S", &tm);
+    printf("%-3d %-5s %-35s %s.%03d %dms n=%d err=%d q=%s",
+           u->id,
+           num,
+           name,
+           tstr,
+           (int )(start % 1000),
+           ms,
+           a->n,
+           a->err,
+           a->n == 0 ? "bad" : (a->err ? "partial" : "good")
+    );
+    if (a->n > 0) {
+        printf(" min=%.2f max=%.2f mean=%.2f last=%.2f", a->min, a->max, a->mean, a->last);
+        if (win_sd) {
+            printf(" sd=%.2f", (a->n > 1) ? sqrt(a->m2 / (a->n - 1)) : 0.0);
+        }
+    }
+    printf("%s%s\n", *engu ? " " : "", engu);
+}
+
+/*
+ * Add value v of value index vi of unit u, of device dv, to the window
+ * of the register at the current wall clock time, err is set for a
+ * failed read. A value of the next window prints the summary of the
+ * window before it.
+ */
+void
+window_add(dvlist_t *dv, unit_t *u, int vi, double v, int err)
+{
+    struct timespec ts;
+    wagg_t *a;
+    int64_t win;
+    double d;
+
+    if (win_ms == 0 || (!err && isnan(v))) {
+        return;
+    }
+
+    /* the aggregates follow the register counts of reloaded device files */
+    if (u->nagg != dv->nor + dv->nod) {
+        free(u->agg);
+        u->nagg = dv->nor + dv->nod;
+        u->agg = (wagg_t *)calloc(u->nagg ? u->nagg : 1, sizeof(wagg_t));
+        if (u->agg == NULL) {
+            fprintf(stderr, "malloc failed: insufficient memory!\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    a = &u->agg[vi];
+    clock_gettime(CLOCK_REALTIME, &ts);
+    win = ((int64_t )ts.tv_sec * 1000 + ts.tv_nsec / 1000000) / window_len(dv, vi);
+    if (win != a->win) {
+        if (a->n + a->err > 0) {
+            window_print(dv, u, vi, a);
+        }
+        a->win = win;
+        a->n = 0;
+        a->err = 0;
+    }
+    if (err || isnan(v)) {
+        a->err++;
+        return;
+    }
+    if (a->n == 0) {
+        a->min = a->max = a->mean = v;
+        a->m2 = 0;
+    } else {
+        a->min = (v < a->min) ? v : a->min;
+        a->max = (v > a->max) ? v : a->max;
+    }
+    a->n++;
+    d = v - a->mean;
+    a->mean += d / a->n;
+    a->m2 += d * (v - a->mean);
+    a->last = v;
+}
+
+/*
+ * print the windows of unit u, of device dv, that have values, as at
+ * the end of polling
+ */
+void
+window_flush(dvlist_t *dv, unit_t *u)
+{
+    if (win_ms == 0 || u->nagg != dv->nor + dv->nod) {
+        return;
+    }
+    for (int i = 0; i < u->nagg; i++) {
+        if (u->agg[i].n + u->agg[i].err > 0) {
+            window_print(dv, u, i, &u->agg[i]);
+            u->agg[i].n = 0;
+            u->agg[i].err = 0;
+        }
+    }
+}
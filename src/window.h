@@ -0,0 +1,53 @@
+/*
+ *  modio - Modbus input output access tool
+ *
+ *  Copyright (C) 2022, Dimitris Economou (dimitris.s.economou@gmail.com)
+ *
+ *  This file is part of modio.
+ *
+ *  modio is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  modio is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with modio. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Aggregation windows of poll mode.
+ *
+ * With --window <ms> the values of every register and derived register
+ * of the polled units are not printed as they are read but aggregated
+ * in windows of <ms>, or of the window of the register in the device
+ * file, aligned to the wall clock. A window keeps the count, min, max,
+ * running mean and variance (Welford) and last value and the number of
+ * failed reads, updated on every read in constant time, and is printed
+ * as one summary line when the first value of the next window arrives:
+ *
+ *   <uid> <reg> <name> <start> <ms>ms n=<n> err=<n> q=good|partial|bad min= max= mean= last= [sd=] <engu>
+ *
+ * Registers without a numeric value, such as strings, are not
+ * aggregated.
+ */
+
+#ifndef MXIO_WINDOW_H
+#define MXIO_WINDOW_H
+
+#include "modio.h"
+
+/* aggregate the polled values in windows of ms, with their standard deviation if sd */
+void window_init(int ms, int sd);
+
+/* add a value of a unit to the window of its register */
+void window_add(dvlist_t *dv, unit_t *u, int vi, double v, int err);
+
+/* print the windows of a unit that are still open */
+void window_flush(dvlist_t *dv, unit_t *u);
+
+#endif
@@ -0,0 +1,132 @@
+/*
+ *  modio - Modbus input output access tool
+ *
+ *  Copyright (C) 2022, Dimitris Economou (dimitris.s.economou@gmail.com)
+ *
+ *  This file is part of modio.
+ *
+ *  modio is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  modio is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with modio. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Regression tests of the alarms of polled registers (alarm.h): an
+ * alarm that turns into another condition, HIGH to LOW or LOW to FLAG,
+ * is cleared before the new one is raised, so that every ALARM line of
+ * the event stream has its CLEAR.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include "alarm.h"
+#include "test.h"
+
+/*
+ * Set the value of the register of unit u to v, evaluate its alarms
+ * and return the events written, "" for none
+ */
+static const char *
+eval(FILE *fp, dvlist_t *dv, unit_t *u, double v)
+{
+    static char ev[512];
+    size_t n;
+
+    u->val[0] = v;
+    rewind(fp);
+    if (ftruncate(fileno(fp), 0) == -1) {
+        return "";
+    }
+    alarm_eval(fp, dv, u, 0);
+    fflush(fp);
+    rewind(fp);
+    n = fread(ev, 1, sizeof(ev) - 1, fp);
+    ev[n] = '\0';
+    return ev;
+}
+
+/*
+ * check that the events ev are the transitions kinds, one per line, in
+ * that order
+ */
+static int
+events(const char *ev, const char **kinds, int n)
+{
+    const char *p = ev;
+
+    for (int i = 0; i < n; i++) {
+        const char *e = strchr(p, '\n');
+        const char *k = strstr(p, kinds[i]);
+
+        if (e == NULL || k == NULL || k > e) {
+            return 0;
+        }
+        p = e + 1;
+    }
+    return *p == '\0';
+}
+
+int
+main(void)
+{
+    static const char *high[] = { "ALARM HIGH" };
+    static const char *high_low[] = { "CLEAR HIGH", "ALARM LOW" };
+    static const char *low_flag[] = { "CLEAR LOW", "ALARM FLAG" };
+    static const char *flag[] = { "CLEAR FLAG" };
+    dinfo_t info = { "Level", "", "", "mm", "R" };
+    alrule_t rule = { 0, 10.0, 0.0, 0.0, 0x100, 0, 0 };
+    dreg_t reg;
+    dvlist_t dv;
+    unit_t u;
+    double val[1];
+    FILE *fp;
+
+    memset(&reg, 0, sizeof(reg));
+    reg.num = 40001;
+    reg.info = &info;
+    memset(&dv, 0, sizeof(dv));
+    dv.nor = 1;
+    dv.regs = &reg;
+    dv.noa = 1;
+    dv.alarm = &rule;
+    memset(&u, 0, sizeof(u));
+    u.id = 1;
+    u.nval = 1;
+    u.val = val;
+
+    fp = tmpfile();
+    CHECK(fp != NULL);
+    if (fp == NULL) {
+        return TEST_DONE();
+    }
+    CHECK(strcmp(eval(fp, &dv, &u, 5.0), "") == 0);
+    CHECK(events(eval(fp, &dv, &u, 20.0), high, 1));
+
+    /* a direct change of condition clears the raised alarm first */
+    CHECK(events(eval(fp, &dv, &u, -5.0), high_low, 2));
+    CHECK(events(eval(fp, &dv, &u, 256.0), low_flag, 2));
+    CHECK(events(eval(fp, &dv, &u, 5.0), flag, 1));
+    CHECK(strcmp(eval(fp, &dv, &u, 5.0), "") == 0);
+
+    /* a value that isn't known leaves the alarm as it is */
+    CHECK(events(eval(fp, &dv, &u, 20.0), high, 1));
+    CHECK(strcmp(eval(fp, &dv, &u, NAN), "") == 0);
+    CHECK(strcmp(eval(fp, &dv, &u, 20.0), "") == 0);
+
+    free(u.als);
+    fclose(fp);
+    return TEST_DONE();
+}
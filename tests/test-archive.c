@@ -0,0 +1,247 @@
+/*
+ *  modio - Modbus input output access tool
+ *
+ *  Copyright (C) 2022, Dimitris Economou (dimitris.s.economou@gmail.com)
+ *
+ *  This file is part of modio.
+ *
+ *  modio is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  modio is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with modio. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Regression tests of the archive (archive.h): samples read back as
+ * written, an archive of the same series is continued, one of other
+ * series or another file is never overwritten, and an archive that
+ * was not closed is recovered without its index.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "archive.h"
+#include "test.h"
+
+#define T0 1700000000           /* wall clock time of the first sample in s */
+#define ARCH "test-archive.tmp"
+
+/*
+ * series of register num of unit uid
+ */
+static void
+mk_ser(arch_ser_t *a, int uid, int num)
+{
+    memset(a, 0, sizeof(arch_ser_t));
+    a->uid = uid;
+    a->dnum = 1;
+    a->type = HOLDING;
+    a->len = 1;
+    a->prfmt = DEC;
+    a->num = num;
+    a->addr = 0x40000 + num - 40001;
+    a->scale = 1.0;
+    snprintf(a->name, ARCH_NAME_LEN, "reg %d", num);
+}
+
+/*
+ * archive n samples of series ser, one a second from T0 + from s on,
+ * the value of each one follows from its time
+ */
+static void
+put(arch_t *ar, int ser, int from, int n)
+{
+    rsmpl_t s;
+
+    memset(&s, 0, sizeof(s));
+    s.slot = ser;
+    s.nw = 1;
+    for (int i = from; i < from + n; i++) {
+        s.real.tv_sec = T0 + i;
+        s.real.tv_nsec = 1000;
+        s.raw[0] = (uint16_t )(3 * i + ser);
+        arch_put(ar, ser, &s);
+    }
+}
+
+/*
+ * Count the samples of series ser of archive path, -1 if it can't be
+ * loaded, a block can't be decoded or a value is not the one put()
+ * archived at its time.
+ */
+static int
+count(const char *path, int ser)
+{
+    arch_smpl_t *smp = (arch_smpl_t *)malloc(ARCH_BLK_SMPL * sizeof(arch_smpl_t));
+    arch_t *ar = arch_load(path);
+    int total = 0;
+
+    if (ar == NULL || smp == NULL) {
+        free(smp);
+        return -1;
+    }
+    for (uint32_t b = 0; b < ar->nidx && total != -1; b++) {
+        int n;
+
+        if (ar->idx[b].blk.ser != (uint32_t )ser) {
+            continue;
+        }
+        n = arch_block(ar, b, smp);
+        if (n == -1) {
+            total = -1;
+            break;
+        }
+        for (int j = 0; j < n; j++) {
+            int i = (int )((smp[j].real_ns / 1000000000) - T0);
+
+            if (smp[j].err != 0 || smp[j].nw != 1 || smp[j].raw[0] != (uint16_t )(3 * i + ser)) {
+                total = -1;
+                break;
+            }
+        }
+        total = (total == -1) ? -1 : total + n;
+    }
+    arch_close(ar);
+    free(smp);
+    return total;
+}
+
+/*
+ * load the bytes of file path, sets its size
+ */
+static char *
+slurp(const char *path, size_t *sz)
+{
+    struct stat st;
+    char *buf;
+    FILE *f;
+
+    if (stat(path, &st) == -1 || (f = fopen(path, "rb")) == NULL) {
+        return NULL;
+    }
+    buf = (char *)malloc(st.st_size + 1);
+    *sz = fread(buf, 1, st.st_size, f);
+    fclose(f);
+    return buf;
+}
+
+/*
+ * check that arch_open() of ser fails and leaves the file as it is
+ */
+static void
+open_fails(const arch_ser_t *ser, int nser)
+{
+    size_t sz0 = 0;
+    size_t sz1 = 0;
+    char *before = slurp(ARCH, &sz0);
+    char *after;
+
+    CHECK(before != NULL);
+    CHECK(arch_open(ARCH, ser, nser) == NULL);
+    after = slurp(ARCH, &sz1);
+    CHECK(after != NULL && sz0 == sz1 && memcmp(before, after, sz0) == 0);
+    free(before);
+    free(after);
+}
+
+int
+main(void)
+{
+    arch_ser_t ser[3];
+    arch_ser_t other[2];
+    arch_t *ar;
+    pid_t pid;
+    int status;
+    struct stat st;
+    FILE *f;
+
+    mk_ser(&ser[0], 1, 40001);
+    mk_ser(&ser[1], 1, 40002);
+    mk_ser(&ser[2], 1, 40003);
+
+    /* samples read back as written, over several blocks */
+    unlink(ARCH);
+    ar = arch_open(ARCH, ser, 2);
+    CHECK(ar != NULL);
+    put(ar, 0, 0, 1000);
+    put(ar, 1, 0, 10);
+    arch_close(ar);
+    CHECK(count(ARCH, 0) == 1000);
+    CHECK(count(ARCH, 1) == 10);
+
+    /* reopened with the same series the archive is continued */
+    ar = arch_open(ARCH, ser, 2);
+    CHECK(ar != NULL);
+    put(ar, 0, 1000, 500);
+    arch_close(ar);
+    CHECK(count(ARCH, 0) == 1500);
+    CHECK(count(ARCH, 1) == 10);
+
+    /* reopened with other series it fails and the archive is kept */
+    open_fails(ser, 3);
+    open_fails(ser, 1);
+    other[0] = ser[0];
+    mk_ser(&other[1], 2, 40002);
+    open_fails(other, 2);
+    CHECK(count(ARCH, 0) == 1500);
+
+    /* so is a file that is no archive */
+    f = fopen(ARCH, "w");
+    CHECK(f != NULL);
+    fputs("not an archive\n", f);
+    fclose(f);
+    open_fails(ser, 2);
+
+    /* an empty file becomes an archive */
+    f = fopen(ARCH, "w");
+    fclose(f);
+    ar = arch_open(ARCH, ser, 2);
+    CHECK(ar != NULL);
+    arch_close(ar);
+    CHECK(count(ARCH, 0) == 0);
+
+    /*
+     * An archive that was not closed is recovered from its complete
+     * blocks. A block is written once it spans ARCH_BLK_SPAN s, so
+     * 1300 samples a second leave two blocks of ARCH_BLK_SPAN + 1
+     * samples and the rest pending, lost with the recorder.
+     */
+    unlink(ARCH);
+    pid = fork();
+    if (pid == 0) {
+        ar = arch_open(ARCH, ser, 2);
+        if (ar == NULL) {
+            _exit(1);
+        }
+        put(ar, 0, 0, 1300);
+        _exit(0);
+    }
+    CHECK(pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    CHECK(count(ARCH, 0) == 2 * (ARCH_BLK_SPAN + 1));
+
+    /* a block cut short is dropped, the ones before it are kept */
+    CHECK(stat(ARCH, &st) == 0 && truncate(ARCH, st.st_size - 5) == 0);
+    CHECK(count(ARCH, 0) == ARCH_BLK_SPAN + 1);
+
+    /* and the recovered archive is continued */
+    ar = arch_open(ARCH, ser, 2);
+    CHECK(ar != NULL);
+    put(ar, 0, 2000, 100);
+    arch_close(ar);
+    CHECK(count(ARCH, 0) == ARCH_BLK_SPAN + 1 + 100);
+
+    unlink(ARCH);
+    return TEST_DONE();
+}
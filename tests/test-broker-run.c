@@ -0,0 +1,357 @@
+/*
+ *  modio - Modbus input output access tool
+ *
+ *  Copyright (C) 2022, Dimitris Economou (dimitris.s.economou@gmail.com)
+ *
+ *  This file is part of modio.
+ *
+ *  modio is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  modio is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with modio. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Regression tests of broker_run() (broker.h) with several clients:
+ * the reads of a round with the same slave id and function code whose
+ * ranges overlap or adjoin are merged into one request, reads of other
+ * units and function codes are not, a merged read that gets an
+ * exception is run again for every client, and every client gets the
+ * registers or bits of its own read.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "broker.h"
+#include "mbio.h"
+#include "test.h"
+
+#define SLOW_UNIT 99            /* unit the responder answers late */
+#define EXC_UNIT 3              /* unit that takes reads of 4 registers at most */
+#define MAX_LOG 64              /* max requests logged */
+
+/* request of a client */
+struct breq {
+    int unit;                   /* slave id */
+    int fc;                     /* function code */
+    int addr;                   /* first address */
+    int nb;                     /* registers or bits */
+};
+typedef struct breq breq_t;
+
+static int srv_fd = -1;         /* responder socket */
+static breq_t srv_log[MAX_LOG]; /* requests received */
+static volatile int srv_reqs = 0;       /* number of requests received */
+static volatile sig_atomic_t bk_stop = 0;
+
+/*
+ * Value of register or bit addr of a unit, different for every
+ * function code. The bits repeat every 7 and 11 addresses, so a bit
+ * taken from another offset of a merged read shows.
+ */
+static int
+reg_val(int unit, int fc, int addr)
+{
+    switch (fc) {
+        case 0x01:
+            return (addr * 13 + unit) % 7 < 3;
+        case 0x02:
+            return (addr * 5 + unit) % 11 < 5;
+        case 0x03:
+            return (unit << 12) | addr;
+        default:
+            return ((unit << 12) | addr) ^ 0x0800;
+    }
+}
+
+/*
+ * response PDU to read q, returns its length
+ */
+static int
+mk_pdu(const breq_t *q, uint8_t *pdu)
+{
+    pdu[0] = q->fc;
+    if (q->fc <= 0x02) {
+        pdu[1] = (q->nb + 7) / 8;
+        memset(pdu + 2, 0, pdu[1]);
+        for (int i = 0; i < q->nb; i++) {
+            pdu[2 + i / 8] |= reg_val(q->unit, q->fc, q->addr + i) << (i % 8);
+        }
+    } else {
+        pdu[1] = 2 * q->nb;
+        for (int i = 0; i < q->nb; i++) {
+            pdu[2 + 2 * i] = reg_val(q->unit, q->fc, q->addr + i) >> 8;
+            pdu[3 + 2 * i] = reg_val(q->unit, q->fc, q->addr + i) & 0xff;
+        }
+    }
+    return 2 + pdu[1];
+}
+
+/*
+ * Answer the reads of FC1 to FC4 over Modbus/UDP and log them. Unit
+ * SLOW_UNIT is answered after 200ms, unit EXC_UNIT answers reads of
+ * more than 4 registers with an illegal data address exception.
+ */
+static void *
+responder(void *arg)
+{
+    uint8_t req[260];
+    uint8_t rsp[260];
+    struct sockaddr_in sa;
+    socklen_t sl;
+    ssize_t n;
+
+    for (;;) {
+        breq_t q;
+        int len;
+
+        sl = sizeof(sa);
+        n = recvfrom(srv_fd, req, sizeof(req), 0, (struct sockaddr *)&sa, &sl);
+        if (n < 12) {
+            if (n == -1 && errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        q.unit = req[6];
+        q.fc = req[7];
+        q.addr = (req[8] << 8) | req[9];
+        q.nb = (req[10] << 8) | req[11];
+        if (q.fc < 0x01 || q.fc > 0x04) {
+            continue;
+        }
+        if (srv_reqs < MAX_LOG) {
+            srv_log[srv_reqs] = q;
+        }
+        srv_reqs++;
+        if (q.unit == SLOW_UNIT) {
+            usleep(200000);
+        }
+        memcpy(rsp, req, 7);
+        if (q.unit == EXC_UNIT && q.nb > 4) {
+            rsp[7] = q.fc | 0x80;
+            rsp[8] = 0x02;
+            len = 2;
+        } else {
+            len = mk_pdu(&q, rsp + 7);
+        }
+        rsp[4] = (1 + len) >> 8;
+        rsp[5] = (1 + len) & 0xff;
+        sendto(srv_fd, rsp, 7 + len, 0, (struct sockaddr *)&sa, sl);
+    }
+    return NULL;
+}
+
+/*
+ * run the broker of port on a context of the responder
+ */
+static void *
+broker(void *arg)
+{
+    const char *port = (const char *)arg;
+    modbus_t *mb = modbus_new_tcp("127.0.0.1", 502);
+
+    if (mb == NULL || mbio_udp(mb, port) == -1) {
+        printf("FAIL: broker context of %s\n", port);
+        return NULL;
+    }
+    broker_run(mb, port, &bk_stop);
+    mbio_udp_close(mb);
+    modbus_free(mb);
+    return NULL;
+}
+
+/*
+ * connect to the broker socket path, -1 if it doesn't listen within 2s
+ */
+static int
+bk_connect(const char *path)
+{
+    struct sockaddr_un sa;
+    int fd;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    snprintf(sa.sun_path, sizeof(sa.sun_path), "%s", path);
+    for (int i = 0; i < 200; i++) {
+        if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+            return -1;
+        }
+        if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) == 0) {
+            return fd;
+        }
+        close(fd);
+        usleep(10000);
+    }
+    return -1;
+}
+
+/*
+ * send read q of a client to the broker
+ */
+static int
+bk_send(int fd, const breq_t *q)
+{
+    bk_msg_t m = { 5, q->unit, 0, 0 };
+    uint8_t pdu[5] = { q->fc, q->addr >> 8, q->addr & 0xff, q->nb >> 8, q->nb & 0xff };
+
+    if (mbio_sockio(fd, &m, sizeof(m), 1) == -1 || mbio_sockio(fd, pdu, sizeof(pdu), 1) == -1) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * receive the response of the broker to read q of a client and check
+ * that it is the response to q alone
+ */
+static int
+bk_check(int fd, const breq_t *q)
+{
+    uint8_t rsp[CAP_PDU_MAX];
+    uint8_t exp[CAP_PDU_MAX];
+    bk_msg_t m;
+    int len = mk_pdu(q, exp);
+
+    if (mbio_sockio(fd, &m, sizeof(m), 0) == -1 || m.len > sizeof(rsp) ||
+        mbio_sockio(fd, rsp, m.len, 0) == -1) {
+        return 0;
+    }
+    return m.unit == q->unit && m.len == len && memcmp(rsp, exp, len) == 0;
+}
+
+/*
+ * check if read q has been sent to the responder since request first
+ */
+static int
+srv_sent(int first, int unit, int fc, int addr, int nb)
+{
+    for (int i = first; i < srv_reqs && i < MAX_LOG; i++) {
+        if (srv_log[i].unit == unit && srv_log[i].fc == fc &&
+            srv_log[i].addr == addr && srv_log[i].nb == nb) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int
+main(void)
+{
+    static const breq_t rq[] = {
+        { 1, 0x03, 10, 5 },     /* overlaps the next one */
+        { 1, 0x03, 12, 6 },
+        { 1, 0x03, 18, 2 },     /* adjoins the one before */
+        { 2, 0x03, 10, 5 },     /* another unit */
+        { 1, 0x04, 10, 5 },     /* another function code */
+        { 1, 0x01, 3, 10 },     /* bits at an offset off a byte boundary */
+        { 1, 0x01, 9, 12 },
+        { 1, 0x02, 5, 4 },
+        { 1, 0x02, 9, 9 },
+        { EXC_UNIT, 0x03, 0, 4 },       /* merged read gets an exception */
+        { EXC_UNIT, 0x03, 4, 4 },
+        { 4, 0x03, 100, 3 },    /* a gap between the two reads */
+        { 4, 0x03, 104, 3 }
+    };
+    const int nrq = sizeof(rq) / sizeof(rq[0]);
+    const breq_t slow = { SLOW_UNIT, 0x03, 0, 1 };
+    char dir[] = "/tmp/test-broker-run-XXXXXX";
+    struct sockaddr_in sa;
+    socklen_t sl = sizeof(sa);
+    pthread_t rth;
+    pthread_t bth;
+    char port[64];
+    char path[PATH_MAX];
+    int fd[sizeof(rq) / sizeof(rq[0])];
+    int sfd;
+    int first;
+
+    srv_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (mkdtemp(dir) == NULL || setenv("XDG_RUNTIME_DIR", dir, 1) == -1 || srv_fd == -1 ||
+        bind(srv_fd, (struct sockaddr *)&sa, sizeof(sa)) == -1 ||
+        getsockname(srv_fd, (struct sockaddr *)&sa, &sl) == -1 ||
+        pthread_create(&rth, NULL, responder, NULL) != 0) {
+        printf("FAIL: responder: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+    snprintf(port, sizeof(port), "udp://127.0.0.1:%d", ntohs(sa.sin_port));
+    snprintf(path, sizeof(path), "%s", mbio_broker_path(port, geteuid() == 0));
+    if (pthread_create(&bth, NULL, broker, port) != 0) {
+        printf("FAIL: broker: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    /* all clients connect before the first request */
+    sfd = bk_connect(path);
+    CHECK(sfd != -1);
+    for (int i = 0; i < nrq; i++) {
+        fd[i] = bk_connect(path);
+        CHECK(fd[i] != -1);
+    }
+    usleep(200000);
+
+    /* the reads arrive while the broker waits for a slow unit, they are served in one round */
+    CHECK(bk_send(sfd, &slow) == 0);
+    usleep(50000);
+    first = srv_reqs;
+    for (int i = 0; i < nrq; i++) {
+        CHECK(bk_send(fd[i], &rq[i]) == 0);
+    }
+    CHECK(bk_check(sfd, &slow));
+    for (int i = 0; i < nrq; i++) {
+        if (!bk_check(fd[i], &rq[i])) {
+            printf("FAIL: read %d of unit %d FC%d 0x%04x+%d\n",
+                   i, rq[i].unit, rq[i].fc, rq[i].addr, rq[i].nb);
+            test_fails++;
+        }
+    }
+
+    /* merged reads of overlapping and adjoining ranges, of one unit and function code */
+    CHECK(srv_sent(first, 1, 0x03, 10, 10));
+    CHECK(srv_sent(first, 2, 0x03, 10, 5));
+    CHECK(srv_sent(first, 1, 0x04, 10, 5));
+    CHECK(srv_sent(first, 1, 0x01, 3, 18));
+    CHECK(srv_sent(first, 1, 0x02, 5, 13));
+
+    /* the read that got an exception again for every client */
+    CHECK(srv_sent(first, EXC_UNIT, 0x03, 0, 8));
+    CHECK(srv_sent(first, EXC_UNIT, 0x03, 0, 4));
+    CHECK(srv_sent(first, EXC_UNIT, 0x03, 4, 4));
+
+    /* reads with a gap between them aren't merged */
+    CHECK(srv_sent(first, 4, 0x03, 100, 3));
+    CHECK(srv_sent(first, 4, 0x03, 104, 3));
+    CHECK(srv_reqs - first == 10);
+
+    bk_stop = 1;
+    pthread_join(bth, NULL);
+    close(sfd);
+    for (int i = 0; i < nrq; i++) {
+        close(fd[i]);
+    }
+    shutdown(srv_fd, SHUT_RDWR);
+    close(srv_fd);
+    rmdir(dir);
+    return TEST_DONE();
+}
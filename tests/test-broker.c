@@ -0,0 +1,139 @@
+/*
+ *  modio - Modbus input output access tool
+ *
+ *  Copyright (C) 2022, Dimitris Economou (dimitris.s.economou@gmail.com)
+ *
+ *  This file is part of modio.
+ *
+ *  modio is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  modio is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with modio. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Regression tests of transfers through a broker (broker.h): a broker
+ * connection that fails after a request is sent is dropped, and the
+ * next transfer connects again instead of failing for good or taking
+ * what is left of the failed one for its response.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "mbio.h"
+#include "test.h"
+
+#define BK_PORT "127.0.0.1:1502"
+
+static int srv_fd = -1;         /* broker socket */
+static volatile int srv_conns = 0;      /* connections accepted */
+static volatile int srv_reqs = 0;       /* requests received */
+
+/*
+ * Answer read holding registers requests: register addr of unit holds
+ * 0x100 * unit + addr. The first request closes the connection, as a
+ * restarting broker does, and the third one is answered with a length
+ * over CAP_PDU_MAX and that many bytes.
+ */
+static void *
+broker(void *arg)
+{
+    uint8_t req[CAP_PDU_MAX];
+    uint8_t rsp[CAP_PDU_MAX + 64];
+    bk_msg_t m;
+    int fd;
+
+    while ((fd = accept(srv_fd, NULL, NULL)) != -1) {
+        srv_conns++;
+        while (mbio_sockio(fd, &m, sizeof(m), 0) == 0 && m.len <= sizeof(req) &&
+               mbio_sockio(fd, req, m.len, 0) == 0) {
+            int addr = (req[1] << 8) | req[2];
+
+            if (++srv_reqs == 1) {
+                break;
+            }
+            if (srv_reqs == 3) {
+                memset(rsp, 0, sizeof(rsp));
+                m.len = sizeof(rsp);
+                mbio_sockio(fd, &m, sizeof(m), 1);
+                mbio_sockio(fd, rsp, sizeof(rsp), 1);
+                continue;
+            }
+            rsp[0] = 0x03;
+            rsp[1] = 2;
+            rsp[2] = m.unit;
+            rsp[3] = addr & 0xff;
+            m.len = 4;
+            m.err = 0;
+            mbio_sockio(fd, &m, sizeof(m), 1);
+            mbio_sockio(fd, rsp, 4, 1);
+        }
+        close(fd);
+    }
+    return NULL;
+}
+
+int
+main(void)
+{
+    struct sockaddr_un sa;
+    char dir[] = "/tmp/test-broker-XXXXXX";
+    const char *path;
+    pthread_t th;
+    modbus_t *mb;
+    uint16_t v;
+
+    if (mkdtemp(dir) == NULL || setenv("XDG_RUNTIME_DIR", dir, 1) == -1) {
+        printf("FAIL: %s: %s\n", dir, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    path = mbio_broker_path(BK_PORT, 0);
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    snprintf(sa.sun_path, sizeof(sa.sun_path), "%s", path);
+    srv_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (srv_fd == -1 || bind(srv_fd, (struct sockaddr *)&sa, sizeof(sa)) == -1 ||
+        listen(srv_fd, 4) == -1 || pthread_create(&th, NULL, broker, NULL) != 0) {
+        printf("FAIL: broker: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    mb = modbus_new_tcp("127.0.0.1", 1502);
+    CHECK(mb != NULL);
+    CHECK(mbio_broker(BK_PORT) == 0 && mbio_brokered());
+    CHECK(mbio_set_slave(mb, 4) == 0);
+
+    /* a broker that went away fails the transfer, the next one connects again */
+    CHECK(mbio_read_registers(mb, 0x10, 1, &v) == -1);
+    CHECK(mbio_read_registers(mb, 0x11, 1, &v) == 1 && v == 0x0411);
+    CHECK(srv_conns == 2);
+
+    /* the rest of a response that failed isn't the response of the next transfer */
+    CHECK(mbio_read_registers(mb, 0x12, 1, &v) == -1);
+    CHECK(mbio_read_registers(mb, 0x13, 1, &v) == 1 && v == 0x0413);
+    CHECK(mbio_read_registers(mb, 0x14, 1, &v) == 1 && v == 0x0414);
+    CHECK(srv_conns == 3 && srv_reqs == 5);
+
+    mbio_close();
+    CHECK(!mbio_brokered());
+    modbus_free(mb);
+    shutdown(srv_fd, SHUT_RDWR);
+    close(srv_fd);
+    unlink(path);
+    rmdir(dir);
+    return TEST_DONE();
+}
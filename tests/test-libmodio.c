@@ -0,0 +1,218 @@
+/*
+ *  modio - Modbus input output access tool
+ *
+ *  Copyright (C) 2022, Dimitris Economou (dimitris.s.economou@gmail.com)
+ *
+ *  This file is part of modio.
+ *
+ *  modio is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  modio is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with modio. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Regression tests of libmodio (libmodio.h) with more than one
+ * context: contexts of different units of the same Modbus/UDP server
+ * read their own unit, whatever the order of their calls, and read
+ * spans of registers in one request. And the library keeps the
+ * warnings of device files for modio_error().
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "libmodio.h"
+#include "test.h"
+
+static int srv_fd = -1;         /* responder socket */
+
+/*
+ * Answer read holding and input registers requests: the registers of
+ * a unit hold 0x100 * unit + the low byte of their address.
+ */
+static void *
+responder(void *arg)
+{
+    uint8_t req[260];
+    uint8_t rsp[260];
+    struct sockaddr_in sa;
+    socklen_t sl;
+    ssize_t n;
+
+    for (;;) {
+        int nb;
+
+        sl = sizeof(sa);
+        n = recvfrom(srv_fd, req, sizeof(req), 0, (struct sockaddr *)&sa, &sl);
+        if (n < 12) {
+            if (n == -1 && errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        nb = (req[10] << 8) | req[11];
+        if ((req[7] != 0x03 && req[7] != 0x04) || nb < 1 || nb > 125) {
+            continue;
+        }
+        memcpy(rsp, req, 7);
+        rsp[4] = (3 + 2 * nb) >> 8;
+        rsp[5] = (3 + 2 * nb) & 0xff;
+        rsp[7] = req[7];
+        rsp[8] = 2 * nb;
+        for (int i = 0; i < nb; i++) {
+            rsp[9 + 2 * i] = req[6];
+            rsp[10 + 2 * i] = (req[9] + i) & 0xff;
+        }
+        sendto(srv_fd, rsp, 9 + 2 * nb, 0, (struct sockaddr *)&sa, sl);
+    }
+    return NULL;
+}
+
+/*
+ * read register reg of m, -1 on failure
+ */
+static int
+read_reg(modio_t *m, const char *reg)
+{
+    modio_reg_t r;
+    uint16_t v;
+
+    if (modio_find(m, reg, &r) == -1 || modio_read(m, &r, &v, 1) != 1) {
+        return -1;
+    }
+    return v;
+}
+
+/*
+ * Load a device file without manufacturer into m and check it is
+ * loaded, the warning kept for modio_error() and nothing printed.
+ */
+static void
+check_load_warning(modio_t *m)
+{
+    static const char dev[] =
+        "device = { type = \"RIO\"; model = \"X1\"; zba = 1; };\n"
+        "regs = ( { num = 40001; addr = 0; len = 1; type = 3; name = \"R1\";\n"
+        "  descr = \"\"; range = \"\"; scale = 1.0; print = 2; engu = \"\"; access = \"R\"; } );\n";
+    char dir[] = "/tmp/test-libmodio-XXXXXX";
+    char path[sizeof(dir) + 16];
+    char out[] = "/tmp/test-libmodio-err-XXXXXX";
+    FILE *fp;
+    int efd;
+    int ofd;
+    int n;
+
+    CHECK(mkdtemp(dir) != NULL);
+    snprintf(path, sizeof(path), "%s/x1.cfg", dir);
+    CHECK((fp = fopen(path, "w")) != NULL && fputs(dev, fp) >= 0 && fclose(fp) == 0);
+    CHECK((ofd = mkstemp(out)) != -1);
+
+    /* catch anything the library prints */
+    fflush(stderr);
+    efd = dup(STDERR_FILENO);
+    dup2(ofd, STDERR_FILENO);
+    n = modio_load(m, dir);
+    fflush(stderr);
+    dup2(efd, STDERR_FILENO);
+    close(efd);
+
+    CHECK(n == 1);
+    CHECK(strstr(modio_error(m), "No 'device manfc'") != NULL);
+    CHECK(lseek(ofd, 0, SEEK_END) == 0);
+    close(ofd);
+    unlink(out);
+    unlink(path);
+    rmdir(dir);
+}
+
+int
+main(void)
+{
+    struct sockaddr_in sa;
+    socklen_t sl = sizeof(sa);
+    pthread_t th;
+    char port[64];
+    modio_t *m1;
+    modio_t *m2;
+    modio_reg_t r;
+    uint16_t buf[MODIO_READ_REGS];
+    double v;
+
+    srv_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (srv_fd == -1 || bind(srv_fd, (struct sockaddr *)&sa, sizeof(sa)) == -1 ||
+        getsockname(srv_fd, (struct sockaddr *)&sa, &sl) == -1 ||
+        pthread_create(&th, NULL, responder, NULL) != 0) {
+        printf("FAIL: responder: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+    snprintf(port, sizeof(port), "udp://127.0.0.1:%d", ntohs(sa.sin_port));
+
+    m1 = modio_open(port, NULL, 1);
+    m2 = modio_open(port, NULL, 2);
+    CHECK(m1 != NULL && m2 != NULL);
+    if (m1 == NULL || m2 == NULL) {
+        return TEST_DONE();
+    }
+
+    /* the unit opened last doesn't take over the other context */
+    CHECK(read_reg(m1, "40001") == 0x0100);
+    CHECK(read_reg(m2, "40001") == 0x0200);
+    CHECK(read_reg(m1, "40002") == 0x0101);
+    CHECK(read_reg(m1, "30003") == 0x0102);
+    CHECK(read_reg(m2, "30003") == 0x0202);
+
+    /* nor does a unit set on the other one */
+    CHECK(modio_set_unit(m2, 7) == 0);
+    CHECK(read_reg(m1, "40001") == 0x0100);
+    CHECK(read_reg(m2, "40001") == 0x0700);
+    CHECK(modio_set_unit(m1, 9) == 0);
+    CHECK(read_reg(m2, "40005") == 0x0704);
+    CHECK(read_reg(m1, "40005") == 0x0904);
+
+    /* a span of registers in one request, up to the limit of a request */
+    CHECK(modio_find(m1, "40001", &r) == 0);
+    r.len = 100;
+    CHECK(modio_read(m1, &r, buf, MODIO_READ_REGS) == 100 && buf[0] == 0x0900 && buf[99] == 0x0963);
+    r.len = MODIO_READ_REGS + 1;
+    CHECK(modio_read(m1, &r, buf, MODIO_READ_REGS) == -1 && errno == EINVAL);
+    CHECK(modio_set_turnaround(m1, 50) == 0 && read_reg(m1, "40001") == 0x0900);
+
+    /* by register name of a device file */
+    CHECK(modio_load(m1, REGS_DIR) > 0);
+    CHECK(modio_select_model(m1, NULL, "CBI2801224A") == 0);
+    CHECK(modio_find(m1, "Battery voltage", &r) == 0);
+    CHECK(modio_get(m1, "Battery voltage", &v) == 0 && v == 0x0900 + (r.addr & 0xff));
+
+    /* warnings of device files aren't printed */
+    check_load_warning(m1);
+
+    /* a context without a connection doesn't read */
+    modio_close(m2);
+    m2 = modio_open(NULL, NULL, 3);
+    CHECK(m2 != NULL && read_reg(m2, "40001") == -1 && strcmp(modio_error(m2), "no connection") == 0);
+    CHECK(read_reg(m1, "40001") == 0x0900);
+
+    modio_close(m1);
+    modio_close(m2);
+    shutdown(srv_fd, SHUT_RDWR);
+    close(srv_fd);
+    return TEST_DONE();
+}
@@ -0,0 +1,119 @@
+/*
+ *  modio - Modbus input output access tool
+ *
+ *  Copyright (C) 2022, Dimitris Economou (dimitris.s.economou@gmail.com)
+ *
+ *  This file is part of modio.
+ *
+ *  modio is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  modio is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with modio. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Regression tests of the ring file recorder (ring.h): a ring of the
+ * same capacity is continued, a ring of another capacity or another
+ * file is never overwritten, and a ring has one recorder at a time.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "ring.h"
+#include "test.h"
+
+#define RING "test-ring.tmp"
+#define CAP 16
+
+/*
+ * record n samples of register rnum
+ */
+static void
+put(ring_t *rg, int rnum, int n)
+{
+    rsmpl_t s;
+
+    memset(&s, 0, sizeof(s));
+    s.uid = 1;
+    s.dnum = 1;
+    s.rnum = rnum;
+    s.nw = 1;
+    for (int i = 0; i < n; i++) {
+        s.raw[0] = (uint16_t )i;
+        ring_put(rg, &s);
+    }
+}
+
+/*
+ * size of file path, -1 if it can't be read
+ */
+static long
+fsize(const char *path)
+{
+    struct stat st;
+
+    return (stat(path, &st) == -1) ? -1 : (long )st.st_size;
+}
+
+int
+main(void)
+{
+    ring_t *rg;
+    ring_t *rg2;
+    FILE *f;
+    long sz;
+
+    /* a new ring, continued when reopened with the same capacity */
+    unlink(RING);
+    rg = ring_open(RING, CAP);
+    CHECK(rg != NULL);
+    put(rg, 3, 5);
+    ring_close(rg);
+    rg = ring_open(RING, CAP);
+    CHECK(rg != NULL && rg->hdr->head == 5);
+    put(rg, 3, 20);
+    CHECK(rg->hdr->head == 25 && ring_first(rg) == 25 - CAP);
+    CHECK(ring_get(rg, 24)->rnum == 3 && ring_get(rg, 24)->raw[0] == 19);
+
+    /* a second recorder of the same file fails */
+    rg2 = ring_open(RING, CAP);
+    CHECK(rg2 == NULL);
+    ring_close(rg2);
+    ring_close(rg);
+
+    /* a ring of another capacity is left as it is */
+    sz = fsize(RING);
+    CHECK(ring_open(RING, 2 * CAP) == NULL);
+    CHECK(fsize(RING) == sz);
+    rg = ring_map(RING);
+    CHECK(rg != NULL && rg->hdr->head == 25 && rg->hdr->cap == CAP);
+    ring_close(rg);
+
+    /* so is any other file */
+    f = fopen(RING, "w");
+    CHECK(f != NULL && fputs("not a ring file\n", f) >= 0 && fclose(f) == 0);
+    CHECK(ring_open(RING, CAP) == NULL);
+    CHECK(fsize(RING) == 16);
+
+    /* an empty file becomes a new ring */
+    f = fopen(RING, "w");
+    CHECK(f != NULL && fclose(f) == 0);
+    rg = ring_open(RING, CAP);
+    CHECK(rg != NULL && rg->hdr->head == 0 && rg->hdr->cap == CAP);
+    ring_close(rg);
+    CHECK(fsize(RING) == (long )(sizeof(ring_hdr_t) + CAP * sizeof(ring_smpl_t)));
+
+    unlink(RING);
+    return TEST_DONE();
+}
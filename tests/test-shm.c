@@ -0,0 +1,108 @@
+/*
+ *  modio - Modbus input output access tool
+ *
+ *  Copyright (C) 2022, Dimitris Economou (dimitris.s.economou@gmail.com)
+ *
+ *  This file is part of modio.
+ *
+ *  modio is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  modio is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with modio. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Regression tests of the register image (libmodio_shm.h, shm.h):
+ * readers find and copy the published records, a record left in the
+ * middle of a write fails to read instead of hanging the reader, and a
+ * name is only taken over from a publisher that has exited.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/wait.h>
+#include "shm.h"
+#include "test.h"
+
+int
+main(void)
+{
+    char name[64];
+    shm_t *pub;
+    shm_t *sh;
+    shm_rec_t rec;
+    pid_t pid;
+    int status;
+
+    snprintf(name, sizeof(name), "test-shm-%d", (int )getpid());
+    pub = shm_create(name, 3);
+    CHECK(pub != NULL);
+    if (pub == NULL) {
+        return TEST_DONE();
+    }
+
+    /* a published record reads back */
+    memset(&rec, 0, sizeof(rec));
+    rec.qual = SHM_Q_VALID | SHM_Q_GOOD | SHM_Q_NUMERIC;
+    rec.uid = 7;
+    rec.value = 42.5;
+    snprintf(rec.name, SHM_NAME_LEN, "R1");
+    shm_write(pub, 1, &rec);
+    sh = shm_attach(name);
+    CHECK(sh != NULL);
+    if (sh == NULL) {
+        return TEST_DONE();
+    }
+    CHECK(shm_find(sh, 7, "R1") == 1 && shm_find(sh, -1, "R1") == 1);
+    CHECK(shm_find(sh, 8, "R1") == -1 && errno == ENOENT);
+    memset(&rec, 0, sizeof(rec));
+    CHECK(shm_read(sh, 1, &rec) == 0 && rec.value == 42.5 && rec.uid == 7 && rec.seq == 2);
+    CHECK(shm_read(sh, 3, &rec) == -1 && errno == EINVAL);
+
+    /* a publisher that died in the middle of a write doesn't hang the readers */
+    pub->rec[1].seq++;
+    CHECK(shm_read(sh, 1, &rec) == -1 && errno == EAGAIN);
+    CHECK(shm_find(sh, 7, "R1") == -1);
+    pub->rec[1].seq++;
+    CHECK(shm_read(sh, 1, &rec) == 0 && rec.value == 42.5);
+
+    /* the name of a live publisher isn't taken over */
+    CHECK(shm_create(name, 3) == NULL && errno == EEXIST);
+    CHECK(shm_find(sh, 7, "R1") == 1 && sh->hdr->pid == (uint32_t )getpid());
+    shm_detach(sh);
+
+    /* a layout of another version doesn't attach */
+    pub->hdr->version = SHM_VERSION + 1;
+    CHECK(shm_attach(name) == NULL && errno == EPROTO);
+    pub->hdr->version = SHM_VERSION;
+
+    /* after the publisher is gone the name is free */
+    shm_detach(pub);
+    CHECK(shm_attach(name) == NULL && errno == ENOENT);
+
+    /* and so it is after a publisher exits without removing its segment */
+    pid = fork();
+    if (pid == 0) {
+        _exit(shm_create(name, 1) == NULL ? EXIT_FAILURE : EXIT_SUCCESS);
+    }
+    CHECK(pid != -1 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) &&
+          WEXITSTATUS(status) == EXIT_SUCCESS);
+    sh = shm_attach(name);
+    CHECK(sh != NULL && sh->hdr->pid == (uint32_t )pid);
+    shm_detach(sh);
+    pub = shm_create(name, 2);
+    CHECK(pub != NULL && pub->hdr->nrec == 2);
+    shm_detach(pub);
+    return TEST_DONE();
+}
@@ -0,0 +1,253 @@
+/*
+ *  modio - Modbus input output access tool
+ *
+ *  Copyright (C) 2022, Dimitris Economou (dimitris.s.economou@gmail.com)
+ *
+ *  This file is part of modio.
+ *
+ *  modio is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  modio is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with modio. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Regression tests of the Modbus/UDP transport (udp.h): responses are
+ * matched by transaction id, unit and length, lost requests are sent
+ * again with the same transaction id and late responses don't answer
+ * later requests. Two modbus contexts of Modbus/UDP ports keep their
+ * own slave id in mbio, and transfers over the protocol limit aren't
+ * sent.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "mbio.h"
+#include "udp.h"
+#include "test.h"
+
+/* responder behaviour */
+enum mode {
+    ANSWER = 0,                 /* answer each request */
+    JUNK = 1,                   /* send foreign datagrams before the answer */
+    DROP = 2,                   /* ignore the first copy of a request, answer it late */
+    MUTE = 3                    /* answer nothing */
+};
+
+static int srv_fd = -1;         /* responder socket */
+static volatile int mode = ANSWER;      /* responder behaviour */
+static volatile int srv_reqs = 0;       /* requests received */
+static volatile int srv_tid = -1;       /* transaction id of the last request */
+static volatile int srv_same = 1;       /* all copies of a request had the same transaction id */
+
+/*
+ * send datagram adu of len bytes with the MBAP length of len to sa
+ */
+static void
+srv_send(uint8_t *adu, int len, struct sockaddr_in *sa)
+{
+    adu[4] = (len - 6) >> 8;
+    adu[5] = (len - 6) & 0xff;
+    sendto(srv_fd, adu, len, 0, (struct sockaddr *)sa, sizeof(*sa));
+}
+
+/*
+ * Answer read holding registers requests: register addr of unit holds
+ * 0x100 * unit + addr. The first copy of a request is dropped in DROP
+ * mode and answered after the second, with other values.
+ */
+static void *
+responder(void *arg)
+{
+    uint8_t req[UDP_ADU_MAX];
+    uint8_t rsp[UDP_ADU_MAX];
+    struct sockaddr_in sa;
+    socklen_t sl;
+    int last = -1;
+    ssize_t n;
+
+    for (;;) {
+        int tid;
+        int addr;
+
+        sl = sizeof(sa);
+        n = recvfrom(srv_fd, req, sizeof(req), 0, (struct sockaddr *)&sa, &sl);
+        if (n < 12) {
+            if (n == -1 && errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        srv_reqs++;
+        tid = (req[0] << 8) | req[1];
+        if (mode == DROP && tid == last) {
+            srv_same = srv_same && (tid == srv_tid);
+        }
+        srv_tid = tid;
+        if (mode == MUTE || (mode == DROP && tid != last)) {
+            last = tid;
+            continue;
+        }
+        last = tid;
+
+        /* the answer, MBAP header of the request, FC3 with one register */
+        addr = (req[8] << 8) | req[9];
+        memcpy(rsp, req, 7);
+        rsp[7] = 0x03;
+        rsp[8] = 2;
+        rsp[9] = req[6];
+        rsp[10] = addr & 0xff;
+        if (mode == JUNK) {
+            uint8_t junk[UDP_ADU_MAX];
+
+            memcpy(junk, rsp, 11);
+            junk[1] ^= 0x55;                        /* other transaction */
+            srv_send(junk, 11, &sa);
+            memcpy(junk, rsp, 11);
+            junk[6] ^= 0x01;                        /* other unit */
+            srv_send(junk, 11, &sa);
+            memcpy(junk, rsp, 11);
+            junk[2] = 0x01;                         /* other protocol */
+            srv_send(junk, 11, &sa);
+            memcpy(junk, rsp, 11);
+            junk[4] = 0;
+            junk[5] = 8;                            /* wrong length */
+            sendto(srv_fd, junk, 11, 0, (struct sockaddr *)&sa, sizeof(sa));
+        }
+        srv_send(rsp, 11, &sa);
+        if (mode == DROP) {
+
+            /* the late answer to the dropped copy */
+            rsp[9] = 0xde;
+            rsp[10] = 0xad;
+            srv_send(rsp, 11, &sa);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * read register addr with udp_xfer(), returns its value or -1
+ */
+static int
+read_reg(udp_t *u, int unit, int addr)
+{
+    uint8_t req[5] = { 0x03, addr >> 8, addr & 0xff, 0, 1 };
+    uint8_t rsp[CAP_PDU_MAX];
+    int len = udp_xfer(u, unit, req, sizeof(req), rsp, sizeof(rsp));
+
+    if (len != 4 || rsp[0] != 0x03 || rsp[1] != 2) {
+        return -1;
+    }
+    return (rsp[2] << 8) | rsp[3];
+}
+
+int
+main(void)
+{
+    struct sockaddr_in sa;
+    socklen_t sl = sizeof(sa);
+    pthread_t th;
+    char port[64];
+    modbus_t *mb1;
+    modbus_t *mb2;
+    uint16_t wr[MODBUS_MAX_READ_REGISTERS + 1] = { 0 };
+    uint8_t wb[MODBUS_MAX_WRITE_BITS + 1] = { 0 };
+    uint16_t v;
+    udp_t *u;
+    int n;
+
+    srv_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (srv_fd == -1 || bind(srv_fd, (struct sockaddr *)&sa, sizeof(sa)) == -1 ||
+        getsockname(srv_fd, (struct sockaddr *)&sa, &sl) == -1 ||
+        pthread_create(&th, NULL, responder, NULL) != 0) {
+        printf("FAIL: responder: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+    snprintf(port, sizeof(port), "udp://127.0.0.1:%d", ntohs(sa.sin_port));
+
+    CHECK(udp_port(port));
+    CHECK(!udp_port("127.0.0.1:502"));
+    u = udp_open(port);
+    CHECK(u != NULL);
+    if (u == NULL) {
+        return TEST_DONE();
+    }
+    u->tmo_ms = 100;
+
+    /* answered at once */
+    CHECK(read_reg(u, 1, 0x10) == 0x0110);
+    CHECK(read_reg(u, 7, 0x20) == 0x0720);
+    CHECK(u->sent == 2 && u->lost == 0);
+
+    /* datagrams of other transactions, units and protocols are dropped */
+    mode = JUNK;
+    CHECK(read_reg(u, 3, 0x30) == 0x0330);
+    CHECK(read_reg(u, 4, 0x40) == 0x0440);
+    CHECK(u->lost == 0);
+
+    /* a lost request is sent again with the same transaction id */
+    mode = DROP;
+    n = srv_reqs;
+    CHECK(read_reg(u, 5, 0x50) == 0x0550);
+    CHECK(srv_reqs == n + 2 && u->lost == 1 && srv_same);
+
+    /* and the late answer to its first copy doesn't answer the next request */
+    mode = ANSWER;
+    CHECK(read_reg(u, 5, 0x51) == 0x0551);
+
+    /* without an answer the transfer fails after the retries */
+    mode = MUTE;
+    n = srv_reqs;
+    errno = 0;
+    CHECK(read_reg(u, 1, 0x10) == -1 && errno == ETIMEDOUT);
+    CHECK(srv_reqs == n + 1 + UDP_RETRIES);
+    mode = ANSWER;
+    udp_close(u);
+
+    /* two contexts of Modbus/UDP ports keep their own slave id */
+    mb1 = modbus_new_tcp("127.0.0.1", 502);
+    mb2 = modbus_new_tcp("127.0.0.1", 502);
+    CHECK(mb1 != NULL && mb2 != NULL);
+    CHECK(mbio_udp(mb1, port) == 0 && mbio_udp(mb2, port) == 0);
+    CHECK(mbio_set_slave(mb1, 1) == 0 && mbio_set_slave(mb2, 2) == 0);
+    CHECK(mbio_read_registers(mb1, 0x10, 1, &v) == 1 && v == 0x0110);
+    CHECK(mbio_read_registers(mb2, 0x10, 1, &v) == 1 && v == 0x0210);
+    CHECK(mbio_read_registers(mb1, 0x11, 1, &v) == 1 && v == 0x0111);
+
+    /* a multiple write over the protocol limit isn't sent */
+    n = srv_reqs;
+    CHECK(mbio_write_registers(mb1, 0, MODBUS_MAX_WRITE_REGISTERS + 1, wr) == -1 &&
+          errno == EMBMDATA);
+    CHECK(mbio_write_bits(mb1, 0, MODBUS_MAX_WRITE_BITS + 1, wb) == -1 && errno == EMBMDATA);
+    CHECK(mbio_read_registers(mb1, 0, MODBUS_MAX_READ_REGISTERS + 1, wr) == -1 &&
+          errno == EMBMDATA);
+    CHECK(srv_reqs == n);
+    mbio_close();
+    modbus_free(mb1);
+    modbus_free(mb2);
+
+    /* an unknown host fails */
+    CHECK(udp_open("udp://host.invalid:502") == NULL);
+
+    shutdown(srv_fd, SHUT_RDWR);
+    close(srv_fd);
+    return TEST_DONE();
+}
@@ -0,0 +1,92 @@
+/*
+ *  modio - Modbus input output access tool
+ *
+ *  Copyright (C) 2022, Dimitris Economou (dimitris.s.economou@gmail.com)
+ *
+ *  This file is part of modio.
+ *
+ *  modio is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  modio is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with modio. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Regression tests of register values (value.h): the numeric value of
+ * a register that dreg_value() gives the shared memory image, the ring
+ * and archive exports, alarms, windows, derived registers and
+ * modio_get() is the number its value printer prints first.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "value.h"
+#include "test.h"
+
+/*
+ * Value of raw words raw of a register of type, print format, len
+ * words and scale, of a device file if decorated. Returns the value
+ * dreg_value() decodes, printed the value its value printer prints.
+ */
+static double
+value(int type, int prfmt, int len, double scale, int decorated, const uint16_t *raw, double *printed)
+{
+    dreg_t r;
+    char buf[PRVAL_LEN];
+
+    memset(&r, 0, sizeof(r));
+    r.type = type;
+    r.prfmt = prfmt;
+    r.len = len;
+    r.scale = scale;
+    r.prval = prval_get(type, prfmt, decorated);
+    r.prval(buf, sizeof(buf), raw, 0, len, scale, "");
+    *printed = strtod(buf, NULL);
+    return dreg_value(&r, raw, len);
+}
+
+int
+main(void)
+{
+    const uint16_t w1[1] = { 301 };
+    const uint16_t w2[2] = { 0x0001, 0x0002 };
+    const uint16_t w4[4] = { 7, 8, 9, 10 };
+    double p;
+    double v;
+
+    /* a word is scaled */
+    v = value(HOLDING, DEC, 1, 0.5, 1, w1, &p);
+    CHECK(v == 150.5 && p == v);
+
+    /* two words are one 32bit value, scaled as well */
+    v = value(HOLDING, DEC, 2, 1.0, 1, w2, &p);
+    CHECK(v == (double )concat_inv16(w2, 2) && p == v);
+    v = value(INPUT_R, DEC, 2, 0.25, 1, w2, &p);
+    CHECK(v == (double )concat_inv16(w2, 2) * 0.25 && p == v);
+
+    /* the words of a longer register are values of their own */
+    v = value(HOLDING, DEC, 4, 2.0, 1, w4, &p);
+    CHECK(v == 14.0 && p == v);
+
+    /* a register without device file is its first word, unscaled */
+    v = value(HOLDING, DEC, 2, 1.0, 0, w2, &p);
+    CHECK(v == 1.0 && p == v);
+
+    /* a high / low word pair is one 32bit value */
+    v = value(HOLDING, HLO, 2, 0.5, 1, w2, &p);
+    CHECK(v == (double )concat_inv16(w2, 2) * 0.5 && p == v);
+
+    /* strings have no value */
+    CHECK(isnan(value(HOLDING, ASC, 1, 1.0, 1, w1, &p)));
+    return TEST_DONE();
+}
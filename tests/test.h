@@ -0,0 +1,45 @@
+/*
+ *  modio - Modbus input output access tool
+ *
+ *  Copyright (C) 2022, Dimitris Economou (dimitris.s.economou@gmail.com)
+ *
+ *  This file is part of modio.
+ *
+ *  modio is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  modio is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with modio. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Checks of the regression tests. A failed check prints its file, line
+ * and condition and fails the test, which goes on with the next check.
+ */
+
+#ifndef MXIO_TEST_H
+#define MXIO_TEST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static int test_fails = 0;      /* number of failed checks */
+
+#define CHECK(c) do { \
+        if (!(c)) { \
+            printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #c); \
+            test_fails++; \
+        } \
+    } while (0)
+
+/* exit status of a test */
+#define TEST_DONE() (test_fails ? EXIT_FAILURE : EXIT_SUCCESS)
+
+#endif